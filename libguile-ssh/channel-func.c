@@ -20,6 +20,16 @@
 
 #include <config.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <libguile.h>
 #include <libssh/libssh.h>
 #include <libssh/server.h>
@@ -29,12 +39,55 @@
 #include "error.h"
 #include "channel-type.h"
 #include "session-type.h"
+#include "deadline.h"
 
 #ifdef HAVE_LIBSSH_0_7_3
 #define ssh_forward_listen ssh_channel_listen_forward
 #define ssh_forward_cancel ssh_channel_cancel_forward
 #endif
 
+
+/* Channel requests that can be called with a deadline
+   (see 'gssh_call_with_deadline'.) */
+
+struct request_args {
+  ssh_channel channel;
+  const char *name;
+  const char *value;
+};
+
+static int
+_open_session (void *data)
+{
+  return ssh_channel_open_session (((struct request_args *) data)->channel);
+}
+
+static int
+_request_exec (void *data)
+{
+  struct request_args *args = (struct request_args *) data;
+  return ssh_channel_request_exec (args->channel, args->name);
+}
+
+static int
+_request_pty (void *data)
+{
+  return ssh_channel_request_pty (((struct request_args *) data)->channel);
+}
+
+static int
+_request_shell (void *data)
+{
+  return ssh_channel_request_shell (((struct request_args *) data)->channel);
+}
+
+static int
+_request_env (void *data)
+{
+  struct request_args *args = (struct request_args *) data;
+  return ssh_channel_request_env (args->channel, args->name, args->value);
+}
+
 
 /* Allocate a new SSH channel. */
 SCM_DEFINE_N (guile_ssh_make_channel, "%make-channel", 2, (SCM arg1, SCM flags),
@@ -99,13 +152,16 @@ Return value is undefined.\
 #define FUNC_NAME s_guile_ssh_channel_open_session
 {
   gssh_channel_t *data = gssh_channel_from_scm (channel);
+  struct request_args args;
   int res;
   GSSH_VALIDATE_CHANNEL_DATA (data, channel, FUNC_NAME);
 
   if (! _gssh_channel_parent_session_connected_p (data))
     guile_ssh_error1 (FUNC_NAME, "Parent session is not connected", channel);
 
-  res = ssh_channel_open_session (data->ssh_channel);
+  args.channel = data->ssh_channel;
+  res = gssh_call_with_deadline (ssh_channel_get_session (data->ssh_channel),
+                                 _open_session, &args, FUNC_NAME, channel);
   _gssh_log_debug_format(FUNC_NAME, channel, "result: %d", res);
   if (res != SSH_OK)
     {
@@ -128,6 +184,7 @@ Run a shell command CMD without an interactive shell.\
 #define FUNC_NAME s_guile_ssh_channel_request_exec
 {
   gssh_channel_t *data = gssh_channel_from_scm (channel);
+  struct request_args args;
   int res;
   char *c_cmd;                  /* Command to execute. */
 
@@ -137,17 +194,26 @@ Run a shell command CMD without an interactive shell.\
   if (! _gssh_channel_parent_session_connected_p (data))
     guile_ssh_error1 (FUNC_NAME, "Parent session is not connected", channel);
 
+  scm_dynwind_begin (0);
+
   c_cmd = scm_to_locale_string (cmd);
-  res = ssh_channel_request_exec (data->ssh_channel, c_cmd);
+  scm_dynwind_free (c_cmd);
+
+  args.channel = data->ssh_channel;
+  args.name    = c_cmd;
+  res = gssh_call_with_deadline (ssh_channel_get_session (data->ssh_channel),
+                                 _request_exec, &args, FUNC_NAME,
+                                 scm_list_2 (channel, cmd));
   _gssh_log_debug_format(FUNC_NAME, scm_list_2 (channel, cmd),
                          "result: %d", res);
-  free (c_cmd);
   if (res != SSH_OK)
     {
       ssh_session session = ssh_channel_get_session (data->ssh_channel);
       guile_ssh_session_error1 (FUNC_NAME, session, scm_list_2 (channel, cmd));
     }
 
+  scm_dynwind_end ();
+
   return SCM_UNDEFINED;
 }
 #undef FUNC_NAME
@@ -225,6 +291,7 @@ Return value is undefined.\
 #define FUNC_NAME s_guile_ssh_channel_request_pty
 {
   gssh_channel_t *data = gssh_channel_from_scm (channel);
+  struct request_args args;
   int res;
 
   GSSH_VALIDATE_OPEN_CHANNEL (channel, SCM_ARG1, FUNC_NAME);
@@ -232,7 +299,9 @@ Return value is undefined.\
   if (! _gssh_channel_parent_session_connected_p (data))
     guile_ssh_error1 (FUNC_NAME, "Parent session is not connected", channel);
 
-  res = ssh_channel_request_pty (data->ssh_channel);
+  args.channel = data->ssh_channel;
+  res = gssh_call_with_deadline (ssh_channel_get_session (data->ssh_channel),
+                                 _request_pty, &args, FUNC_NAME, channel);
   _gssh_log_debug_format(FUNC_NAME, channel, "result: %d", res);
   if (res != SSH_OK)
     {
@@ -253,6 +322,7 @@ Return value is undefined.\
 #define FUNC_NAME s_guile_ssh_channel_request_shell
 {
   gssh_channel_t *data = gssh_channel_from_scm (channel);
+  struct request_args args;
   int res;
 
   GSSH_VALIDATE_OPEN_CHANNEL (channel, SCM_ARG1, FUNC_NAME);
@@ -260,7 +330,9 @@ Return value is undefined.\
   if (! _gssh_channel_parent_session_connected_p (data))
     guile_ssh_error1 (FUNC_NAME, "Parent session is not connected", channel);
 
-  res = ssh_channel_request_shell (data->ssh_channel);
+  args.channel = data->ssh_channel;
+  res = gssh_call_with_deadline (ssh_channel_get_session (data->ssh_channel),
+                                 _request_shell, &args, FUNC_NAME, channel);
   _gssh_log_debug_format(FUNC_NAME, channel, "result: %d", res);
   if (res != SSH_OK)
     {
@@ -283,6 +355,7 @@ Return value is undefined.\
 #define FUNC_NAME s_guile_ssh_channel_request_env
 {
   gssh_channel_t *data = gssh_channel_from_scm (channel);
+  struct request_args args;
   char *c_name;
   char *c_value;
   int res;
@@ -294,9 +367,19 @@ Return value is undefined.\
   if (! _gssh_channel_parent_session_connected_p (data))
     guile_ssh_error1 (FUNC_NAME, "Parent session is not connected", channel);
 
+  scm_dynwind_begin (0);
+
   c_name  = scm_to_locale_string (name);
+  scm_dynwind_free (c_name);
   c_value = scm_to_locale_string (value);
-  res = ssh_channel_request_env (data->ssh_channel, c_name, c_value);
+  scm_dynwind_free (c_value);
+
+  args.channel = data->ssh_channel;
+  args.name    = c_name;
+  args.value   = c_value;
+  res = gssh_call_with_deadline (ssh_channel_get_session (data->ssh_channel),
+                                 _request_env, &args, FUNC_NAME,
+                                 scm_list_3 (channel, name, value));
   _gssh_log_debug_format(FUNC_NAME, scm_list_3 (channel, name, value),
                          "result: %d", res);
   if (res != SSH_OK)
@@ -305,6 +388,8 @@ Return value is undefined.\
       guile_ssh_session_error1 (FUNC_NAME, session, channel);
     }
 
+  scm_dynwind_end ();
+
   return SCM_UNDEFINED;
 }
 #undef FUNC_NAME
@@ -650,6 +735,526 @@ Throw `guile-ssh-error' if the channel has been closed and freed.\
 }
 #undef FUNC_NAME
 
+
+/* Process bridge.
+
+   A local process is spawned with its standard streams connected to pipes,
+   and the pipes are pumped to and from a channel in C, outside of Guile
+   mode, until the process closes its output. */
+
+#define BRIDGE_BUFSZ 32768
+
+struct bridge_args {
+  ssh_channel channel;
+  pid_t pid;
+  int in_fd;                    /* Process stdin (write end.) */
+  int out_fd;                   /* Process stdout (read end.) */
+  int err_fd;                   /* Process stderr (read end.) */
+  int timeout_ms;               /* Time left before the deadline, or -1. */
+  int status;                   /* Process status from 'waitpid'. */
+  int timed_out;
+  int terminated;               /* The process is sent SIGTERM. */
+};
+
+/* The time in milliseconds that a process is given to exit after SIGTERM,
+   before it is killed. */
+#define BRIDGE_TERM_GRACE_MS 2000
+
+static long
+_bridge_now_ms (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Read a chunk from a process stream FD and write it to the channel of
+   ARGS.  Return 0 on EOF or a channel error, 1 otherwise. */
+static int
+_bridge_pump_out (struct bridge_args *args, int fd, int is_stderr, char *buf)
+{
+  ssize_t n = read (fd, buf, BRIDGE_BUFSZ);
+  int res;
+
+  if (n < 0)
+    return (errno == EINTR || errno == EAGAIN) ? 1 : 0;
+  if (n == 0)
+    return 0;
+
+  res = is_stderr
+    ? ssh_channel_write_stderr (args->channel, buf, (uint32_t) n)
+    : ssh_channel_write (args->channel, buf, (uint32_t) n);
+  return (res == SSH_ERROR) ? 0 : 1;
+}
+
+/* Wait for the process of ARGS to exit and store its status.  A process that
+   is sent SIGTERM is killed if it does not exit in BRIDGE_TERM_GRACE_MS. */
+static void
+_bridge_reap (struct bridge_args *args)
+{
+  if (args->terminated)
+    {
+      long deadline = _bridge_now_ms () + BRIDGE_TERM_GRACE_MS;
+      struct timespec delay = { 0, 10 * 1000000 };
+      pid_t res;
+
+      while (((res = waitpid (args->pid, &args->status, WNOHANG)) == 0)
+             || ((res < 0) && (errno == EINTR)))
+        {
+          if (_bridge_now_ms () >= deadline)
+            {
+              kill (args->pid, SIGKILL);
+              break;
+            }
+          nanosleep (&delay, NULL);
+        }
+      if (res > 0)
+        return;
+    }
+
+  while ((waitpid (args->pid, &args->status, 0) < 0) && (errno == EINTR))
+    ;
+}
+
+static void *
+_bridge_pump (void *data)
+{
+  struct bridge_args *args = data;
+  ssh_session session = ssh_channel_get_session (args->channel);
+  long deadline = (args->timeout_ms < 0)
+    ? -1
+    : _bridge_now_ms () + args->timeout_ms;
+  char *inbuf  = malloc (BRIDGE_BUFSZ);
+  char *outbuf = malloc (BRIDGE_BUFSZ);
+  size_t in_len = 0;
+  size_t in_off = 0;
+
+  while ((args->out_fd >= 0) || (args->err_fd >= 0))
+    {
+      struct pollfd fds[4];
+      nfds_t nfds = 0;
+      int timeout = -1;
+      int out_idx = -1, err_idx = -1, in_idx = -1;
+
+      /* Take the client data that libssh has already buffered. */
+      if ((args->in_fd >= 0) && (in_len == 0))
+        {
+          int n = ssh_channel_read_nonblocking (args->channel, inbuf,
+                                                BRIDGE_BUFSZ, 0);
+          if (n > 0)
+            {
+              in_len = (size_t) n;
+              in_off = 0;
+            }
+          else if ((n == SSH_ERROR) || ssh_channel_is_eof (args->channel))
+            {
+              close (args->in_fd);
+              args->in_fd = -1;
+            }
+        }
+
+      if (args->out_fd >= 0)
+        {
+          fds[nfds].fd = args->out_fd;
+          fds[nfds].events = POLLIN;
+          out_idx = nfds++;
+        }
+      if (args->err_fd >= 0)
+        {
+          fds[nfds].fd = args->err_fd;
+          fds[nfds].events = POLLIN;
+          err_idx = nfds++;
+        }
+      if ((args->in_fd >= 0) && (in_len > 0))
+        {
+          fds[nfds].fd = args->in_fd;
+          fds[nfds].events = POLLOUT;
+          in_idx = nfds++;
+        }
+      else if (args->in_fd >= 0)
+        {
+          fds[nfds].fd = ssh_get_fd (session);
+          fds[nfds].events = POLLIN;
+          nfds++;
+        }
+
+      if (deadline >= 0)
+        {
+          timeout = (int) (deadline - _bridge_now_ms ());
+          if (timeout <= 0)
+            {
+              args->timed_out = 1;
+              kill (args->pid, SIGKILL);
+              break;
+            }
+        }
+
+      if (poll (fds, nfds, timeout) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      if ((out_idx >= 0) && fds[out_idx].revents)
+        {
+          if (! _bridge_pump_out (args, args->out_fd, 0, outbuf))
+            {
+              close (args->out_fd);
+              args->out_fd = -1;
+            }
+        }
+      if ((err_idx >= 0) && fds[err_idx].revents)
+        {
+          if (! _bridge_pump_out (args, args->err_fd, 1, outbuf))
+            {
+              close (args->err_fd);
+              args->err_fd = -1;
+            }
+        }
+      if ((in_idx >= 0) && fds[in_idx].revents)
+        {
+          ssize_t n = write (args->in_fd, inbuf + in_off, in_len - in_off);
+          if ((n < 0) && (errno != EINTR) && (errno != EAGAIN))
+            {
+              /* The process does not read its input anymore. */
+              close (args->in_fd);
+              args->in_fd = -1;
+              in_len = 0;
+            }
+          else if (n > 0)
+            {
+              in_off += (size_t) n;
+              if (in_off == in_len)
+                in_len = 0;
+            }
+        }
+
+      if (! ssh_channel_is_open (args->channel))
+        {
+          kill (args->pid, SIGTERM);
+          args->terminated = 1;
+          break;
+        }
+    }
+
+  free (inbuf);
+  free (outbuf);
+
+  if (args->in_fd >= 0)
+    close (args->in_fd);
+  if (args->out_fd >= 0)
+    close (args->out_fd);
+  if (args->err_fd >= 0)
+    close (args->err_fd);
+
+  _bridge_reap (args);
+
+  return NULL;
+}
+
+/* Signal names for 'exit-signal' requests (RFC 4254, section 6.10.) */
+static gssh_symbol_t exit_signals[] = {
+  { "ABRT", SIGABRT },
+  { "ALRM", SIGALRM },
+  { "FPE",  SIGFPE  },
+  { "HUP",  SIGHUP  },
+  { "ILL",  SIGILL  },
+  { "INT",  SIGINT  },
+  { "KILL", SIGKILL },
+  { "PIPE", SIGPIPE },
+  { "QUIT", SIGQUIT },
+  { "SEGV", SIGSEGV },
+  { "TERM", SIGTERM },
+  { "USR1", SIGUSR1 },
+  { "USR2", SIGUSR2 },
+  { NULL,   -1      }
+};
+
+/* Make a pipe whose both ends are closed on exec, so they do not leak into
+   processes that are started by other threads.  Return 0 on success, -1 on
+   an error. */
+static int
+_pipe_cloexec (int fds[2])
+{
+  if (pipe (fds) < 0)
+    return -1;
+  fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+  return 0;
+}
+
+/* Make a descriptor FD available as TARGET in a child process.  Called
+   after 'fork', so only async-signal-safe calls are allowed. */
+static void
+_child_redirect (int fd, int target)
+{
+  if (fd == target)
+    fcntl (target, F_SETFD, 0);  /* Keep it open on exec. */
+  else
+    dup2 (fd, target);
+}
+
+/* Close the descriptors above the standard streams in a child process.
+   MAX_FD is the limit of descriptors that is used when the 'close_range'
+   system call is not available.  Called after 'fork', so only
+   async-signal-safe calls are allowed. */
+static void
+_child_close_fds (long max_fd)
+{
+  long fd;
+
+#ifdef SYS_close_range
+  if (syscall (SYS_close_range, STDERR_FILENO + 1, ~0U, 0) == 0)
+    return;
+#endif
+
+  for (fd = STDERR_FILENO + 1; fd < max_fd; fd++)
+    close ((int) fd);
+}
+
+/* Convert a list of strings LST to a NULL-terminated array of C strings
+   that is freed when the current dynwind context is left. */
+static char **
+_scm_to_argv (SCM lst, int pos, const char *func_name)
+{
+  long len = scm_ilength (lst);
+  char **argv;
+  long i;
+
+  SCM_ASSERT (len >= 0, lst, pos, func_name);
+
+  argv = scm_malloc ((len + 1) * sizeof (char *));
+  scm_dynwind_free (argv);
+  for (i = 0; i < len; i++, lst = scm_cdr (lst))
+    {
+      SCM_ASSERT (scm_is_string (scm_car (lst)), scm_car (lst), pos,
+                  func_name);
+      argv[i] = scm_to_locale_string (scm_car (lst));
+      scm_dynwind_free (argv[i]);
+    }
+  argv[len] = NULL;
+  return argv;
+}
+
+SCM_GSSH_DEFINE (gssh_channel_exec_process, "%gssh-channel-exec-process", 3,
+                 (SCM channel, SCM command, SCM environment))
+#define FUNC_NAME s_gssh_channel_exec_process
+{
+  gssh_channel_t *cd = gssh_channel_from_scm (channel);
+  struct bridge_args args;
+  char **argv;
+  char **envp = NULL;
+  int in_pipe[2], out_pipe[2], err_pipe[2];
+  long max_fd;
+  int status;
+
+  GSSH_VALIDATE_CHANNEL_DATA (cd, channel, FUNC_NAME);
+  GSSH_VALIDATE_OPEN_CHANNEL (channel, SCM_ARG1, FUNC_NAME);
+  SCM_ASSERT (scm_is_pair (command), command, SCM_ARG2, FUNC_NAME);
+
+  if (! _gssh_channel_parent_session_connected_p (cd))
+    guile_ssh_error1 (FUNC_NAME, "Parent session is not connected", channel);
+
+  scm_dynwind_begin (0);
+
+  argv = _scm_to_argv (command, SCM_ARG2, FUNC_NAME);
+  if (scm_is_true (environment))
+    envp = _scm_to_argv (environment, SCM_ARG3, FUNC_NAME);
+
+  if (_pipe_cloexec (in_pipe) < 0)
+    guile_ssh_error1 (FUNC_NAME, strerror (errno), command);
+  if (_pipe_cloexec (out_pipe) < 0)
+    {
+      close (in_pipe[0]);
+      close (in_pipe[1]);
+      guile_ssh_error1 (FUNC_NAME, strerror (errno), command);
+    }
+  if (_pipe_cloexec (err_pipe) < 0)
+    {
+      close (in_pipe[0]);
+      close (in_pipe[1]);
+      close (out_pipe[0]);
+      close (out_pipe[1]);
+      guile_ssh_error1 (FUNC_NAME, strerror (errno), command);
+    }
+
+  max_fd = sysconf (_SC_OPEN_MAX);
+  if (max_fd < 0)
+    max_fd = 1024;
+
+  args.pid = fork ();
+  if (args.pid == 0)
+    {
+      /* Only async-signal-safe calls are allowed here, since the parent
+         may have other threads. */
+      _child_redirect (in_pipe[0],  STDIN_FILENO);
+      _child_redirect (out_pipe[1], STDOUT_FILENO);
+      _child_redirect (err_pipe[1], STDERR_FILENO);
+
+      /* Do not let the process inherit the session socket and other
+         descriptors of the parent, including the ones that were opened by
+         other threads without the close-on-exec flag. */
+      _child_close_fds (max_fd);
+
+      if (envp)
+        execve (argv[0], argv, envp);
+      else
+        execv (argv[0], argv);
+      _exit (127);
+    }
+
+  close (in_pipe[0]);
+  close (out_pipe[1]);
+  close (err_pipe[1]);
+
+  if (args.pid < 0)
+    {
+      close (in_pipe[1]);
+      close (out_pipe[0]);
+      close (err_pipe[0]);
+      guile_ssh_error1 (FUNC_NAME, strerror (errno), command);
+    }
+
+  /* Writes to the process must not block the pump. */
+  fcntl (in_pipe[1], F_SETFL, fcntl (in_pipe[1], F_GETFL) | O_NONBLOCK);
+
+  args.channel    = cd->ssh_channel;
+  args.in_fd      = in_pipe[1];
+  args.out_fd     = out_pipe[0];
+  args.err_fd     = err_pipe[0];
+  args.timeout_ms = gssh_deadline_remaining_ms ();
+  args.status     = 0;
+  args.timed_out  = 0;
+  args.terminated = 0;
+
+  scm_without_guile (_bridge_pump, &args);
+
+  scm_dynwind_end ();
+
+  if (args.timed_out)
+    {
+      /* The process is killed; let the client know about it. */
+      if (ssh_channel_is_open (cd->ssh_channel))
+        {
+          ssh_channel_request_send_exit_signal (cd->ssh_channel, "KILL",
+                                                0, "", "");
+          ssh_channel_send_eof (cd->ssh_channel);
+        }
+      guile_ssh_timeout_error1 (FUNC_NAME, "Deadline is expired", channel);
+    }
+
+  if (WIFSIGNALED (args.status))
+    {
+      const gssh_symbol_t *sig = NULL;
+      int i;
+      for (i = 0; exit_signals[i].symbol; i++)
+        {
+          if (exit_signals[i].value == WTERMSIG (args.status))
+            {
+              sig = &exit_signals[i];
+              break;
+            }
+        }
+      status = 128 + WTERMSIG (args.status);
+      if (sig && ssh_channel_is_open (cd->ssh_channel))
+        ssh_channel_request_send_exit_signal (cd->ssh_channel, sig->symbol,
+                                              0, "", "");
+      else if (ssh_channel_is_open (cd->ssh_channel))
+        ssh_channel_request_send_exit_status (cd->ssh_channel, status);
+    }
+  else
+    {
+      status = WEXITSTATUS (args.status);
+      if (ssh_channel_is_open (cd->ssh_channel))
+        ssh_channel_request_send_exit_status (cd->ssh_channel, status);
+    }
+
+  if (ssh_channel_is_open (cd->ssh_channel))
+    ssh_channel_send_eof (cd->ssh_channel);
+
+  return scm_from_int (status);
+}
+#undef FUNC_NAME
+
+
+/* Waiting for descriptors. */
+
+struct poll_fds_args {
+  struct pollfd *fds;
+  nfds_t nfds;
+  int timeout_ms;
+  int res;
+  int err;
+};
+
+static void *
+_poll_fds (void *data)
+{
+  struct poll_fds_args *args = data;
+  args->res = poll (args->fds, args->nfds, args->timeout_ms);
+  args->err = errno;
+  return NULL;
+}
+
+/* Add the descriptors of a list LST to FDS starting from an index IDX with
+   poll EVENTS.  Return the next index. */
+static nfds_t
+_scm_to_pollfds (SCM lst, struct pollfd *fds, nfds_t idx, short events,
+                 int pos, const char *func_name)
+{
+  for (; ! scm_is_null (lst); lst = scm_cdr (lst), idx++)
+    {
+      SCM_ASSERT (scm_is_integer (scm_car (lst)), scm_car (lst), pos,
+                  func_name);
+      fds[idx].fd      = scm_to_int (scm_car (lst));
+      fds[idx].events  = events;
+      fds[idx].revents = 0;
+    }
+  return idx;
+}
+
+/* Wait at most TIMEOUT milliseconds until one of the descriptors of a list
+   READ-FDS is ready for reading, or one of WRITE-FDS is ready for writing.
+   Unlike 'select', any descriptor numbers can be used.  Return #t if a
+   descriptor is ready, #f on timeout.  Throw 'guile-ssh-error' on an
+   error. */
+SCM_GSSH_DEFINE (gssh_poll_fds, "%gssh-poll-fds", 3,
+                 (SCM read_fds, SCM write_fds, SCM timeout))
+#define FUNC_NAME s_gssh_poll_fds
+{
+  long rlen = scm_ilength (read_fds);
+  long wlen = scm_ilength (write_fds);
+  struct poll_fds_args args;
+  nfds_t idx;
+
+  SCM_ASSERT (rlen >= 0, read_fds,  SCM_ARG1, FUNC_NAME);
+  SCM_ASSERT (wlen >= 0, write_fds, SCM_ARG2, FUNC_NAME);
+  SCM_ASSERT (scm_is_integer (timeout), timeout, SCM_ARG3, FUNC_NAME);
+
+  scm_dynwind_begin (0);
+
+  args.nfds       = (nfds_t) (rlen + wlen);
+  args.fds        = scm_malloc ((args.nfds + 1) * sizeof (struct pollfd));
+  args.timeout_ms = scm_to_int (timeout);
+  scm_dynwind_free (args.fds);
+
+  idx = _scm_to_pollfds (read_fds, args.fds, 0, POLLIN, SCM_ARG1, FUNC_NAME);
+  _scm_to_pollfds (write_fds, args.fds, idx, POLLOUT, SCM_ARG2, FUNC_NAME);
+
+  scm_without_guile (_poll_fds, &args);
+
+  if ((args.res < 0) && (args.err != EINTR))
+    guile_ssh_error1 (FUNC_NAME, strerror (args.err),
+                      scm_list_2 (read_fds, write_fds));
+
+  scm_dynwind_end ();
+
+  return scm_from_bool (args.res > 0);
+}
+#undef FUNC_NAME
+
+
 
 /* Initialize channel related functions. */
 void
@@ -30,6 +30,9 @@ extern SCM guile_ssh_channel_set_pty_size_x (SCM arg1, SCM arg2, SCM arg3);
 
 extern SCM guile_ssh_channel_get_exit_status (SCM arg1);
 
+extern SCM gssh_channel_exec_process (SCM channel, SCM command,
+                                      SCM environment);
+
 extern void init_channel_func (void);
 
 #endif /* ifndef __CHANNEL_FUNC_H__ */
@@ -30,6 +30,7 @@
 #include "error.h"
 #include "common.h"
 #include "log.h"
+#include "deadline.h"
 
 static const char* GSSH_CHANNEL_TYPE_NAME = "channel";
 
@@ -42,6 +43,35 @@ enum {
 };
 
 
+/* Helper procedures */
+
+/* Poll the channel CD for data.  If there is a deadline, wait for the data
+   until the deadline and throw 'guile-ssh-timeout' if no data arrived.
+   Return the value of 'ssh_channel_poll'. */
+static int
+_poll_channel (gssh_channel_t *cd, SCM channel, const char *proc)
+{
+  int timeout = gssh_deadline_remaining_ms ();
+  int res;
+
+  if (timeout < 0)
+    return ssh_channel_poll (cd->ssh_channel, cd->is_stderr);
+
+  for (;;)
+    {
+      res = ssh_channel_poll_timeout (cd->ssh_channel, timeout,
+                                      cd->is_stderr);
+      if (res != 0)
+        return res;
+
+      timeout = gssh_deadline_remaining_ms ();
+      if (timeout == 0)
+        guile_ssh_timeout_error1 (proc, "Timed out reading from the channel",
+                                  channel);
+    }
+}
+
+
 /* Ptob specific procedures */
 
 #if USING_GUILE_BEFORE_2_2
@@ -61,7 +91,7 @@ ptob_fill_input (SCM channel)
 
   /* Update state of the underlying channel and check whether we have
      data to read or not. */
-  res = ssh_channel_poll (cd->ssh_channel, cd->is_stderr);
+  res = _poll_channel (cd, channel, FUNC_NAME);
   if (res == SSH_ERROR)
     guile_ssh_error1 (FUNC_NAME, "Error polling channel", channel);
   else if (res == SSH_EOF)
@@ -134,6 +164,31 @@ ptob_flush (SCM channel)
 
 #else /* !USING_GUILE_BEFORE_2_2 */
 
+/* Wait until the remote window of the channel CD is open, or throw
+   'guile-ssh-timeout' when the deadline passes.  Return the number of bytes
+   that can be written without waiting for the window, at most COUNT. */
+static size_t
+_wait_for_window (gssh_channel_t *cd, SCM channel, size_t count,
+                  const char *proc)
+{
+  ssh_session session = ssh_channel_get_session (cd->ssh_channel);
+  uint32_t window;
+
+  while ((window = ssh_channel_window_size (cd->ssh_channel)) == 0)
+    {
+      int timeout = gssh_deadline_remaining_ms ();
+      if ((timeout == 0) || (gssh_session_wait (session, timeout) == 0))
+        guile_ssh_timeout_error1 (proc, "Timed out writing to the channel",
+                                  channel);
+
+      /* Process the incoming packets, including window adjustments. */
+      if (ssh_channel_poll (cd->ssh_channel, 0) == SSH_ERROR)
+        guile_ssh_session_error1 (proc, session, channel);
+    }
+
+  return (count < window) ? count : window;
+}
+
 static size_t
 read_from_channel_port (SCM channel, SCM dst, size_t start, size_t count)
 #define FUNC_NAME "read_from_channel_port"
@@ -147,7 +202,7 @@ read_from_channel_port (SCM channel, SCM dst, size_t start, size_t count)
 
   /* Update state of the underlying channel and check whether we have
      data to read or not. */
-  res = ssh_channel_poll (cd->ssh_channel, cd->is_stderr);
+  res = _poll_channel (cd, channel, FUNC_NAME);
   if (res == SSH_ERROR)
     guile_ssh_error1 (FUNC_NAME, "Error polling channel", channel);
   else if (res == SSH_EOF)
@@ -177,6 +232,9 @@ write_to_channel_port (SCM channel, SCM src, size_t start, size_t count)
   if (! _gssh_channel_parent_session_connected_p (channel_data))
     guile_ssh_error1 (FUNC_NAME, "Parent session is not connected", channel);
 
+  if (gssh_deadline_remaining_ms () >= 0)
+    count = _wait_for_window (channel_data, channel, count, FUNC_NAME);
+
   int res = ssh_channel_write (channel_data->ssh_channel, data, count);
   if (res == SSH_ERROR)
     {
@@ -207,6 +265,12 @@ ptob_input_waiting (SCM channel)
 }
 #undef FUNC_NAME
 
+static inline SCM
+_channel_key (ssh_channel ch)
+{
+  return scm_from_uintptr_t ((scm_t_uintptr) ch);
+}
+
 /* Close underlying SSH channel and free all allocated resources. */
 #if USING_GUILE_BEFORE_2_2
 static int
@@ -226,6 +290,18 @@ ptob_close (SCM channel)
   if (ch)
     {
       gssh_session_t *sd = gssh_session_from_scm (ch->session);
+
+      /* The address of the libssh channel may be reused after it is freed,
+         so the channel must not be found by it anymore. */
+      if (sd && scm_is_true (sd->channels)
+          && scm_is_eq (scm_hashv_ref (sd->channels,
+                                       _channel_key (ch->ssh_channel),
+                                       SCM_BOOL_F),
+                        channel))
+        {
+          scm_hashv_remove_x (sd->channels, _channel_key (ch->ssh_channel));
+        }
+
       if (sd && ssh_is_connected (sd->ssh_session))
         {
           if (ssh_channel_is_open (ch->ssh_channel))
@@ -393,6 +469,33 @@ _gssh_channel_parent_session_connected_p (gssh_channel_t* cd)
   return (sd && ssh_is_connected (sd->ssh_session));
 }
 
+/* Register a CHANNEL that was accepted on the server side in its parent
+   session, so requests for the channel can be passed to handlers along with
+   the CHANNEL (see 'gssh_channel_lookup'.)  The registration is dropped when
+   the CHANNEL is closed. */
+void
+gssh_channel_register (SCM channel)
+{
+  gssh_channel_t *cd = gssh_channel_from_scm (channel);
+  gssh_session_t *sd = gssh_session_from_scm (cd->session);
+
+  if (scm_is_false (sd->channels))
+    sd->channels = scm_make_weak_value_hash_table (scm_from_int (7));
+  scm_hashv_set_x (sd->channels, _channel_key (cd->ssh_channel), channel);
+}
+
+/* Get the registered channel of a SESSION for a libssh channel CH, or #f if
+   there is no such channel. */
+SCM
+gssh_channel_lookup (SCM session, ssh_channel ch)
+{
+  gssh_session_t *sd = gssh_session_from_scm (session);
+
+  if ((! ch) || scm_is_false (sd->channels))
+    return SCM_BOOL_F;
+  return scm_hashv_ref (sd->channels, _channel_key (ch), SCM_BOOL_F);
+}
+
 
 /* channel smob initialization. */
 void
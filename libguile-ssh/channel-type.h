@@ -80,6 +80,8 @@ extern void init_channel_type (void);
 /* Helper procedures */
 extern gssh_channel_t *gssh_channel_from_scm (SCM x);
 extern SCM ssh_channel_to_scm (ssh_channel ch, SCM session, long flags);
+extern void gssh_channel_register (SCM channel);
+extern SCM gssh_channel_lookup (SCM session, ssh_channel ch);
 
 int _gssh_channel_parent_session_connected_p (gssh_channel_t* cd);
 
@@ -0,0 +1,219 @@
+/* deadline.c -- Per-operation deadlines.
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The current deadline is kept in a fluid, so it is local to the dynamic
+   extent of 'call-with-deadline' and to the current thread.  The deadline
+   is stored as an absolute time in milliseconds of the monotonic clock.
+   Operations that may block check the deadline and throw
+   'guile-ssh-timeout' when it has passed. */
+
+#include <config.h>
+
+#include <libguile.h>
+#include <libssh/libssh.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+
+#include "common.h"
+#include "error.h"
+#include "deadline.h"
+
+/* The fluid that holds the current deadline, or #f. */
+static SCM deadline_fluid = SCM_BOOL_F;
+
+
+/* Helper procedures. */
+
+/* Get the current time of the monotonic clock in milliseconds. */
+static scm_t_int64
+_now_ms (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (scm_t_int64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Get the current deadline in milliseconds, or -1 if there is no
+   deadline. */
+static scm_t_int64
+_current_deadline (void)
+{
+  SCM deadline;
+
+  if (scm_is_false (deadline_fluid))
+    return -1;
+
+  deadline = scm_fluid_ref (deadline_fluid);
+  return scm_is_false (deadline) ? -1 : scm_to_int64 (deadline);
+}
+
+/* Get the number of milliseconds left until the current deadline.  Return
+   -1 if there is no deadline, or 0 if the deadline has passed. */
+int
+gssh_deadline_remaining_ms (void)
+{
+  scm_t_int64 deadline = _current_deadline ();
+  scm_t_int64 remaining;
+
+  if (deadline < 0)
+    return -1;
+
+  remaining = deadline - _now_ms ();
+  if (remaining <= 0)
+    return 0;
+
+  return (remaining > INT_MAX) ? INT_MAX : (int) remaining;
+}
+
+/* Throw 'guile-ssh-timeout' if the current deadline has passed. */
+void
+gssh_deadline_check (const char *proc, SCM args)
+{
+  if (gssh_deadline_remaining_ms () == 0)
+    guile_ssh_timeout_error1 (proc, "Deadline expired", args);
+}
+
+/* Wait for at most TIMEOUT_MS milliseconds until the socket of a SESSION is
+   ready for the I/O that the session waits for.  Return a positive value if
+   the socket is ready, 0 on timeout, or -1 on an error. */
+int
+gssh_session_wait (ssh_session session, int timeout_ms)
+{
+  struct pollfd pfd;
+  int flags = ssh_get_poll_flags (session);
+
+  pfd.fd      = ssh_get_fd (session);
+  pfd.events  = POLLIN;
+  pfd.revents = 0;
+
+  if (pfd.fd == SSH_INVALID_SOCKET)
+    return -1;
+
+  if (flags & SSH_WRITE_PENDING)
+    pfd.events |= POLLOUT;
+
+  return poll (&pfd, 1, timeout_ms);
+}
+
+/* Call an operation OP with DATA as the argument, respecting the current
+   deadline.  If there is no deadline, OP is called as is.  Otherwise the
+   SESSION is switched to non-blocking mode and OP is repeated while it
+   returns SSH_AGAIN, until the deadline passes.  Throw 'guile-ssh-timeout'
+   with a PROC name and ARGS on timeout.  Return the result of OP. */
+int
+gssh_call_with_deadline (ssh_session session,
+                         gssh_deadline_op_t op, void *data,
+                         const char *proc, SCM args)
+{
+  int remaining = gssh_deadline_remaining_ms ();
+  int is_blocking;
+  int res;
+
+  if (remaining < 0)
+    return op (data);
+
+  if (remaining == 0)
+    guile_ssh_timeout_error1 (proc, "Deadline expired", args);
+
+  is_blocking = ssh_is_blocking (session);
+  ssh_set_blocking (session, 0);
+
+  while ((res = op (data)) == SSH_AGAIN)
+    {
+      remaining = gssh_deadline_remaining_ms ();
+      if ((remaining == 0)
+          || (gssh_session_wait (session, remaining) == 0))
+        {
+          ssh_set_blocking (session, is_blocking);
+          guile_ssh_timeout_error1 (proc, "Deadline expired", args);
+        }
+    }
+
+  ssh_set_blocking (session, is_blocking);
+  return res;
+}
+
+
+/* Scheme procedures. */
+
+SCM_GSSH_DEFINE (gssh_deadline_after, "%gssh-deadline-after", 1,
+                 (SCM seconds))
+#define FUNC_NAME s_gssh_deadline_after
+{
+  scm_t_int64 current = _current_deadline ();
+  scm_t_int64 deadline;
+
+  if (scm_is_false (seconds))
+    return SCM_BOOL_F;
+
+  SCM_ASSERT (scm_is_real (seconds), seconds, SCM_ARG1, FUNC_NAME);
+
+  deadline = _now_ms () + (scm_t_int64) (scm_to_double (seconds) * 1000);
+
+  /* A nested deadline cannot extend the outer one. */
+  if ((current >= 0) && (current < deadline))
+    deadline = current;
+
+  return scm_from_int64 (deadline);
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_deadline_remaining, "%gssh-deadline-remaining", 1,
+                 (SCM deadline))
+#define FUNC_NAME s_gssh_deadline_remaining
+{
+  scm_t_int64 remaining;
+
+  if (scm_is_false (deadline))
+    return SCM_BOOL_F;
+
+  remaining = scm_to_int64 (deadline) - _now_ms ();
+  return scm_from_double ((remaining > 0) ? remaining / 1000.0 : 0.0);
+}
+#undef FUNC_NAME
+
+/* Get the CPU time of the calling thread in seconds, or #f if the system
+   has no per-thread CPU clock. */
+SCM_GSSH_DEFINE (gssh_thread_cpu_time, "%gssh-thread-cpu-time", 0, ())
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec ts;
+  if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    return scm_from_double (ts.tv_sec + ts.tv_nsec / 1e9);
+#endif
+  return SCM_BOOL_F;
+}
+
+
+/* Initialize the deadline fluid and procedures. */
+void
+init_deadline (void)
+{
+  if (scm_is_false (deadline_fluid))
+    {
+      deadline_fluid = scm_permanent_object (scm_make_fluid ());
+      scm_c_define ("%gssh-deadline", deadline_fluid);
+    }
+
+#include "deadline.x"
+}
+
+/* deadline.c ends here */
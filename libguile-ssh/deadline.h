@@ -0,0 +1,43 @@
+/* Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEADLINE_H__
+#define __DEADLINE_H__
+
+#include <libguile.h>
+#include <libssh/libssh.h>
+
+/* Type of an operation that can be called with a deadline.  The operation
+   must return SSH_AGAIN when the session is in non-blocking mode and the
+   operation is not completed yet. */
+typedef int (*gssh_deadline_op_t) (void *data);
+
+extern SCM gssh_deadline_after (SCM seconds);
+extern SCM gssh_deadline_remaining (SCM deadline);
+extern SCM gssh_thread_cpu_time (void);
+
+extern int gssh_deadline_remaining_ms (void);
+extern void gssh_deadline_check (const char *proc, SCM args);
+extern int gssh_session_wait (ssh_session session, int timeout_ms);
+extern int gssh_call_with_deadline (ssh_session session,
+                                    gssh_deadline_op_t op, void *data,
+                                    const char *proc, SCM args);
+
+extern void init_deadline (void);
+
+#endif  /* ifndef __DEADLINE_H__ */
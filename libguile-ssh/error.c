@@ -43,6 +43,16 @@ guile_ssh_error1 (const char *proc, const char *msg, SCM args)
              SCM_BOOL_F);
 }
 
+/* Report that an operation did not complete before the deadline. */
+void
+guile_ssh_timeout_error1 (const char *proc, const char *msg, SCM args)
+{
+  _gssh_log_error (proc, msg, args);
+
+  scm_error (scm_from_locale_symbol (GUILE_SSH_TIMEOUT), proc, msg, args,
+             SCM_BOOL_F);
+}
+
 /* Report a session error. */
 void
 guile_ssh_session_error1 (const char *proc, ssh_session session, SCM args)
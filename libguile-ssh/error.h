@@ -19,12 +19,15 @@
 #ifndef __GUILE_SSH_ERROR_H__
 #define __GUILE_SSH_ERROR_H__
 
-#define GUILE_SSH_ERROR "guile-ssh-error"
+#define GUILE_SSH_ERROR   "guile-ssh-error"
+#define GUILE_SSH_TIMEOUT "guile-ssh-timeout"
 
 extern void guile_ssh_error (const char *proc, const char *msg,
                                      SCM args, SCM rest);
 extern void guile_ssh_error1 (const char *proc, const char *msg,
                                      SCM args);
+extern void guile_ssh_timeout_error1 (const char *proc, const char *msg,
+                                      SCM args);
 extern void
 guile_ssh_session_error1 (const char *proc, ssh_session session, SCM args);
 
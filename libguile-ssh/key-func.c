@@ -169,7 +169,7 @@ Throw `guile-ssh-error' on error.\
 }
 #undef FUNC_NAME
 
-SCM_DEFINE (guile_ssh_private_key_from_file, "private-key-from-file", 1, 0, 0,
+SCM_DEFINE (guile_ssh_private_key_from_file, "%gssh-private-key-from-file", 1, 0, 0,
             (SCM filename),
             "\
 Read private key from a file FILENAME.  If the the key isn encrypted the user\n\
@@ -217,7 +217,7 @@ Return a new SSH key of #f on error.\
 #undef FUNC_NAME
 
 SCM_DEFINE (guile_ssh_private_key_to_file,
-            "private-key-to-file", 2, 0, 0,
+            "%gssh-private-key-to-file", 2, 0, 0,
             (SCM key, SCM file_name),
             "\
 Export a private KEY to file FILE_NAME.  Throw `guile-ssh-error' on error. \
@@ -282,7 +282,7 @@ Get public key from a private key KEY.\
  *
  * Return a SSH key smob.
  */
-SCM_DEFINE (guile_ssh_public_key_from_file, "public-key-from-file", 1, 0, 0,
+SCM_DEFINE (guile_ssh_public_key_from_file, "%gssh-public-key-from-file", 1, 0, 0,
             (SCM filename),
             "\
 Read public key from a file FILENAME.  Return a SSH key.\
@@ -54,17 +54,21 @@ static int is_logging_callback_set = 0;
 /* A Scheme log printer. */
 static SCM logging_callback = SCM_BOOL_F;
 
-/* The libssh logging callback which calls Scheme callback procedure. */
-void
-libssh_logging_callback (int        c_priority,
-                         const char *c_function_name,
-                         const char *c_message,
-                         void       *c_userdata)
+struct logging_callback_args {
+  int        priority;
+  const char *function_name;
+  const char *message;
+  void       *userdata;
+};
+
+static void *
+_call_logging_callback (void *data)
 {
-  SCM priority = scm_from_int (c_priority);
-  SCM function = scm_from_locale_string (c_function_name);
-  SCM message  = scm_from_locale_string (c_message);
-  SCM userdata = (SCM) c_userdata;
+  struct logging_callback_args *args = data;
+  SCM priority = scm_from_int (args->priority);
+  SCM function = scm_from_locale_string (args->function_name);
+  SCM message  = scm_from_locale_string (args->message);
+  SCM userdata = (SCM) args->userdata;
 
   scm_call_4 (logging_callback, priority, function, message, userdata);
 
@@ -72,6 +76,26 @@ libssh_logging_callback (int        c_priority,
   scm_remember_upto_here_1 (function);
   scm_remember_upto_here_1 (message);
   scm_remember_upto_here_1 (userdata);
+
+  return NULL;
+}
+
+/* The libssh logging callback which calls Scheme callback procedure. */
+void
+libssh_logging_callback (int        c_priority,
+                         const char *c_function_name,
+                         const char *c_message,
+                         void       *c_userdata)
+{
+  struct logging_callback_args args = {
+    c_priority, c_function_name, c_message, c_userdata
+  };
+
+  /* libssh may call the procedure from a thread that is not in Guile mode
+     (e.g. from 'connect-many' workers), so enter Guile mode first.
+     'scm_with_guile' is a no-op for threads that are already in Guile
+     mode. */
+  scm_with_guile (_call_logging_callback, &args);
 }
 
 
@@ -150,6 +150,7 @@ Return a new SSH channel.\
                                     SCM_RDNG | SCM_WRTNG);
 
   SCM_SET_CELL_TYPE (channel, SCM_CELL_TYPE (channel) | SCM_OPN);
+  gssh_channel_register (channel);
 
   return channel;
 }
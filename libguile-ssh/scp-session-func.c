@@ -0,0 +1,331 @@
+/* scp-session-func.c -- Functions for working with SCP sessions.
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <config.h>
+
+/* Guile */
+#include <libguile.h>
+
+/* libssh */
+#include <libssh/libssh.h>
+
+/* Guile-SSH */
+#include "common.h"
+#include "error.h"
+#include "session-type.h"
+#include "scp-session-type.h"
+
+
+/* Get the libssh session that is the parent of an SCP session SCP_SD. */
+static ssh_session
+_scp_parent_session (gssh_scp_session_t *scp_sd)
+{
+  return gssh_session_from_scm (scp_sd->session)->ssh_session;
+}
+
+/* Check that BV is a bytevector and that the range [START, START + COUNT) is
+   inside of it. */
+#define GSSH_VALIDATE_BYTEVECTOR_RANGE(bv, start, count, pos)           \
+  do {                                                                  \
+    SCM_ASSERT (scm_is_bytevector (bv), bv, pos, FUNC_NAME);            \
+    SCM_ASSERT (scm_is_unsigned_integer (start, 0, SIZE_MAX),           \
+                start, pos + 1, FUNC_NAME);                             \
+    SCM_ASSERT (scm_is_unsigned_integer (count, 0, SIZE_MAX),           \
+                count, pos + 2, FUNC_NAME);                             \
+    if (scm_to_size_t (start) + scm_to_size_t (count)                   \
+        > SCM_BYTEVECTOR_LENGTH (bv))                                   \
+      {                                                                 \
+        guile_ssh_error1 (FUNC_NAME, "Range is out of the bytevector",  \
+                          scm_list_3 (bv, start, count));               \
+      }                                                                 \
+  } while (0)
+
+
+SCM_GSSH_DEFINE (gssh_scp_init, "%gssh-scp-init", 1, (SCM scp_session))
+#define FUNC_NAME s_gssh_scp_init
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  if (ssh_scp_init (scp_sd->scp) != SSH_OK)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, _scp_parent_session (scp_sd),
+                                scp_session);
+    }
+
+  return SCM_UNDEFINED;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_scp_close, "%gssh-scp-close", 1, (SCM scp_session))
+#define FUNC_NAME s_gssh_scp_close
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  if (ssh_scp_close (scp_sd->scp) != SSH_OK)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, _scp_parent_session (scp_sd),
+                                scp_session);
+    }
+
+  return SCM_UNDEFINED;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_scp_get_session, "%gssh-scp-get-session", 1,
+                 (SCM scp_session))
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  return scp_sd->session;
+}
+
+
+/* Sending. */
+
+SCM_GSSH_DEFINE (gssh_scp_push_directory, "%gssh-scp-push-directory", 3,
+                 (SCM scp_session, SCM dirname, SCM mode))
+#define FUNC_NAME s_gssh_scp_push_directory
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  char *c_dirname;
+
+  SCM_ASSERT (scm_is_string (dirname), dirname, SCM_ARG2, FUNC_NAME);
+  SCM_ASSERT (scm_is_number (mode), mode, SCM_ARG3, FUNC_NAME);
+
+  scm_dynwind_begin (0);
+
+  c_dirname = scm_to_locale_string (dirname);
+  scm_dynwind_free (c_dirname);
+
+  if (ssh_scp_push_directory (scp_sd->scp, c_dirname, scm_to_int (mode))
+      != SSH_OK)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, _scp_parent_session (scp_sd),
+                                scm_list_3 (scp_session, dirname, mode));
+    }
+
+  scm_dynwind_end ();
+
+  return SCM_UNDEFINED;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_scp_leave_directory, "%gssh-scp-leave-directory", 1,
+                 (SCM scp_session))
+#define FUNC_NAME s_gssh_scp_leave_directory
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  if (ssh_scp_leave_directory (scp_sd->scp) != SSH_OK)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, _scp_parent_session (scp_sd),
+                                scp_session);
+    }
+
+  return SCM_UNDEFINED;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_scp_push_file, "%gssh-scp-push-file", 4,
+                 (SCM scp_session, SCM filename, SCM size, SCM mode))
+#define FUNC_NAME s_gssh_scp_push_file
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  char *c_filename;
+
+  SCM_ASSERT (scm_is_string (filename), filename, SCM_ARG2, FUNC_NAME);
+  SCM_ASSERT (scm_is_unsigned_integer (size, 0, UINT64_MAX), size,
+              SCM_ARG3, FUNC_NAME);
+  SCM_ASSERT (scm_is_number (mode), mode, SCM_ARG4, FUNC_NAME);
+
+  scm_dynwind_begin (0);
+
+  c_filename = scm_to_locale_string (filename);
+  scm_dynwind_free (c_filename);
+
+  if (ssh_scp_push_file64 (scp_sd->scp, c_filename, scm_to_uint64 (size),
+                           scm_to_int (mode))
+      != SSH_OK)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, _scp_parent_session (scp_sd),
+                                scm_list_4 (scp_session, filename, size,
+                                            mode));
+    }
+
+  scm_dynwind_end ();
+
+  return SCM_UNDEFINED;
+}
+#undef FUNC_NAME
+
+/* Write COUNT bytes starting from START directly from the memory of a
+   bytevector BV, so the data is not copied on the Scheme side. */
+SCM_GSSH_DEFINE (gssh_scp_write, "%gssh-scp-write", 4,
+                 (SCM scp_session, SCM bv, SCM start, SCM count))
+#define FUNC_NAME s_gssh_scp_write
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  const char *data;
+
+  GSSH_VALIDATE_BYTEVECTOR_RANGE (bv, start, count, SCM_ARG2);
+
+  data = (const char *) SCM_BYTEVECTOR_CONTENTS (bv) + scm_to_size_t (start);
+
+  if (ssh_scp_write (scp_sd->scp, data, scm_to_size_t (count)) != SSH_OK)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, _scp_parent_session (scp_sd),
+                                scp_session);
+    }
+
+  return SCM_UNDEFINED;
+}
+#undef FUNC_NAME
+
+
+/* Receiving. */
+
+/* Types of SCP requests. */
+static gssh_symbol_t scp_request_types[] = {
+  { "new-directory", SSH_SCP_REQUEST_NEWDIR  },
+  { "new-file",      SSH_SCP_REQUEST_NEWFILE },
+  { "eof",           SSH_SCP_REQUEST_EOF     },
+  { "end-directory", SSH_SCP_REQUEST_ENDDIR  },
+  { "warning",       SSH_SCP_REQUEST_WARNING },
+  { NULL,            -1                      }
+};
+
+SCM_GSSH_DEFINE (gssh_scp_pull_request, "%gssh-scp-pull-request", 1,
+                 (SCM scp_session))
+#define FUNC_NAME s_gssh_scp_pull_request
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  int res = ssh_scp_pull_request (scp_sd->scp);
+  if (res == SSH_ERROR)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, _scp_parent_session (scp_sd),
+                                scp_session);
+    }
+
+  return gssh_symbol_to_scm (scp_request_types, res);
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_scp_request_get_filename,
+                 "%gssh-scp-request-get-filename", 1, (SCM scp_session))
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  const char *filename = ssh_scp_request_get_filename (scp_sd->scp);
+  return filename ? scm_from_locale_string (filename) : SCM_BOOL_F;
+}
+
+SCM_GSSH_DEFINE (gssh_scp_request_get_size, "%gssh-scp-request-get-size", 1,
+                 (SCM scp_session))
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  return scm_from_uint64 (ssh_scp_request_get_size64 (scp_sd->scp));
+}
+
+SCM_GSSH_DEFINE (gssh_scp_request_get_permissions,
+                 "%gssh-scp-request-get-permissions", 1, (SCM scp_session))
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  int mode = ssh_scp_request_get_permissions (scp_sd->scp);
+  return (mode < 0) ? SCM_BOOL_F : scm_from_int (mode);
+}
+
+SCM_GSSH_DEFINE (gssh_scp_request_get_warning,
+                 "%gssh-scp-request-get-warning", 1, (SCM scp_session))
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  const char *warning = ssh_scp_request_get_warning (scp_sd->scp);
+  return warning ? scm_from_locale_string (warning) : SCM_BOOL_F;
+}
+
+SCM_GSSH_DEFINE (gssh_scp_accept_request, "%gssh-scp-accept-request", 1,
+                 (SCM scp_session))
+#define FUNC_NAME s_gssh_scp_accept_request
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  if (ssh_scp_accept_request (scp_sd->scp) != SSH_OK)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, _scp_parent_session (scp_sd),
+                                scp_session);
+    }
+
+  return SCM_UNDEFINED;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_scp_deny_request, "%gssh-scp-deny-request", 2,
+                 (SCM scp_session, SCM reason))
+#define FUNC_NAME s_gssh_scp_deny_request
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  char *c_reason;
+
+  SCM_ASSERT (scm_is_string (reason), reason, SCM_ARG2, FUNC_NAME);
+
+  scm_dynwind_begin (0);
+
+  c_reason = scm_to_locale_string (reason);
+  scm_dynwind_free (c_reason);
+
+  if (ssh_scp_deny_request (scp_sd->scp, c_reason) != SSH_OK)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, _scp_parent_session (scp_sd),
+                                scm_list_2 (scp_session, reason));
+    }
+
+  scm_dynwind_end ();
+
+  return SCM_UNDEFINED;
+}
+#undef FUNC_NAME
+
+/* Read at most COUNT bytes of the current file directly into a bytevector BV
+   starting from START.  Return the number of bytes read. */
+SCM_GSSH_DEFINE (gssh_scp_read, "%gssh-scp-read", 4,
+                 (SCM scp_session, SCM bv, SCM start, SCM count))
+#define FUNC_NAME s_gssh_scp_read
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  char *data;
+  int res;
+
+  GSSH_VALIDATE_BYTEVECTOR_RANGE (bv, start, count, SCM_ARG2);
+
+  data = (char *) SCM_BYTEVECTOR_CONTENTS (bv) + scm_to_size_t (start);
+
+  res = ssh_scp_read (scp_sd->scp, data, scm_to_size_t (count));
+  if (res == SSH_ERROR)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, _scp_parent_session (scp_sd),
+                                scp_session);
+    }
+
+  return scm_from_int (res);
+}
+#undef FUNC_NAME
+
+
+void
+init_scp_session_func (void)
+{
+#include "scp-session-func.x"
+}
+
+/* scp-session-func.c ends here. */
@@ -0,0 +1,44 @@
+/* Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SCP_SESSION_FUNC_H__
+#define __SCP_SESSION_FUNC_H__
+
+#include <libguile.h>
+
+extern SCM gssh_scp_init (SCM scp_session);
+extern SCM gssh_scp_close (SCM scp_session);
+extern SCM gssh_scp_get_session (SCM scp_session);
+extern SCM gssh_scp_push_directory (SCM scp_session, SCM dirname, SCM mode);
+extern SCM gssh_scp_leave_directory (SCM scp_session);
+extern SCM gssh_scp_push_file (SCM scp_session, SCM filename, SCM size,
+                               SCM mode);
+extern SCM gssh_scp_write (SCM scp_session, SCM bv, SCM start, SCM count);
+extern SCM gssh_scp_pull_request (SCM scp_session);
+extern SCM gssh_scp_request_get_filename (SCM scp_session);
+extern SCM gssh_scp_request_get_size (SCM scp_session);
+extern SCM gssh_scp_request_get_permissions (SCM scp_session);
+extern SCM gssh_scp_request_get_warning (SCM scp_session);
+extern SCM gssh_scp_accept_request (SCM scp_session);
+extern SCM gssh_scp_deny_request (SCM scp_session, SCM reason);
+extern SCM gssh_scp_read (SCM scp_session, SCM bv, SCM start, SCM count);
+
+
+extern void init_scp_session_func (void);
+
+#endif /* ifndef __SCP_SESSION_FUNC_H__ */
@@ -0,0 +1,167 @@
+/* scp-session-type.c -- SCP session smob.
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <libguile.h>
+#include <libssh/libssh.h>
+
+#include "common.h"
+#include "error.h"
+#include "session-type.h"
+#include "scp-session-type.h"
+
+scm_t_bits scp_session_tag;     /* Smob tag. */
+
+
+/* SCP session modes. */
+static gssh_symbol_t scp_modes[] = {
+  { "write", SSH_SCP_WRITE },
+  { "read",  SSH_SCP_READ  },
+  { NULL,    -1            }
+};
+
+
+/* GC callbacks. */
+
+static SCM
+_mark (SCM scp_session)
+{
+  gssh_scp_session_t *scp_sd = gssh_scp_session_from_scm (scp_session);
+  return scp_sd->session;
+}
+
+static size_t
+_free (SCM scp_session)
+{
+  gssh_scp_session_t *scp_sd
+    = (gssh_scp_session_t *) SCM_SMOB_DATA (scp_session);
+
+  /* 'ssh_scp_free' closes the SCP channel if it is still open. */
+  ssh_scp_free (scp_sd->scp);
+  gssh_session_unref (scp_sd->session_refs);
+  return 0;
+}
+
+static SCM
+_equalp (SCM x1, SCM x2)
+{
+  gssh_scp_session_t *scp_sd1 = gssh_scp_session_from_scm (x1);
+  gssh_scp_session_t *scp_sd2 = gssh_scp_session_from_scm (x2);
+
+  if ((! scp_sd1) || (! scp_sd2))
+    return SCM_BOOL_F;
+  else if (scp_sd1 != scp_sd2)
+    return SCM_BOOL_F;
+  else
+    return SCM_BOOL_T;
+}
+
+/* Printing procedure. */
+static int
+_print (SCM scp_session, SCM port, scm_print_state *pstate)
+{
+  scm_puts ("#<scp-session ", port);
+  scm_display (_scm_object_hex_address (scp_session), port);
+  scm_puts (">", port);
+  return 1;
+}
+
+
+SCM_GSSH_DEFINE (gssh_scp_session_p, "%gssh-scp-session?", 1, (SCM x))
+{
+  return scm_from_bool (SCM_SMOB_PREDICATE (scp_session_tag, x));
+}
+
+
+SCM_GSSH_DEFINE (gssh_make_scp_session, "%gssh-make-scp-session", 4,
+                 (SCM session, SCM mode, SCM location, SCM recursive_p))
+#define FUNC_NAME s_gssh_make_scp_session
+{
+  gssh_session_t *sd = gssh_session_from_scm (session);
+  const gssh_symbol_t *c_mode;
+  char *c_location;
+  ssh_scp scp;
+  int flags;
+
+  GSSH_VALIDATE_CONNECTED_SESSION (sd, session, SCM_ARG1);
+  SCM_ASSERT (scm_is_symbol (mode), mode, SCM_ARG2, FUNC_NAME);
+  SCM_ASSERT (scm_is_string (location), location, SCM_ARG3, FUNC_NAME);
+  SCM_ASSERT (scm_is_bool (recursive_p), recursive_p, SCM_ARG4, FUNC_NAME);
+
+  c_mode = gssh_symbol_from_scm (scp_modes, mode);
+  if (! c_mode)
+    guile_ssh_error1 (FUNC_NAME, "Wrong SCP mode", mode);
+
+  flags = c_mode->value;
+  if (scm_is_true (recursive_p))
+    flags |= SSH_SCP_RECURSIVE;
+
+  scm_dynwind_begin (0);
+
+  c_location = scm_to_locale_string (location);
+  scm_dynwind_free (c_location);
+
+  scp = ssh_scp_new (sd->ssh_session, flags, c_location);
+  if (! scp)
+    {
+      guile_ssh_error1 (FUNC_NAME, "Could not create a SCP session",
+                        scm_list_3 (session, mode, location));
+    }
+
+  scm_dynwind_end ();
+
+  return make_gssh_scp_session (scp, session);
+}
+#undef FUNC_NAME
+
+
+gssh_scp_session_t *
+gssh_scp_session_from_scm (SCM x)
+{
+  scm_assert_smob_type (scp_session_tag, x);
+  return (gssh_scp_session_t *) SCM_SMOB_DATA (x);
+}
+
+SCM
+make_gssh_scp_session (ssh_scp scp, SCM session)
+{
+  SCM smob;
+  gssh_scp_session_t *scp_sd
+    = (gssh_scp_session_t *) scm_gc_malloc (sizeof (gssh_scp_session_t),
+                                            "scp session");
+  scp_sd->scp          = scp;
+  scp_sd->session      = session;
+  scp_sd->session_refs = gssh_session_ref (gssh_session_from_scm (session));
+  SCM_NEWSMOB (smob, scp_session_tag, scp_sd);
+  return smob;
+}
+
+void
+init_scp_session_type (void)
+{
+  scp_session_tag = scm_make_smob_type ("scp session",
+                                        sizeof (gssh_scp_session_t));
+  set_smob_callbacks (scp_session_tag, _mark, _free, _equalp, _print);
+
+#include "scp-session-type.x"
+}
+
+/* scp-session-type.c ends here. */
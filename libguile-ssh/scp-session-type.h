@@ -0,0 +1,59 @@
+/* Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SCP_SESSION_TYPE_H__
+#define __SCP_SESSION_TYPE_H__
+
+#include <libguile.h>
+#include <libssh/libssh.h>
+#include "session-type.h"
+
+
+extern scm_t_bits scp_session_tag;
+
+
+/* Smob data. */
+struct gssh_scp_session {
+  /* Reference to the parent session.  We need to keep the reference
+     to prevent the session from premature freeing by the GC. */
+  SCM session;
+
+  /* Reference to the libssh session that is used by the finalizer. */
+  gssh_session_refs_t *session_refs;
+
+  ssh_scp scp;
+};
+
+typedef struct gssh_scp_session gssh_scp_session_t;
+
+
+extern SCM gssh_scp_session_p (SCM x);
+extern SCM gssh_make_scp_session (SCM session, SCM mode, SCM location,
+                                  SCM recursive_p);
+
+extern void init_scp_session_type (void);
+
+
+/* Internal procedures */
+
+extern gssh_scp_session_t* gssh_scp_session_from_scm (SCM x);
+extern SCM make_gssh_scp_session (ssh_scp scp, SCM session);
+
+#endif  /* ifndef __SCP_SESSION_TYPE_H__ */
+
+/* scp-session-type.h ends here. */
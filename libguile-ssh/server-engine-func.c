@@ -0,0 +1,736 @@
+/* server-engine-func.c -- Event-driven server engine.
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The engine drives many server sessions from a single 'ssh_event'.  libssh
+   calls the server and channel callbacks below from 'ssh_event_dopoll',
+   which runs outside of Guile mode; each callback enters Guile mode only
+   for the time it takes to call the Scheme handler. */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <libguile.h>
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+#include <libssh/callbacks.h>
+
+#include "common.h"
+#include "error.h"
+#include "log.h"
+#include "session-type.h"
+#include "channel-type.h"
+#include "key-type.h"
+#include "server-engine-type.h"
+#include "server-engine-func.h"
+
+
+/* Authentication results that can be returned by handlers. */
+static gssh_symbol_t auth_results[] = {
+  { "success", SSH_AUTH_SUCCESS },
+  { "partial", SSH_AUTH_PARTIAL },
+  { "denied",  SSH_AUTH_DENIED  },
+  { NULL,      -1               }
+};
+
+/* Public key signature states. */
+static gssh_symbol_t pubkey_states[] = {
+  { "error", SSH_PUBLICKEY_STATE_ERROR },
+  { "none",  SSH_PUBLICKEY_STATE_NONE  },
+  { "valid", SSH_PUBLICKEY_STATE_VALID },
+  { "wrong", SSH_PUBLICKEY_STATE_WRONG },
+  { NULL,    -1                        }
+};
+
+
+/* Helper procedures. */
+
+static inline SCM
+_pointer_key (const void *ptr)
+{
+  return scm_from_uintptr_t ((scm_t_uintptr) ptr);
+}
+
+/* Get a Scheme handler NAME of an engine ED, or #f if the handler is not
+   set. */
+static SCM
+_handler_ref (gssh_server_engine_t *ed, const char *name)
+{
+  SCM handler = scm_assq_ref (ed->handlers, scm_from_locale_symbol (name));
+  return scm_is_true (handler) ? handler : SCM_BOOL_F;
+}
+
+struct handler_call {
+  SCM handler;
+  SCM args;
+};
+
+static SCM
+_handler_body (void *data)
+{
+  struct handler_call *c = data;
+  return scm_apply_0 (c->handler, c->args);
+}
+
+static SCM
+_handler_error (void *data, SCM key, SCM args)
+{
+  struct handler_call *c = data;
+  _gssh_log_error ("server-engine", "Handler failed",
+                   scm_list_3 (c->handler, key, args));
+  return SCM_BOOL_F;
+}
+
+/* Call a handler NAME of an engine ED with ARGS.  Return DEFAULT if the
+   handler is not set.  Errors are logged and make the call return #f, so a
+   failing handler never unwinds through libssh. */
+static SCM
+_call_handler (gssh_server_engine_t *ed, const char *name, SCM args,
+               SCM default_value)
+{
+  struct handler_call c;
+  c.handler = _handler_ref (ed, name);
+  if (scm_is_false (c.handler))
+    return default_value;
+  c.args = args;
+  return scm_internal_catch (SCM_BOOL_T,
+                             _handler_body,  &c,
+                             _handler_error, &c);
+}
+
+static inline SCM
+_session_ref (gssh_server_engine_t *ed, ssh_session session)
+{
+  return scm_hashv_ref (ed->sessions, _pointer_key (session), SCM_BOOL_F);
+}
+
+/* Convert a handler result to a reply for a channel request. */
+static inline int
+_request_result (SCM result)
+{
+  return scm_is_true (result) ? 0 : -1;
+}
+
+/* Convert a handler result to an authentication result. */
+static int
+_auth_result (SCM result)
+{
+  if (scm_is_symbol (result))
+    {
+      const gssh_symbol_t *sym = gssh_symbol_from_scm (auth_results, result);
+      return sym ? sym->value : SSH_AUTH_DENIED;
+    }
+  return scm_is_eq (result, SCM_BOOL_T) ? SSH_AUTH_SUCCESS : SSH_AUTH_DENIED;
+}
+
+
+/* libssh callbacks.
+
+   All the callbacks share one argument structure that is filled in by the
+   C callback and read in Guile mode by the corresponding '_do_*'
+   procedure. */
+
+struct engine_call {
+  gssh_server_engine_t *engine;
+  ssh_session session;
+  ssh_channel channel;
+  const char *str1;
+  const char *str2;
+  int ints[4];
+  ssh_key key;
+  char state;
+  void *data;
+  uint32_t len;
+  int result;
+};
+
+/* Set the authentication result of a call C to RESULT.  A session that is
+   authenticated is not subject to the login grace time anymore. */
+static void
+_set_auth_result (struct engine_call *c, int result)
+{
+  c->result = result;
+  if (result == SSH_AUTH_SUCCESS)
+    scm_hashv_remove_x (c->engine->logins, _pointer_key (c->session));
+}
+
+static void *
+_do_auth_none (void *data)
+{
+  struct engine_call *c = data;
+  SCM session = _session_ref (c->engine, c->session);
+  SCM result = _call_handler (c->engine, "auth-none",
+                              scm_list_2 (session,
+                                          scm_from_locale_string (c->str1)),
+                              SCM_BOOL_F);
+  _set_auth_result (c, _auth_result (result));
+  return NULL;
+}
+
+static int
+_auth_none (ssh_session session, const char *user, void *userdata)
+{
+  struct engine_call c = { userdata, session, NULL, user };
+  scm_with_guile (_do_auth_none, &c);
+  return c.result;
+}
+
+static void *
+_do_auth_password (void *data)
+{
+  struct engine_call *c = data;
+  SCM session = _session_ref (c->engine, c->session);
+  SCM result = _call_handler (c->engine, "auth-password",
+                              scm_list_3 (session,
+                                          scm_from_locale_string (c->str1),
+                                          scm_from_locale_string (c->str2)),
+                              SCM_BOOL_F);
+  _set_auth_result (c, _auth_result (result));
+  return NULL;
+}
+
+static int
+_auth_password (ssh_session session, const char *user, const char *password,
+                void *userdata)
+{
+  struct engine_call c = { userdata, session, NULL, user, password };
+  scm_with_guile (_do_auth_password, &c);
+  return c.result;
+}
+
+static void *
+_do_auth_public_key (void *data)
+{
+  struct engine_call *c = data;
+  SCM session = _session_ref (c->engine, c->session);
+  SCM result;
+  SCM key;
+  ssh_key copy = NULL;
+  char *b64 = NULL;
+
+  /* The key is owned by libssh and freed after the callback returns, so the
+     handler gets a copy of it. */
+  if (ssh_pki_export_pubkey_base64 (c->key, &b64) != SSH_OK)
+    {
+      c->result = SSH_AUTH_DENIED;
+      return NULL;
+    }
+  if (ssh_pki_import_pubkey_base64 (b64, ssh_key_type (c->key), &copy)
+      != SSH_OK)
+    {
+      free (b64);
+      c->result = SSH_AUTH_DENIED;
+      return NULL;
+    }
+  free (b64);
+
+  key = _scm_from_ssh_key (copy, SCM_BOOL_F);
+  result = _call_handler (c->engine, "auth-public-key",
+                          scm_list_4 (session,
+                                      scm_from_locale_string (c->str1),
+                                      key,
+                                      gssh_symbol_to_scm (pubkey_states,
+                                                          c->state)),
+                          SCM_BOOL_F);
+
+  /* libssh accepts the user if the callback returns success in any state
+     other than "none", so a request with a signature that failed to verify
+     is denied whatever the handler says. */
+  if ((c->state != SSH_PUBLICKEY_STATE_NONE)
+      && (c->state != SSH_PUBLICKEY_STATE_VALID))
+    c->result = SSH_AUTH_DENIED;
+  else
+    _set_auth_result (c, _auth_result (result));
+  return NULL;
+}
+
+static int
+_auth_public_key (ssh_session session, const char *user,
+                  struct ssh_key_struct *pubkey, char signature_state,
+                  void *userdata)
+{
+  struct engine_call c = { userdata, session, NULL, user };
+  c.key   = pubkey;
+  c.state = signature_state;
+  scm_with_guile (_do_auth_public_key, &c);
+  return c.result;
+}
+
+static int
+_service_request (ssh_session session, const char *service, void *userdata)
+{
+  return strcmp (service, "ssh-userauth") == 0 ? 0 : -1;
+}
+
+static void *
+_do_channel_open (void *data)
+{
+  struct engine_call *c = data;
+  gssh_server_engine_t *ed = c->engine;
+  SCM session = _session_ref (ed, c->session);
+  SCM channel;
+  SCM result;
+
+  result = _call_handler (ed, "channel-open", scm_list_1 (session),
+                          SCM_BOOL_T);
+  if (scm_is_false (result))
+    return NULL;
+
+  c->channel = ssh_channel_new (c->session);
+  if (! c->channel)
+    return NULL;
+
+  ssh_set_channel_callbacks (c->channel, &ed->channel_cb);
+  channel = ssh_channel_to_scm (c->channel, session, SCM_RDNG | SCM_WRTNG);
+  scm_hashv_set_x (ed->channels, _pointer_key (c->channel),
+                   scm_cons (session, channel));
+  return NULL;
+}
+
+static ssh_channel
+_channel_open (ssh_session session, void *userdata)
+{
+  struct engine_call c = { userdata, session, NULL };
+  scm_with_guile (_do_channel_open, &c);
+  return c.channel;
+}
+
+/* Call a channel handler NAME for the channel of C with EXTRA_ARGS appended
+   to the session and the channel.  Return the handler result, or
+   DEFAULT_VALUE if either the handler or the channel is unknown. */
+static SCM
+_call_channel_handler (struct engine_call *c, const char *name,
+                       SCM extra_args, SCM default_value)
+{
+  SCM entry = scm_hashv_ref (c->engine->channels,
+                             _pointer_key (c->channel), SCM_BOOL_F);
+  if (scm_is_false (entry))
+    return default_value;
+
+  return _call_handler (c->engine, name,
+                        scm_cons2 (scm_car (entry), scm_cdr (entry),
+                                   extra_args),
+                        default_value);
+}
+
+static void *
+_do_channel_exec (void *data)
+{
+  struct engine_call *c = data;
+  SCM result = _call_channel_handler (c, "exec",
+                                      scm_list_1 (scm_from_locale_string
+                                                  (c->str1)),
+                                      SCM_BOOL_F);
+  c->result = _request_result (result);
+  return NULL;
+}
+
+static int
+_channel_exec (ssh_session session, ssh_channel channel, const char *command,
+               void *userdata)
+{
+  struct engine_call c = { userdata, session, channel, command };
+  scm_with_guile (_do_channel_exec, &c);
+  return c.result;
+}
+
+static void *
+_do_channel_shell (void *data)
+{
+  struct engine_call *c = data;
+  SCM result = _call_channel_handler (c, "shell", SCM_EOL, SCM_BOOL_F);
+  c->result = _request_result (result);
+  return NULL;
+}
+
+static int
+_channel_shell (ssh_session session, ssh_channel channel, void *userdata)
+{
+  struct engine_call c = { userdata, session, channel };
+  scm_with_guile (_do_channel_shell, &c);
+  return c.result;
+}
+
+static void *
+_do_channel_pty (void *data)
+{
+  struct engine_call *c = data;
+  SCM result = _call_channel_handler (c, "pty",
+                                      scm_list_3 (scm_from_locale_string
+                                                  (c->str1),
+                                                  scm_from_int (c->ints[0]),
+                                                  scm_from_int (c->ints[1])),
+                                      SCM_BOOL_F);
+  c->result = _request_result (result);
+  return NULL;
+}
+
+static int
+_channel_pty (ssh_session session, ssh_channel channel, const char *term,
+              int width, int height, int pxwidth, int pxheight,
+              void *userdata)
+{
+  struct engine_call c = { userdata, session, channel, term };
+  c.ints[0] = width;
+  c.ints[1] = height;
+  c.ints[2] = pxwidth;
+  c.ints[3] = pxheight;
+  scm_with_guile (_do_channel_pty, &c);
+  return c.result;
+}
+
+static void *
+_do_channel_env (void *data)
+{
+  struct engine_call *c = data;
+  SCM result = _call_channel_handler (c, "env",
+                                      scm_list_2 (scm_from_locale_string
+                                                  (c->str1),
+                                                  scm_from_locale_string
+                                                  (c->str2)),
+                                      SCM_BOOL_F);
+  c->result = _request_result (result);
+  return NULL;
+}
+
+static int
+_channel_env (ssh_session session, ssh_channel channel, const char *name,
+              const char *value, void *userdata)
+{
+  struct engine_call c = { userdata, session, channel, name, value };
+  scm_with_guile (_do_channel_env, &c);
+  return c.result;
+}
+
+static void *
+_do_channel_data (void *data)
+{
+  struct engine_call *c = data;
+  SCM bv = scm_c_make_bytevector (c->len);
+  SCM result;
+
+  memcpy (SCM_BYTEVECTOR_CONTENTS (bv), c->data, c->len);
+  result = _call_channel_handler (c, "data",
+                                  scm_list_2 (bv, scm_from_bool (c->ints[0])),
+                                  SCM_BOOL_F);
+
+  /* A handler may return the number of bytes it has consumed; the rest of
+     the data is kept by libssh and passed to the handler again later. */
+  if (scm_is_integer (result))
+    {
+      long consumed = scm_to_long (result);
+      c->result = (consumed < 0) ? 0
+        : (consumed > (long) c->len) ? (int) c->len : (int) consumed;
+    }
+  else
+    {
+      c->result = (int) c->len;
+    }
+  return NULL;
+}
+
+static int
+_channel_data (ssh_session session, ssh_channel channel, void *data,
+               uint32_t len, int is_stderr, void *userdata)
+{
+  struct engine_call c = { userdata, session, channel };
+  c.data    = data;
+  c.len     = len;
+  c.ints[0] = is_stderr;
+  scm_with_guile (_do_channel_data, &c);
+  return c.result;
+}
+
+static void *
+_do_channel_eof (void *data)
+{
+  struct engine_call *c = data;
+  _call_channel_handler (c, "eof", SCM_EOL, SCM_BOOL_F);
+  return NULL;
+}
+
+static void
+_channel_eof (ssh_session session, ssh_channel channel, void *userdata)
+{
+  struct engine_call c = { userdata, session, channel };
+  scm_with_guile (_do_channel_eof, &c);
+}
+
+static void *
+_do_channel_close (void *data)
+{
+  struct engine_call *c = data;
+  _call_channel_handler (c, "close", SCM_EOL, SCM_BOOL_F);
+  scm_hashv_remove_x (c->engine->channels, _pointer_key (c->channel));
+  return NULL;
+}
+
+static void
+_channel_close (ssh_session session, ssh_channel channel, void *userdata)
+{
+  struct engine_call c = { userdata, session, channel };
+  scm_with_guile (_do_channel_close, &c);
+}
+
+/* Set up the libssh callback structures of an engine ED according to its
+   handlers.  Requests that have no handler are denied; the data and EOF
+   callbacks are installed only when there are handlers for them, otherwise
+   the data is buffered by libssh and can be read from the channel port. */
+void
+gssh_server_engine_setup_callbacks (gssh_server_engine_t *ed)
+{
+  struct ssh_server_callbacks_struct  *scb = &ed->server_cb;
+  struct ssh_channel_callbacks_struct *ccb = &ed->channel_cb;
+
+  memset (scb, 0, sizeof (*scb));
+  memset (ccb, 0, sizeof (*ccb));
+  ssh_callbacks_init (scb);
+  ssh_callbacks_init (ccb);
+
+  ed->auth_methods = 0;
+  scb->userdata = ed;
+  if (scm_is_true (_handler_ref (ed, "auth-none")))
+    {
+      scb->auth_none_function = _auth_none;
+      ed->auth_methods |= SSH_AUTH_METHOD_NONE;
+    }
+  if (scm_is_true (_handler_ref (ed, "auth-password")))
+    {
+      scb->auth_password_function = _auth_password;
+      ed->auth_methods |= SSH_AUTH_METHOD_PASSWORD;
+    }
+  if (scm_is_true (_handler_ref (ed, "auth-public-key")))
+    {
+      scb->auth_pubkey_function = _auth_public_key;
+      ed->auth_methods |= SSH_AUTH_METHOD_PUBLICKEY;
+    }
+  scb->service_request_function = _service_request;
+  scb->channel_open_request_session_function = _channel_open;
+
+  ccb->userdata = ed;
+  ccb->channel_exec_request_function  = _channel_exec;
+  ccb->channel_shell_request_function = _channel_shell;
+  ccb->channel_pty_request_function   = _channel_pty;
+  ccb->channel_env_request_function   = _channel_env;
+  ccb->channel_close_function         = _channel_close;
+  if (scm_is_true (_handler_ref (ed, "data")))
+    ccb->channel_data_function = _channel_data;
+  if (scm_is_true (_handler_ref (ed, "eof")))
+    ccb->channel_eof_function = _channel_eof;
+}
+
+
+/* Session management. */
+
+static void
+_remove_session (gssh_server_engine_t *ed, SCM key, SCM session)
+{
+  gssh_session_t *sd = gssh_session_from_scm (session);
+
+  ssh_event_remove_session (ed->event, sd->ssh_session);
+  scm_hashv_remove_x (ed->sessions, key);
+  scm_hashv_remove_x (ed->logins, key);
+  if (--ed->session_count == 0)
+    scm_gc_unprotect_object (ed->smob);
+}
+
+SCM_GSSH_DEFINE (gssh_server_engine_add_session_x,
+                 "%gssh-server-engine-add-session!", 2,
+                 (SCM engine, SCM session))
+#define FUNC_NAME s_gssh_server_engine_add_session_x
+{
+  gssh_server_engine_t *ed = gssh_server_engine_from_scm (engine);
+  gssh_session_t *sd = gssh_session_from_scm (session);
+  SCM key = _pointer_key (sd->ssh_session);
+  int res;
+
+  GSSH_VALIDATE_CONNECTED_SESSION (sd, session, SCM_ARG2);
+
+  if (scm_is_true (scm_hashv_ref (ed->sessions, key, SCM_BOOL_F)))
+    {
+      guile_ssh_error1 (FUNC_NAME, "Session is already added to the engine",
+                        scm_list_2 (engine, session));
+    }
+
+  /* The callbacks must be set before the key exchange.  The key exchange is
+     only started here; it is completed by the event loop along with the
+     rest of the session. */
+  ssh_set_server_callbacks (sd->ssh_session, &ed->server_cb);
+  ssh_set_auth_methods (sd->ssh_session, ed->auth_methods);
+  ssh_set_blocking (sd->ssh_session, 0);
+
+  res = ssh_handle_key_exchange (sd->ssh_session);
+  if (res == SSH_ERROR)
+    guile_ssh_session_error1 (FUNC_NAME, sd->ssh_session, session);
+
+  if (ssh_event_add_session (ed->event, sd->ssh_session) != SSH_OK)
+    {
+      guile_ssh_error1 (FUNC_NAME, "Could not add the session to the engine",
+                        scm_list_2 (engine, session));
+    }
+
+  scm_hashv_set_x (ed->sessions, key, session);
+  scm_hashv_set_x (ed->logins, key, scm_get_internal_real_time ());
+  if (ed->session_count++ == 0)
+    scm_gc_protect_object (ed->smob);
+
+  return SCM_UNSPECIFIED;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_server_engine_remove_session_x,
+                 "%gssh-server-engine-remove-session!", 2,
+                 (SCM engine, SCM session))
+#define FUNC_NAME s_gssh_server_engine_remove_session_x
+{
+  gssh_server_engine_t *ed = gssh_server_engine_from_scm (engine);
+  gssh_session_t *sd = gssh_session_from_scm (session);
+  SCM key = _pointer_key (sd->ssh_session);
+
+  if (scm_is_false (scm_hashv_ref (ed->sessions, key, SCM_BOOL_F)))
+    return SCM_BOOL_F;
+
+  _remove_session (ed, key, session);
+  return SCM_BOOL_T;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_server_engine_session_count,
+                 "%gssh-server-engine-session-count", 1,
+                 (SCM engine))
+{
+  gssh_server_engine_t *ed = gssh_server_engine_from_scm (engine);
+  return scm_from_size_t (ed->session_count);
+}
+
+static SCM
+_collect_sessions (void *data, SCM key, SCM session, SCM result)
+{
+  return scm_cons (session, result);
+}
+
+SCM_GSSH_DEFINE (gssh_server_engine_sessions,
+                 "%gssh-server-engine-sessions", 1,
+                 (SCM engine))
+{
+  gssh_server_engine_t *ed = gssh_server_engine_from_scm (engine);
+  return scm_internal_hash_fold (_collect_sessions, NULL, SCM_EOL,
+                                 ed->sessions);
+}
+
+static SCM
+_collect_logins (void *data, SCM key, SCM start, SCM result)
+{
+  gssh_server_engine_t *ed = data;
+  return scm_acons (scm_hashv_ref (ed->sessions, key, SCM_BOOL_F), start,
+                    result);
+}
+
+SCM_GSSH_DEFINE (gssh_server_engine_logins,
+                 "%gssh-server-engine-logins", 1,
+                 (SCM engine))
+{
+  gssh_server_engine_t *ed = gssh_server_engine_from_scm (engine);
+  return scm_internal_hash_fold (_collect_logins, ed, SCM_EOL, ed->logins);
+}
+
+
+/* Event loop. */
+
+struct poll_args {
+  ssh_event event;
+  int timeout;
+  int result;
+};
+
+static void *
+_event_dopoll (void *data)
+{
+  struct poll_args *args = data;
+  args->result = ssh_event_dopoll (args->event, args->timeout);
+  return NULL;
+}
+
+static SCM
+_collect_closed_sessions (void *data, SCM key, SCM session, SCM result)
+{
+  gssh_session_t *sd = gssh_session_from_scm (session);
+  if (ssh_get_status (sd->ssh_session) & (SSH_CLOSED | SSH_CLOSED_ERROR))
+    return scm_cons (scm_cons (key, session), result);
+  return result;
+}
+
+static SCM
+_collect_orphan_channels (void *data, SCM key, SCM entry, SCM result)
+{
+  SCM closed = *(SCM *) data;
+  if (scm_is_true (scm_memq (scm_car (entry), closed)))
+    return scm_cons (key, result);
+  return result;
+}
+
+SCM_GSSH_DEFINE (gssh_server_engine_poll, "%gssh-server-engine-poll", 2,
+                 (SCM engine, SCM timeout))
+#define FUNC_NAME s_gssh_server_engine_poll
+{
+  gssh_server_engine_t *ed = gssh_server_engine_from_scm (engine);
+  struct poll_args args;
+  SCM closed;
+  SCM sessions = SCM_EOL;
+  SCM channels;
+
+  SCM_ASSERT (scm_is_integer (timeout), timeout, SCM_ARG2, FUNC_NAME);
+
+  args.event   = ed->event;
+  args.timeout = scm_to_int (timeout);
+  args.result  = SSH_OK;
+
+  /* Leave Guile mode while waiting so other threads and the GC can run;
+     the callbacks re-enter Guile mode on their own. */
+  scm_without_guile (_event_dopoll, &args);
+
+  /* Drop the sessions that were closed by either side, along with their
+     channels. */
+  closed = scm_internal_hash_fold (_collect_closed_sessions, NULL, SCM_EOL,
+                                   ed->sessions);
+  for (; ! scm_is_null (closed); closed = scm_cdr (closed))
+    {
+      SCM entry = scm_car (closed);
+      _remove_session (ed, scm_car (entry), scm_cdr (entry));
+      sessions = scm_cons (scm_cdr (entry), sessions);
+    }
+
+  channels = scm_internal_hash_fold (_collect_orphan_channels, &sessions,
+                                     SCM_EOL, ed->channels);
+  for (; ! scm_is_null (channels); channels = scm_cdr (channels))
+    scm_hashv_remove_x (ed->channels, scm_car (channels));
+
+  return scm_from_size_t (ed->session_count);
+}
+#undef FUNC_NAME
+
+
+void
+init_server_engine_func (void)
+{
+#include "server-engine-func.x"
+}
+
+/* server-engine-func.c ends here. */
@@ -0,0 +1,42 @@
+/* Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SERVER_ENGINE_FUNC_H__
+#define __SERVER_ENGINE_FUNC_H__
+
+#include <libguile.h>
+#include <libssh/libssh.h>
+#include <libssh/callbacks.h>
+
+#include "server-engine-type.h"
+
+extern SCM gssh_server_engine_add_session_x (SCM engine, SCM session);
+extern SCM gssh_server_engine_remove_session_x (SCM engine, SCM session);
+extern SCM gssh_server_engine_sessions (SCM engine);
+extern SCM gssh_server_engine_poll (SCM engine, SCM timeout);
+extern SCM gssh_server_engine_session_count (SCM engine);
+extern SCM gssh_server_engine_logins (SCM engine);
+
+extern void init_server_engine_func (void);
+
+
+/* Internal procedures */
+
+extern void gssh_server_engine_setup_callbacks (gssh_server_engine_t *ed);
+
+#endif /* ifndef __SERVER_ENGINE_FUNC_H__ */
@@ -0,0 +1,142 @@
+/* server-engine-type.c -- Event-driven server engine smob.
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <libguile.h>
+#include <libssh/libssh.h>
+#include <libssh/callbacks.h>
+
+#include "common.h"
+#include "error.h"
+#include "server-engine-type.h"
+#include "server-engine-func.h"
+
+scm_t_bits server_engine_tag;   /* Smob tag. */
+
+
+/* GC callbacks. */
+
+static SCM
+_mark (SCM engine)
+{
+  gssh_server_engine_t *ed = gssh_server_engine_from_scm (engine);
+  scm_gc_mark (ed->handlers);
+  scm_gc_mark (ed->sessions);
+  scm_gc_mark (ed->logins);
+  return ed->channels;
+}
+
+static size_t
+_free (SCM engine)
+{
+  gssh_server_engine_t *ed
+    = (gssh_server_engine_t *) SCM_SMOB_DATA (engine);
+
+  /* The engine is protected from the GC while it has sessions (see
+     'session_count'), so the event is not used by any session here. */
+  ssh_event_free (ed->event);
+  return 0;
+}
+
+static SCM
+_equalp (SCM x1, SCM x2)
+{
+  gssh_server_engine_t *ed1 = gssh_server_engine_from_scm (x1);
+  gssh_server_engine_t *ed2 = gssh_server_engine_from_scm (x2);
+
+  if ((! ed1) || (! ed2))
+    return SCM_BOOL_F;
+  else if (ed1 != ed2)
+    return SCM_BOOL_F;
+  else
+    return SCM_BOOL_T;
+}
+
+/* Printing procedure. */
+static int
+_print (SCM engine, SCM port, scm_print_state *pstate)
+{
+  gssh_server_engine_t *ed = gssh_server_engine_from_scm (engine);
+  scm_puts ("#<server-engine ", port);
+  scm_display (scm_from_size_t (ed->session_count), port);
+  scm_puts (" sessions ", port);
+  scm_display (_scm_object_hex_address (engine), port);
+  scm_puts (">", port);
+  return 1;
+}
+
+
+SCM_GSSH_DEFINE (gssh_server_engine_p, "%gssh-server-engine?", 1, (SCM x))
+{
+  return scm_from_bool (SCM_SMOB_PREDICATE (server_engine_tag, x));
+}
+
+
+SCM_GSSH_DEFINE (gssh_make_server_engine, "%gssh-make-server-engine", 1,
+                 (SCM handlers))
+#define FUNC_NAME s_gssh_make_server_engine
+{
+  SCM smob;
+  gssh_server_engine_t *ed;
+  ssh_event event;
+
+  SCM_ASSERT (scm_to_bool (scm_list_p (handlers)), handlers, SCM_ARG1,
+              FUNC_NAME);
+
+  event = ssh_event_new ();
+  if (! event)
+    guile_ssh_error1 (FUNC_NAME, "Could not create an event", SCM_BOOL_F);
+
+  ed = (gssh_server_engine_t *) scm_gc_malloc (sizeof (gssh_server_engine_t),
+                                               "server engine");
+  ed->event         = event;
+  ed->handlers      = handlers;
+  ed->sessions      = scm_c_make_hash_table (31);
+  ed->channels      = scm_c_make_hash_table (31);
+  ed->logins        = scm_c_make_hash_table (31);
+  ed->session_count = 0;
+  gssh_server_engine_setup_callbacks (ed);
+
+  SCM_NEWSMOB (smob, server_engine_tag, ed);
+  ed->smob = smob;
+  return smob;
+}
+#undef FUNC_NAME
+
+
+gssh_server_engine_t *
+gssh_server_engine_from_scm (SCM x)
+{
+  scm_assert_smob_type (server_engine_tag, x);
+  return (gssh_server_engine_t *) SCM_SMOB_DATA (x);
+}
+
+void
+init_server_engine_type (void)
+{
+  server_engine_tag = scm_make_smob_type ("server engine",
+                                          sizeof (gssh_server_engine_t));
+  set_smob_callbacks (server_engine_tag, _mark, _free, _equalp, _print);
+
+#include "server-engine-type.x"
+}
+
+/* server-engine-type.c ends here. */
@@ -0,0 +1,83 @@
+/* Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SERVER_ENGINE_TYPE_H__
+#define __SERVER_ENGINE_TYPE_H__
+
+#include <libguile.h>
+#include <libssh/libssh.h>
+#include <libssh/callbacks.h>
+
+
+extern scm_t_bits server_engine_tag;
+
+
+/* Smob data. */
+struct gssh_server_engine {
+  /* libssh event loop that multiplexes all the sessions of the engine. */
+  ssh_event event;
+
+  /* An alist of Scheme handlers. */
+  SCM handlers;
+
+  /* A hash table that maps 'ssh_session' addresses to session smobs.  The
+     table keeps the sessions from being freed by the GC while they are
+     handled by the engine. */
+  SCM sessions;
+
+  /* A hash table that maps 'ssh_channel' addresses to pairs of the form
+     (SESSION . CHANNEL). */
+  SCM channels;
+
+  /* A hash table that maps the 'ssh_session' addresses of the sessions
+     that are not authenticated yet to the internal real time when they
+     were added to the engine. */
+  SCM logins;
+
+  /* Number of sessions that are attached to the event.  While there are
+     attached sessions the engine smob is protected from the GC, so the
+     event is never freed before the sessions that use it. */
+  size_t session_count;
+  SCM smob;
+
+  /* Authentication methods that are announced to clients. */
+  int auth_methods;
+
+  /* Callbacks that are shared by all the sessions and channels of the
+     engine.  The 'userdata' of both structures points back to the
+     engine. */
+  struct ssh_server_callbacks_struct  server_cb;
+  struct ssh_channel_callbacks_struct channel_cb;
+};
+
+typedef struct gssh_server_engine gssh_server_engine_t;
+
+
+extern SCM gssh_make_server_engine (SCM handlers);
+extern SCM gssh_server_engine_p (SCM x);
+
+extern void init_server_engine_type (void);
+
+
+/* Internal procedures */
+
+extern gssh_server_engine_t *gssh_server_engine_from_scm (SCM x);
+
+#endif  /* ifndef __SERVER_ENGINE_TYPE_H__ */
+
+/* server-engine-type.h ends here. */
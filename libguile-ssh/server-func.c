@@ -20,6 +20,15 @@
 
 #include <config.h>
 
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
 #include <libguile.h>
 #include <libssh/libssh.h>
 #include <libssh/server.h>
@@ -28,14 +37,20 @@
 #include "session-type.h"
 #include "server-type.h"
 #include "message-type.h"
+#include "channel-type.h"
+#include "key-type.h"
 #include "error.h"
 #include "log.h"
+#include "deadline.h"
 
 /* Guile SSH specific options that are aimed to unificate the way of
    server configuration. */
 enum gssh_server_options {
   /* Should not intersect with options from SSH server API. */
-  GSSH_BIND_OPTIONS_BLOCKING_MODE = 100
+  GSSH_BIND_OPTIONS_BLOCKING_MODE = 100,
+  GSSH_BIND_OPTIONS_FD,
+  GSSH_BIND_OPTIONS_REUSEPORT,
+  GSSH_BIND_OPTIONS_BACKLOG
 };
 
 
@@ -49,6 +64,9 @@ gssh_symbol_t server_options[] = {
   { "banner",             SSH_BIND_OPTIONS_BANNER         },
   { "log-verbosity",      SSH_BIND_OPTIONS_LOG_VERBOSITY  },
   { "blocking-mode",      GSSH_BIND_OPTIONS_BLOCKING_MODE },
+  { "fd",                 GSSH_BIND_OPTIONS_FD            },
+  { "reuseport",          GSSH_BIND_OPTIONS_REUSEPORT     },
+  { "backlog",            GSSH_BIND_OPTIONS_BACKLOG       },
   { NULL,                 -1                              }
 };
 
@@ -105,6 +123,55 @@ set_blocking_mode (ssh_bind bind, SCM value)
   return SSH_OK;
 }
 
+/* Make a SSH bind BIND use a socket FD that is bound by the caller (e.g. a
+   supervisor process) instead of making its own socket.
+
+   Always return SSH_OK. */
+static inline int
+set_fd (ssh_bind bind, SCM value)
+{
+  SCM_ASSERT (scm_is_unsigned_integer (value, 0, INT_MAX), value, SCM_ARG3,
+              "server-set!");
+  ssh_bind_set_fd (bind, scm_to_int (value));
+  return SSH_OK;
+}
+
+/* Set a private key object VALUE as a host key of a SSH bind BIND.  The key
+   is parsed once by the caller and can be shared by many servers, so the
+   host key files are not read on each 'server-listen'.  The bind takes
+   ownership of the key it is given, thus a copy of the key is passed. */
+static inline int
+set_key_opt (ssh_bind bind, SCM value)
+{
+#if HAVE_LIBSSH_0_8
+  gssh_key_t *kd = gssh_key_from_scm (value);
+  ssh_key copy = NULL;
+  char *b64 = NULL;
+  int res;
+
+  SCM_ASSERT (_private_key_p (kd), value, SCM_ARG3, "server-set!");
+
+  res = ssh_pki_export_privkey_base64 (kd->ssh_key, NULL, NULL, NULL, &b64);
+  if (res != SSH_OK)
+    return res;
+
+  res = ssh_pki_import_privkey_base64 (b64, NULL, NULL, NULL, &copy);
+  ssh_string_free_char (b64);
+  if (res != SSH_OK)
+    return res;
+
+  res = ssh_bind_options_set (bind, SSH_BIND_OPTIONS_IMPORT_KEY, copy);
+  if (res != SSH_OK)
+    ssh_key_free (copy);
+
+  return res;
+#else
+  guile_ssh_error1 ("server-set!",
+                    "Host key objects require libssh 0.8 or later", value);
+  return SSH_ERROR;
+#endif
+}
+
 /* Convert Scheme symbol to libssh constant and set the corresponding
    option to the value of the constant. */
 static inline int
@@ -121,8 +188,12 @@ set_option (ssh_bind bind, int type, SCM value)
 {
   switch (type)
     {
-    case SSH_BIND_OPTIONS_BINDADDR:
     case SSH_BIND_OPTIONS_HOSTKEY:
+      if (SCM_SMOB_PREDICATE (key_tag, value))
+        return set_key_opt (bind, value);
+      return set_string_opt (bind, type, value);
+
+    case SSH_BIND_OPTIONS_BINDADDR:
     case SSH_BIND_OPTIONS_DSAKEY:
     case SSH_BIND_OPTIONS_RSAKEY:
     case SSH_BIND_OPTIONS_BANNER:
@@ -137,6 +208,19 @@ set_option (ssh_bind bind, int type, SCM value)
     case GSSH_BIND_OPTIONS_BLOCKING_MODE:
       return set_blocking_mode (bind, value);
 
+    case GSSH_BIND_OPTIONS_FD:
+      return set_fd (bind, value);
+
+    /* These options are used by 'server-listen'. */
+    case GSSH_BIND_OPTIONS_REUSEPORT:
+      SCM_ASSERT (scm_is_bool (value), value, SCM_ARG3, "server-set!");
+      return SSH_OK;
+
+    case GSSH_BIND_OPTIONS_BACKLOG:
+      SCM_ASSERT (scm_is_unsigned_integer (value, 1, INT_MAX), value,
+                  SCM_ARG3, "server-set!");
+      return SSH_OK;
+
     default:
       guile_ssh_error1 ("server-set!",
                         "Operation is not supported yet: %a~%",
@@ -204,6 +288,86 @@ not set.  Throw `guile-ssh-error' on error.\
 #undef FUNC_NAME
 
 
+static inline SCM
+_option_ref (gssh_server_t *sd, const char *name)
+{
+  return scm_assq_ref (sd->options, scm_from_latin1_symbol (name));
+}
+
+/* Make a listening socket for a server SERVER according to its options.
+   libssh binds its own socket without SO_REUSEPORT and with a fixed listen
+   backlog, so the socket is made here and passed to libssh instead.
+   Return the socket descriptor.  Throw 'guile-ssh-error' on an error. */
+static int
+_make_listening_socket (SCM server, int reuseport, int backlog)
+{
+  gssh_server_t *sd = gssh_server_from_scm (server);
+  SCM bindaddr = _option_ref (sd, "bindaddr");
+  SCM bindport = _option_ref (sd, "bindport");
+  struct addrinfo hints;
+  struct addrinfo *ai = NULL;
+  char *c_addr = NULL;
+  char c_port[16];
+  const char *error = NULL;
+  int on = 1;
+  int fd = -1;
+  int res;
+
+  snprintf (c_port, sizeof (c_port), "%u",
+            scm_is_true (bindport) ? scm_to_uint32 (bindport) : 22);
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_flags    = AI_PASSIVE;
+  hints.ai_socktype = SOCK_STREAM;
+
+  scm_dynwind_begin (0);
+  if (scm_is_true (bindaddr))
+    {
+      c_addr = scm_to_locale_string (bindaddr);
+      scm_dynwind_free (c_addr);
+    }
+
+  res = getaddrinfo (c_addr, c_port, &hints, &ai);
+  if (res != 0)
+    {
+      guile_ssh_error1 ("server-listen", gai_strerror (res),
+                        scm_list_2 (bindaddr, bindport));
+    }
+
+  fd = socket (ai->ai_family, SOCK_STREAM, 0);
+  if (fd < 0)
+    error = strerror (errno);
+  else if (setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on)) < 0)
+    error = strerror (errno);
+  else if (reuseport)
+    {
+#ifdef SO_REUSEPORT
+      if (setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on)) < 0)
+        error = strerror (errno);
+#else
+      error = "SO_REUSEPORT is not supported";
+#endif
+    }
+
+  if ((! error) && (bind (fd, ai->ai_addr, ai->ai_addrlen) < 0))
+    error = strerror (errno);
+  if ((! error) && (listen (fd, backlog) < 0))
+    error = strerror (errno);
+
+  freeaddrinfo (ai);
+
+  if (error)
+    {
+      if (fd >= 0)
+        close (fd);
+      guile_ssh_error1 ("server-listen", error, server);
+    }
+
+  scm_dynwind_end ();
+
+  return fd;
+}
+
 SCM_DEFINE (guile_ssh_server_listen, "server-listen", 1, 0, 0,
             (SCM server),
             "\
@@ -213,7 +377,27 @@ Return value is undefined.\
 #define FUNC_NAME s_guile_ssh_server_listen
 {
   gssh_server_t *server_data = gssh_server_from_scm (server);
-  int res = ssh_bind_listen (server_data->bind);
+  SCM fd        = _option_ref (server_data, "fd");
+  SCM reuseport = _option_ref (server_data, "reuseport");
+  SCM backlog   = _option_ref (server_data, "backlog");
+  int c_backlog = scm_is_true (backlog) ? scm_to_int (backlog) : SOMAXCONN;
+  int res;
+
+  if (scm_is_true (fd))
+    {
+      /* The socket is bound by the caller; it may be listening already, in
+         which case 'listen' only changes the backlog. */
+      if (scm_is_true (backlog) && (listen (scm_to_int (fd), c_backlog) < 0))
+        guile_ssh_error1 (FUNC_NAME, strerror (errno), server);
+    }
+  else if (scm_is_true (reuseport) || scm_is_true (backlog))
+    {
+      ssh_bind_set_fd (server_data->bind,
+                       _make_listening_socket (server, scm_is_true (reuseport),
+                                               c_backlog));
+    }
+
+  res = ssh_bind_listen (server_data->bind);
 
   _gssh_log_debug_format(FUNC_NAME, server, "result: %d", res);
 
@@ -224,6 +408,31 @@ Return value is undefined.\
 #undef FUNC_NAME
 
 
+/* Arguments of the blocking server calls that are made outside of Guile
+   mode, so the threads that wait for clients or do key exchanges do not
+   block the garbage collector. */
+struct server_call_args {
+  ssh_bind    bind;
+  ssh_session session;
+  int         result;
+};
+
+static void *
+_bind_accept (void *data)
+{
+  struct server_call_args *args = (struct server_call_args *) data;
+  args->result = ssh_bind_accept (args->bind, args->session);
+  return NULL;
+}
+
+static void *
+_handle_key_exchange (void *data)
+{
+  struct server_call_args *args = (struct server_call_args *) data;
+  args->result = ssh_handle_key_exchange (args->session);
+  return NULL;
+}
+
 SCM_DEFINE (guile_ssh_server_accept, "server-accept", 1, 0, 0,
             (SCM server),
             "\
@@ -235,7 +444,14 @@ Throw `guile-ssh-error' on error.  Return a new SSH session.\
   gssh_server_t *server_data   = gssh_server_from_scm (server);
   SCM session = guile_ssh_make_session ();
   gssh_session_t *session_data = gssh_session_from_scm (session);
-  int res = ssh_bind_accept (server_data->bind, session_data->ssh_session);
+  struct server_call_args args;
+  int res;
+
+  args.bind    = server_data->bind;
+  args.session = session_data->ssh_session;
+  scm_without_guile (_bind_accept, &args);
+  res = args.result;
+  scm_remember_upto_here_2 (server, session);
 
   _gssh_log_debug_format(FUNC_NAME, server, "result: %d", res);
 
@@ -257,7 +473,21 @@ Return value is undefined.\
 #define FUNC_NAME s_guile_ssh_server_handle_key_exchange
 {
   gssh_session_t *session_data = gssh_session_from_scm (session);
-  int res = ssh_handle_key_exchange (session_data->ssh_session);
+  struct server_call_args args;
+  int res;
+
+  args.bind    = NULL;
+  args.session = session_data->ssh_session;
+
+  /* Session callbacks call Scheme procedures, so they must be called in
+     Guile mode. */
+  if (scm_is_true (session_data->callbacks))
+    _handle_key_exchange (&args);
+  else
+    scm_without_guile (_handle_key_exchange, &args);
+
+  res = args.result;
+  scm_remember_upto_here_1 (session);
 
   _gssh_log_debug_format(FUNC_NAME, session, "result: %d", res);
 
@@ -269,20 +499,48 @@ Return value is undefined.\
 #undef FUNC_NAME
 
 
+struct message_get_args {
+  ssh_session session;
+  ssh_message message;
+};
+
+/* Get a message from a session.  Return SSH_AGAIN if there is no message
+   yet and the session is alive (see 'gssh_call_with_deadline'.) */
+static int
+_message_get (void *data)
+{
+  struct message_get_args *args = (struct message_get_args *) data;
+
+  args->message = ssh_message_get (args->session);
+  if (args->message)
+    return SSH_OK;
+
+  return (ssh_get_status (args->session) & (SSH_CLOSED | SSH_CLOSED_ERROR))
+    ? SSH_ERROR
+    : SSH_AGAIN;
+}
+
 SCM_DEFINE (guile_ssh_server_message_get,
             "server-message-get", 1, 0, 0,
             (SCM session),
             "\
 Get a message.\
 ")
+#define FUNC_NAME s_guile_ssh_server_message_get
 {
   SCM smob;
   gssh_session_t *session_data = gssh_session_from_scm (session);
-  gssh_message_t* message_data
-    = (gssh_message_t *) scm_gc_malloc (sizeof (gssh_message_t),
-                                        "message");
+  struct message_get_args args;
+  gssh_message_t* message_data;
+
+  args.session = session_data->ssh_session;
+  args.message = NULL;
+  gssh_call_with_deadline (session_data->ssh_session, _message_get, &args,
+                           FUNC_NAME, session);
 
-  message_data->message = ssh_message_get (session_data->ssh_session);
+  message_data = (gssh_message_t *) scm_gc_malloc (sizeof (gssh_message_t),
+                                                   "message");
+  message_data->message = args.message;
   if (! message_data->message)
     {
       scm_gc_free (message_data, sizeof (gssh_message_t), "message");
@@ -294,6 +552,492 @@ Get a message.\
   SCM_NEWSMOB (smob, message_tag, message_data);
   return smob;
 }
+#undef FUNC_NAME
+
+
+
+/* Message dispatch.
+
+   The dispatcher routes messages to Scheme handlers that are registered once
+   per server.  Request fields are passed to handlers as arguments and the
+   reply is made according to the handler result, so no message smob and no
+   request vector are allocated for messages that have a handler. */
+
+enum dispatch_slot {
+  DISPATCH_SERVICE,
+  DISPATCH_AUTH_NONE,
+  DISPATCH_AUTH_PASSWORD,
+  DISPATCH_AUTH_PUBLICKEY,
+  DISPATCH_CHANNEL_SESSION,
+  DISPATCH_CHANNEL_DIRECT_TCPIP,
+  DISPATCH_CHANNEL_REQUEST_PTY,
+  DISPATCH_CHANNEL_REQUEST_EXEC,
+  DISPATCH_CHANNEL_REQUEST_SHELL,
+  DISPATCH_CHANNEL_REQUEST_ENV,
+  DISPATCH_CHANNEL_REQUEST_SUBSYSTEM,
+  DISPATCH_CHANNEL_REQUEST_WINDOW_CHANGE,
+  DISPATCH_GLOBAL_TCPIP_FORWARD,
+  DISPATCH_GLOBAL_CANCEL_TCPIP_FORWARD,
+  DISPATCH_DEFAULT,
+  DISPATCH_SLOT_COUNT
+};
+
+/* Message kinds mapping to Guile symbols.  The names are the same as the
+   message subtypes returned by 'message-get-type'. */
+static gssh_symbol_t dispatch_slots[] = {
+  { "request-service",                     DISPATCH_SERVICE                     },
+  { "auth-method-none",                    DISPATCH_AUTH_NONE                   },
+  { "auth-method-password",                DISPATCH_AUTH_PASSWORD               },
+  { "auth-method-publickey",               DISPATCH_AUTH_PUBLICKEY              },
+  { "channel-session",                     DISPATCH_CHANNEL_SESSION             },
+  { "channel-direct-tcpip",                DISPATCH_CHANNEL_DIRECT_TCPIP        },
+  { "channel-request-pty",                 DISPATCH_CHANNEL_REQUEST_PTY         },
+  { "channel-request-exec",                DISPATCH_CHANNEL_REQUEST_EXEC        },
+  { "channel-request-shell",               DISPATCH_CHANNEL_REQUEST_SHELL       },
+  { "channel-request-env",                 DISPATCH_CHANNEL_REQUEST_ENV         },
+  { "channel-request-subsystem",           DISPATCH_CHANNEL_REQUEST_SUBSYSTEM   },
+  { "channel-request-window-change",       DISPATCH_CHANNEL_REQUEST_WINDOW_CHANGE },
+  { "global-request-tcpip-forward",        DISPATCH_GLOBAL_TCPIP_FORWARD        },
+  { "global-request-cancel-tcpip-forward", DISPATCH_GLOBAL_CANCEL_TCPIP_FORWARD },
+  { "default",                             DISPATCH_DEFAULT                     },
+  { NULL,                                  -1                                   }
+};
+
+static gssh_symbol_t dispatch_pubkey_states[] = {
+  { "error", SSH_PUBLICKEY_STATE_ERROR },
+  { "none",  SSH_PUBLICKEY_STATE_NONE  },
+  { "valid", SSH_PUBLICKEY_STATE_VALID },
+  { "wrong", SSH_PUBLICKEY_STATE_WRONG },
+  { NULL,    -1                        }
+};
+
+/* Get a dispatch slot for a message MSG.  Return -1 if the message kind has
+   no slot. */
+static int
+_message_dispatch_slot (ssh_message msg)
+{
+  int subtype = ssh_message_subtype (msg);
+
+  switch (ssh_message_type (msg))
+    {
+    case SSH_REQUEST_SERVICE:
+      return DISPATCH_SERVICE;
+
+    case SSH_REQUEST_AUTH:
+      switch (subtype)
+        {
+        case SSH_AUTH_METHOD_NONE:      return DISPATCH_AUTH_NONE;
+        case SSH_AUTH_METHOD_PASSWORD:  return DISPATCH_AUTH_PASSWORD;
+        case SSH_AUTH_METHOD_PUBLICKEY: return DISPATCH_AUTH_PUBLICKEY;
+        }
+      break;
+
+    case SSH_REQUEST_CHANNEL_OPEN:
+      switch (subtype)
+        {
+        case SSH_CHANNEL_SESSION:      return DISPATCH_CHANNEL_SESSION;
+        case SSH_CHANNEL_DIRECT_TCPIP: return DISPATCH_CHANNEL_DIRECT_TCPIP;
+        }
+      break;
+
+    case SSH_REQUEST_CHANNEL:
+      switch (subtype)
+        {
+        case SSH_CHANNEL_REQUEST_PTY:
+          return DISPATCH_CHANNEL_REQUEST_PTY;
+        case SSH_CHANNEL_REQUEST_EXEC:
+          return DISPATCH_CHANNEL_REQUEST_EXEC;
+        case SSH_CHANNEL_REQUEST_SHELL:
+          return DISPATCH_CHANNEL_REQUEST_SHELL;
+        case SSH_CHANNEL_REQUEST_ENV:
+          return DISPATCH_CHANNEL_REQUEST_ENV;
+        case SSH_CHANNEL_REQUEST_SUBSYSTEM:
+          return DISPATCH_CHANNEL_REQUEST_SUBSYSTEM;
+        case SSH_CHANNEL_REQUEST_WINDOW_CHANGE:
+          return DISPATCH_CHANNEL_REQUEST_WINDOW_CHANGE;
+        }
+      break;
+
+    case SSH_REQUEST_GLOBAL:
+      switch (subtype)
+        {
+        case SSH_GLOBAL_REQUEST_TCPIP_FORWARD:
+          return DISPATCH_GLOBAL_TCPIP_FORWARD;
+        case SSH_GLOBAL_REQUEST_CANCEL_TCPIP_FORWARD:
+          return DISPATCH_GLOBAL_CANCEL_TCPIP_FORWARD;
+        }
+      break;
+    }
+
+  return -1;
+}
+
+/* Convert a string that may be NULL to a Scheme string or #f. */
+static inline SCM
+_string_or_false (const char *str)
+{
+  return str ? scm_from_locale_string (str) : SCM_BOOL_F;
+}
+
+SCM_DEFINE (guile_ssh_server_set_message_handlers_x,
+            "server-set-message-handlers!", 2, 0, 0,
+            (SCM server, SCM handlers),
+            "\
+Set message HANDLERS for a SERVER.  HANDLERS is an alist of the form\n\
+((KIND . PROCEDURE) ...) where KIND is a message kind such as\n\
+'auth-method-password' or 'channel-request-exec'.  Return value is\n\
+undefined.\
+")
+#define FUNC_NAME s_guile_ssh_server_set_message_handlers_x
+{
+  gssh_server_t *server_data = gssh_server_from_scm (server);
+  SCM table = scm_c_make_vector (DISPATCH_SLOT_COUNT, SCM_BOOL_F);
+  int auth_methods = 0;
+  SCM rest;
+
+  SCM_ASSERT (scm_to_bool (scm_list_p (handlers)), handlers, SCM_ARG2,
+              FUNC_NAME);
+
+  for (rest = handlers; ! scm_is_null (rest); rest = scm_cdr (rest))
+    {
+      SCM entry = scm_car (rest);
+      const gssh_symbol_t *slot;
+
+      SCM_ASSERT (scm_is_pair (entry), handlers, SCM_ARG2, FUNC_NAME);
+      slot = gssh_symbol_from_scm (dispatch_slots, scm_car (entry));
+      if (! slot)
+        guile_ssh_error1 (FUNC_NAME, "Unknown message kind", scm_car (entry));
+      SCM_ASSERT (scm_is_true (scm_procedure_p (scm_cdr (entry))),
+                  handlers, SCM_ARG2, FUNC_NAME);
+
+      SCM_SIMPLE_VECTOR_SET (table, slot->value, scm_cdr (entry));
+      if (slot->value == DISPATCH_AUTH_PASSWORD)
+        auth_methods |= SSH_AUTH_METHOD_PASSWORD;
+      else if (slot->value == DISPATCH_AUTH_PUBLICKEY)
+        auth_methods |= SSH_AUTH_METHOD_PUBLICKEY;
+    }
+
+  server_data->handlers     = table;
+  server_data->auth_methods = auth_methods;
+
+  return SCM_UNSPECIFIED;
+}
+#undef FUNC_NAME
+
+struct dispatch_state {
+  gssh_server_t *server;
+  ssh_message message;
+  int replied;
+};
+
+/* Deny a message with the default reply.  For authentication requests the
+   methods that have handlers are announced to the client. */
+static void
+_dispatch_deny (struct dispatch_state *state)
+{
+  if ((ssh_message_type (state->message) == SSH_REQUEST_AUTH)
+      && state->server->auth_methods)
+    {
+      ssh_message_auth_set_methods (state->message,
+                                    state->server->auth_methods);
+    }
+  ssh_message_reply_default (state->message);
+  state->replied = 1;
+}
+
+/* Reply to the message if a handler has not done it (e.g. because of a
+   non-local exit) and free the message. */
+static void
+_dispatch_cleanup (void *data)
+{
+  struct dispatch_state *state = data;
+  if (! state->replied)
+    _dispatch_deny (state);
+  ssh_message_free (state->message);
+}
+
+/* Reply to an authentication request according to a handler RESULT: one of
+   the symbols 'success', 'partial' and 'denied', or a boolean.  A public
+   key request is accepted only if its signature is verified, whatever the
+   RESULT is. */
+static void
+_dispatch_auth_reply (struct dispatch_state *state, SCM result)
+{
+  ssh_message msg = state->message;
+
+  if (ssh_message_subtype (msg) == SSH_AUTH_METHOD_PUBLICKEY)
+    {
+      switch (ssh_message_auth_publickey_state (msg))
+        {
+        case SSH_PUBLICKEY_STATE_NONE:
+          /* The client asks whether the key is acceptable. */
+          if (scm_is_true (result)
+              && ! scm_is_eq (result, scm_from_latin1_symbol ("denied")))
+            {
+              ssh_message_auth_reply_pk_ok_simple (msg);
+              state->replied = 1;
+            }
+          return;
+
+        case SSH_PUBLICKEY_STATE_VALID:
+          break;
+
+        default:
+          /* The signature is wrong or could not be checked; the request is
+             denied by the cleanup. */
+          return;
+        }
+    }
+
+  if (scm_is_eq (result, SCM_BOOL_T)
+      || scm_is_eq (result, scm_from_latin1_symbol ("success")))
+    {
+      ssh_message_auth_reply_success (msg, 0);
+      state->replied = 1;
+    }
+  else if (scm_is_eq (result, scm_from_latin1_symbol ("partial")))
+    {
+      ssh_message_auth_reply_success (msg, 1);
+      state->replied = 1;
+    }
+}
+
+/* Copy a public key of an authentication request MSG.  The key is owned by
+   the message, which is freed after the dispatch.  Return #f on error. */
+static SCM
+_dispatch_copy_pubkey (ssh_message msg)
+{
+  ssh_key key = ssh_message_auth_pubkey (msg);
+  ssh_key copy = NULL;
+  char *b64 = NULL;
+  int res;
+
+  if ((! key) || (ssh_pki_export_pubkey_base64 (key, &b64) != SSH_OK))
+    return SCM_BOOL_F;
+
+  res = ssh_pki_import_pubkey_base64 (b64, ssh_key_type (key), &copy);
+  free (b64);
+  return (res == SSH_OK) ? _scm_from_ssh_key (copy, SCM_BOOL_F) : SCM_BOOL_F;
+}
+
+/* Accept a channel-open request and register the new channel.  Return the
+   channel or #f on error. */
+static SCM
+_dispatch_accept_channel (struct dispatch_state *state, SCM session)
+{
+  ssh_channel ch
+    = ssh_message_channel_request_open_reply_accept (state->message);
+  SCM channel;
+
+  state->replied = 1;
+  if (! ch)
+    return SCM_BOOL_F;
+
+  channel = ssh_channel_to_scm (ch, session, SCM_RDNG | SCM_WRTNG);
+  gssh_channel_register (channel);
+  return channel;
+}
+
+/* Call a HANDLER for a message from STATE that has a dispatch SLOT, then
+   reply to the message according to the handler result.  Return the handler
+   result, or the new channel for an accepted channel-open request. */
+static SCM
+_dispatch (struct dispatch_state *state, SCM session, int slot, SCM handler)
+{
+  ssh_message msg = state->message;
+  SCM channel = SCM_BOOL_F;
+  SCM result;
+
+  if ((slot >= DISPATCH_CHANNEL_REQUEST_PTY)
+      && (slot <= DISPATCH_CHANNEL_REQUEST_WINDOW_CHANGE))
+    {
+      channel = gssh_channel_lookup (session,
+                                     ssh_message_channel_request_channel (msg));
+    }
+
+  switch (slot)
+    {
+    case DISPATCH_SERVICE:
+      result = scm_call_2 (handler, session,
+                           _string_or_false (ssh_message_service_service (msg)));
+      if (scm_is_true (result))
+        {
+          ssh_message_service_reply_success (msg);
+          state->replied = 1;
+        }
+      return result;
+
+    case DISPATCH_AUTH_NONE:
+      result = scm_call_2 (handler, session,
+                           _string_or_false (ssh_message_auth_user (msg)));
+      _dispatch_auth_reply (state, result);
+      return result;
+
+    case DISPATCH_AUTH_PASSWORD:
+      result = scm_call_3 (handler, session,
+                           _string_or_false (ssh_message_auth_user (msg)),
+                           _string_or_false (ssh_message_auth_password (msg)));
+      _dispatch_auth_reply (state, result);
+      return result;
+
+    case DISPATCH_AUTH_PUBLICKEY:
+      result = scm_call_4 (handler, session,
+                           _string_or_false (ssh_message_auth_user (msg)),
+                           _dispatch_copy_pubkey (msg),
+                           gssh_symbol_to_scm (dispatch_pubkey_states,
+                                               ssh_message_auth_publickey_state (msg)));
+      _dispatch_auth_reply (state, result);
+      return result;
+
+    case DISPATCH_CHANNEL_SESSION:
+      result = scm_call_1 (handler, session);
+      return scm_is_true (result)
+        ? _dispatch_accept_channel (state, session)
+        : result;
+
+    case DISPATCH_CHANNEL_DIRECT_TCPIP:
+      result = scm_call_5
+        (handler, session,
+         _string_or_false (ssh_message_channel_request_open_originator (msg)),
+         scm_from_int (ssh_message_channel_request_open_originator_port (msg)),
+         _string_or_false (ssh_message_channel_request_open_destination (msg)),
+         scm_from_int (ssh_message_channel_request_open_destination_port (msg)));
+      return scm_is_true (result)
+        ? _dispatch_accept_channel (state, session)
+        : result;
+
+    case DISPATCH_CHANNEL_REQUEST_PTY:
+      result = scm_call_5
+        (handler, session, channel,
+         _string_or_false (ssh_message_channel_request_pty_term (msg)),
+         scm_from_int (ssh_message_channel_request_pty_width (msg)),
+         scm_from_int (ssh_message_channel_request_pty_height (msg)));
+      break;
+
+    case DISPATCH_CHANNEL_REQUEST_EXEC:
+      result = scm_call_3
+        (handler, session, channel,
+         _string_or_false (ssh_message_channel_request_command (msg)));
+      break;
+
+    case DISPATCH_CHANNEL_REQUEST_SHELL:
+      result = scm_call_2 (handler, session, channel);
+      break;
+
+    case DISPATCH_CHANNEL_REQUEST_ENV:
+      result = scm_call_4
+        (handler, session, channel,
+         _string_or_false (ssh_message_channel_request_env_name (msg)),
+         _string_or_false (ssh_message_channel_request_env_value (msg)));
+      break;
+
+    case DISPATCH_CHANNEL_REQUEST_SUBSYSTEM:
+      result = scm_call_3
+        (handler, session, channel,
+         _string_or_false (ssh_message_channel_request_subsystem (msg)));
+      break;
+
+    case DISPATCH_CHANNEL_REQUEST_WINDOW_CHANGE:
+      result = scm_call_4
+        (handler, session, channel,
+         scm_from_int (ssh_message_channel_request_pty_width (msg)),
+         scm_from_int (ssh_message_channel_request_pty_height (msg)));
+      break;
+
+    case DISPATCH_GLOBAL_TCPIP_FORWARD:
+    case DISPATCH_GLOBAL_CANCEL_TCPIP_FORWARD:
+      {
+        int port = ssh_message_global_request_port (msg);
+        result = scm_call_3
+          (handler, session,
+           _string_or_false (ssh_message_global_request_address (msg)),
+           scm_from_int (port));
+        if (scm_is_true (result))
+          {
+            /* A handler of a 'tcpip-forward' request may return the port
+               that was actually bound. */
+            if (scm_is_unsigned_integer (result, 0, UINT16_MAX))
+              port = scm_to_uint16 (result);
+            ssh_message_global_request_reply_success (msg, port);
+            state->replied = 1;
+          }
+        return result;
+      }
+
+    default:
+      return SCM_BOOL_F;        /* Never reached. */
+    }
+
+  /* Channel requests. */
+  if (scm_is_true (result))
+    {
+      ssh_message_channel_request_reply_success (msg);
+      state->replied = 1;
+    }
+  return result;
+}
+
+SCM_DEFINE (guile_ssh_server_dispatch_message,
+            "server-dispatch-message", 2, 0, 0,
+            (SCM server, SCM session),
+            "\
+Get a message from a SESSION and dispatch it to a handler of a SERVER.\n\
+Return the handler result, #f if the message is denied because it has no\n\
+handler, or the end-of-file object if the session is closed.\
+")
+#define FUNC_NAME s_guile_ssh_server_dispatch_message
+{
+  gssh_server_t *server_data = gssh_server_from_scm (server);
+  gssh_session_t *session_data = gssh_session_from_scm (session);
+  struct message_get_args args;
+  struct dispatch_state state;
+  SCM handler = SCM_BOOL_F;
+  SCM result;
+  int slot;
+
+  args.session = session_data->ssh_session;
+  args.message = NULL;
+  gssh_call_with_deadline (session_data->ssh_session, _message_get, &args,
+                           FUNC_NAME, session);
+  if (! args.message)
+    return SCM_EOF_VAL;
+
+  slot = _message_dispatch_slot (args.message);
+  if (scm_is_true (server_data->handlers))
+    {
+      if (slot >= 0)
+        handler = SCM_SIMPLE_VECTOR_REF (server_data->handlers, slot);
+
+      /* Messages without a handler are passed as message objects to the
+         default handler, if any. */
+      if (scm_is_false (handler))
+        {
+          SCM dflt = SCM_SIMPLE_VECTOR_REF (server_data->handlers,
+                                            DISPATCH_DEFAULT);
+          if (scm_is_true (dflt))
+            return scm_call_1 (dflt, _scm_from_ssh_message (args.message,
+                                                            session));
+        }
+    }
+
+  state.server  = server_data;
+  state.message = args.message;
+  state.replied = 0;
+
+  scm_dynwind_begin (0);
+  scm_dynwind_unwind_handler (_dispatch_cleanup, &state,
+                              SCM_F_WIND_EXPLICITLY);
+
+  result = scm_is_true (handler)
+    ? _dispatch (&state, session, slot, handler)
+    : SCM_BOOL_F;
+
+  scm_dynwind_end ();
+
+  return result;
+}
+#undef FUNC_NAME
+
 
 
 /* Initialize server related functions. */
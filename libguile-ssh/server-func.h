@@ -26,6 +26,8 @@ extern gssh_symbol_t server_options[];
 
 extern SCM guile_ssh_server_set_x (SCM arg1, SCM arg2, SCM arg3);
 extern SCM guile_ssh_server_accept (SCM arg1);
+extern SCM guile_ssh_server_set_message_handlers_x (SCM server, SCM handlers);
+extern SCM guile_ssh_server_dispatch_message (SCM server, SCM session);
 
 extern void init_server_func (void);
 
@@ -40,6 +40,7 @@ static SCM
 _mark (SCM server)
 {
   gssh_server_t *sd = gssh_server_from_scm (server);
+  scm_gc_mark (sd->handlers);
   return sd->options;
 }
 
@@ -117,6 +118,8 @@ SCM_DEFINE (guile_ssh_make_server, "%make-server", 0, 0, 0,
   gssh_server_t *server_data = make_gssh_server ();
   server_data->bind = ssh_bind_new ();
   server_data->options = SCM_EOL;
+  server_data->handlers = SCM_BOOL_F;
+  server_data->auth_methods = 0;
   SCM_NEWSMOB (smob, server_tag, server_data);
   return smob;
 }
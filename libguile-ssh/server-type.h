@@ -29,6 +29,14 @@ extern scm_t_bits server_tag;
 struct gssh_server {
   ssh_bind bind;
   SCM options;
+
+  /* Message dispatch table: a vector of handlers indexed by message kind,
+     or #f if no handlers are set (see 'server-set-message-handlers!'.) */
+  SCM handlers;
+
+  /* Authentication methods that are announced to clients when an
+     authentication request is denied by the dispatcher. */
+  int auth_methods;
 };
 
 typedef struct gssh_server gssh_server_t;
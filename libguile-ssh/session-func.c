@@ -20,6 +20,19 @@
 
 #include <config.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 
 #include <libguile.h>
 #include <libssh/libssh.h>
@@ -32,12 +45,14 @@
 #include "key-type.h"
 #include "message-type.h"
 #include "log.h"
+#include "sha1.h"
 
 /* Guile SSH specific options that are aimed to unificate the way of session
    configuration. */
 enum gssh_session_options {
   /* Should not intersect with options from SSH session API. */
-  GSSH_OPTIONS_CALLBACKS = 100
+  GSSH_OPTIONS_CALLBACKS = 100,
+  GSSH_OPTIONS_BLOCKING_MODE
 };
 
 
@@ -81,6 +96,7 @@ static gssh_symbol_t session_options[] = {
 #endif
 
   { "callbacks",          GSSH_OPTIONS_CALLBACKS         },
+  { "blocking-mode",      GSSH_OPTIONS_BLOCKING_MODE     },
   { NULL,                 -1 }
 };
 
@@ -397,6 +413,11 @@ set_option (SCM scm_session, gssh_session_t* sd, int type, SCM value)
     case GSSH_OPTIONS_CALLBACKS:
       return set_callbacks (scm_session, sd, value);
 
+    case GSSH_OPTIONS_BLOCKING_MODE:
+      SCM_ASSERT (scm_is_bool (value), value, SCM_ARG3, "session-set!");
+      ssh_set_blocking (session, scm_to_bool (value));
+      return SSH_OK;
+
 #if ! HAVE_LIBSSH_0_8_3
     case SSH_OPTIONS_PUBLICKEY_ACCEPTED_TYPES:
         guile_ssh_error1 ("session-set!",
@@ -454,13 +475,17 @@ Return value is undefined.\
 
 /* Options whose values can be requested through `session-get' */
 static gssh_symbol_t session_options_getable[] = {
-  { "host",         SSH_OPTIONS_HOST         },
-  { "port",         SSH_OPTIONS_PORT         },
-  { "user",         SSH_OPTIONS_USER         },
-  { "identity",     SSH_OPTIONS_IDENTITY     },
-  { "proxycommand", SSH_OPTIONS_PROXYCOMMAND },
-  { "callbacks",    GSSH_OPTIONS_CALLBACKS   },
-  { NULL,           -1                       }
+  { "host",          SSH_OPTIONS_HOST           },
+  { "port",          SSH_OPTIONS_PORT           },
+  { "user",          SSH_OPTIONS_USER           },
+  { "identity",      SSH_OPTIONS_IDENTITY       },
+  { "proxycommand",  SSH_OPTIONS_PROXYCOMMAND   },
+#if HAVE_LIBSSH_0_9
+  { "knownhosts",    SSH_OPTIONS_KNOWNHOSTS     },
+#endif
+  { "callbacks",     GSSH_OPTIONS_CALLBACKS     },
+  { "blocking-mode", GSSH_OPTIONS_BLOCKING_MODE },
+  { NULL,            -1                         }
 };
 
 SCM_DEFINE (guile_ssh_session_get, "session-get", 2, 0, 0,
@@ -491,6 +516,10 @@ Get value of the OPTION.  Throw `guile-ssh-error' on an error.\
     {
       value = sd->callbacks;
     }
+  else if (opt->value == GSSH_OPTIONS_BLOCKING_MODE)
+    {
+      value = scm_from_bool (ssh_is_blocking (sd->ssh_session));
+    }
   else
     {
       char *c_value = NULL;
@@ -638,6 +667,79 @@ Retrieve the error text message from the last error.\
   return error;
 }
 
+SCM_DEFINE (guile_ssh_get_fd, "get-fd", 1, 0, 0,
+            (SCM session),
+            "\
+Get the file descriptor of the SESSION socket.\n\
+Return the file descriptor or #f if the session is not connected.\
+")
+#define FUNC_NAME s_guile_ssh_get_fd
+{
+  gssh_session_t* sd = gssh_session_from_scm (session);
+  socket_t fd = ssh_get_fd (sd->ssh_session);
+  return (fd == SSH_INVALID_SOCKET) ? SCM_BOOL_F : scm_from_int (fd);
+}
+#undef FUNC_NAME
+
+SCM_DEFINE (guile_ssh_get_peer_address, "get-peer-address", 1, 0, 0,
+            (SCM session),
+            "\
+Get the network address of the remote side of the SESSION socket as a\n\
+string.  Return #f if the session is not connected or the address is not\n\
+an IPv4 or IPv6 address.\
+")
+#define FUNC_NAME s_guile_ssh_get_peer_address
+{
+  gssh_session_t* sd = gssh_session_from_scm (session);
+  socket_t fd = ssh_get_fd (sd->ssh_session);
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof (addr);
+  char buf[INET6_ADDRSTRLEN];
+  const char *res = NULL;
+
+  if (fd == SSH_INVALID_SOCKET)
+    return SCM_BOOL_F;
+
+  if (getpeername (fd, (struct sockaddr *) &addr, &addrlen) < 0)
+    return SCM_BOOL_F;
+
+  if (addr.ss_family == AF_INET)
+    res = inet_ntop (AF_INET, &((struct sockaddr_in *) &addr)->sin_addr,
+                     buf, sizeof (buf));
+  else if (addr.ss_family == AF_INET6)
+    res = inet_ntop (AF_INET6, &((struct sockaddr_in6 *) &addr)->sin6_addr,
+                     buf, sizeof (buf));
+
+  return res ? scm_from_locale_string (res) : SCM_BOOL_F;
+}
+#undef FUNC_NAME
+
+/* Get the I/O events that a non-blocking SESSION waits for.
+
+   Return a list that contains the symbols 'read and/or 'write. */
+SCM_DEFINE (guile_ssh_get_poll_flags, "get-poll-flags", 1, 0, 0,
+            (SCM session),
+            "\
+Get the list of I/O events ('read, 'write) that the SESSION waits for on its\n\
+socket.  A non-blocking operation that returned 'again should be repeated\n\
+when one of these events occurs.\
+")
+#define FUNC_NAME s_guile_ssh_get_poll_flags
+{
+  gssh_session_t* sd = gssh_session_from_scm (session);
+  int flags = ssh_get_poll_flags (sd->ssh_session);
+  SCM result = SCM_EOL;
+
+  if (flags & SSH_WRITE_PENDING)
+    result = scm_cons (scm_from_locale_symbol ("write"), result);
+
+  if (flags & SSH_READ_PENDING)
+    result = scm_cons (scm_from_locale_symbol ("read"), result);
+
+  return result;
+}
+#undef FUNC_NAME
+
 /* Authenticate the server.
 
    Return one of the following symbols: 'ok, 'known-changed,
@@ -646,7 +748,7 @@ Retrieve the error text message from the last error.\
    Asserts:
    - Return value of `ssh_is_server_known' is one of the valid constants
      described in libssh.h */
-SCM_DEFINE (guile_ssh_authenticate_server, "authenticate-server", 1, 0, 0,
+SCM_DEFINE (guile_ssh_authenticate_server, "%gssh-authenticate-server", 1, 0, 0,
             (SCM session),
             "\
 Authenticate the server.\n\
@@ -695,6 +797,99 @@ Return one of the following symbols: 'ok, 'known-changed, 'found-other,\n\
 }
 #undef FUNC_NAME
 
+static const char base64_digits[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Decode a base64 string IN into OUT that has room for OUT_SIZE bytes.
+   Return the number of decoded bytes, or -1 on an error. */
+static ssize_t
+_base64_decode (const char *in, uint8_t *out, size_t out_size)
+{
+  uint32_t acc = 0;
+  int bits = 0;
+  size_t len = 0;
+
+  for (; *in && (*in != '='); ++in)
+    {
+      const char *digit = strchr (base64_digits, *in);
+      if (! digit)
+        return -1;
+      acc = (acc << 6) | (uint32_t) (digit - base64_digits);
+      bits += 6;
+      if (bits >= 8)
+        {
+          bits -= 8;
+          if (len == out_size)
+            return -1;
+          out[len++] = (uint8_t) (acc >> bits);
+        }
+    }
+  return (ssize_t) len;
+}
+
+/* Encode LEN bytes of DATA as a base64 string OUT that has room for
+   ((LEN + 2) / 3) * 4 + 1 characters. */
+static void
+_base64_encode (const uint8_t *data, size_t len, char *out)
+{
+  size_t idx;
+
+  for (idx = 0; idx < len; idx += 3)
+    {
+      uint32_t acc = (uint32_t) data[idx] << 16;
+      if (idx + 1 < len)
+        acc |= (uint32_t) data[idx + 1] << 8;
+      if (idx + 2 < len)
+        acc |= data[idx + 2];
+      *out++ = base64_digits[(acc >> 18) & 0x3f];
+      *out++ = base64_digits[(acc >> 12) & 0x3f];
+      *out++ = (idx + 1 < len) ? base64_digits[(acc >> 6) & 0x3f] : '=';
+      *out++ = (idx + 2 < len) ? base64_digits[acc & 0x3f] : '=';
+    }
+  *out = '\0';
+}
+
+/* Hash a host NAME with a SALT the way OpenSSH does it for the hashed
+   entries of known hosts files ("|1|SALT|HASH".)  Return the hash as a base64
+   string, or #f if the SALT is not valid. */
+SCM_GSSH_DEFINE (gssh_hash_host_name, "%gssh-hash-host-name", 2,
+                 (SCM salt, SCM name))
+#define FUNC_NAME s_gssh_hash_host_name
+{
+  uint8_t c_salt[GSSH_SHA1_BLOCK_SIZE];
+  uint8_t digest[GSSH_SHA1_DIGEST_SIZE];
+  char hash[((GSSH_SHA1_DIGEST_SIZE + 2) / 3) * 4 + 1];
+  char *c_str;
+  char *c_name;
+  ssize_t salt_len;
+
+  SCM_ASSERT (scm_is_string (salt), salt, SCM_ARG1, FUNC_NAME);
+  SCM_ASSERT (scm_is_string (name), name, SCM_ARG2, FUNC_NAME);
+
+  scm_dynwind_begin (0);
+
+  c_str = scm_to_locale_string (salt);
+  scm_dynwind_free (c_str);
+  c_name = scm_to_locale_string (name);
+  scm_dynwind_free (c_name);
+
+  salt_len = _base64_decode (c_str, c_salt, sizeof (c_salt));
+  if (salt_len < 0)
+    {
+      scm_dynwind_end ();
+      return SCM_BOOL_F;
+    }
+
+  gssh_hmac_sha1 (c_salt, (size_t) salt_len,
+                  (const uint8_t *) c_name, strlen (c_name), digest);
+  _base64_encode (digest, sizeof (digest), hash);
+
+  scm_dynwind_end ();
+
+  return scm_from_locale_string (hash);
+}
+#undef FUNC_NAME
+
 SCM_DEFINE (guile_ssh_get_server_public_key, "get-server-public-key", 1, 0, 0,
             (SCM session),
             "\
@@ -730,7 +925,7 @@ Return server's public key.  Throw `guile-ssh-error' on error.\
 }
 #undef FUNC_NAME
 
-SCM_DEFINE (guile_ssh_write_known_host, "write-known-host!", 1, 0, 0,
+SCM_DEFINE (guile_ssh_write_known_host, "%gssh-write-known-host!", 1, 0, 0,
             (SCM session),
             "\
 Write the current server as known in the known hosts file.\n\
@@ -758,6 +953,850 @@ Return value is undefined.\
 }
 #undef FUNC_NAME
 
+
+/* Connecting to many hosts in parallel. */
+
+/* Results of a connection to a host.  See '_connect_many_step'. */
+enum {
+  /* The server must be checked by the Guile thread; never reported. */
+  CONNECT_MANY_VERIFY = -2,
+  /* The handshake is not finished yet; never reported. */
+  CONNECT_MANY_AGAIN = -1,
+  CONNECT_MANY_OK,
+  CONNECT_MANY_CONNECT_ERROR,
+  CONNECT_MANY_SERVER_KNOWN_CHANGED,
+  CONNECT_MANY_SERVER_FOUND_OTHER,
+  CONNECT_MANY_SERVER_NOT_KNOWN,
+  CONNECT_MANY_SERVER_FILE_NOT_FOUND,
+  CONNECT_MANY_SERVER_ERROR,
+  CONNECT_MANY_AUTH_DENIED,
+  CONNECT_MANY_AUTH_PARTIAL,
+  CONNECT_MANY_AUTH_ERROR,
+  CONNECT_MANY_TIMEOUT
+};
+
+static gssh_symbol_t connect_many_results[] = {
+  { "ok",                    CONNECT_MANY_OK                    },
+  { "connect-error",         CONNECT_MANY_CONNECT_ERROR         },
+  { "server-known-changed",  CONNECT_MANY_SERVER_KNOWN_CHANGED  },
+  { "server-found-other",    CONNECT_MANY_SERVER_FOUND_OTHER    },
+  { "server-not-known",      CONNECT_MANY_SERVER_NOT_KNOWN      },
+  { "server-file-not-found", CONNECT_MANY_SERVER_FILE_NOT_FOUND },
+  { "server-error",          CONNECT_MANY_SERVER_ERROR          },
+  { "auth-denied",           CONNECT_MANY_AUTH_DENIED           },
+  { "auth-partial",          CONNECT_MANY_AUTH_PARTIAL          },
+  { "auth-error",            CONNECT_MANY_AUTH_ERROR            },
+  { "timeout",               CONNECT_MANY_TIMEOUT               },
+  { NULL,                    -1                                 }
+};
+
+/* Results of the procedure that checks servers (see 'authenticate-server'.) */
+static gssh_symbol_t connect_many_server_results[] = {
+  { "ok",             CONNECT_MANY_OK                    },
+  { "known-changed",  CONNECT_MANY_SERVER_KNOWN_CHANGED  },
+  { "found-other",    CONNECT_MANY_SERVER_FOUND_OTHER    },
+  { "not-known",      CONNECT_MANY_SERVER_NOT_KNOWN      },
+  { "file-not-found", CONNECT_MANY_SERVER_FILE_NOT_FOUND },
+  { "error",          CONNECT_MANY_SERVER_ERROR          },
+  { NULL,             -1                                 }
+};
+
+/* The longest time in milliseconds that the event loop sleeps in 'poll'.
+   Handshakes are also advanced after each timeout, in case libssh has
+   buffered data that 'poll' cannot see. */
+#define CONNECT_MANY_POLL_INTERVAL 100
+
+/* Stages of a handshake. */
+enum {
+  CONNECT_MANY_STATE_CONNECT,
+  CONNECT_MANY_STATE_AUTH
+};
+
+/* An in-flight handshake. */
+struct connect_many_slot {
+  size_t    idx;              /* Index of the session. */
+  int       state;            /* One of CONNECT_MANY_STATE_* constants. */
+  int       blocking_p;       /* The original blocking mode of the session. */
+  int       ready_p;          /* Whether the handshake should be advanced. */
+  long long deadline;         /* Monotonic time in ms, or 0 for no deadline. */
+};
+
+/* The state that is shared between the event loop thread and the Guile
+   thread that reports the results. */
+struct connect_many_job {
+  ssh_session *sessions;
+  size_t      count;
+  int         check_server_p;
+  int         authenticate_p;
+
+  /* The maximum number of in-flight handshakes. */
+  size_t      concurrency;
+  /* Per-host timeout in milliseconds, or 0 for no timeout. */
+  long long   timeout;
+
+  /* Storage for the event loop, allocated by the Guile thread. */
+  struct connect_many_slot *slots;
+  struct pollfd            *pfds;
+
+  /* Set by the Guile thread to stop the event loop. */
+  int         stop_p;
+
+  /* Servers are checked by the Guile thread with the known hosts cache.  A
+     connected session is passed to the Guile thread, and when its server
+     is checked it is passed back to the event loop to authenticate the
+     user.  DEADLINES keeps the deadlines of the sessions meanwhile. */
+  long long   *deadlines;
+  /* Indices of the sessions that are waiting for the authentication. */
+  size_t      *verified;
+  size_t      verified_count;
+  /* Number of the sessions that are being checked by the Guile thread. */
+  size_t      verifying;
+  /* A pipe that wakes up the event loop when a session is passed back. */
+  int         wake_fds[2];
+
+  /* Indices of the processed sessions, in the order of completion.  A
+     session that is checked by the Guile thread appears twice. */
+  size_t      *done;
+  size_t      done_count;
+  int         *results;
+
+  pthread_t   thread;
+  int         thread_started_p;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+};
+
+/* Get the monotonic time in milliseconds. */
+static long long
+_monotonic_ms (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Advance the non-blocking handshake in a SLOT as far as the available data
+   allows.  This procedure is called from the event loop thread that is not
+   in Guile mode, so it must not touch any Scheme objects.  Return
+   CONNECT_MANY_AGAIN if the handshake is not finished yet, or one of the
+   other CONNECT_MANY_* constants. */
+static int
+_connect_many_step (struct connect_many_job *job,
+                    struct connect_many_slot *slot)
+{
+  ssh_session session = job->sessions[slot->idx];
+
+  if (slot->state == CONNECT_MANY_STATE_CONNECT)
+    {
+      switch (ssh_connect (session))
+        {
+        case SSH_OK:
+          break;
+        case SSH_AGAIN:
+          return CONNECT_MANY_AGAIN;
+        default:
+          return CONNECT_MANY_CONNECT_ERROR;
+        }
+
+      if (job->check_server_p)
+        return CONNECT_MANY_VERIFY;
+
+      if (! job->authenticate_p)
+        return CONNECT_MANY_OK;
+
+      slot->state = CONNECT_MANY_STATE_AUTH;
+    }
+
+  switch (ssh_userauth_publickey_auto (session, NULL, NULL))
+    {
+    case SSH_AUTH_SUCCESS:
+      return CONNECT_MANY_OK;
+    case SSH_AUTH_AGAIN:
+      return CONNECT_MANY_AGAIN;
+    case SSH_AUTH_DENIED:
+      return CONNECT_MANY_AUTH_DENIED;
+    case SSH_AUTH_PARTIAL:
+      return CONNECT_MANY_AUTH_PARTIAL;
+    default:
+      return CONNECT_MANY_AUTH_ERROR;
+    }
+}
+
+/* Finish the handshake in a SLOT with a RESULT and pass the result to the
+   Guile thread.  If the RESULT is CONNECT_MANY_VERIFY, the session is passed
+   to the Guile thread to check the server. */
+static void
+_connect_many_finish (struct connect_many_job *job,
+                      struct connect_many_slot *slot, int result)
+{
+  ssh_set_blocking (job->sessions[slot->idx], slot->blocking_p);
+
+  pthread_mutex_lock (&job->mutex);
+  if (result == CONNECT_MANY_VERIFY)
+    {
+      job->deadlines[slot->idx] = slot->deadline;
+      ++job->verifying;
+    }
+  job->results[slot->idx] = result;
+  job->done[job->done_count++] = slot->idx;
+  pthread_cond_signal (&job->cond);
+  pthread_mutex_unlock (&job->mutex);
+}
+
+/* The event loop that drives at most 'concurrency' non-blocking handshakes
+   at once, waiting for the socket events of all of them with 'poll'. */
+static void *
+_connect_many_loop (void *data)
+{
+  struct connect_many_job *job = data;
+  struct connect_many_slot *slots = job->slots;
+  struct pollfd *pfds = job->pfds;
+  size_t active = 0;
+  size_t next = 0;
+
+  for (;;)
+    {
+      long long now = _monotonic_ms ();
+      long long poll_timeout = CONNECT_MANY_POLL_INTERVAL;
+      size_t pending;
+      int stop_p;
+      int res;
+      size_t idx;
+
+      pthread_mutex_lock (&job->mutex);
+      stop_p = job->stop_p;
+      /* The sessions with checked servers go first, as they are in the
+         middle of their handshakes. */
+      while ((! stop_p) && (job->verified_count > 0)
+             && (active < job->concurrency))
+        {
+          struct connect_many_slot *slot = &slots[active++];
+          ssh_session session;
+          slot->idx        = job->verified[--job->verified_count];
+          session          = job->sessions[slot->idx];
+          slot->state      = CONNECT_MANY_STATE_AUTH;
+          slot->blocking_p = ssh_is_blocking (session);
+          slot->ready_p    = 1;
+          slot->deadline   = job->deadlines[slot->idx];
+          ssh_set_blocking (session, 0);
+        }
+      pending = job->verifying + job->verified_count;
+      pthread_mutex_unlock (&job->mutex);
+
+      if (stop_p)
+        {
+          /* The results are not needed anymore; leave the sessions as they
+             are, but in their original blocking mode. */
+          for (idx = 0; idx < active; ++idx)
+            ssh_set_blocking (job->sessions[slots[idx].idx],
+                              slots[idx].blocking_p);
+          break;
+        }
+
+      while ((next < job->count) && (active < job->concurrency))
+        {
+          struct connect_many_slot *slot = &slots[active++];
+          ssh_session session = job->sessions[next];
+          slot->idx        = next++;
+          slot->state      = CONNECT_MANY_STATE_CONNECT;
+          slot->blocking_p = ssh_is_blocking (session);
+          slot->ready_p    = 1;
+          slot->deadline   = job->timeout ? now + job->timeout : 0;
+          ssh_set_blocking (session, 0);
+        }
+
+      if ((active == 0) && (pending == 0))
+        break;
+
+      for (idx = 0; idx < active; )
+        {
+          struct connect_many_slot *slot = &slots[idx];
+          int result = CONNECT_MANY_AGAIN;
+
+          if (slot->ready_p)
+            result = _connect_many_step (job, slot);
+
+          if ((result == CONNECT_MANY_AGAIN) && slot->deadline
+              && (_monotonic_ms () >= slot->deadline))
+            {
+              result = CONNECT_MANY_TIMEOUT;
+            }
+
+          if (result == CONNECT_MANY_AGAIN)
+            {
+              ++idx;
+              continue;
+            }
+
+          _connect_many_finish (job, slot, result);
+          slots[idx] = slots[--active];
+        }
+
+      pthread_mutex_lock (&job->mutex);
+      pending = job->verifying + job->verified_count;
+      pthread_mutex_unlock (&job->mutex);
+
+      if ((active == 0) && ((next < job->count) || (pending == 0)))
+        continue;
+
+      now = _monotonic_ms ();
+      for (idx = 0; idx < active; ++idx)
+        {
+          ssh_session session = job->sessions[slots[idx].idx];
+          pfds[idx].fd      = ssh_get_fd (session);
+          pfds[idx].events  = POLLIN;
+          pfds[idx].revents = 0;
+          if (ssh_get_poll_flags (session) & SSH_WRITE_PENDING)
+            pfds[idx].events |= POLLOUT;
+          if (slots[idx].deadline && (slots[idx].deadline - now < poll_timeout))
+            {
+              poll_timeout = (slots[idx].deadline > now)
+                ? slots[idx].deadline - now
+                : 0;
+            }
+        }
+
+      /* The last descriptor is the wake-up pipe. */
+      pfds[active].fd      = job->wake_fds[0];
+      pfds[active].events  = POLLIN;
+      pfds[active].revents = 0;
+
+      res = poll (pfds, active + 1, (int) poll_timeout);
+      if ((res < 0) && (errno != EINTR))
+        {
+          for (idx = 0; idx < active; ++idx)
+            _connect_many_finish (job, &slots[idx], CONNECT_MANY_CONNECT_ERROR);
+          active = 0;
+          continue;
+        }
+
+      if ((res > 0) && pfds[active].revents)
+        {
+          char buf[64];
+          while (read (job->wake_fds[0], buf, sizeof (buf)) > 0)
+            ;
+        }
+
+      for (idx = 0; idx < active; ++idx)
+        {
+          slots[idx].ready_p = (res <= 0)
+            || (pfds[idx].fd < 0)
+            || (pfds[idx].revents != 0);
+        }
+    }
+
+  return NULL;
+}
+
+/* Check the server of a SESSION with the index IDX in a JOB with a
+   procedure CHECK_SERVER that returns the same values as
+   'authenticate-server'.  Called from the Guile thread.  If the server is
+   known and the user must be authenticated, pass the session back to the
+   event loop and return CONNECT_MANY_AGAIN; otherwise return the result of
+   the handshake. */
+static int
+_connect_many_verify (struct connect_many_job *job, SCM check_server,
+                      SCM session, size_t idx)
+{
+  const gssh_symbol_t *sym
+    = gssh_symbol_from_scm (connect_many_server_results,
+                            scm_call_1 (check_server, session));
+  int res = sym ? sym->value : CONNECT_MANY_SERVER_ERROR;
+
+  pthread_mutex_lock (&job->mutex);
+  --job->verifying;
+  if ((res == CONNECT_MANY_OK) && job->authenticate_p)
+    {
+      job->verified[job->verified_count++] = idx;
+      res = CONNECT_MANY_AGAIN;
+    }
+  pthread_mutex_unlock (&job->mutex);
+
+  if ((res == CONNECT_MANY_AGAIN) && (write (job->wake_fds[1], "", 1) < 0))
+    {
+      /* The pipe is full, so the event loop is woken up anyway. */
+    }
+
+  return res;
+}
+
+/* Wait until there are unreported results in a JOB.  REPORTED points to the
+   number of the already reported results.  Called without Guile mode. */
+struct connect_many_wait {
+  struct connect_many_job *job;
+  size_t reported;
+};
+
+static void *
+_connect_many_wait (void *data)
+{
+  struct connect_many_wait *wait = data;
+  struct connect_many_job *job = wait->job;
+
+  pthread_mutex_lock (&job->mutex);
+  while (job->done_count == wait->reported)
+    pthread_cond_wait (&job->cond, &job->mutex);
+  pthread_mutex_unlock (&job->mutex);
+
+  return NULL;
+}
+
+static void *
+_connect_many_join (void *data)
+{
+  struct connect_many_job *job = data;
+  pthread_join (job->thread, NULL);
+  return NULL;
+}
+
+/* Stop the event loop thread of a JOB and free its resources.  The
+   handshakes that are in flight are abandoned. */
+static void
+_connect_many_cleanup (void *data)
+{
+  struct connect_many_job *job = data;
+
+  pthread_mutex_lock (&job->mutex);
+  job->stop_p = 1;
+  pthread_mutex_unlock (&job->mutex);
+
+  if (job->thread_started_p)
+    scm_without_guile (_connect_many_join, job);
+
+  close (job->wake_fds[0]);
+  close (job->wake_fds[1]);
+  pthread_mutex_destroy (&job->mutex);
+  pthread_cond_destroy (&job->cond);
+}
+
+SCM_DEFINE (guile_ssh_connect_many, "%gssh-connect-many", 6, 0, 0,
+            (SCM sessions, SCM concurrency, SCM timeout, SCM check_server,
+             SCM authenticate_p, SCM callback),
+            "\
+Connect SESSIONS (a vector) with non-blocking handshakes that are driven by\n\
+a single native thread, with at most CONCURRENCY handshakes in flight.\n\
+TIMEOUT is the number of seconds that each handshake may take, or #f.  If\n\
+CHECK_SERVER is a procedure then it is called from the current thread as\n\
+(CHECK_SERVER SESSION) to check each server, and it must return the same\n\
+values as 'authenticate-server'.  If AUTHENTICATE_P is true then\n\
+authenticate the user with the public keys.\n\
+CALLBACK is called as (CALLBACK SESSION RESULT) from the current thread\n\
+as each session completes.  Return value is undefined.\
+")
+#define FUNC_NAME s_guile_ssh_connect_many
+{
+  struct connect_many_job *job;
+  struct connect_many_wait wait;
+  size_t completed = 0;
+  size_t count;
+  size_t idx;
+  size_t c_concurrency;
+  long long c_timeout = 0;
+
+  SCM_ASSERT (scm_is_simple_vector (sessions), sessions, SCM_ARG1, FUNC_NAME);
+  SCM_ASSERT (scm_is_unsigned_integer (concurrency, 1, SIZE_MAX),
+              concurrency, SCM_ARG2, FUNC_NAME);
+  SCM_ASSERT (scm_is_false (timeout)
+              || (scm_is_real (timeout)
+                  && scm_is_true (scm_positive_p (timeout))),
+              timeout, SCM_ARG3, FUNC_NAME);
+  SCM_ASSERT (scm_is_false (check_server)
+              || scm_is_true (scm_procedure_p (check_server)),
+              check_server, SCM_ARG4, FUNC_NAME);
+  SCM_ASSERT (scm_is_bool (authenticate_p), authenticate_p, SCM_ARG5,
+              FUNC_NAME);
+  SCM_ASSERT (scm_is_true (scm_procedure_p (callback)), callback, SCM_ARG6,
+              FUNC_NAME);
+
+  if (scm_is_true (timeout))
+    {
+      double seconds = scm_to_double (timeout);
+      /* One day is way more than any handshake could take. */
+      if (seconds > 86400.0)
+        seconds = 86400.0;
+      c_timeout = (long long) (seconds * 1000.0);
+      if (c_timeout < 1)
+        c_timeout = 1;
+    }
+
+  count = SCM_SIMPLE_VECTOR_LENGTH (sessions);
+  if (count == 0)
+    return SCM_UNDEFINED;
+
+  c_concurrency = scm_to_size_t (concurrency);
+
+  scm_dynwind_begin (0);
+
+  job = scm_malloc (sizeof (struct connect_many_job));
+  scm_dynwind_free (job);
+  job->sessions = scm_malloc (count * sizeof (ssh_session));
+  scm_dynwind_free (job->sessions);
+  job->done = scm_malloc (2 * count * sizeof (size_t));
+  scm_dynwind_free (job->done);
+  job->deadlines = scm_malloc (count * sizeof (long long));
+  scm_dynwind_free (job->deadlines);
+  job->verified = scm_malloc (count * sizeof (size_t));
+  scm_dynwind_free (job->verified);
+  job->results = scm_malloc (count * sizeof (int));
+  scm_dynwind_free (job->results);
+  job->count            = count;
+  job->timeout          = c_timeout;
+  job->stop_p           = 0;
+  job->done_count       = 0;
+  job->thread_started_p = 0;
+  job->verified_count   = 0;
+  job->verifying        = 0;
+  job->check_server_p   = scm_is_true (check_server);
+  job->authenticate_p   = scm_is_true (authenticate_p);
+
+  for (idx = 0; idx < count; ++idx)
+    {
+      SCM session = SCM_SIMPLE_VECTOR_REF (sessions, idx);
+      gssh_session_t *sd = gssh_session_from_scm (session);
+      /* Session callbacks are Scheme procedures that cannot be called from
+         the event loop thread. */
+      if (scm_is_true (sd->callbacks))
+        {
+          guile_ssh_error1 (FUNC_NAME,
+                            "Sessions with callbacks are not supported",
+                            session);
+        }
+      job->sessions[idx] = sd->ssh_session;
+    }
+
+  if (c_concurrency > count)
+    c_concurrency = count;
+
+  job->concurrency = c_concurrency;
+  job->slots = scm_malloc (c_concurrency * sizeof (struct connect_many_slot));
+  scm_dynwind_free (job->slots);
+  job->pfds = scm_malloc ((c_concurrency + 1) * sizeof (struct pollfd));
+  scm_dynwind_free (job->pfds);
+
+  if (pipe (job->wake_fds) < 0)
+    guile_ssh_error1 (FUNC_NAME, strerror (errno), sessions);
+  fcntl (job->wake_fds[0], F_SETFL, O_NONBLOCK);
+  fcntl (job->wake_fds[1], F_SETFL, O_NONBLOCK);
+
+  pthread_mutex_init (&job->mutex, NULL);
+  pthread_cond_init (&job->cond, NULL);
+  scm_dynwind_unwind_handler (_connect_many_cleanup, job,
+                              SCM_F_WIND_EXPLICITLY);
+
+  if (pthread_create (&job->thread, NULL, _connect_many_loop, job))
+    guile_ssh_error1 (FUNC_NAME, "Could not start the event loop thread",
+                      sessions);
+  job->thread_started_p = 1;
+
+  wait.job      = job;
+  wait.reported = 0;
+  while (completed < count)
+    {
+      size_t done_count;
+
+      scm_without_guile (_connect_many_wait, &wait);
+
+      pthread_mutex_lock (&job->mutex);
+      done_count = job->done_count;
+      pthread_mutex_unlock (&job->mutex);
+
+      /* The entries below DONE_COUNT are not changed by the event loop
+         anymore, so they can be read without the lock. */
+      for (; wait.reported < done_count; ++wait.reported)
+        {
+          size_t session_idx = job->done[wait.reported];
+          SCM session = SCM_SIMPLE_VECTOR_REF (sessions, session_idx);
+          int res = job->results[session_idx];
+          SCM result;
+
+          if (res == CONNECT_MANY_VERIFY)
+            {
+              res = _connect_many_verify (job, check_server, session,
+                                          session_idx);
+              if (res == CONNECT_MANY_AGAIN)
+                continue;
+            }
+
+          ++completed;
+          result = gssh_symbol_to_scm (connect_many_results, res);
+          _gssh_log_debug_format (FUNC_NAME, result, "session: %zu",
+                                  session_idx);
+          scm_call_2 (callback, session, result);
+        }
+    }
+
+  scm_dynwind_end ();
+
+  scm_remember_upto_here_1 (sessions);
+
+  return SCM_UNDEFINED;
+}
+#undef FUNC_NAME
+
+
+/* Keepalive */
+
+SCM_DEFINE (guile_ssh_send_keepalive, "send-keepalive!", 1, 0, 0,
+            (SCM session),
+            "\
+Send a keepalive request through a connected SESSION.  The server reply is\n\
+handled by libssh the next time the session reads data.\n\
+Throw 'guile-ssh-error' on an error.  Return value is undefined.\
+")
+#define FUNC_NAME s_guile_ssh_send_keepalive
+{
+  gssh_session_t* sd = gssh_session_from_scm (session);
+
+  GSSH_VALIDATE_CONNECTED_SESSION (sd, session, SCM_ARG1);
+
+#if HAVE_LIBSSH_0_7_3
+  if (ssh_send_keepalive (sd->ssh_session) != SSH_OK)
+    {
+      guile_ssh_session_error1 (FUNC_NAME, sd->ssh_session, session);
+    }
+#else
+  guile_ssh_error1 (FUNC_NAME, "Not implemented (libssh 0.7.3+ required)",
+                    session);
+#endif
+
+  return SCM_UNDEFINED;
+}
+#undef FUNC_NAME
+
+#if HAVE_LIBSSH_0_7_3
+
+/* The state of '_session_ping_wait'. */
+struct session_ping {
+  socket_t  fd;
+  /* Number of bytes in the socket receive buffer before the request. */
+  int       before;
+  /* Monotonic time in ms. */
+  long long deadline;
+  int       alive_p;
+};
+
+/* Wait until the peer sends any data after a keepalive request, the peer
+   closes the connection, or the deadline expires.  The data is left in the
+   socket for libssh.  Called without Guile mode. */
+static void *
+_session_ping_wait (void *data)
+{
+  struct session_ping *ping = data;
+
+  for (;;)
+    {
+      struct pollfd pfd;
+      long long left = ping->deadline - _monotonic_ms ();
+      int available = 0;
+      char c;
+
+      if (left <= 0)
+        break;
+
+      pfd.fd      = ping->fd;
+      pfd.events  = POLLIN;
+      pfd.revents = 0;
+      if (poll (&pfd, 1, (int) left) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      if (pfd.revents == 0)
+        continue;
+
+      if (ioctl (ping->fd, FIONREAD, &available) < 0)
+        break;
+
+      if (available > ping->before)
+        {
+          ping->alive_p = 1;
+          break;
+        }
+
+      if (available == 0)
+        {
+          /* The socket is readable but there is no data: the connection is
+             closed or reset, unless the data has just arrived. */
+          if (recv (ping->fd, &c, 1, MSG_PEEK) <= 0)
+            break;
+          continue;
+        }
+
+      /* Only the data that was received before the request is available;
+         wait for more. */
+      poll (NULL, 0, 10);
+    }
+
+  return NULL;
+}
+
+#endif  /* HAVE_LIBSSH_0_7_3 */
+
+/* Send a keepalive request through a connected SESSION and wait at most
+   TIMEOUT seconds for any data from the peer.  Return #t if the peer has
+   answered, #f if the connection is closed or the peer is silent.  Throw
+   'guile-ssh-error' if the request cannot be sent. */
+SCM_GSSH_DEFINE (gssh_session_ping, "%gssh-session-ping", 2,
+                 (SCM session, SCM timeout))
+#define FUNC_NAME s_gssh_session_ping
+{
+  gssh_session_t* sd = gssh_session_from_scm (session);
+#if HAVE_LIBSSH_0_7_3
+  struct ssh_counter_struct counter;
+  struct session_ping ping;
+  int blocking;
+  int after;
+  int res;
+#endif
+
+  GSSH_VALIDATE_CONNECTED_SESSION (sd, session, SCM_ARG1);
+  SCM_ASSERT (scm_is_real (timeout) && scm_is_true (scm_positive_p (timeout)),
+              timeout, SCM_ARG2, FUNC_NAME);
+
+#if HAVE_LIBSSH_0_7_3
+  ping.fd = ssh_get_fd (sd->ssh_session);
+  if (ping.fd == SSH_INVALID_SOCKET)
+    guile_ssh_error1 (FUNC_NAME, "Session has no socket", session);
+
+  if (ioctl (ping.fd, FIONREAD, &ping.before) < 0)
+    guile_ssh_error1 (FUNC_NAME, strerror (errno), session);
+
+  ping.deadline = _monotonic_ms ()
+    + (long long) (scm_to_double (scm_min (timeout, scm_from_int (86400)))
+                   * 1000.0);
+  ping.alive_p  = 0;
+
+  /* libssh 0.8+ waits for the reply in 'ssh_send_keepalive' with the
+     default session timeout, which would hold Guile mode for as long as the
+     peer is silent.  The request is sent in non-blocking mode instead, and
+     all the waiting is done below without Guile mode.  The packets that are
+     handled while sending are counted.
+
+     If the reply to a previous request has not been handled yet, the first
+     call only checks that request; in that case the call is repeated to
+     send a new one.  If the previous request is still pending nothing is
+     sent, but any data from the peer still means that it is alive. */
+  memset (&counter, 0, sizeof (counter));
+  blocking = ssh_is_blocking (sd->ssh_session);
+  ssh_set_blocking (sd->ssh_session, 0);
+  ssh_set_counters (sd->ssh_session, NULL, &counter);
+  res = ssh_send_keepalive (sd->ssh_session);
+  if ((res == SSH_OK) && (counter.out_packets == 0)
+      && ssh_is_connected (sd->ssh_session))
+    res = ssh_send_keepalive (sd->ssh_session);
+  ssh_set_counters (sd->ssh_session, NULL, NULL);
+  ssh_set_blocking (sd->ssh_session, blocking);
+
+  if (res == SSH_ERROR)
+    guile_ssh_session_error1 (FUNC_NAME, sd->ssh_session, session);
+
+  if (! ssh_is_connected (sd->ssh_session))
+    return SCM_BOOL_F;
+
+  if (counter.in_packets > 0)
+    return SCM_BOOL_T;
+
+  /* libssh may have read a part of a packet from the socket while sending
+     the request. */
+  if ((ioctl (ping.fd, FIONREAD, &after) == 0) && (after < ping.before))
+    ping.before = after;
+
+  scm_without_guile (_session_ping_wait, &ping);
+
+  return scm_from_bool (ping.alive_p);
+#else
+  guile_ssh_error1 (FUNC_NAME, "Not implemented (libssh 0.7.3+ required)",
+                    session);
+  return SCM_BOOL_F;            /* Not reached. */
+#endif
+}
+#undef FUNC_NAME
+
+/* The largest values of the TCP keepalive options that Linux accepts.  They
+   also keep the TCP_USER_TIMEOUT value below within 'unsigned int'. */
+#define TCP_KEEPALIVE_MAX_TIME  32767
+#define TCP_KEEPALIVE_MAX_COUNT 127
+
+/* Enable TCP keepalive on the SESSION socket.  IDLE is the number of seconds
+   the connection stays idle before the first probe is sent, INTERVAL is the
+   number of seconds between probes and COUNT is the number of unanswered
+   probes after which the connection is dropped.  Where supported, unacked
+   outgoing data also drops the connection after IDLE + INTERVAL * COUNT
+   seconds, so a blocked read or write fails instead of hanging until the
+   system TCP timeout. */
+SCM_GSSH_DEFINE (gssh_session_set_tcp_keepalive, "%gssh-set-tcp-keepalive!", 4,
+                 (SCM session, SCM idle, SCM interval, SCM count))
+#define FUNC_NAME s_gssh_session_set_tcp_keepalive
+{
+  gssh_session_t* sd = gssh_session_from_scm (session);
+  socket_t fd;
+  int c_idle;
+  int c_interval;
+  int c_count;
+  int on = 1;
+
+  GSSH_VALIDATE_CONNECTED_SESSION (sd, session, SCM_ARG1);
+  SCM_ASSERT (scm_is_unsigned_integer (idle, 1, TCP_KEEPALIVE_MAX_TIME),
+              idle, SCM_ARG2, FUNC_NAME);
+  SCM_ASSERT (scm_is_unsigned_integer (interval, 1, TCP_KEEPALIVE_MAX_TIME),
+              interval, SCM_ARG3, FUNC_NAME);
+  SCM_ASSERT (scm_is_unsigned_integer (count, 1, TCP_KEEPALIVE_MAX_COUNT),
+              count, SCM_ARG4, FUNC_NAME);
+
+  c_idle     = scm_to_int (idle);
+  c_interval = scm_to_int (interval);
+  c_count    = scm_to_int (count);
+
+  fd = ssh_get_fd (sd->ssh_session);
+  if (fd == SSH_INVALID_SOCKET)
+    guile_ssh_error1 (FUNC_NAME, "Session has no socket", session);
+
+  if (setsockopt (fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof (on)) < 0)
+    goto error;
+
+#ifdef TCP_KEEPIDLE
+  if (setsockopt (fd, IPPROTO_TCP, TCP_KEEPIDLE,
+                  &c_idle, sizeof (c_idle)) < 0)
+    goto error;
+#elif defined (TCP_KEEPALIVE)
+  if (setsockopt (fd, IPPROTO_TCP, TCP_KEEPALIVE,
+                  &c_idle, sizeof (c_idle)) < 0)
+    goto error;
+#endif
+
+#ifdef TCP_KEEPINTVL
+  if (setsockopt (fd, IPPROTO_TCP, TCP_KEEPINTVL,
+                  &c_interval, sizeof (c_interval)) < 0)
+    goto error;
+#endif
+
+#ifdef TCP_KEEPCNT
+  if (setsockopt (fd, IPPROTO_TCP, TCP_KEEPCNT,
+                  &c_count, sizeof (c_count)) < 0)
+    goto error;
+#endif
+
+#ifdef TCP_USER_TIMEOUT
+  {
+    unsigned int timeout = (c_idle + c_interval * c_count) * 1000U;
+    if (setsockopt (fd, IPPROTO_TCP, TCP_USER_TIMEOUT,
+                    &timeout, sizeof (timeout)) < 0)
+      goto error;
+  }
+#endif
+
+  return SCM_UNDEFINED;
+
+ error:
+  guile_ssh_error1 (FUNC_NAME, strerror (errno),
+                    scm_list_4 (session, idle, interval, count));
+  return SCM_UNDEFINED;         /* Not reached. */
+}
+#undef FUNC_NAME
+
 
 /* Predicates */
 
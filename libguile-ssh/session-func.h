@@ -28,6 +28,16 @@ extern SCM guile_ssh_get_version (SCM arg1);
 extern SCM guile_ssh_is_connected_p (SCM arg1);
 extern SCM guile_ssh_connect_x (SCM arg1);
 extern SCM guile_ssh_authenticate_server (SCM arg1);
+extern SCM guile_ssh_get_fd (SCM session);
+extern SCM guile_ssh_get_peer_address (SCM session);
+extern SCM guile_ssh_get_poll_flags (SCM session);
+extern SCM guile_ssh_send_keepalive (SCM session);
+extern SCM gssh_session_ping (SCM session, SCM timeout);
+extern SCM gssh_session_set_tcp_keepalive (SCM session, SCM idle,
+                                          SCM interval, SCM count);
+extern SCM guile_ssh_connect_many (SCM sessions, SCM concurrency,
+                                   SCM timeout, SCM check_server_p,
+                                   SCM authenticate_p, SCM callback);
 
 extern void init_session_func (void);
 
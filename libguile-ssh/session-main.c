@@ -23,6 +23,7 @@
 #include "session-type.h"
 #include "session-func.h"
 #include "threads.h"
+#include "deadline.h"
 
 void
 init_session (void)
@@ -30,6 +31,7 @@ init_session (void)
   init_session_type ();
   init_session_func ();
   init_pthreads ();
+  init_deadline ();
 }
 
 /* session-main.c ends here */
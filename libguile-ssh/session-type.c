@@ -23,6 +23,8 @@
 #include <libguile.h>
 #include <libssh/libssh.h>
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #include "session-type.h"
 #include "channel-type.h"
@@ -36,10 +38,134 @@ static const char* GSSH_SESSION_TYPE_NAME = "session";
 
 scm_t_bits session_tag;	/* Smob tag. */
 
+
+/* Session reaper.
+
+   Disconnecting a session sends a packet to the peer and closes the socket,
+   which may block for a long time if the peer is dead.  To keep the garbage
+   collector from blocking, the GC'ed sessions are passed to a background
+   thread that disconnects and frees them.  If the queue of the thread is
+   full, a session is freed synchronously.
+
+   A session is queued only when the last reference to it is released (see
+   'gssh_session_unref'), that is, after the finalizers of all its child
+   objects have run, so the reaper thread never frees a libssh session that
+   is still used by a finalizer on the GC thread.  The mutex of the reaper
+   protects the reference counters as well. */
+
+enum { REAPER_QUEUE_SIZE = 1024 };
+
+static struct {
+  ssh_session     queue[REAPER_QUEUE_SIZE];
+  size_t          head;         /* Index of the first queued session. */
+  size_t          pending;      /* Number of queued sessions. */
+  int             started;      /* Whether the reaper thread is running. */
+
+  /* Statistics. */
+  unsigned long   queued;       /* Sessions passed to the reaper thread. */
+  unsigned long   reaped;       /* Sessions freed by the reaper thread. */
+  unsigned long   synchronous;  /* Sessions freed in the GC finalizer. */
+  size_t          max_pending;  /* Maximum length of the queue. */
+
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+} reaper = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+  .cond  = PTHREAD_COND_INITIALIZER
+};
+
+static void
+_free_ssh_session (ssh_session session)
+{
+  ssh_disconnect (session);
+  ssh_free (session);
+}
+
+static void *
+_reaper_thread (void *data)
+{
+  for (;;)
+    {
+      ssh_session session;
+
+      pthread_mutex_lock (&reaper.mutex);
+      while (reaper.pending == 0)
+        pthread_cond_wait (&reaper.cond, &reaper.mutex);
+      session = reaper.queue[reaper.head];
+      reaper.head = (reaper.head + 1) % REAPER_QUEUE_SIZE;
+      reaper.pending--;
+      pthread_mutex_unlock (&reaper.mutex);
+
+      _free_ssh_session (session);
+
+      pthread_mutex_lock (&reaper.mutex);
+      reaper.reaped++;
+      pthread_mutex_unlock (&reaper.mutex);
+    }
+
+  return NULL;
+}
+
+/* The reaper thread does not exist in a child process after 'fork'.  Drop
+   the queued sessions as they belong to the parent process. */
+static void
+_reaper_atfork_child (void)
+{
+  pthread_mutex_init (&reaper.mutex, NULL);
+  pthread_cond_init (&reaper.cond, NULL);
+  reaper.head    = 0;
+  reaper.pending = 0;
+  reaper.started = 0;
+}
+
+/* Pass a SESSION to the reaper thread, starting the thread if needed.
+   Return 1 on success, 0 if the session must be freed by the caller. */
+static int
+_reaper_enqueue (ssh_session session)
+{
+  int res = 0;
+
+  pthread_mutex_lock (&reaper.mutex);
+
+  if (! reaper.started)
+    {
+      pthread_t thread;
+      pthread_attr_t attr;
+
+      pthread_attr_init (&attr);
+      pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+      reaper.started = (pthread_create (&thread, &attr, _reaper_thread, NULL)
+                        == 0);
+      pthread_attr_destroy (&attr);
+    }
+
+  if (reaper.started && (reaper.pending < REAPER_QUEUE_SIZE))
+    {
+      reaper.queue[(reaper.head + reaper.pending) % REAPER_QUEUE_SIZE]
+        = session;
+      reaper.pending++;
+      reaper.queued++;
+      if (reaper.pending > reaper.max_pending)
+        reaper.max_pending = reaper.pending;
+      pthread_cond_signal (&reaper.cond);
+      res = 1;
+    }
+  else
+    {
+      reaper.synchronous++;
+    }
+
+  pthread_mutex_unlock (&reaper.mutex);
+
+  return res;
+}
+
+
 static SCM
 _mark (SCM session_smob)
 {
   gssh_session_t *sd = gssh_session_from_scm (session_smob);
+  scm_gc_mark (sd->channels);
   return sd->callbacks;
 }
 
@@ -49,8 +175,7 @@ _free (SCM session)
 {
   gssh_session_t *sd = (gssh_session_t *) SCM_SMOB_DATA (session);
 
-  ssh_disconnect (sd->ssh_session);
-  ssh_free (sd->ssh_session);
+  gssh_session_unref (sd->refs);
 
   SCM_SET_SMOB_DATA (session, NULL);
 
@@ -129,6 +254,11 @@ Create a new session.\
     return SCM_BOOL_F;
 
   session_data->callbacks = SCM_BOOL_F;
+  session_data->channels  = SCM_BOOL_F;
+
+  session_data->refs = scm_malloc (sizeof (gssh_session_refs_t));
+  session_data->refs->ssh_session = session_data->ssh_session;
+  session_data->refs->count       = 1;
 
   SCM_NEWSMOB (smob, session_tag, session_data);
 
@@ -146,6 +276,37 @@ Return #t if X is a SSH session, #f otherwise.\
   return scm_from_bool (SCM_SMOB_PREDICATE (session_tag, x));
 }
 
+SCM_DEFINE (guile_ssh_session_reaper_stats, "session-reaper-stats", 0, 0, 0,
+            (),
+            "\
+Get statistics of the thread that disconnects and frees GC'ed sessions as an\n\
+alist with the following keys: 'queued, 'reaped, 'synchronous, 'pending,\n\
+'max-pending.\
+")
+{
+  unsigned long queued, reaped, synchronous;
+  size_t pending, max_pending;
+
+  pthread_mutex_lock (&reaper.mutex);
+  queued      = reaper.queued;
+  reaped      = reaper.reaped;
+  synchronous = reaper.synchronous;
+  pending     = reaper.pending;
+  max_pending = reaper.max_pending;
+  pthread_mutex_unlock (&reaper.mutex);
+
+  return scm_list_5 (scm_cons (scm_from_locale_symbol ("queued"),
+                               scm_from_ulong (queued)),
+                     scm_cons (scm_from_locale_symbol ("reaped"),
+                               scm_from_ulong (reaped)),
+                     scm_cons (scm_from_locale_symbol ("synchronous"),
+                               scm_from_ulong (synchronous)),
+                     scm_cons (scm_from_locale_symbol ("pending"),
+                               scm_from_size_t (pending)),
+                     scm_cons (scm_from_locale_symbol ("max-pending"),
+                               scm_from_size_t (max_pending)));
+}
+
 
 /* Helper procedures  */
 
@@ -157,6 +318,39 @@ gssh_session_from_scm (SCM x)
   return (gssh_session_t *) SCM_SMOB_DATA (x);
 }
 
+/* Take a reference to the libssh session of a session SD for a child object
+   (an SFTP session, an SCP session or an SFTP file) whose finalizer uses the
+   libssh session.  The child must release the reference with
+   'gssh_session_unref' when the libssh session is not needed anymore.
+   Return the references structure. */
+gssh_session_refs_t*
+gssh_session_ref (gssh_session_t *sd)
+{
+  pthread_mutex_lock (&reaper.mutex);
+  sd->refs->count++;
+  pthread_mutex_unlock (&reaper.mutex);
+  return sd->refs;
+}
+
+/* Release a reference to a libssh session.  When the last reference is
+   released, pass the session to the reaper thread. */
+void
+gssh_session_unref (gssh_session_refs_t *refs)
+{
+  size_t count;
+
+  pthread_mutex_lock (&reaper.mutex);
+  count = --refs->count;
+  pthread_mutex_unlock (&reaper.mutex);
+
+  if (count == 0)
+    {
+      if (! _reaper_enqueue (refs->ssh_session))
+        _free_ssh_session (refs->ssh_session);
+      free (refs);
+    }
+}
+
 
 /* session smob initialization. */
 void
@@ -166,6 +360,8 @@ init_session_type (void)
                                     sizeof (gssh_session_t));
   set_smob_callbacks (session_tag, _mark, _free, _equalp, _print);
 
+  pthread_atfork (NULL, NULL, _reaper_atfork_child);
+
 #include "session-type.x"
 }
 
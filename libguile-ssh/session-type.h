@@ -26,9 +26,27 @@
 extern scm_t_bits session_tag;
 
 
+/* References to a libssh session.  The session smob holds one reference,
+   and so does each child object whose finalizer uses the libssh session (see
+   'gssh_session_ref'.)  The libssh session is freed when the last reference
+   is released.  The structure is not managed by the GC, so it can be used
+   from finalizers regardless of the order in which they are called. */
+struct gssh_session_refs {
+  ssh_session ssh_session;
+  size_t      count;
+};
+
+typedef struct gssh_session_refs gssh_session_refs_t;
+
 struct gssh_session {
   ssh_session ssh_session;
   SCM callbacks;
+  gssh_session_refs_t *refs;
+
+  /* A weak-value hash table that maps 'ssh_channel' addresses to the
+     channels that were accepted on the server side of the session, or #f
+     (see 'gssh_channel_register'.) */
+  SCM channels;
 };
 
 typedef struct gssh_session gssh_session_t;
@@ -44,11 +62,14 @@ typedef struct gssh_session gssh_session_t;
 
 extern SCM guile_ssh_make_session (void);
 extern SCM guile_ssh_is_session_p (SCM arg1);
+extern SCM guile_ssh_session_reaper_stats (void);
 
 extern void init_session_type (void);
 
 
 /* Helper procedures */
 extern gssh_session_t* gssh_session_from_scm (SCM x);
+extern gssh_session_refs_t* gssh_session_ref (gssh_session_t *sd);
+extern void gssh_session_unref (gssh_session_refs_t *refs);
 
 #endif  /* ifndef __SESSION_TYPE_H__ */
@@ -28,6 +28,7 @@
 #include "error.h"
 #include "sftp-session-type.h"
 #include "sftp-file-type.h"
+#include "deadline.h"
 
 
 static const char* GSSH_SFTP_FILE_TYPE_NAME = "sftp-file";
@@ -38,10 +39,125 @@ gssh_port_t sftp_file_tag;       /* Smob tag. */
 
 enum {
   DEFAULT_PORT_R_BUFSZ = 256,      /* Default read buffer size */
-  DEFAULT_PORT_W_BUFSZ = 1         /* Default write buffer size */
+  DEFAULT_PORT_W_BUFSZ = 1,        /* Default write buffer size */
+  MAX_ASYNC_READ_SZ = 32768        /* Maximum size of an async read request */
 };
 
 
+/* Helper procedures. */
+
+/* Receive the reply to a read request ID of an SFTP file FD into a buffer
+   DATA of COUNT bytes.  If there is a deadline, wait for the reply until the
+   deadline and return SSH_AGAIN if it did not arrive in time.  Return the
+   number of bytes read, 0 on EOF or a negative value on an error. */
+static ssize_t
+_sftp_async_read (gssh_sftp_file_t *fd, void *data, uint32_t count, int id)
+{
+  ssh_channel channel = fd->file->sftp->channel;
+  int timeout = gssh_deadline_remaining_ms ();
+  ssize_t res;
+
+  if (timeout < 0)
+    return sftp_async_read (fd->file, data, count, id);
+
+  /* In the non-blocking mode 'sftp_async_read' returns SSH_AGAIN when no
+     data is available on the channel.  Replies to other requests are queued
+     by libssh, so wait until the reply with the ID is received. */
+  sftp_file_set_nonblocking (fd->file);
+  for (;;)
+    {
+      res = sftp_async_read (fd->file, data, count, id);
+      if (res != SSH_AGAIN)
+        break;
+
+      timeout = gssh_deadline_remaining_ms ();
+      if (timeout <= 0)
+        break;
+
+      res = ssh_channel_poll_timeout (channel, timeout, 0);
+      if (res == SSH_ERROR || res == SSH_EOF)
+        break;
+      if (res == 0)
+        {
+          res = SSH_AGAIN;
+          break;
+        }
+    }
+  sftp_file_set_blocking (fd->file);
+
+  return res;
+}
+
+/* Drop the reply to a read request of an SFTP file FD that timed out
+   earlier.  The file offset is kept.  Throw 'guile-ssh-timeout' if the
+   reply did not arrive before the deadline. */
+static void
+_sftp_drop_pending_read (gssh_sftp_file_t *fd, SCM file, const char *proc)
+{
+  uint64_t offset = sftp_tell64 (fd->file);
+  char *buf = scm_malloc (fd->pending_count);
+  ssize_t res;
+
+  res = _sftp_async_read (fd, buf, fd->pending_count, fd->pending_id);
+  free (buf);
+
+  if (res == SSH_AGAIN)
+    guile_ssh_timeout_error1 (proc, "Timed out reading the file", file);
+
+  fd->pending_id = -1;
+
+  /* 'sftp_async_read' moves the offset back on a short read and sets the
+     EOF flag; both are reset by seeking. */
+  if (sftp_seek64 (fd->file, offset))
+    guile_ssh_error1 (proc, "Could not seek a file", file);
+}
+
+/* Read at most COUNT bytes from an SFTP file FD into a buffer DATA.  If there
+   is a deadline, the read request is sent asynchronously and the reply is
+   awaited until the deadline; 'guile-ssh-timeout' is thrown if no reply
+   arrived in time.  In that case the file offset is restored, so the next
+   read starts from the same position.  Return the number of bytes read, 0
+   on EOF or a negative value on an error. */
+static ssize_t
+_sftp_read (gssh_sftp_file_t *fd, void *data, size_t count, SCM file,
+            const char *proc)
+{
+  int timeout = gssh_deadline_remaining_ms ();
+  uint64_t offset;
+  ssize_t res;
+  int id;
+
+  if (timeout == 0)
+    guile_ssh_timeout_error1 (proc, "Deadline expired", file);
+
+  if (fd->pending_id >= 0)
+    _sftp_drop_pending_read (fd, file, proc);
+
+  if (timeout < 0)
+    return sftp_read (fd->file, data, count);
+
+  if (count > MAX_ASYNC_READ_SZ)
+    count = MAX_ASYNC_READ_SZ;
+
+  /* 'sftp_async_read_begin' advances the file offset. */
+  offset = sftp_tell64 (fd->file);
+  id = sftp_async_read_begin (fd->file, count);
+  if (id < 0)
+    return id;
+
+  res = _sftp_async_read (fd, data, count, id);
+  if (res == SSH_AGAIN)
+    {
+      fd->pending_id    = id;
+      fd->pending_count = count;
+      sftp_seek64 (fd->file, offset);
+      guile_ssh_timeout_error1 (proc, "Timed out reading the file", file);
+    }
+
+  return res;
+}
+
+
 /* Ptob callbacks. */
 
 #if USING_GUILE_BEFORE_2_2
@@ -56,7 +172,7 @@ ptob_fill_input (SCM file)
   scm_port *pt = SCM_PTAB_ENTRY (file);
   ssize_t res;
 
-  res = sftp_read (fd->file, pt->read_buf, pt->read_buf_size);
+  res = _sftp_read (fd, pt->read_buf, pt->read_buf_size, file, FUNC_NAME);
   if (! res)
     return EOF;
   else if (res < 0)
@@ -74,7 +190,11 @@ ptob_write (SCM file, const void* data, size_t sz)
 #define FUNC_NAME "ptob_write"
 {
   gssh_sftp_file_t *fd = gssh_sftp_file_from_scm (file);
-  ssize_t nwritten = sftp_write (fd->file, data, sz);
+  ssize_t nwritten;
+
+  gssh_deadline_check (FUNC_NAME, file);
+
+  nwritten = sftp_write (fd->file, data, sz);
   if (nwritten != sz)
     guile_ssh_error1 (FUNC_NAME, "Error writing the file", file);
 }
@@ -90,7 +210,7 @@ read_from_sftp_file_port (SCM file, SCM dst, size_t start, size_t count)
   gssh_sftp_file_t *fd = gssh_sftp_file_from_scm (file);
   ssize_t res;
 
-  res = sftp_read (fd->file, data, count);
+  res = _sftp_read (fd, data, count, file, FUNC_NAME);
   if (res < 0)
     guile_ssh_error1 (FUNC_NAME, "Error reading the file", file);
 
@@ -104,8 +224,11 @@ write_to_sftp_file_port (SCM file, SCM src, size_t start, size_t count)
 {
   char *data = (char *) SCM_BYTEVECTOR_CONTENTS (src) + start;
   gssh_sftp_file_t *fd = gssh_sftp_file_from_scm (file);
-  ssize_t nwritten = sftp_write (fd->file, data, count);
+  ssize_t nwritten;
 
+  gssh_deadline_check (FUNC_NAME, file);
+
+  nwritten = sftp_write (fd->file, data, count);
   if (nwritten < 0)
     guile_ssh_error1 (FUNC_NAME, "Error reading the file", file);
 
@@ -219,6 +342,9 @@ ptob_close (SCM sftp_file)
   if (fd)
     {
       sftp_close (fd->file);
+#if USING_GUILE_BEFORE_2_2
+      gssh_session_unref (fd->session_refs);
+#endif
     }
 
   SCM_SETSTREAM (sftp_file, NULL);
@@ -314,6 +440,8 @@ SCM_GSSH_DEFINE (gssh_sftp_open, "%gssh-sftp-open", 4,
   c_access_type = scm_to_uint (access_type);
   c_mode = scm_to_uint (mode);
 
+  gssh_deadline_check (FUNC_NAME, sftp_session);
+
   file = sftp_open (sftp_sd->sftp_session, c_path, c_access_type, c_mode);
   if (file == NULL)
     {
@@ -360,10 +488,18 @@ SCM
 make_gssh_sftp_file (const sftp_file file, const SCM name, SCM sftp_session)
 {
   SCM ptob;
+#if USING_GUILE_BEFORE_2_2
+  gssh_sftp_session_t *sftp_sd = gssh_sftp_session_from_scm (sftp_session);
+#endif
   gssh_sftp_file_t *fd = scm_gc_malloc (sizeof (gssh_sftp_file_t),
                                         GSSH_SFTP_FILE_TYPE_NAME);
   fd->sftp_session = sftp_session;
   fd->file         = file;
+  fd->pending_id   = -1;
+#if USING_GUILE_BEFORE_2_2
+  /* Guile 2.0 closes ports when they are GC'ed. */
+  fd->session_refs = gssh_session_ref (gssh_session_from_scm (sftp_sd->session));
+#endif
 
 #if USING_GUILE_BEFORE_2_2
   {
@@ -23,6 +23,7 @@
 
 #include <libguile.h>
 #include <libssh/sftp.h>
+#include "session-type.h"
 
 
 /* Smob data. */
@@ -30,7 +31,17 @@ struct gssh_sftp_file {
   /* Reference to the parent SFTP session. */
   SCM sftp_session;
 
+  /* Reference to the libssh session that is used when the file is closed
+     by the GC (only in Guile 2.0.) */
+  gssh_session_refs_t *session_refs;
+
   sftp_file file;
+
+  /* ID of a read request that timed out and whose reply is not received
+     yet, or -1.  The reply is dropped before the next read. */
+  int pending_id;
+  /* Size of the pending read request. */
+  uint32_t pending_count;
 };
 
 typedef struct gssh_sftp_file gssh_sftp_file_t;
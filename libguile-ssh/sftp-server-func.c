@@ -0,0 +1,1286 @@
+/* sftp-server-func.c -- SFTP server procedures.
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <libguile.h>
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include "common.h"
+#include "error.h"
+#include "sftp-server-type.h"
+#include "sftp-server-func.h"
+
+
+/* Maximum size of data that is sent in reply to a "read" request. */
+#define SFTP_SERVER_MAX_READ (64 * 1024)
+
+/* Maximum number of names that are sent in reply to a "readdir"
+   request. */
+#define SFTP_SERVER_MAX_NAMES 64
+
+/* SFTP status codes. */
+static gssh_symbol_t sftp_statuses[] = {
+  { "ok",                  SSH_FX_OK                  },
+  { "eof",                 SSH_FX_EOF                 },
+  { "no-such-file",        SSH_FX_NO_SUCH_FILE        },
+  { "permission-denied",   SSH_FX_PERMISSION_DENIED   },
+  { "failure",             SSH_FX_FAILURE             },
+  { "bad-message",         SSH_FX_BAD_MESSAGE         },
+  { "op-unsupported",      SSH_FX_OP_UNSUPPORTED      },
+  { "file-already-exists", SSH_FX_FILE_ALREADY_EXISTS },
+  { NULL,                  -1                         }
+};
+
+/* SFTP requests that are passed to Scheme. */
+static gssh_symbol_t sftp_requests[] = {
+  { "open",     SSH_FXP_OPEN     },
+  { "close",    SSH_FXP_CLOSE    },
+  { "read",     SSH_FXP_READ     },
+  { "write",    SSH_FXP_WRITE    },
+  { "lstat",    SSH_FXP_LSTAT    },
+  { "fstat",    SSH_FXP_FSTAT    },
+  { "setstat",  SSH_FXP_SETSTAT  },
+  { "fsetstat", SSH_FXP_FSETSTAT },
+  { "opendir",  SSH_FXP_OPENDIR  },
+  { "readdir",  SSH_FXP_READDIR  },
+  { "remove",   SSH_FXP_REMOVE   },
+  { "mkdir",    SSH_FXP_MKDIR    },
+  { "rmdir",    SSH_FXP_RMDIR    },
+  { "realpath", SSH_FXP_REALPATH },
+  { "stat",     SSH_FXP_STAT     },
+  { "rename",   SSH_FXP_RENAME   },
+  { "readlink", SSH_FXP_READLINK },
+  { "symlink",  SSH_FXP_SYMLINK  },
+  { NULL,       -1               }
+};
+
+
+/* Helper procedures. */
+
+/* Make an SFTP handle string that holds a handle number ID. */
+static ssh_string
+_handle_to_string (uint32_t id)
+{
+  ssh_string handle = ssh_string_new (sizeof (id));
+  if (handle)
+    ssh_string_fill (handle, &id, sizeof (id));
+  return handle;
+}
+
+/* Get a handle number from a HANDLE string into ID.  Return 1 on success,
+   0 if the handle is malformed. */
+static int
+_handle_from_string (ssh_string handle, uint32_t *id)
+{
+  if ((! handle) || (ssh_string_len (handle) != sizeof (*id)))
+    return 0;
+  memcpy (id, ssh_string_data (handle), sizeof (*id));
+  return 1;
+}
+
+static int
+_errno_to_status (int err)
+{
+  switch (err)
+    {
+    case ENOENT:
+    case ENOTDIR:
+      return SSH_FX_NO_SUCH_FILE;
+    case EACCES:
+    case EPERM:
+      return SSH_FX_PERMISSION_DENIED;
+    case EEXIST:
+      return SSH_FX_FILE_ALREADY_EXISTS;
+    default:
+      return SSH_FX_FAILURE;
+    }
+}
+
+static void
+_stat_to_attrs (const struct stat *st, struct sftp_attributes_struct *attr)
+{
+  memset (attr, 0, sizeof (*attr));
+  attr->flags = SSH_FILEXFER_ATTR_SIZE
+    | SSH_FILEXFER_ATTR_UIDGID
+    | SSH_FILEXFER_ATTR_PERMISSIONS
+    | SSH_FILEXFER_ATTR_ACMODTIME;
+  attr->size        = st->st_size;
+  attr->uid         = st->st_uid;
+  attr->gid         = st->st_gid;
+  attr->permissions = st->st_mode;
+  attr->atime       = st->st_atime;
+  attr->mtime       = st->st_mtime;
+}
+
+/* Format a "long name" of a file NAME in the format of "ls -l" (see
+   draft-ietf-secsh-filexfer-02, section 7) into a buffer BUF. */
+static void
+_format_longname (char *buf, size_t size, const char *name,
+                  const struct sftp_attributes_struct *attr)
+{
+  static const char *rwx = "rwxrwxrwx";
+  uint32_t perms = attr->permissions;
+  char mode[11];
+  char date[16] = "";
+  time_t mtime = attr->mtime;
+  struct tm tm;
+  int i;
+
+  switch (perms & S_IFMT)
+    {
+    case S_IFDIR:  mode[0] = 'd'; break;
+    case S_IFLNK:  mode[0] = 'l'; break;
+    case S_IFCHR:  mode[0] = 'c'; break;
+    case S_IFBLK:  mode[0] = 'b'; break;
+    case S_IFIFO:  mode[0] = 'p'; break;
+    case S_IFSOCK: mode[0] = 's'; break;
+    default:       mode[0] = '-'; break;
+    }
+  for (i = 0; i < 9; i++)
+    mode[i + 1] = (perms & (0400 >> i)) ? rwx[i] : '-';
+  mode[10] = '\0';
+
+  if (localtime_r (&mtime, &tm))
+    strftime (date, sizeof (date), "%b %e %H:%M", &tm);
+
+  snprintf (buf, size, "%s    1 %-8u %-8u %8llu %s %s",
+            mode, attr->uid, attr->gid, (unsigned long long) attr->size,
+            date, name);
+}
+
+/* Convert SFTP attributes ATTR to an alist. */
+static SCM
+_attrs_to_scm (sftp_attributes attr)
+{
+  SCM result = SCM_EOL;
+
+  if (! attr)
+    return result;
+
+  if (attr->flags & SSH_FILEXFER_ATTR_ACMODTIME)
+    {
+      result = scm_acons (scm_from_locale_symbol ("mtime"),
+                          scm_from_uint32 (attr->mtime), result);
+      result = scm_acons (scm_from_locale_symbol ("atime"),
+                          scm_from_uint32 (attr->atime), result);
+    }
+  if (attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS)
+    result = scm_acons (scm_from_locale_symbol ("permissions"),
+                        scm_from_uint32 (attr->permissions), result);
+  if (attr->flags & SSH_FILEXFER_ATTR_UIDGID)
+    {
+      result = scm_acons (scm_from_locale_symbol ("gid"),
+                          scm_from_uint32 (attr->gid), result);
+      result = scm_acons (scm_from_locale_symbol ("uid"),
+                          scm_from_uint32 (attr->uid), result);
+    }
+  if (attr->flags & SSH_FILEXFER_ATTR_SIZE)
+    result = scm_acons (scm_from_locale_symbol ("size"),
+                        scm_from_uint64 (attr->size), result);
+
+  return result;
+}
+
+static SCM
+_attrs_ref (SCM alist, const char *key)
+{
+  return scm_assq_ref (alist, scm_from_locale_symbol (key));
+}
+
+/* Convert an alist ALIST to SFTP attributes ATTR.  Only the attributes
+   that are present in the alist are set. */
+static void
+_scm_to_attrs (SCM alist, struct sftp_attributes_struct *attr)
+{
+  SCM size        = _attrs_ref (alist, "size");
+  SCM uid         = _attrs_ref (alist, "uid");
+  SCM gid         = _attrs_ref (alist, "gid");
+  SCM permissions = _attrs_ref (alist, "permissions");
+  SCM atime       = _attrs_ref (alist, "atime");
+  SCM mtime       = _attrs_ref (alist, "mtime");
+
+  memset (attr, 0, sizeof (*attr));
+
+  if (scm_is_true (size))
+    {
+      attr->size = scm_to_uint64 (size);
+      attr->flags |= SSH_FILEXFER_ATTR_SIZE;
+    }
+  if (scm_is_true (uid) && scm_is_true (gid))
+    {
+      attr->uid = scm_to_uint32 (uid);
+      attr->gid = scm_to_uint32 (gid);
+      attr->flags |= SSH_FILEXFER_ATTR_UIDGID;
+    }
+  if (scm_is_true (permissions))
+    {
+      attr->permissions = scm_to_uint32 (permissions);
+      attr->flags |= SSH_FILEXFER_ATTR_PERMISSIONS;
+    }
+  if (scm_is_true (atime) || scm_is_true (mtime))
+    {
+      attr->atime = scm_to_uint32 (scm_is_true (atime) ? atime : mtime);
+      attr->mtime = scm_to_uint32 (scm_is_true (mtime) ? mtime : atime);
+      attr->flags |= SSH_FILEXFER_ATTR_ACMODTIME;
+    }
+}
+
+static void *
+_get_client_message (void *data)
+{
+  return sftp_get_client_message ((sftp_session) data);
+}
+
+
+/* Requests that are handled by Scheme code. */
+
+static SCM
+_scm_from_path (const char *path)
+{
+  return path ? scm_from_locale_string (path) : scm_from_locale_string ("");
+}
+
+/* Convert a request MSG of TYPE to a list.  A handle is replaced with its
+   Scheme object.  Return SCM_UNDEFINED if the handle is not known. */
+static SCM
+_request_to_scm (gssh_sftp_server_t *ssd, sftp_client_message msg,
+                 SCM type)
+{
+  SCM object = SCM_BOOL_F;
+  uint32_t id;
+
+  if (msg->handle)
+    {
+      SCM key;
+      if (! _handle_from_string (msg->handle, &id))
+        return SCM_UNDEFINED;
+      key = scm_from_uint32 (id);
+      object = scm_hashv_ref (ssd->handles, key, SCM_UNDEFINED);
+      if (SCM_UNBNDP (object))
+        return SCM_UNDEFINED;
+      if (msg->type == SSH_FXP_CLOSE)
+        scm_hashv_remove_x (ssd->handles, key);
+    }
+
+  switch (msg->type)
+    {
+    case SSH_FXP_OPEN:
+      {
+        SCM flags = SCM_EOL;
+        SCM mode  = SCM_BOOL_F;
+        if (msg->flags & SSH_FXF_EXCL)
+          flags = scm_cons (scm_from_locale_symbol ("exclusive"), flags);
+        if (msg->flags & SSH_FXF_TRUNC)
+          flags = scm_cons (scm_from_locale_symbol ("truncate"), flags);
+        if (msg->flags & SSH_FXF_CREAT)
+          flags = scm_cons (scm_from_locale_symbol ("create"), flags);
+        if (msg->flags & SSH_FXF_APPEND)
+          flags = scm_cons (scm_from_locale_symbol ("append"), flags);
+        if (msg->flags & SSH_FXF_WRITE)
+          flags = scm_cons (scm_from_locale_symbol ("write"), flags);
+        if (msg->flags & SSH_FXF_READ)
+          flags = scm_cons (scm_from_locale_symbol ("read"), flags);
+        if (msg->attr && (msg->attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS))
+          mode = scm_from_uint32 (msg->attr->permissions & 07777);
+        return scm_list_4 (type, _scm_from_path (msg->filename), flags, mode);
+      }
+
+    case SSH_FXP_READ:
+      return scm_list_4 (type, object, scm_from_uint64 (msg->offset),
+                         scm_from_uint32 (msg->len));
+
+    case SSH_FXP_WRITE:
+      {
+        size_t len = msg->data ? ssh_string_len (msg->data) : 0;
+        SCM bv = scm_c_make_bytevector (len);
+        if (len)
+          memcpy (SCM_BYTEVECTOR_CONTENTS (bv), ssh_string_data (msg->data),
+                  len);
+        return scm_list_4 (type, object, scm_from_uint64 (msg->offset), bv);
+      }
+
+    case SSH_FXP_CLOSE:
+    case SSH_FXP_FSTAT:
+    case SSH_FXP_READDIR:
+      return scm_list_2 (type, object);
+
+    case SSH_FXP_FSETSTAT:
+      return scm_list_3 (type, object, _attrs_to_scm (msg->attr));
+
+    case SSH_FXP_SETSTAT:
+      return scm_list_3 (type, _scm_from_path (msg->filename),
+                         _attrs_to_scm (msg->attr));
+
+    case SSH_FXP_MKDIR:
+      {
+        SCM mode = SCM_BOOL_F;
+        if (msg->attr && (msg->attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS))
+          mode = scm_from_uint32 (msg->attr->permissions & 07777);
+        return scm_list_3 (type, _scm_from_path (msg->filename), mode);
+      }
+
+    case SSH_FXP_RENAME:
+    case SSH_FXP_SYMLINK:
+      return scm_list_3 (type, _scm_from_path (msg->filename),
+                         _scm_from_path (sftp_client_message_get_data (msg)));
+
+    default:
+      return scm_list_2 (type, _scm_from_path (msg->filename));
+    }
+}
+
+SCM_GSSH_DEFINE (gssh_sftp_server_get_request,
+                 "%gssh-sftp-server-get-request", 1,
+                 (SCM sftp_server))
+#define FUNC_NAME s_gssh_sftp_server_get_request
+{
+  gssh_sftp_server_t *ssd = gssh_sftp_server_from_scm (sftp_server);
+
+  /* A request that was not replied to is a bug in the file system, but the
+     client must get a reply anyway. */
+  if (ssd->message)
+    {
+      sftp_reply_status (ssd->message, SSH_FX_FAILURE, "Request not handled");
+      sftp_client_message_free (ssd->message);
+      ssd->message = NULL;
+    }
+
+  while (1)
+    {
+      sftp_client_message msg
+        = scm_without_guile (_get_client_message, ssd->sftp_session);
+      SCM type;
+      SCM request;
+
+      if (! msg)
+        return SCM_BOOL_F;
+
+      type = gssh_symbol_to_scm (sftp_requests, msg->type);
+      if (scm_is_false (type))
+        {
+          sftp_reply_status (msg, SSH_FX_OP_UNSUPPORTED,
+                             "Unsupported request");
+          sftp_client_message_free (msg);
+          continue;
+        }
+
+      request = _request_to_scm (ssd, msg, type);
+      if (SCM_UNBNDP (request))
+        {
+          sftp_reply_status (msg, SSH_FX_FAILURE, "Invalid handle");
+          sftp_client_message_free (msg);
+          continue;
+        }
+
+      ssd->message = msg;
+      return request;
+    }
+}
+#undef FUNC_NAME
+
+
+/* Replies to the current request. */
+
+static sftp_client_message
+_current_message (gssh_sftp_server_t *ssd, SCM sftp_server,
+                  const char *func_name)
+{
+  if (! ssd->message)
+    guile_ssh_error1 (func_name, "No request to reply to", sftp_server);
+  return ssd->message;
+}
+
+static void
+_finish_reply (gssh_sftp_server_t *ssd, SCM sftp_server, int res,
+               const char *func_name)
+{
+  sftp_client_message_free (ssd->message);
+  ssd->message = NULL;
+  if (res < 0)
+    guile_ssh_error1 (func_name, "Could not send a reply", sftp_server);
+}
+
+SCM_GSSH_DEFINE (gssh_sftp_server_reply_status,
+                 "%gssh-sftp-server-reply-status", 3,
+                 (SCM sftp_server, SCM status, SCM message))
+#define FUNC_NAME s_gssh_sftp_server_reply_status
+{
+  gssh_sftp_server_t *ssd = gssh_sftp_server_from_scm (sftp_server);
+  sftp_client_message msg;
+  const gssh_symbol_t *c_status;
+  char *c_message = NULL;
+  int res;
+
+  SCM_ASSERT (scm_is_symbol (status), status, SCM_ARG2, FUNC_NAME);
+  SCM_ASSERT (scm_is_string (message) || scm_is_false (message), message,
+              SCM_ARG3, FUNC_NAME);
+
+  c_status = gssh_symbol_from_scm (sftp_statuses, status);
+  if (! c_status)
+    guile_ssh_error1 (FUNC_NAME, "Wrong status", status);
+
+  msg = _current_message (ssd, sftp_server, FUNC_NAME);
+
+  scm_dynwind_begin (0);
+
+  if (scm_is_string (message))
+    {
+      c_message = scm_to_locale_string (message);
+      scm_dynwind_free (c_message);
+    }
+
+  res = sftp_reply_status (msg, c_status->value, c_message);
+  _finish_reply (ssd, sftp_server, res, FUNC_NAME);
+
+  scm_dynwind_end ();
+
+  return SCM_UNSPECIFIED;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_sftp_server_reply_handle,
+                 "%gssh-sftp-server-reply-handle", 2,
+                 (SCM sftp_server, SCM object))
+#define FUNC_NAME s_gssh_sftp_server_reply_handle
+{
+  gssh_sftp_server_t *ssd = gssh_sftp_server_from_scm (sftp_server);
+  sftp_client_message msg = _current_message (ssd, sftp_server, FUNC_NAME);
+  uint32_t id = ++ssd->next_handle;
+  ssh_string handle = _handle_to_string (id);
+  int res;
+
+  if (! handle)
+    guile_ssh_error1 (FUNC_NAME, "Could not allocate a handle", sftp_server);
+
+  scm_hashv_set_x (ssd->handles, scm_from_uint32 (id), object);
+  res = sftp_reply_handle (msg, handle);
+  ssh_string_free (handle);
+  _finish_reply (ssd, sftp_server, res, FUNC_NAME);
+
+  return SCM_UNSPECIFIED;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_sftp_server_reply_data,
+                 "%gssh-sftp-server-reply-data", 2,
+                 (SCM sftp_server, SCM data))
+#define FUNC_NAME s_gssh_sftp_server_reply_data
+{
+  gssh_sftp_server_t *ssd = gssh_sftp_server_from_scm (sftp_server);
+  sftp_client_message msg;
+  int res;
+
+  SCM_ASSERT (scm_is_bytevector (data), data, SCM_ARG2, FUNC_NAME);
+
+  msg = _current_message (ssd, sftp_server, FUNC_NAME);
+  res = sftp_reply_data (msg, SCM_BYTEVECTOR_CONTENTS (data),
+                         (int) SCM_BYTEVECTOR_LENGTH (data));
+  _finish_reply (ssd, sftp_server, res, FUNC_NAME);
+
+  return SCM_UNSPECIFIED;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_sftp_server_reply_attrs,
+                 "%gssh-sftp-server-reply-attrs", 2,
+                 (SCM sftp_server, SCM attrs))
+#define FUNC_NAME s_gssh_sftp_server_reply_attrs
+{
+  gssh_sftp_server_t *ssd = gssh_sftp_server_from_scm (sftp_server);
+  struct sftp_attributes_struct attr;
+  sftp_client_message msg;
+  int res;
+
+  SCM_ASSERT (scm_to_bool (scm_list_p (attrs)), attrs, SCM_ARG2, FUNC_NAME);
+
+  msg = _current_message (ssd, sftp_server, FUNC_NAME);
+  _scm_to_attrs (attrs, &attr);
+  res = sftp_reply_attr (msg, &attr);
+  _finish_reply (ssd, sftp_server, res, FUNC_NAME);
+
+  return SCM_UNSPECIFIED;
+}
+#undef FUNC_NAME
+
+SCM_GSSH_DEFINE (gssh_sftp_server_reply_names,
+                 "%gssh-sftp-server-reply-names", 2,
+                 (SCM sftp_server, SCM names))
+#define FUNC_NAME s_gssh_sftp_server_reply_names
+{
+  gssh_sftp_server_t *ssd = gssh_sftp_server_from_scm (sftp_server);
+  sftp_client_message msg;
+  int res = SSH_OK;
+
+  SCM_ASSERT (scm_to_bool (scm_list_p (names)), names, SCM_ARG2, FUNC_NAME);
+
+  msg = _current_message (ssd, sftp_server, FUNC_NAME);
+
+  scm_dynwind_begin (0);
+
+  for (; scm_is_pair (names); names = scm_cdr (names))
+    {
+      SCM entry = scm_car (names);
+      struct sftp_attributes_struct attr;
+      char longname[512];
+      char *name;
+
+      SCM_ASSERT (scm_is_pair (entry) && scm_is_string (scm_car (entry)),
+                  entry, SCM_ARG2, FUNC_NAME);
+
+      name = scm_to_locale_string (scm_car (entry));
+      scm_dynwind_free (name);
+      _scm_to_attrs (scm_cdr (entry), &attr);
+      _format_longname (longname, sizeof (longname), name, &attr);
+      if (sftp_reply_names_add (msg, name, longname, &attr) < 0)
+        {
+          res = SSH_ERROR;
+          break;
+        }
+    }
+
+  if (res == SSH_OK)
+    res = sftp_reply_names (msg);
+  _finish_reply (ssd, sftp_server, res, FUNC_NAME);
+
+  scm_dynwind_end ();
+
+  return SCM_UNSPECIFIED;
+}
+#undef FUNC_NAME
+
+
+/* Native file system.
+
+   Requests for a local directory are handled in C without entering Guile
+   mode, so a client that reads or writes large files is served at the
+   speed of the channel.
+
+   Client paths are normalized and then resolved with 'realpath', so a
+   symbolic link inside of the root cannot be used to reach files outside of
+   it.  Clients cannot create symbolic links. */
+
+struct native_handle {
+  int fd;
+  DIR *dir;
+};
+
+struct native_server {
+  sftp_session sftp_session;
+  /* The root directory without symbolic links. */
+  const char *root;
+  size_t root_len;
+  struct native_handle **handles;
+  uint32_t handle_count;
+  char *buffer;
+  unsigned long request_count;
+};
+
+/* Normalize a client PATH to an absolute path without "." and ".."
+   components, so it can never refer to a file outside of the root.
+   Return a newly allocated string. */
+static char *
+_normalize_path (const char *path)
+{
+  size_t n = 0;
+  char *result = malloc (strlen (path) + 2);
+
+  if (! result)
+    return NULL;
+
+  result[n++] = '/';
+  while (*path)
+    {
+      const char *start;
+      size_t len;
+
+      while (*path == '/')
+        path++;
+      start = path;
+      while (*path && (*path != '/'))
+        path++;
+      len = path - start;
+
+      if ((len == 0) || ((len == 1) && (start[0] == '.')))
+        continue;
+
+      if ((len == 2) && (start[0] == '.') && (start[1] == '.'))
+        {
+          if (n > 1)
+            {
+              while (result[n - 1] != '/')
+                n--;
+              if (n > 1)
+                n--;
+            }
+          continue;
+        }
+
+      if (n > 1)
+        result[n++] = '/';
+      memcpy (result + n, start, len);
+      n += len;
+    }
+  result[n] = '\0';
+
+  return result;
+}
+
+/* Map a client PATH to a local file name.  Return a newly allocated
+   string. */
+static char *
+_native_path (struct native_server *ns, const char *path)
+{
+  char *vpath = _normalize_path (path ? path : "");
+  char *result;
+
+  if (! vpath)
+    return NULL;
+
+  result = malloc (strlen (ns->root) + strlen (vpath) + 1);
+  if (result)
+    {
+      strcpy (result, ns->root);
+      if (strcmp (vpath, "/") != 0)
+        strcat (result, vpath);
+    }
+  free (vpath);
+  return result;
+}
+
+/* Check if a local file name PATH that has no symbolic links is the root
+   of a server NS or a file under it. */
+static int
+_native_under_root (struct native_server *ns, const char *path)
+{
+  if (ns->root_len == 1)        /* The root is "/". */
+    return 1;
+  return (strncmp (path, ns->root, ns->root_len) == 0)
+    && ((path[ns->root_len] == '\0') || (path[ns->root_len] == '/'));
+}
+
+/* Map a client PATH to a local file name without symbolic links.  If
+   FOLLOW is false, or the file does not exist, only the directory part of
+   the name is resolved and the last component is kept as is.  Return a
+   newly allocated string, or NULL with errno set on an error; errno is
+   EACCES if the resolved name is outside of the root of a server NS. */
+static char *
+_native_resolve (struct native_server *ns, const char *path, int follow)
+{
+  char *local = _native_path (ns, path);
+  char *result = NULL;
+
+  if (! local)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+  if (follow)
+    result = realpath (local, NULL);
+
+  if ((! result) && ((! follow) || (errno == ENOENT)))
+    {
+      if (strcmp (local, ns->root) == 0)
+        {
+          result = strdup (local);
+        }
+      else
+        {
+          char *name = strrchr (local, '/');
+          char *dir;
+
+          *name++ = '\0';
+          dir = realpath ((*local != '\0') ? local : "/", NULL);
+          if (dir)
+            {
+              result = malloc (strlen (dir) + strlen (name) + 2);
+              if (result)
+                sprintf (result, "%s/%s",
+                         (strcmp (dir, "/") == 0) ? "" : dir, name);
+              else
+                errno = ENOMEM;
+              free (dir);
+            }
+        }
+    }
+
+  free (local);
+
+  if (result && (! _native_under_root (ns, result)))
+    {
+      free (result);
+      result = NULL;
+      errno  = EACCES;
+    }
+
+  return result;
+}
+
+static int
+_native_handle_alloc (struct native_server *ns, int fd, DIR *dir,
+                      uint32_t *id)
+{
+  struct native_handle *h;
+  uint32_t idx;
+
+  for (idx = 0; idx < ns->handle_count; idx++)
+    if (! ns->handles[idx])
+      break;
+
+  if (idx == ns->handle_count)
+    {
+      uint32_t count = ns->handle_count ? ns->handle_count * 2 : 16;
+      struct native_handle **handles
+        = realloc (ns->handles, count * sizeof (*handles));
+      if (! handles)
+        return -1;
+      memset (handles + ns->handle_count, 0,
+              (count - ns->handle_count) * sizeof (*handles));
+      ns->handles      = handles;
+      ns->handle_count = count;
+    }
+
+  h = malloc (sizeof (*h));
+  if (! h)
+    return -1;
+  h->fd  = fd;
+  h->dir = dir;
+  ns->handles[idx] = h;
+  *id = idx;
+  return 0;
+}
+
+static struct native_handle *
+_native_handle_ref (struct native_server *ns, sftp_client_message msg,
+                    uint32_t *id)
+{
+  if ((! _handle_from_string (msg->handle, id))
+      || (*id >= ns->handle_count))
+    return NULL;
+  return ns->handles[*id];
+}
+
+static void
+_native_handle_free (struct native_server *ns, uint32_t id)
+{
+  struct native_handle *h = ns->handles[id];
+  if (h->dir)
+    closedir (h->dir);
+  else if (h->fd >= 0)
+    close (h->fd);
+  free (h);
+  ns->handles[id] = NULL;
+}
+
+static void
+_reply_errno (sftp_client_message msg)
+{
+  sftp_reply_status (msg, _errno_to_status (errno), strerror (errno));
+}
+
+static void
+_reply_new_handle (struct native_server *ns, sftp_client_message msg,
+                   int fd, DIR *dir)
+{
+  uint32_t id;
+  ssh_string handle;
+
+  if (_native_handle_alloc (ns, fd, dir, &id) < 0)
+    {
+      if (dir)
+        closedir (dir);
+      else
+        close (fd);
+      sftp_reply_status (msg, SSH_FX_FAILURE, "Could not allocate a handle");
+      return;
+    }
+
+  handle = _handle_to_string (id);
+  if (! handle)
+    {
+      _native_handle_free (ns, id);
+      sftp_reply_status (msg, SSH_FX_FAILURE, "Could not allocate a handle");
+      return;
+    }
+
+  sftp_reply_handle (msg, handle);
+  ssh_string_free (handle);
+}
+
+static int
+_native_setstat (const char *path, sftp_attributes attr)
+{
+  if (! attr)
+    return 0;
+
+  if ((attr->flags & SSH_FILEXFER_ATTR_SIZE)
+      && (truncate (path, attr->size) < 0))
+    return -1;
+  if ((attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS)
+      && (chmod (path, attr->permissions & 07777) < 0))
+    return -1;
+  if ((attr->flags & SSH_FILEXFER_ATTR_UIDGID)
+      && (chown (path, attr->uid, attr->gid) < 0))
+    return -1;
+  if (attr->flags & SSH_FILEXFER_ATTR_ACMODTIME)
+    {
+      struct timeval tv[2];
+      tv[0].tv_sec  = attr->atime;
+      tv[0].tv_usec = 0;
+      tv[1].tv_sec  = attr->mtime;
+      tv[1].tv_usec = 0;
+      if (utimes (path, tv) < 0)
+        return -1;
+    }
+  return 0;
+}
+
+/* Set the attributes ATTR of an open file FD. */
+static int
+_native_fsetstat (int fd, sftp_attributes attr)
+{
+  if (! attr)
+    return 0;
+
+  if ((attr->flags & SSH_FILEXFER_ATTR_SIZE)
+      && (ftruncate (fd, attr->size) < 0))
+    return -1;
+  if ((attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS)
+      && (fchmod (fd, attr->permissions & 07777) < 0))
+    return -1;
+  if ((attr->flags & SSH_FILEXFER_ATTR_UIDGID)
+      && (fchown (fd, attr->uid, attr->gid) < 0))
+    return -1;
+  if (attr->flags & SSH_FILEXFER_ATTR_ACMODTIME)
+    {
+      struct timespec ts[2];
+      ts[0].tv_sec  = attr->atime;
+      ts[0].tv_nsec = 0;
+      ts[1].tv_sec  = attr->mtime;
+      ts[1].tv_nsec = 0;
+      if (futimens (fd, ts) < 0)
+        return -1;
+    }
+  return 0;
+}
+
+static void
+_native_reply_stat (sftp_client_message msg, int res, struct stat *st)
+{
+  struct sftp_attributes_struct attr;
+
+  if (res < 0)
+    {
+      _reply_errno (msg);
+      return;
+    }
+
+  _stat_to_attrs (st, &attr);
+  sftp_reply_attr (msg, &attr);
+}
+
+static void
+_native_readdir (struct native_server *ns, sftp_client_message msg,
+                 struct native_handle *h)
+{
+  int count = 0;
+
+  while (count < SFTP_SERVER_MAX_NAMES)
+    {
+      struct dirent *entry = readdir (h->dir);
+      struct sftp_attributes_struct attr;
+      struct stat st;
+      char longname[512];
+
+      if (! entry)
+        break;
+
+      if (fstatat (h->fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        _stat_to_attrs (&st, &attr);
+      else
+        memset (&attr, 0, sizeof (attr));
+
+      _format_longname (longname, sizeof (longname), entry->d_name, &attr);
+      if (sftp_reply_names_add (msg, entry->d_name, longname, &attr) < 0)
+        break;
+      count++;
+    }
+
+  if (count == 0)
+    sftp_reply_status (msg, SSH_FX_EOF, NULL);
+  else
+    sftp_reply_names (msg);
+}
+
+static void
+_native_handle_request (struct native_server *ns, sftp_client_message msg)
+{
+  struct native_handle *h = NULL;
+  struct sftp_attributes_struct attr;
+  struct stat st;
+  uint32_t id = 0;
+  char *path = NULL;
+
+  switch (msg->type)
+    {
+    case SSH_FXP_CLOSE:
+    case SSH_FXP_READ:
+    case SSH_FXP_WRITE:
+    case SSH_FXP_FSTAT:
+    case SSH_FXP_FSETSTAT:
+    case SSH_FXP_READDIR:
+      h = _native_handle_ref (ns, msg, &id);
+      if (! h)
+        {
+          sftp_reply_status (msg, SSH_FX_FAILURE, "Invalid handle");
+          return;
+        }
+      break;
+
+    case SSH_FXP_OPEN:
+    case SSH_FXP_OPENDIR:
+    case SSH_FXP_STAT:
+    case SSH_FXP_SETSTAT:
+      path = _native_resolve (ns, msg->filename, 1);
+      if (! path)
+        {
+          _reply_errno (msg);
+          return;
+        }
+      break;
+
+    case SSH_FXP_LSTAT:
+    case SSH_FXP_REMOVE:
+    case SSH_FXP_MKDIR:
+    case SSH_FXP_RMDIR:
+    case SSH_FXP_RENAME:
+    case SSH_FXP_READLINK:
+      /* These requests operate on a symbolic link itself. */
+      path = _native_resolve (ns, msg->filename, 0);
+      if (! path)
+        {
+          _reply_errno (msg);
+          return;
+        }
+      break;
+    }
+
+  switch (msg->type)
+    {
+    case SSH_FXP_OPEN:
+      {
+        int flags;
+        int fd;
+        mode_t mode = 0644;
+
+        if ((msg->flags & SSH_FXF_READ) && (msg->flags & SSH_FXF_WRITE))
+          flags = O_RDWR;
+        else if (msg->flags & SSH_FXF_WRITE)
+          flags = O_WRONLY;
+        else
+          flags = O_RDONLY;
+        if (msg->flags & SSH_FXF_APPEND)
+          flags |= O_APPEND;
+        if (msg->flags & SSH_FXF_CREAT)
+          flags |= O_CREAT;
+        if (msg->flags & SSH_FXF_TRUNC)
+          flags |= O_TRUNC;
+        if (msg->flags & SSH_FXF_EXCL)
+          flags |= O_EXCL;
+        if (msg->attr && (msg->attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS))
+          mode = msg->attr->permissions & 07777;
+
+        /* The resolved path has no symbolic links unless the file has
+           been replaced meanwhile. */
+        fd = open (path, flags | O_NOFOLLOW, mode);
+        if (fd < 0)
+          break;
+        free (path);
+        _reply_new_handle (ns, msg, fd, NULL);
+        return;
+      }
+
+    case SSH_FXP_OPENDIR:
+      {
+        int fd = open (path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        DIR *dir;
+        if (fd < 0)
+          break;
+        dir = fdopendir (fd);
+        if (! dir)
+          {
+            int err = errno;
+            close (fd);
+            errno = err;
+            break;
+          }
+        free (path);
+        _reply_new_handle (ns, msg, fd, dir);
+        return;
+      }
+
+    case SSH_FXP_CLOSE:
+      _native_handle_free (ns, id);
+      sftp_reply_status (msg, SSH_FX_OK, NULL);
+      return;
+
+    case SSH_FXP_READ:
+      {
+        uint32_t len = (msg->len > SFTP_SERVER_MAX_READ)
+          ? SFTP_SERVER_MAX_READ
+          : msg->len;
+        ssize_t n = pread (h->fd, ns->buffer, len, (off_t) msg->offset);
+        if (n < 0)
+          _reply_errno (msg);
+        else if (n == 0)
+          sftp_reply_status (msg, SSH_FX_EOF, NULL);
+        else
+          sftp_reply_data (msg, ns->buffer, (int) n);
+        return;
+      }
+
+    case SSH_FXP_WRITE:
+      {
+        const char *data = ssh_string_data (msg->data);
+        size_t len = ssh_string_len (msg->data);
+        off_t offset = (off_t) msg->offset;
+        while (len > 0)
+          {
+            ssize_t n = pwrite (h->fd, data, len, offset);
+            if (n < 0)
+              {
+                if (errno == EINTR)
+                  continue;
+                _reply_errno (msg);
+                return;
+              }
+            data   += n;
+            len    -= n;
+            offset += n;
+          }
+        sftp_reply_status (msg, SSH_FX_OK, NULL);
+        return;
+      }
+
+    case SSH_FXP_READDIR:
+      if (! h->dir)
+        sftp_reply_status (msg, SSH_FX_FAILURE, "Not a directory handle");
+      else
+        _native_readdir (ns, msg, h);
+      return;
+
+    case SSH_FXP_LSTAT:
+      _native_reply_stat (msg, lstat (path, &st), &st);
+      free (path);
+      return;
+
+    case SSH_FXP_STAT:
+      _native_reply_stat (msg, stat (path, &st), &st);
+      free (path);
+      return;
+
+    case SSH_FXP_FSTAT:
+      _native_reply_stat (msg, fstat (h->fd, &st), &st);
+      return;
+
+    case SSH_FXP_SETSTAT:
+      if (_native_setstat (path, msg->attr) < 0)
+        break;
+      sftp_reply_status (msg, SSH_FX_OK, NULL);
+      free (path);
+      return;
+
+    case SSH_FXP_FSETSTAT:
+      if (_native_fsetstat (h->fd, msg->attr) < 0)
+        _reply_errno (msg);
+      else
+        sftp_reply_status (msg, SSH_FX_OK, NULL);
+      return;
+
+    case SSH_FXP_REMOVE:
+      if (unlink (path) < 0)
+        break;
+      sftp_reply_status (msg, SSH_FX_OK, NULL);
+      free (path);
+      return;
+
+    case SSH_FXP_MKDIR:
+      {
+        mode_t mode = 0755;
+        if (msg->attr && (msg->attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS))
+          mode = msg->attr->permissions & 07777;
+        if (mkdir (path, mode) < 0)
+          break;
+        sftp_reply_status (msg, SSH_FX_OK, NULL);
+        free (path);
+        return;
+      }
+
+    case SSH_FXP_RMDIR:
+      if (rmdir (path) < 0)
+        break;
+      sftp_reply_status (msg, SSH_FX_OK, NULL);
+      free (path);
+      return;
+
+    case SSH_FXP_REALPATH:
+      {
+        char *vpath = _normalize_path (msg->filename ? msg->filename : "");
+        if (! vpath)
+          {
+            sftp_reply_status (msg, SSH_FX_FAILURE, "Out of memory");
+            return;
+          }
+        memset (&attr, 0, sizeof (attr));
+        sftp_reply_name (msg, vpath, &attr);
+        free (vpath);
+        return;
+      }
+
+    case SSH_FXP_RENAME:
+      {
+        char *newpath
+          = _native_resolve (ns, sftp_client_message_get_data (msg), 0);
+        if ((! newpath) || (rename (path, newpath) < 0))
+          _reply_errno (msg);
+        else
+          sftp_reply_status (msg, SSH_FX_OK, NULL);
+        free (newpath);
+        free (path);
+        return;
+      }
+
+    case SSH_FXP_READLINK:
+      {
+        char target[4096];
+        ssize_t n = readlink (path, target, sizeof (target) - 1);
+        if (n < 0)
+          break;
+        target[n] = '\0';
+        memset (&attr, 0, sizeof (attr));
+        sftp_reply_name (msg, target, &attr);
+        free (path);
+        return;
+      }
+
+    case SSH_FXP_SYMLINK:
+      /* A link could point anywhere, and it could be swapped with a file
+         between the check and the use of a path, so clients cannot make
+         them. */
+      sftp_reply_status (msg, SSH_FX_PERMISSION_DENIED,
+                         "Symbolic links are not allowed");
+      return;
+
+    default:
+      sftp_reply_status (msg, SSH_FX_OP_UNSUPPORTED, "Unsupported request");
+      return;
+    }
+
+  /* A system call failed. */
+  _reply_errno (msg);
+  free (path);
+}
+
+static void *
+_native_serve (void *data)
+{
+  struct native_server *ns = data;
+  sftp_client_message msg;
+  uint32_t idx;
+
+  while ((msg = sftp_get_client_message (ns->sftp_session)) != NULL)
+    {
+      _native_handle_request (ns, msg);
+      sftp_client_message_free (msg);
+      ns->request_count++;
+    }
+
+  for (idx = 0; idx < ns->handle_count; idx++)
+    if (ns->handles[idx])
+      _native_handle_free (ns, idx);
+  free (ns->handles);
+
+  return NULL;
+}
+
+SCM_GSSH_DEFINE (gssh_sftp_server_serve_directory,
+                 "%gssh-sftp-server-serve-directory", 2,
+                 (SCM sftp_server, SCM root))
+#define FUNC_NAME s_gssh_sftp_server_serve_directory
+{
+  gssh_sftp_server_t *ssd = gssh_sftp_server_from_scm (sftp_server);
+  struct native_server ns;
+  char *c_root;
+  char *real_root;
+
+  SCM_ASSERT (scm_is_string (root), root, SCM_ARG2, FUNC_NAME);
+
+  scm_dynwind_begin (0);
+
+  c_root = scm_to_locale_string (root);
+  scm_dynwind_free (c_root);
+
+  /* Paths are checked against the root without symbolic links and trailing
+     slashes. */
+  real_root = realpath (c_root, NULL);
+  if (! real_root)
+    guile_ssh_error1 (FUNC_NAME, strerror (errno), root);
+  scm_dynwind_free (real_root);
+
+  ns.sftp_session  = ssd->sftp_session;
+  ns.root          = real_root;
+  ns.root_len      = strlen (real_root);
+  ns.handles       = NULL;
+  ns.handle_count  = 0;
+  ns.request_count = 0;
+  ns.buffer        = scm_malloc (SFTP_SERVER_MAX_READ);
+  scm_dynwind_free (ns.buffer);
+
+  scm_without_guile (_native_serve, &ns);
+
+  scm_dynwind_end ();
+
+  return scm_from_ulong (ns.request_count);
+}
+#undef FUNC_NAME
+
+
+/* Initialize SFTP server related functions. */
+void
+init_sftp_server_func (void)
+{
+#include "sftp-server-func.x"
+}
+
+/* sftp-server-func.c ends here. */
@@ -0,0 +1,35 @@
+/* Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SFTP_SERVER_FUNC_H__
+#define __SFTP_SERVER_FUNC_H__
+
+#include <libguile.h>
+
+extern SCM gssh_sftp_server_get_request (SCM sftp_server);
+extern SCM gssh_sftp_server_reply_status (SCM sftp_server, SCM status,
+                                          SCM message);
+extern SCM gssh_sftp_server_reply_handle (SCM sftp_server, SCM object);
+extern SCM gssh_sftp_server_reply_data (SCM sftp_server, SCM data);
+extern SCM gssh_sftp_server_reply_attrs (SCM sftp_server, SCM attrs);
+extern SCM gssh_sftp_server_reply_names (SCM sftp_server, SCM names);
+extern SCM gssh_sftp_server_serve_directory (SCM sftp_server, SCM root);
+
+extern void init_sftp_server_func (void);
+
+#endif /* ifndef __SFTP_SERVER_FUNC_H__ */
@@ -0,0 +1,35 @@
+/* sftp-server-main.c -- SFTP server initialization.
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include "threads.h"
+#include "sftp-server-type.h"
+#include "sftp-server-func.h"
+
+void
+init_sftp_server (void)
+{
+  init_sftp_server_type ();
+  init_sftp_server_func ();
+  init_pthreads ();
+}
+
+/* sftp-server-main.c ends here. */
@@ -0,0 +1,161 @@
+/* sftp-server-type.c -- SFTP server smob.
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <libguile.h>
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+#include "common.h"
+#include "error.h"
+#include "channel-type.h"
+#include "sftp-server-type.h"
+
+scm_t_bits sftp_server_tag;     /* Smob tag. */
+
+
+/* GC callbacks. */
+
+static SCM
+_mark (SCM sftp_server)
+{
+  gssh_sftp_server_t *ssd = gssh_sftp_server_from_scm (sftp_server);
+  scm_gc_mark (ssd->handles);
+  return ssd->channel;
+}
+
+static size_t
+_free (SCM sftp_server)
+{
+  gssh_sftp_server_t *ssd
+    = (gssh_sftp_server_t *) SCM_SMOB_DATA (sftp_server);
+
+  if (ssd->message)
+    sftp_client_message_free (ssd->message);
+
+  /* 'sftp_free' frees the channel of an SFTP session, but the channel is
+     owned by the channel smob. */
+  ssd->sftp_session->channel = NULL;
+  sftp_free (ssd->sftp_session);
+  return 0;
+}
+
+static SCM
+_equalp (SCM x1, SCM x2)
+{
+  gssh_sftp_server_t *ssd1 = gssh_sftp_server_from_scm (x1);
+  gssh_sftp_server_t *ssd2 = gssh_sftp_server_from_scm (x2);
+
+  if ((! ssd1) || (! ssd2))
+    return SCM_BOOL_F;
+  else if (ssd1 != ssd2)
+    return SCM_BOOL_F;
+  else
+    return SCM_BOOL_T;
+}
+
+/* Printing procedure. */
+static int
+_print (SCM sftp_server, SCM port, scm_print_state *pstate)
+{
+  scm_puts ("#<sftp-server ", port);
+  scm_display (_scm_object_hex_address (sftp_server), port);
+  scm_puts (">", port);
+  return 1;
+}
+
+
+SCM_GSSH_DEFINE (gssh_sftp_server_p, "%gssh-sftp-server?", 1, (SCM x))
+{
+  return scm_from_bool (SCM_SMOB_PREDICATE (sftp_server_tag, x));
+}
+
+
+struct server_init_args {
+  sftp_session sftp_session;
+  int res;
+};
+
+static void *
+_server_init (void *data)
+{
+  struct server_init_args *args = data;
+  args->res = sftp_server_init (args->sftp_session);
+  return NULL;
+}
+
+SCM_GSSH_DEFINE (gssh_make_sftp_server, "%gssh-make-sftp-server", 1,
+                 (SCM channel))
+#define FUNC_NAME s_gssh_make_sftp_server
+{
+  gssh_channel_t *cd = gssh_channel_from_scm (channel);
+  gssh_sftp_server_t *ssd;
+  struct server_init_args args;
+  sftp_session sftp;
+  SCM smob;
+
+  GSSH_VALIDATE_CHANNEL_DATA (cd, channel, FUNC_NAME);
+  GSSH_VALIDATE_OPEN_CHANNEL (channel, SCM_ARG1, FUNC_NAME);
+
+  sftp = sftp_server_new (ssh_channel_get_session (cd->ssh_channel),
+                          cd->ssh_channel);
+  if (! sftp)
+    guile_ssh_error1 (FUNC_NAME, "Could not create a SFTP server", channel);
+
+  ssd = (gssh_sftp_server_t *) scm_gc_malloc (sizeof (gssh_sftp_server_t),
+                                              "sftp server");
+  ssd->channel      = channel;
+  ssd->sftp_session = sftp;
+  ssd->message      = NULL;
+  ssd->handles      = scm_c_make_hash_table (31);
+  ssd->next_handle  = 0;
+
+  SCM_NEWSMOB (smob, sftp_server_tag, ssd);
+
+  /* Wait for the "init" packet from the client. */
+  args.sftp_session = sftp;
+  scm_without_guile (_server_init, &args);
+  if (args.res < 0)
+    guile_ssh_error1 (FUNC_NAME, "Could not initialize a SFTP server", channel);
+
+  return smob;
+}
+#undef FUNC_NAME
+
+
+gssh_sftp_server_t *
+gssh_sftp_server_from_scm (SCM x)
+{
+  scm_assert_smob_type (sftp_server_tag, x);
+  return (gssh_sftp_server_t *) SCM_SMOB_DATA (x);
+}
+
+void
+init_sftp_server_type (void)
+{
+  sftp_server_tag = scm_make_smob_type ("sftp server",
+                                        sizeof (gssh_sftp_server_t));
+  set_smob_callbacks (sftp_server_tag, _mark, _free, _equalp, _print);
+
+#include "sftp-server-type.x"
+}
+
+/* sftp-server-type.c ends here. */
@@ -0,0 +1,62 @@
+/* Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SFTP_SERVER_TYPE_H__
+#define __SFTP_SERVER_TYPE_H__
+
+#include <libguile.h>
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+
+
+extern scm_t_bits sftp_server_tag;
+
+
+/* Smob data. */
+struct gssh_sftp_server {
+  /* Reference to the channel that carries the "sftp" subsystem.  The
+     channel keeps the parent session from being freed by the GC. */
+  SCM channel;
+
+  sftp_session sftp_session;
+
+  /* The request that is being handled by Scheme code, or NULL. */
+  sftp_client_message message;
+
+  /* A hash table that maps handle numbers to the Scheme objects that are
+     returned by a virtual file system. */
+  SCM handles;
+  uint32_t next_handle;
+};
+
+typedef struct gssh_sftp_server gssh_sftp_server_t;
+
+
+extern SCM gssh_make_sftp_server (SCM channel);
+extern SCM gssh_sftp_server_p (SCM x);
+
+extern void init_sftp_server_type (void);
+
+
+/* Internal procedures */
+
+extern gssh_sftp_server_t *gssh_sftp_server_from_scm (SCM x);
+
+#endif  /* ifndef __SFTP_SERVER_TYPE_H__ */
+
+/* sftp-server-type.h ends here. */
@@ -21,6 +21,10 @@
 
 #include <config.h>
 
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
 /* Guile */
 #include <libguile.h>
 
@@ -32,12 +36,16 @@
 #include "common.h"
 #include "error.h"
 #include "sftp-session-type.h"
+#include "sha256.h"
+#include "deadline.h"
 
 
 SCM_GSSH_DEFINE (gssh_sftp_init, "%gssh-sftp-init", 1, (SCM sftp_session))
 #define FUNC_NAME s_gssh_sftp_init
 {
   gssh_sftp_session_t *sftp_sd = gssh_sftp_session_from_scm (sftp_session);
+  gssh_deadline_check (FUNC_NAME, sftp_session);
+
   if (sftp_init (sftp_sd->sftp_session))
     {
       guile_ssh_error1 (FUNC_NAME, "Could not initialize the SFTP session.",
@@ -71,6 +79,8 @@ SCM_GSSH_DEFINE (gssh_sftp_mkdir, "%gssh-sftp-mkdir", 3,
   c_dirname = scm_to_locale_string (dirname);
   scm_dynwind_free (c_dirname);
 
+  gssh_deadline_check (FUNC_NAME, sftp_session);
+
   if (sftp_mkdir (sftp_sd->sftp_session, c_dirname, scm_to_uint32 (mode)))
     {
       guile_ssh_error1 (FUNC_NAME, "Could not create a directory",
@@ -96,6 +106,8 @@ SCM_GSSH_DEFINE (gssh_sftp_rmdir, "%gssh-sftp-rmdir", 2,
   c_dirname = scm_to_locale_string (dirname);
   scm_dynwind_free (c_dirname);
 
+  gssh_deadline_check (FUNC_NAME, sftp_session);
+
   if (sftp_rmdir (sftp_sd->sftp_session, c_dirname))
     {
       guile_ssh_error1 (FUNC_NAME, "Could not remove a directory",
@@ -127,6 +139,8 @@ SCM_GSSH_DEFINE (gssh_sftp_mv, "%gssh-sftp-mv", 3,
   c_dest = scm_to_locale_string (dest);
   scm_dynwind_free (c_dest);
 
+  gssh_deadline_check (FUNC_NAME, sftp_session);
+
   if (sftp_rename (sftp_sd->sftp_session, c_source, c_dest))
     {
       guile_ssh_error1 (FUNC_NAME, "Could not move a file",
@@ -154,6 +168,8 @@ SCM_GSSH_DEFINE (gssh_sftp_chmod, "%gssh-sftp-chmod", 3,
   c_filename = scm_to_locale_string (filename);
   scm_dynwind_free (c_filename);
 
+  gssh_deadline_check (FUNC_NAME, sftp_session);
+
   if (sftp_chmod (sftp_sd->sftp_session, c_filename, scm_to_uint32 (mode)))
     {
       guile_ssh_error1 (FUNC_NAME, "Could not chmod a file",
@@ -186,6 +202,8 @@ SCM_GSSH_DEFINE (gssh_sftp_symlink, "%gssh-sftp-symlink", 3,
   c_dest = scm_to_locale_string (dest);
   scm_dynwind_free (c_dest);
 
+  gssh_deadline_check (FUNC_NAME, sftp_session);
+
   if (sftp_symlink (sftp_sd->sftp_session, c_target, c_dest))
     {
       guile_ssh_error1 (FUNC_NAME, "Could not create a symlink",
@@ -213,6 +231,8 @@ SCM_GSSH_DEFINE (gssh_sftp_readlink, "%gssh-sftp-readlink", 2,
   c_path = scm_to_locale_string (path);
   scm_dynwind_free (c_path);
 
+  gssh_deadline_check (FUNC_NAME, sftp_session);
+
   ret = sftp_readlink (sftp_sd->sftp_session, c_path);
 
   scm_dynwind_end ();
@@ -236,6 +256,8 @@ SCM_GSSH_DEFINE (gssh_sftp_unlink, "%gssh-sftp-unlink", 2,
   c_path = scm_to_locale_string (path);
   scm_dynwind_free (c_path);
 
+  gssh_deadline_check (FUNC_NAME, sftp_session);
+
   ret = sftp_unlink (sftp_sd->sftp_session, c_path);
   if (ret)
     {
@@ -284,6 +306,141 @@ SCM_GSSH_DEFINE (gssh_sftp_get_error, "%gssh-sftp-get-error", 1,
 }
 #undef FUNC_NAME
 
+
+SCM_GSSH_DEFINE (gssh_sftp_extensions, "%gssh-sftp-extensions", 1,
+                 (SCM sftp_session))
+{
+  gssh_sftp_session_t *sftp_sd = gssh_sftp_session_from_scm (sftp_session);
+  unsigned int count = sftp_extensions_get_count (sftp_sd->sftp_session);
+  SCM result = SCM_EOL;
+  unsigned int idx;
+
+  for (idx = count; idx > 0; --idx)
+    {
+      const char *name = sftp_extensions_get_name (sftp_sd->sftp_session,
+                                                   idx - 1);
+      const char *data = sftp_extensions_get_data (sftp_sd->sftp_session,
+                                                   idx - 1);
+      if (name)
+        {
+          result = scm_acons (scm_from_locale_string (name),
+                              data ? scm_from_locale_string (data) : SCM_BOOL_F,
+                              result);
+        }
+    }
+
+  return result;
+}
+
+
+SCM_GSSH_DEFINE (gssh_sha256_blocks, "%gssh-sha256-blocks", 3,
+                 (SCM bv, SCM count, SCM block_size))
+#define FUNC_NAME s_gssh_sha256_blocks
+{
+  const uint8_t *data;
+  size_t c_count;
+  size_t c_block_size;
+  size_t offset;
+  SCM result = SCM_EOL;
+
+  SCM_ASSERT (scm_is_bytevector (bv), bv, SCM_ARG1, FUNC_NAME);
+  SCM_ASSERT (scm_is_unsigned_integer (count, 0, SIZE_MAX), count,
+              SCM_ARG2, FUNC_NAME);
+  SCM_ASSERT (scm_is_unsigned_integer (block_size, 1, SIZE_MAX), block_size,
+              SCM_ARG3, FUNC_NAME);
+
+  c_count      = scm_to_size_t (count);
+  c_block_size = scm_to_size_t (block_size);
+
+  if (c_count > SCM_BYTEVECTOR_LENGTH (bv))
+    {
+      guile_ssh_error1 (FUNC_NAME, "Count is out of range",
+                        scm_list_2 (bv, count));
+    }
+
+  data = (const uint8_t *) SCM_BYTEVECTOR_CONTENTS (bv);
+
+  /* Hash the blocks from the last one to the first so the resulting list is
+     built in the right order without reversing. */
+  offset = (c_count / c_block_size) * c_block_size;
+  if (offset == c_count && offset > 0)
+    offset -= c_block_size;
+
+  while (c_count > 0)
+    {
+      uint8_t digest[GSSH_SHA256_DIGEST_SIZE];
+      char hex[GSSH_SHA256_HEX_SIZE];
+      gssh_sha256 (data + offset, c_count - offset, digest);
+      gssh_digest_to_hex (digest, GSSH_SHA256_DIGEST_SIZE, hex);
+      result = scm_cons (scm_from_locale_string (hex), result);
+      c_count = offset;
+      if (offset >= c_block_size)
+        offset -= c_block_size;
+    }
+
+  return result;
+}
+#undef FUNC_NAME
+
+/* Size of the buffer that is used to read a local file for hashing. */
+#define FILE_HASH_BUFFER_SIZE (1024 * 1024)
+
+static void
+_close_file (void *file)
+{
+  fclose ((FILE *) file);
+}
+
+SCM_GSSH_DEFINE (gssh_file_sha256, "%gssh-file-sha256", 1, (SCM filename))
+#define FUNC_NAME s_gssh_file_sha256
+{
+  gssh_sha256_ctx_t ctx;
+  uint8_t digest[GSSH_SHA256_DIGEST_SIZE];
+  char hex[GSSH_SHA256_HEX_SIZE];
+  char *c_filename;
+  uint8_t *buffer;
+  FILE *file;
+  size_t nread;
+
+  SCM_ASSERT (scm_is_string (filename), filename, SCM_ARG1, FUNC_NAME);
+
+  scm_dynwind_begin (0);
+
+  c_filename = scm_to_locale_string (filename);
+  scm_dynwind_free (c_filename);
+
+  file = fopen (c_filename, "rb");
+  if (! file)
+    {
+      guile_ssh_error1 (FUNC_NAME, "Could not open a file",
+                        scm_list_2 (filename,
+                                    scm_from_locale_string (strerror (errno))));
+    }
+  scm_dynwind_unwind_handler (_close_file, file, SCM_F_WIND_EXPLICITLY);
+
+  buffer = scm_malloc (FILE_HASH_BUFFER_SIZE);
+  scm_dynwind_free (buffer);
+
+  gssh_sha256_init (&ctx);
+  while ((nread = fread (buffer, 1, FILE_HASH_BUFFER_SIZE, file)) > 0)
+    gssh_sha256_update (&ctx, buffer, nread);
+
+  if (ferror (file))
+    {
+      guile_ssh_error1 (FUNC_NAME, "Could not read a file",
+                        scm_list_2 (filename,
+                                    scm_from_locale_string (strerror (errno))));
+    }
+
+  gssh_sha256_final (&ctx, digest);
+
+  scm_dynwind_end ();
+
+  gssh_digest_to_hex (digest, GSSH_SHA256_DIGEST_SIZE, hex);
+  return scm_from_locale_string (hex);
+}
+#undef FUNC_NAME
+
 
 void
 init_sftp_session_func (void)
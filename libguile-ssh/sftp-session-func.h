@@ -31,6 +31,9 @@ extern SCM gssh_sftp_symlink (SCM sftp_session, SCM target, SCM dest);
 extern SCM gssh_sftp_readlink (SCM sftp_session, SCM path);
 extern SCM gssh_sftp_unlink (SCM sftp_session, SCM path);
 extern SCM gssh_sftp_get_error (SCM sftp_session);
+extern SCM gssh_sftp_extensions (SCM sftp_session);
+extern SCM gssh_sha256_blocks (SCM bv, SCM count, SCM block_size);
+extern SCM gssh_file_sha256 (SCM filename);
 
 
 extern void init_sftp_session_func (void);
@@ -48,6 +48,7 @@ _free (SCM sftp_session)
     = (gssh_sftp_session_t *) SCM_SMOB_DATA (sftp_session);
 
   sftp_free (sftp_sd->sftp_session);
+  gssh_session_unref (sftp_sd->session_refs);
   return 0;
 }
 
@@ -113,6 +114,7 @@ make_gssh_sftp_session (sftp_session sftp_session, SCM session)
                                              "sftp session");
   sftp_sd->sftp_session = sftp_session;
   sftp_sd->session      = session;
+  sftp_sd->session_refs = gssh_session_ref (gssh_session_from_scm (session));
   SCM_NEWSMOB (smob, sftp_session_tag, sftp_sd);
   return smob;
 }
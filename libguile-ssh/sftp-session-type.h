@@ -22,6 +22,7 @@
 #include <libguile.h>
 #include <libssh/libssh.h>
 #include <libssh/sftp.h>
+#include "session-type.h"
 
 
 extern scm_t_bits sftp_session_tag;
@@ -33,6 +34,9 @@ struct gssh_sftp_session {
      to prevent the session from premature freeing by the GC. */
   SCM session;
 
+  /* Reference to the libssh session that is used by the finalizer. */
+  gssh_session_refs_t *session_refs;
+
   sftp_session sftp_session;
 };
 
@@ -0,0 +1,212 @@
+/* sha1.c -- SHA-1 message digest (FIPS 180-4) and HMAC-SHA1 (RFC 2104).
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* OpenSSH stores hashed host names in known hosts files as HMAC-SHA1 of the
+   name with a random salt.  Like SHA-256 (see "sha256.c"), the digest is
+   implemented here so that Guile-SSH does not depend on the crypto library
+   that libssh was built with.  SHA-1 is used only to match host names that
+   are already hashed in this way. */
+
+#include <config.h>
+#include <string.h>
+
+#include "sha1.h"
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* Process NBLOCKS consecutive 64-byte blocks from DATA. */
+static void
+sha1_transform (uint32_t state[5], const uint8_t *data, size_t nblocks)
+{
+  uint32_t w[80];
+  uint32_t a, b, c, d, e;
+  size_t blk;
+  int i;
+
+  for (blk = 0; blk < nblocks; ++blk, data += GSSH_SHA1_BLOCK_SIZE)
+    {
+      for (i = 0; i < 16; ++i)
+        {
+          w[i] = ((uint32_t) data[i * 4] << 24)
+            | ((uint32_t) data[i * 4 + 1] << 16)
+            | ((uint32_t) data[i * 4 + 2] << 8)
+            | ((uint32_t) data[i * 4 + 3]);
+        }
+
+      for (i = 16; i < 80; ++i)
+        w[i] = ROTL (w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+      a = state[0]; b = state[1]; c = state[2]; d = state[3]; e = state[4];
+
+      for (i = 0; i < 80; ++i)
+        {
+          uint32_t f, k, t;
+          if (i < 20)
+            {
+              f = (b & c) | (~b & d);
+              k = 0x5a827999;
+            }
+          else if (i < 40)
+            {
+              f = b ^ c ^ d;
+              k = 0x6ed9eba1;
+            }
+          else if (i < 60)
+            {
+              f = (b & c) | (b & d) | (c & d);
+              k = 0x8f1bbcdc;
+            }
+          else
+            {
+              f = b ^ c ^ d;
+              k = 0xca62c1d6;
+            }
+          t = ROTL (a, 5) + f + e + k + w[i];
+          e = d;
+          d = c;
+          c = ROTL (b, 30);
+          b = a;
+          a = t;
+        }
+
+      state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+      state[4] += e;
+    }
+}
+
+void
+gssh_sha1_init (gssh_sha1_ctx_t *ctx)
+{
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->state[4] = 0xc3d2e1f0;
+  ctx->length     = 0;
+  ctx->buffer_len = 0;
+}
+
+void
+gssh_sha1_update (gssh_sha1_ctx_t *ctx, const uint8_t *data, size_t len)
+{
+  ctx->length += len;
+
+  if (ctx->buffer_len)
+    {
+      size_t n = GSSH_SHA1_BLOCK_SIZE - ctx->buffer_len;
+      if (n > len)
+        n = len;
+      memcpy (ctx->buffer + ctx->buffer_len, data, n);
+      ctx->buffer_len += n;
+      data += n;
+      len  -= n;
+      if (ctx->buffer_len < GSSH_SHA1_BLOCK_SIZE)
+        return;
+      sha1_transform (ctx->state, ctx->buffer, 1);
+      ctx->buffer_len = 0;
+    }
+
+  if (len >= GSSH_SHA1_BLOCK_SIZE)
+    {
+      size_t nblocks = len / GSSH_SHA1_BLOCK_SIZE;
+      sha1_transform (ctx->state, data, nblocks);
+      data += nblocks * GSSH_SHA1_BLOCK_SIZE;
+      len  -= nblocks * GSSH_SHA1_BLOCK_SIZE;
+    }
+
+  if (len)
+    {
+      memcpy (ctx->buffer, data, len);
+      ctx->buffer_len = len;
+    }
+}
+
+void
+gssh_sha1_final (gssh_sha1_ctx_t *ctx, uint8_t digest[GSSH_SHA1_DIGEST_SIZE])
+{
+  uint64_t bit_len = ctx->length * 8;
+  int i;
+
+  ctx->buffer[ctx->buffer_len++] = 0x80;
+
+  if (ctx->buffer_len > GSSH_SHA1_BLOCK_SIZE - 8)
+    {
+      memset (ctx->buffer + ctx->buffer_len, 0,
+              GSSH_SHA1_BLOCK_SIZE - ctx->buffer_len);
+      sha1_transform (ctx->state, ctx->buffer, 1);
+      ctx->buffer_len = 0;
+    }
+
+  memset (ctx->buffer + ctx->buffer_len, 0,
+          GSSH_SHA1_BLOCK_SIZE - 8 - ctx->buffer_len);
+
+  for (i = 0; i < 8; ++i)
+    ctx->buffer[GSSH_SHA1_BLOCK_SIZE - 1 - i] = (uint8_t) (bit_len >> (i * 8));
+
+  sha1_transform (ctx->state, ctx->buffer, 1);
+
+  for (i = 0; i < 5; ++i)
+    {
+      digest[i * 4]     = (uint8_t) (ctx->state[i] >> 24);
+      digest[i * 4 + 1] = (uint8_t) (ctx->state[i] >> 16);
+      digest[i * 4 + 2] = (uint8_t) (ctx->state[i] >> 8);
+      digest[i * 4 + 3] = (uint8_t) (ctx->state[i]);
+    }
+}
+
+/* Calculate HMAC-SHA1 of LEN bytes of DATA with a KEY of KEY_LEN bytes. */
+void
+gssh_hmac_sha1 (const uint8_t *key, size_t key_len,
+                const uint8_t *data, size_t len,
+                uint8_t digest[GSSH_SHA1_DIGEST_SIZE])
+{
+  uint8_t block[GSSH_SHA1_BLOCK_SIZE];
+  uint8_t inner[GSSH_SHA1_DIGEST_SIZE];
+  gssh_sha1_ctx_t ctx;
+  int i;
+
+  memset (block, 0, sizeof (block));
+  if (key_len > GSSH_SHA1_BLOCK_SIZE)
+    {
+      gssh_sha1_init (&ctx);
+      gssh_sha1_update (&ctx, key, key_len);
+      gssh_sha1_final (&ctx, block);
+    }
+  else
+    {
+      memcpy (block, key, key_len);
+    }
+
+  for (i = 0; i < GSSH_SHA1_BLOCK_SIZE; ++i)
+    block[i] ^= 0x36;
+  gssh_sha1_init (&ctx);
+  gssh_sha1_update (&ctx, block, sizeof (block));
+  gssh_sha1_update (&ctx, data, len);
+  gssh_sha1_final (&ctx, inner);
+
+  for (i = 0; i < GSSH_SHA1_BLOCK_SIZE; ++i)
+    block[i] ^= 0x36 ^ 0x5c;
+  gssh_sha1_init (&ctx);
+  gssh_sha1_update (&ctx, block, sizeof (block));
+  gssh_sha1_update (&ctx, inner, sizeof (inner));
+  gssh_sha1_final (&ctx, digest);
+}
+
+/* sha1.c ends here. */
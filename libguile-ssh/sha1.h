@@ -0,0 +1,53 @@
+/* sha1.h -- SHA-1 message digest and HMAC-SHA1.
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SHA1_H__
+#define __SHA1_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  GSSH_SHA1_BLOCK_SIZE  = 64,
+  GSSH_SHA1_DIGEST_SIZE = 20
+};
+
+struct gssh_sha1_ctx {
+  uint32_t state[5];
+  uint64_t length;              /* Total length of the data in bytes. */
+  uint8_t  buffer[GSSH_SHA1_BLOCK_SIZE];
+  size_t   buffer_len;
+};
+
+typedef struct gssh_sha1_ctx gssh_sha1_ctx_t;
+
+extern void gssh_sha1_init (gssh_sha1_ctx_t *ctx);
+extern void gssh_sha1_update (gssh_sha1_ctx_t *ctx,
+                              const uint8_t *data, size_t len);
+extern void gssh_sha1_final (gssh_sha1_ctx_t *ctx,
+                             uint8_t digest[GSSH_SHA1_DIGEST_SIZE]);
+
+extern void gssh_hmac_sha1 (const uint8_t *key, size_t key_len,
+                            const uint8_t *data, size_t len,
+                            uint8_t digest[GSSH_SHA1_DIGEST_SIZE]);
+
+#endif /* ifndef __SHA1_H__ */
+
+/* sha1.h ends here. */
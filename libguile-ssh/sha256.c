@@ -0,0 +1,216 @@
+/* sha256.c -- SHA-256 message digest (FIPS 180-4).
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* libssh does not export its hashing primitives, and we do not want to
+   depend on a particular crypto library that libssh was built with, so
+   Guile-SSH carries its own small SHA-256 implementation.  It is used to
+   compare file contents with the output of "sha256sum" on a remote side. */
+
+#include <config.h>
+#include <string.h>
+
+#include "sha256.h"
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define CH(x, y, z)  (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x) (ROTR (x, 2)  ^ ROTR (x, 13) ^ ROTR (x, 22))
+#define EP1(x) (ROTR (x, 6)  ^ ROTR (x, 11) ^ ROTR (x, 25))
+#define SIG0(x) (ROTR (x, 7)  ^ ROTR (x, 18) ^ ((x) >> 3))
+#define SIG1(x) (ROTR (x, 17) ^ ROTR (x, 19) ^ ((x) >> 10))
+
+/* Process NBLOCKS consecutive 64-byte blocks from DATA.  Processing a run of
+   blocks in one call keeps the state in registers between the blocks, which
+   matters when we hash megabytes of file data at once. */
+static void
+sha256_transform (uint32_t state[8], const uint8_t *data, size_t nblocks)
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h;
+  size_t blk;
+  int i;
+
+  for (blk = 0; blk < nblocks; ++blk, data += GSSH_SHA256_BLOCK_SIZE)
+    {
+      for (i = 0; i < 16; ++i)
+        {
+          w[i] = ((uint32_t) data[i * 4] << 24)
+            | ((uint32_t) data[i * 4 + 1] << 16)
+            | ((uint32_t) data[i * 4 + 2] << 8)
+            | ((uint32_t) data[i * 4 + 3]);
+        }
+
+      for (i = 16; i < 64; ++i)
+        w[i] = SIG1 (w[i - 2]) + w[i - 7] + SIG0 (w[i - 15]) + w[i - 16];
+
+      a = state[0]; b = state[1]; c = state[2]; d = state[3];
+      e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+      for (i = 0; i < 64; ++i)
+        {
+          uint32_t t1 = h + EP1 (e) + CH (e, f, g) + K[i] + w[i];
+          uint32_t t2 = EP0 (a) + MAJ (a, b, c);
+          h = g;
+          g = f;
+          f = e;
+          e = d + t1;
+          d = c;
+          c = b;
+          b = a;
+          a = t1 + t2;
+        }
+
+      state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+      state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+void
+gssh_sha256_init (gssh_sha256_ctx_t *ctx)
+{
+  ctx->state[0] = 0x6a09e667;
+  ctx->state[1] = 0xbb67ae85;
+  ctx->state[2] = 0x3c6ef372;
+  ctx->state[3] = 0xa54ff53a;
+  ctx->state[4] = 0x510e527f;
+  ctx->state[5] = 0x9b05688c;
+  ctx->state[6] = 0x1f83d9ab;
+  ctx->state[7] = 0x5be0cd19;
+  ctx->length     = 0;
+  ctx->buffer_len = 0;
+}
+
+void
+gssh_sha256_update (gssh_sha256_ctx_t *ctx, const uint8_t *data, size_t len)
+{
+  ctx->length += len;
+
+  if (ctx->buffer_len)
+    {
+      size_t n = GSSH_SHA256_BLOCK_SIZE - ctx->buffer_len;
+      if (n > len)
+        n = len;
+      memcpy (ctx->buffer + ctx->buffer_len, data, n);
+      ctx->buffer_len += n;
+      data += n;
+      len  -= n;
+      if (ctx->buffer_len < GSSH_SHA256_BLOCK_SIZE)
+        return;
+      sha256_transform (ctx->state, ctx->buffer, 1);
+      ctx->buffer_len = 0;
+    }
+
+  if (len >= GSSH_SHA256_BLOCK_SIZE)
+    {
+      size_t nblocks = len / GSSH_SHA256_BLOCK_SIZE;
+      sha256_transform (ctx->state, data, nblocks);
+      data += nblocks * GSSH_SHA256_BLOCK_SIZE;
+      len  -= nblocks * GSSH_SHA256_BLOCK_SIZE;
+    }
+
+  if (len)
+    {
+      memcpy (ctx->buffer, data, len);
+      ctx->buffer_len = len;
+    }
+}
+
+void
+gssh_sha256_final (gssh_sha256_ctx_t *ctx,
+                   uint8_t digest[GSSH_SHA256_DIGEST_SIZE])
+{
+  uint64_t bit_len = ctx->length * 8;
+  int i;
+
+  ctx->buffer[ctx->buffer_len++] = 0x80;
+
+  if (ctx->buffer_len > GSSH_SHA256_BLOCK_SIZE - 8)
+    {
+      memset (ctx->buffer + ctx->buffer_len, 0,
+              GSSH_SHA256_BLOCK_SIZE - ctx->buffer_len);
+      sha256_transform (ctx->state, ctx->buffer, 1);
+      ctx->buffer_len = 0;
+    }
+
+  memset (ctx->buffer + ctx->buffer_len, 0,
+          GSSH_SHA256_BLOCK_SIZE - 8 - ctx->buffer_len);
+
+  for (i = 0; i < 8; ++i)
+    ctx->buffer[GSSH_SHA256_BLOCK_SIZE - 1 - i] = (uint8_t) (bit_len >> (i * 8));
+
+  sha256_transform (ctx->state, ctx->buffer, 1);
+
+  for (i = 0; i < 8; ++i)
+    {
+      digest[i * 4]     = (uint8_t) (ctx->state[i] >> 24);
+      digest[i * 4 + 1] = (uint8_t) (ctx->state[i] >> 16);
+      digest[i * 4 + 2] = (uint8_t) (ctx->state[i] >> 8);
+      digest[i * 4 + 3] = (uint8_t) (ctx->state[i]);
+    }
+}
+
+/* Calculate SHA-256 digest of LEN bytes of DATA. */
+void
+gssh_sha256 (const uint8_t *data, size_t len,
+             uint8_t digest[GSSH_SHA256_DIGEST_SIZE])
+{
+  gssh_sha256_ctx_t ctx;
+  gssh_sha256_init (&ctx);
+  gssh_sha256_update (&ctx, data, len);
+  gssh_sha256_final (&ctx, digest);
+}
+
+/* Convert a DIGEST of LEN bytes to a lowercase hex string.  HEX must have
+   room for LEN * 2 + 1 characters. */
+void
+gssh_digest_to_hex (const uint8_t *digest, size_t len, char *hex)
+{
+  static const char digits[] = "0123456789abcdef";
+  size_t idx;
+
+  for (idx = 0; idx < len; ++idx)
+    {
+      hex[idx * 2]     = digits[digest[idx] >> 4];
+      hex[idx * 2 + 1] = digits[digest[idx] & 0x0f];
+    }
+  hex[len * 2] = '\0';
+}
+
+/* sha256.c ends here. */
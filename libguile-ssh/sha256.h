@@ -0,0 +1,56 @@
+/* sha256.h -- SHA-256 message digest.
+ *
+ * Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+ *
+ * This file is part of Guile-SSH.
+ *
+ * Guile-SSH is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * Guile-SSH is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SHA256_H__
+#define __SHA256_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  GSSH_SHA256_BLOCK_SIZE  = 64,
+  GSSH_SHA256_DIGEST_SIZE = 32,
+  /* Size of a digest as a NUL-terminated hex string. */
+  GSSH_SHA256_HEX_SIZE    = GSSH_SHA256_DIGEST_SIZE * 2 + 1
+};
+
+struct gssh_sha256_ctx {
+  uint32_t state[8];
+  uint64_t length;              /* Total length of the data in bytes. */
+  uint8_t  buffer[GSSH_SHA256_BLOCK_SIZE];
+  size_t   buffer_len;
+};
+
+typedef struct gssh_sha256_ctx gssh_sha256_ctx_t;
+
+extern void gssh_sha256_init (gssh_sha256_ctx_t *ctx);
+extern void gssh_sha256_update (gssh_sha256_ctx_t *ctx,
+                                const uint8_t *data, size_t len);
+extern void gssh_sha256_final (gssh_sha256_ctx_t *ctx,
+                               uint8_t digest[GSSH_SHA256_DIGEST_SIZE]);
+
+extern void gssh_sha256 (const uint8_t *data, size_t len,
+                         uint8_t digest[GSSH_SHA256_DIGEST_SIZE]);
+extern void gssh_digest_to_hex (const uint8_t *digest, size_t len,
+                                char *hex);
+
+#endif /* ifndef __SHA256_H__ */
+
+/* sha256.h ends here. */
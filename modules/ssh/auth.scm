@@ -32,6 +32,13 @@
 ;;   userauth-gssapi!
 ;;   userauth-none!
 ;;   userauth-get-list
+;;   userauth-sequence!
+;;   userauth-method/public-key
+;;   %default-userauth-methods
+;;   make-userauth-cache
+;;   userauth-cache?
+;;   userauth-cache-ref
+;;   userauth-cache-flush!
 
 
 ;;; Code:
@@ -39,8 +46,13 @@
 (define-module (ssh auth)
   #:use-module (ice-9 popen)
   #:use-module (ice-9 rdelim)
+  #:use-module (ice-9 receive)
   #:use-module (ice-9 regex)
+  #:use-module (ice-9 threads)
+  #:use-module (srfi srfi-1)
+  #:use-module (srfi srfi-9)
   #:use-module (ssh log)
+  #:use-module (ssh key)
   #:use-module (ssh session)
   #:export (userauth-public-key!
             userauth-public-key/auto!
@@ -50,6 +62,13 @@
             userauth-gssapi!
             userauth-none!
             userauth-get-list
+            userauth-sequence!
+            userauth-method/public-key
+            %default-userauth-methods
+            make-userauth-cache
+            userauth-cache?
+            userauth-cache-ref
+            userauth-cache-flush!
             openssh-agent-start
             openssh-agent-info
             openssh-agent-setenv))
@@ -125,6 +144,172 @@
   "Setup openssh agent environment variables for the current user."
   (setenv "SSH_AUTH_SOCK" (caar (openssh-agent-info))))
 
+
+;;; Authentication method cache.
+
+;; Each rejected authentication attempt costs a round-trip to the server (and
+;; some servers delay failures on purpose), so the cache remembers the
+;; authentication method that succeeded last time for each (user host port)
+;; and 'userauth-sequence!' tries it first.  For 'public-key/auto' the cache
+;; remembers the key file that succeeded, as (public-key . FILE-NAME), so only
+;; that key is offered next time.
+
+(define-record-type <userauth-cache>
+  (%make-userauth-cache mutex table)
+  userauth-cache?
+  (mutex userauth-cache-mutex)          ; <mutex>
+  (table userauth-cache-table))         ; <hash-table>: (user host port) -> name
+
+(define (make-userauth-cache)
+  "Make a new cache of successful authentication methods."
+  (%make-userauth-cache (make-mutex) (make-hash-table)))
+
+(define (session-userauth-key session)
+  (list (false-if-exception (session-get session 'user))
+        (session-get session 'host)
+        (session-get session 'port)))
+
+(define (userauth-cache-ref cache session)
+  "Get the name of the authentication method that succeeded last time for
+the user, host and port of a SESSION from a CACHE, or #f if there is no such
+method."
+  (with-mutex (userauth-cache-mutex cache)
+    (hash-ref (userauth-cache-table cache) (session-userauth-key session))))
+
+(define (userauth-cache-set! cache session name)
+  (with-mutex (userauth-cache-mutex cache)
+    (if name
+        (hash-set! (userauth-cache-table cache)
+                   (session-userauth-key session) name)
+        (hash-remove! (userauth-cache-table cache)
+                      (session-userauth-key session)))))
+
+(define (userauth-cache-flush! cache)
+  "Drop all the entries from a CACHE.  Return value is undefined."
+  (with-mutex (userauth-cache-mutex cache)
+    (hash-clear! (userauth-cache-table cache))))
+
+(define (userauth-method/public-key file-name)
+  "Make an authentication method that uses the private key from a FILE-NAME.
+The name of the method is (public-key . FILE-NAME).  The method returns
+'error' if the key cannot be read."
+  (cons (cons 'public-key file-name)
+        (lambda (session)
+          (let ((key (private-key-from-file file-name)))
+            (if key
+                (userauth-public-key! session key)
+                'error)))))
+
+;; Private keys that are tried by 'userauth-public-key/auto!' in the SSH
+;; directory, in order.
+(define %default-identity-files '("id_ed25519" "id_ecdsa" "id_rsa"))
+
+(define (session-identity-files session)
+  "Get the list of the existing private key files that
+'userauth-public-key/auto!' would try for a SESSION."
+  (let* ((home    (or (getenv "HOME") (passwd:dir (getpwuid (getuid)))))
+         (ssh-dir (string-append home "/.ssh"))
+         (expand  (lambda (file-name)
+                    (cond
+                     ((string-prefix? "%d/" file-name)
+                      (string-append ssh-dir (substring file-name 2)))
+                     ((string-prefix? "~/" file-name)
+                      (string-append home (substring file-name 1)))
+                     (else
+                      file-name))))
+         (identity (false-if-exception (session-get session 'identity))))
+    (filter file-exists?
+            (delete-duplicates
+             (map expand
+                  (append (if (string? identity) (list identity) '())
+                          (map (lambda (name)
+                                 (string-append "%d/" name))
+                               %default-identity-files)))))))
+
+(define %default-userauth-methods
+  (list (cons 'agent           userauth-agent!)
+        (cons 'public-key/auto userauth-public-key/auto!)))
+
+(define* (userauth-sequence! session
+                             #:key
+                             (methods %default-userauth-methods)
+                             (cache   #f))
+  "Authenticate the user of a SESSION by trying METHODS in order until one of
+them succeeds.  METHODS is a list of (NAME . PROCEDURE) pairs, where NAME is
+any object that identifies the method and PROCEDURE is called with the
+SESSION as the argument and returns the result of authentication (see
+'userauth-password!'.)
+
+If a CACHE (see 'make-userauth-cache') is specified then the method that
+succeeded last time for the user, host and port of the SESSION is tried
+first, and the method that succeeds is stored in the CACHE.  With a CACHE,
+the 'userauth-public-key/auto!' method tries the default keys one by one, so
+the key file that succeeds is stored as (public-key . FILE-NAME).
+
+Return 'success', or the result of the last tried method.  Return 'again' as
+soon as a method returns it (in non-blocking mode.)"
+  (define (try method)
+    (catch 'guile-ssh-error
+      (lambda ()
+        ((cdr method) session))
+      (lambda args
+        (format-log 'rare "userauth-sequence!"
+                    "method ~a failed: ~a" (car method) args)
+        'error)))
+  (define (try-auto method)
+    ;; Try the keys of 'userauth-public-key/auto!' one by one to find out
+    ;; which one succeeds.  If no key can be read (e.g. the keys are
+    ;; encrypted), fall back to the METHOD itself.  Return the result and
+    ;; the name of the method to cache as two values.
+    (let loop ((files  (session-identity-files session))
+               (result 'error))
+      (if (null? files)
+          (if (eq? result 'error)
+              (values (try method) (car method))
+              (values result (car method)))
+          (let* ((key-method (userauth-method/public-key (car files)))
+                 (key-result (try key-method)))
+            (case key-result
+              ((success again)
+               (values key-result (car key-method)))
+              ((error)
+               (loop (cdr files) result))
+              (else
+               (loop (cdr files) key-result)))))))
+  (define (cached-method name)
+    (or (assoc name methods)
+        ;; A key file that was found by 'userauth-public-key/auto!'.
+        (and (pair? name)
+             (eq? (car name) 'public-key)
+             (string? (cdr name))
+             (userauth-method/public-key (cdr name)))))
+  (let* ((cached  (and cache (userauth-cache-ref cache session)))
+         (first   (and cached (cached-method cached)))
+         (methods (if first
+                      (cons first (delete first methods))
+                      methods)))
+    (let loop ((methods methods)
+               (result  'denied))
+      (if (null? methods)
+          (begin
+            (when first
+              (userauth-cache-set! cache session #f))
+            result)
+          (receive (result name)
+              (if (and cache
+                       (eq? (cdar methods) userauth-public-key/auto!))
+                  (try-auto (car methods))
+                  (values (try (car methods)) (caar methods)))
+            (case result
+              ((success)
+               (when cache
+                 (userauth-cache-set! cache session name))
+               result)
+              ((again)
+               result)
+              (else
+               (loop (cdr methods) result))))))))
+
 
 ;;;
 
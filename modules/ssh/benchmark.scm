@@ -0,0 +1,337 @@
+;;; benchmark.scm -- Measuring of the SSH channel throughput.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+
+;;; Commentary:
+
+;; This module contains procedures that measure the channel throughput for
+;; each cipher against a local server, so the fastest ciphers for the
+;; current machine can be preferred, and the rate of the server handshakes.
+;;
+;; The module exports:
+;;   %benchmark-ciphers
+;;   benchmark-cipher
+;;   benchmark-ciphers
+;;   cipher-preference-string
+;;   benchmark-handshakes
+;;
+;; See the Info documentation for the detailed description of these
+;; procedures.
+
+
+;;; Code:
+
+(define-module (ssh benchmark)
+  #:use-module (srfi srfi-1)
+  #:use-module (ice-9 threads)
+  #:use-module (rnrs bytevectors)
+  #:use-module (rnrs io ports)
+  #:use-module (ssh log)
+  #:use-module (ssh key)
+  #:use-module (ssh session)
+  #:use-module (ssh auth)
+  #:use-module (ssh channel)
+  #:use-module (ssh server)
+  #:use-module (ssh message)
+  #:export (%benchmark-ciphers
+            benchmark-cipher
+            benchmark-ciphers
+            cipher-preference-string
+            benchmark-handshakes))
+
+
+;;; Helper procedures.
+
+;; Ciphers that are benchmarked by default.  Ciphers that are not supported
+;; by the current libssh are skipped by 'benchmark-ciphers'.
+(define %benchmark-ciphers
+  '("chacha20-poly1305@openssh.com"
+    "aes128-gcm@openssh.com"
+    "aes256-gcm@openssh.com"
+    "aes128-ctr"
+    "aes192-ctr"
+    "aes256-ctr"
+    "aes128-cbc"
+    "aes192-cbc"
+    "aes256-cbc"))
+
+(define %loopback "127.0.0.1")
+
+(define (unused-port)
+  "Get a free TCP port number on the loopback interface."
+  (let ((sock (socket PF_INET SOCK_STREAM 0)))
+    (bind sock AF_INET INADDR_LOOPBACK 0)
+    (let ((port (sockaddr:port (getsockname sock))))
+      (close sock)
+      port)))
+
+(define (call-with-host-key host-key proc)
+  "Call a PROC with the file name of a HOST-KEY.  If HOST-KEY is #f, a
+temporary RSA key is made and deleted after the PROC returns."
+  (if host-key
+      (proc host-key)
+      (let* ((template  (string-copy "/tmp/guile-ssh-benchmark-XXXXXX"))
+             (port      (mkstemp! template))
+             (file-name (port-filename port)))
+        (close-port port)
+        (dynamic-wind
+          (lambda ()
+            (private-key-to-file (make-keypair 'rsa 2048) file-name))
+          (lambda ()
+            (proc file-name))
+          (lambda ()
+            (key-cache-flush! file-name)
+            (delete-file file-name))))))
+
+(define (channel-drain channel buffer)
+  "Read a CHANNEL until EOF.  Return the number of bytes read."
+  (let loop ((total 0))
+    (let ((count (get-bytevector-n! channel buffer 0
+                                    (bytevector-length buffer))))
+      (if (eof-object? count)
+          total
+          (loop (+ total count))))))
+
+(define (serve-sink server buffer-size)
+  "Accept a session on a SERVER, accept any authentication and a channel,
+and read the channel until EOF.  Return the number of bytes read, or #f on
+an error."
+  (let ((session (server-accept server)))
+    (catch 'guile-ssh-error
+      (lambda ()
+        (server-handle-key-exchange session)
+        (let loop ()
+          (let ((msg (server-message-get session)))
+            (cond
+             ((not msg)
+              (and (connected? session)
+                   (loop)))
+             ((eq? (car (message-get-type msg)) 'request-channel-open)
+              (let ((channel (message-channel-request-open-reply-accept msg)))
+                (let ((total (channel-drain channel
+                                            (make-bytevector buffer-size))))
+                  (close channel)
+                  (disconnect! session)
+                  total)))
+             (else
+              (message-reply-success msg)
+              (loop))))))
+      (lambda args
+        (format-log 'rare "serve-sink" "server error: ~a" args)
+        (disconnect! session)
+        #f))))
+
+(define (serve-handshakes server count)
+  "Accept up to COUNT sessions on a SERVER and do the key exchange for each
+of them.  Stop on the first failed handshake.  Return the number of
+successful handshakes."
+  (let loop ((done 0))
+    (if (< done count)
+        (let* ((session (server-accept server))
+               (ok?     (catch 'guile-ssh-error
+                          (lambda ()
+                            (server-handle-key-exchange session)
+                            #t)
+                          (lambda args
+                            (format-log 'rare "serve-handshakes"
+                                        "server error: ~a" args)
+                            #f))))
+          (disconnect! session)
+          (if ok?
+              (loop (1+ done))
+              done))
+        done)))
+
+(define (stop-server-thread thread port)
+  "Wait for a server THREAD that serves a local PORT.  If the thread is still
+waiting in 'server-accept' because the client failed before connecting,
+unblock it with a dummy TCP connection first."
+  (unless (thread-exited? thread)
+    (let ((sock (socket PF_INET SOCK_STREAM 0)))
+      (catch 'system-error
+        (lambda ()
+          (connect sock AF_INET INADDR_LOOPBACK port))
+        (const #f))
+      (close sock)))
+  (join-thread thread))
+
+(define (channel-fill channel buffer total)
+  "Write TOTAL bytes from a BUFFER to a CHANNEL."
+  (let loop ((done 0))
+    (when (< done total)
+      (let ((count (min (bytevector-length buffer) (- total done))))
+        (put-bytevector channel buffer 0 count)
+        (loop (+ done count)))))
+  (force-output channel))
+
+
+;;; Public API.
+
+(define* (benchmark-cipher cipher
+                           #:key
+                           (host-key    #f)
+                           (bytes       (* 64 1024 1024))
+                           (buffer-size (* 32 1024)))
+  "Measure the client-to-server throughput of a channel that uses a CIPHER.
+The CIPHER is set for both directions of the connection, but the data is
+only sent from the client to a local server that is made with 'make-server'
+and uses the HOST-KEY (a temporary RSA key is made if HOST-KEY is #f.)
+BYTES is the amount of data to send, BUFFER-SIZE is the size of each write.
+
+Return the throughput in bytes per second.  Throw 'guile-ssh-error' if the
+cipher cannot be used."
+  (call-with-host-key host-key
+    (lambda (host-key)
+      (let* ((port    (unused-port))
+             ;; The client session is made first, so an unsupported CIPHER
+             ;; is reported before the server thread is started.
+             (session (make-session #:host          %loopback
+                                    #:port          port
+                                    #:user          "benchmark"
+                                    #:knownhosts    "/dev/null"
+                                    #:ciphers-c-s   cipher
+                                    #:ciphers-s-c   cipher
+                                    #:timeout       10
+                                    #:log-verbosity 'nolog))
+             (server  (make-server #:bindaddr      %loopback
+                                   #:bindport      port
+                                   #:rsakey        host-key
+                                   #:log-verbosity 'nolog)))
+        (server-listen server)
+        (let ((thread (call-with-new-thread
+                       (lambda ()
+                         (serve-sink server buffer-size)))))
+          (dynamic-wind
+            (const #t)
+            (lambda ()
+              (unless (eq? (connect! session) 'ok)
+                (throw 'guile-ssh-error "benchmark-cipher: Could not connect"
+                       cipher (get-error session)))
+              (unless (eq? (userauth-none! session) 'success)
+                (throw 'guile-ssh-error
+                       "benchmark-cipher: Could not authenticate" cipher))
+              (let ((channel (make-channel session))
+                    (buffer  (make-bytevector buffer-size 0)))
+                (channel-open-session channel)
+                (let ((start (get-internal-real-time)))
+                  (channel-fill channel buffer bytes)
+                  (channel-send-eof channel)
+                  (let ((received (join-thread thread)))
+                    (unless (eqv? received bytes)
+                      (throw 'guile-ssh-error
+                             "benchmark-cipher: Data was not received"
+                             cipher received))
+                    (/ (exact->inexact bytes)
+                       (max 1/1000
+                            (/ (- (get-internal-real-time) start)
+                               internal-time-units-per-second)))))))
+            (lambda ()
+              (when (connected? session)
+                (disconnect! session))
+              (stop-server-thread thread port))))))))
+
+(define* (benchmark-ciphers #:key
+                            (ciphers     %benchmark-ciphers)
+                            (host-key    #f)
+                            (bytes       (* 64 1024 1024))
+                            (buffer-size (* 32 1024)))
+  "Benchmark each of CIPHERS with 'benchmark-cipher'.  Return an alist of
+(CIPHER . BYTES-PER-SECOND) pairs sorted by the throughput, the fastest
+cipher goes first.  Ciphers that cannot be used are not included."
+  (call-with-host-key host-key
+    (lambda (host-key)
+      (sort (filter-map
+             (lambda (cipher)
+               (catch 'guile-ssh-error
+                 (lambda ()
+                   (cons cipher
+                         (benchmark-cipher cipher
+                                           #:host-key    host-key
+                                           #:bytes       bytes
+                                           #:buffer-size buffer-size)))
+                 (lambda args
+                   (format-log 'rare "benchmark-ciphers"
+                               "skipping ~a: ~a" cipher args)
+                   #f)))
+             ciphers)
+            (lambda (a b)
+              (> (cdr a) (cdr b)))))))
+
+(define* (cipher-preference-string #:optional (results (benchmark-ciphers)))
+  "Make a cipher preference string that is suitable for 'ciphers-c-s' and
+'ciphers-s-c' session options from benchmark RESULTS (see
+'benchmark-ciphers'.)  The fastest cipher goes first."
+  (string-join (map car (sort results (lambda (a b)
+                                         (> (cdr a) (cdr b)))))
+               ","))
+
+(define* (benchmark-handshakes #:key
+                               (host-key #f)
+                               (count    100))
+  "Measure the rate of the SSH handshakes (the key exchange) of a local server
+that is made with 'make-server' and uses the HOST-KEY (a temporary RSA key is
+made if HOST-KEY is #f.)  The host key is parsed once before the benchmark,
+so the libssh must support host key objects.  COUNT is the number of the
+handshakes to make.
+
+Return the number of handshakes per second.  Throw 'guile-ssh-error' on an
+error, or if the libssh does not support host key objects."
+  (call-with-host-key host-key
+    (lambda (host-key)
+      (let* ((port   (unused-port))
+             (key    (private-key-from-file host-key))
+             (server (make-server #:bindaddr      %loopback
+                                  #:bindport      port
+                                  #:log-verbosity 'nolog)))
+        (server-set! server 'hostkey key)
+        (server-listen server)
+        (let ((thread (call-with-new-thread
+                       (lambda ()
+                         (serve-handshakes server count))))
+              (start  (get-internal-real-time)))
+          (dynamic-wind
+            (const #t)
+            (lambda ()
+              (let loop ((n 0))
+                (when (< n count)
+                  (let ((session (make-session #:host          %loopback
+                                               #:port          port
+                                               #:user          "benchmark"
+                                               #:knownhosts    "/dev/null"
+                                               #:timeout       10
+                                               #:log-verbosity 'nolog)))
+                    (unless (eq? (connect! session) 'ok)
+                      (throw 'guile-ssh-error
+                             "benchmark-handshakes: Could not connect"
+                             (get-error session)))
+                    (disconnect! session)
+                    (loop (1+ n)))))
+              (let ((done (join-thread thread)))
+                (unless (eqv? done count)
+                  (throw 'guile-ssh-error
+                         "benchmark-handshakes: Handshakes failed"
+                         (- count done)))
+                (/ (exact->inexact count)
+                   (max 1/1000
+                        (/ (- (get-internal-real-time) start)
+                           internal-time-units-per-second)))))
+            (lambda ()
+              (stop-server-thread thread port))))))))
+
+;;; benchmark.scm ends here.
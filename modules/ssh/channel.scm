@@ -41,6 +41,9 @@
 ;;   channel-open?
 ;;   channel-send-eof
 ;;   channel-eof?
+;;   channel-exec-process
+;;   channel-exec-command
+;;   channel-exec-shell
 
 
 ;;; Code:
@@ -68,7 +71,13 @@
             channel-get-exit-status
             channel-open?
             channel-send-eof
-            channel-eof?))
+            channel-eof?
+            channel-exec-process
+            channel-exec-command
+            channel-exec-shell
+
+            ;; Low-level procedures
+            %gssh-poll-fds))
 
 (define* (make-channel session #:optional (mode OPEN_BOTH))
   (cond
@@ -122,6 +131,39 @@ channel; you may still read from it but not write.  Throw 'guile-ssh-error' on
 an error.  Return value is undefined."
   (%channel-send-eof channel))
 
+
+;;; Bridging of channels to local processes.
+
+(define* (channel-exec-process channel argv #:key (environment #f))
+  "Run a local process with ARGV (a list of strings; the first element is an
+absolute file name of the program) and connect its standard input, output
+and error to a CHANNEL.  The data is copied in C, without passing through
+Scheme ports.  ENVIRONMENT, if specified, is a list of \"NAME=VALUE\"
+strings that replaces the environment of the process.  Other file
+descriptors of the current process are not inherited by the process.
+
+Block until the process closes its output, then send its exit status (or the
+signal that killed it) and EOF to the channel.  Return the exit status, or
+128 plus the signal number if the process was killed by a signal.  Throw
+'guile-ssh-error' on an error."
+  (%gssh-channel-exec-process channel argv environment))
+
+(define* (channel-exec-command channel command
+                               #:key (shell "/bin/sh") (environment #f))
+  "Run a COMMAND string with a SHELL and connect the process to a CHANNEL, as
+an \"exec\" request expects.  See 'channel-exec-process' for the description
+of ENVIRONMENT and of the return value."
+  (channel-exec-process channel (list shell "-c" command)
+                        #:environment environment))
+
+(define* (channel-exec-shell channel
+                             #:key (shell "/bin/sh") (environment #f))
+  "Run an interactive SHELL and connect it to a CHANNEL, as a \"shell\"
+request expects.  See 'channel-exec-process' for the description of
+ENVIRONMENT and of the return value."
+  (channel-exec-process channel (list shell "-i")
+                        #:environment environment))
+
 ;;;
 
 
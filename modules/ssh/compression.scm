@@ -0,0 +1,223 @@
+;;; compression.scm -- Adaptive selection of the compression level.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+
+;;; Commentary:
+
+;; This module contains a compression advisor that keeps a per-host history
+;; of the measured transfers and suggests the compression level for the next
+;; session to a host.  Compression helps on slow links and hurts on fast
+;; ones, so the advisor tries several levels and then prefers the one with
+;; the best effective throughput.
+;;
+;; libssh negotiates compression only during the key exchange and does not
+;; allow to start a key re-exchange on demand, so a suggested level is
+;; applied to new sessions.
+;;
+;; The module exports:
+;;   compression-advisor?
+;;   make-compression-advisor
+;;   compression-suggest
+;;   compression-record!
+;;   compression-history
+;;   make-session/adaptive
+;;   call-with-measured-transfer
+;;
+;; See the Info documentation for the detailed description of these
+;; procedures.
+
+
+;;; Code:
+
+(define-module (ssh compression)
+  #:use-module (srfi srfi-1)
+  #:use-module (srfi srfi-9)
+  #:use-module (ice-9 threads)
+  #:use-module (ssh session)
+  #:export (compression-advisor?
+            make-compression-advisor
+            compression-suggest
+            compression-record!
+            compression-history
+            make-session/adaptive
+            call-with-measured-transfer))
+
+
+;;; Advisor type.
+
+;; A measured transfer.
+(define-record-type <sample>
+  (make-sample level bytes seconds cpu-seconds)
+  sample?
+  (level       sample-level)            ; <number>, 0 means no compression
+  (bytes       sample-bytes)            ; <number>
+  (seconds     sample-seconds)          ; <number>
+  (cpu-seconds sample-cpu-seconds))     ; <number>
+
+(define-record-type <compression-advisor>
+  (%make-compression-advisor levels history-size cpu-limit
+                             mutex history sessions)
+  compression-advisor?
+  (levels       compression-advisor-levels)       ; <list> of <number>
+  (history-size compression-advisor-history-size) ; <number>
+  (cpu-limit    compression-advisor-cpu-limit)    ; <number>
+  (mutex        compression-advisor-mutex)        ; <mutex>
+  (history      compression-advisor-history)      ; <hash-table>: host -> list
+  (sessions     compression-advisor-sessions))    ; <weak-hash-table>
+
+
+;;; Helper procedures.
+
+(define (sample-throughput sample)
+  (/ (sample-bytes sample)
+     (max (sample-seconds sample) 1/1000)))
+
+(define (sample-cpu-load sample)
+  (/ (sample-cpu-seconds sample)
+     (max (sample-seconds sample) 1/1000)))
+
+(define (mean lst)
+  (/ (apply + lst) (length lst)))
+
+(define (level-stats samples level)
+  "Get the mean throughput and CPU load of the SAMPLES for a compression
+LEVEL as a pair, or #f if there are no such samples."
+  (let ((samples (filter (lambda (sample)
+                           (= (sample-level sample) level))
+                         samples)))
+    (and (not (null? samples))
+         (cons (mean (map sample-throughput samples))
+               (mean (map sample-cpu-load samples))))))
+
+(define (session-host session)
+  (session-get session 'host))
+
+
+;;; Public API.
+
+(define* (make-compression-advisor #:key
+                                   (levels       '(0 1 6))
+                                   (history-size 16)
+                                   (cpu-limit    0.9))
+  "Make a new compression advisor.  LEVELS is the list of the compression
+levels to choose from, where 0 means no compression.  At most HISTORY-SIZE
+transfers are kept for each host.  Levels whose CPU load (the CPU time per
+second of a transfer) exceeds CPU-LIMIT are avoided."
+  (%make-compression-advisor levels history-size cpu-limit
+                             (make-mutex) (make-hash-table)
+                             (make-weak-key-hash-table)))
+
+(define (compression-history advisor host)
+  "Get the list of measured transfers for a HOST from an ADVISOR as a list of
+alists, the most recent transfer goes first."
+  (with-mutex (compression-advisor-mutex advisor)
+    (map (lambda (sample)
+           `((level       . ,(sample-level sample))
+             (bytes       . ,(sample-bytes sample))
+             (seconds     . ,(sample-seconds sample))
+             (cpu-seconds . ,(sample-cpu-seconds sample))))
+         (hash-ref (compression-advisor-history advisor) host '()))))
+
+(define* (compression-record! advisor host level bytes seconds
+                              #:optional (cpu-seconds 0))
+  "Record a transfer of BYTES to or from a HOST that took SECONDS (and
+CPU-SECONDS of the CPU time) with the compression LEVEL in an ADVISOR.
+Return value is undefined."
+  (with-mutex (compression-advisor-mutex advisor)
+    (let* ((history (compression-advisor-history advisor))
+           (samples (cons (make-sample level bytes seconds cpu-seconds)
+                          (hash-ref history host '()))))
+      (hash-set! history host
+                 (if (> (length samples)
+                        (compression-advisor-history-size advisor))
+                     (list-head samples
+                                (compression-advisor-history-size advisor))
+                     samples)))))
+
+(define (compression-suggest advisor host)
+  "Suggest a compression level for the next session to a HOST.  Levels that
+were not measured yet are suggested first; after that, the level with the
+best mean throughput among those that do not exceed the CPU limit is
+suggested.  Return 0 for no compression, or a level from 1 to 9."
+  (with-mutex (compression-advisor-mutex advisor)
+    (let* ((samples (hash-ref (compression-advisor-history advisor) host '()))
+           (levels  (compression-advisor-levels advisor))
+           (stats   (map (lambda (level)
+                           (cons level (level-stats samples level)))
+                         levels)))
+      (cond
+       ((find (lambda (entry) (not (cdr entry))) stats)
+        => car)
+       (else
+        (let* ((limit  (compression-advisor-cpu-limit advisor))
+               (usable (filter (lambda (entry)
+                                 (<= (cddr entry) limit))
+                               stats))
+               (best   (lambda (entries)
+                         (car (fold (lambda (entry best)
+                                      (if (> (cadr entry) (cadr best))
+                                          entry
+                                          best))
+                                    (car entries)
+                                    (cdr entries))))))
+          (if (null? usable)
+              (best stats)
+              (best usable))))))))
+
+(define (make-session/adaptive advisor . args)
+  "Make a new session with 'make-session' ARGS and the compression level
+that is suggested by an ADVISOR for the host."
+  (let* ((session (apply make-session args))
+         (level   (compression-suggest advisor (session-host session))))
+    (if (zero? level)
+        (session-set! session 'compression "no")
+        (begin
+          (session-set! session 'compression "yes")
+          (session-set! session 'compression-level level)))
+    (with-mutex (compression-advisor-mutex advisor)
+      (hashq-set! (compression-advisor-sessions advisor) session level))
+    session))
+
+(define (thread-cpu-time)
+  "Get the CPU time of the current thread in seconds.  If the system has no
+per-thread CPU clock, get the CPU time of the whole process."
+  (or (%gssh-thread-cpu-time)
+      (/ (get-internal-run-time) internal-time-units-per-second)))
+
+(define (call-with-measured-transfer advisor session proc)
+  "Call a PROC with a SESSION as the argument, measure the time and the CPU
+time of the call, and record them in an ADVISOR.  The CPU time is measured
+for the current thread, so the work of other threads is not counted.  PROC must return the number
+of transferred bytes.  The SESSION must be made with 'make-session/adaptive'.
+Return the value returned by PROC."
+  (let ((level (with-mutex (compression-advisor-mutex advisor)
+                 (hashq-ref (compression-advisor-sessions advisor) session)))
+        (start     (get-internal-real-time))
+        (start-cpu (thread-cpu-time)))
+    (unless level
+      (throw 'guile-ssh-error
+             "call-with-measured-transfer: Unknown session" session))
+    (let ((bytes (proc session)))
+      (compression-record! advisor (session-host session) level bytes
+                           (/ (- (get-internal-real-time) start)
+                              internal-time-units-per-second)
+                           (- (thread-cpu-time) start-cpu))
+      bytes)))
+
+;;; compression.scm ends here.
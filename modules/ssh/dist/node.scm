@@ -145,8 +145,12 @@ error."
 
 ;;;
 
-(define* (make-node session)
-  "Make a new distributed computing node."
+(define* (make-node session #:key (keepalive #f))
+  "Make a new distributed computing node.  If KEEPALIVE is a number, TCP
+keepalive with the interval of KEEPALIVE seconds is enabled for the SESSION
+so evaluation on a node with a dead peer fails instead of hanging."
+  (when keepalive
+    (session-set-keepalive! session #:interval keepalive))
   (receive (rrepl-port guile-version)
       (make-rrepl session)
     (%make-node session rrepl-port guile-version)))
@@ -37,12 +37,14 @@
 ;;   private-key-to-file
 ;;   get-public-key-hash
 ;;   bytevector->hex-string
+;;   key-cache-flush!
 
 
 ;;; Code:
 
 (define-module (ssh key)
   #:use-module (ice-9 format)
+  #:use-module (ice-9 threads)
   #:use-module (rnrs bytevectors)
   #:use-module (ssh log)
   #:export (key
@@ -58,7 +60,8 @@
             private-key-from-file
             private-key-to-file
             get-public-key-hash
-            bytevector->hex-string))
+            bytevector->hex-string
+            key-cache-flush!))
 
 (define (bytevector->hex-string bv)
   "Convert bytevector BV to a colon separated hex string."
@@ -66,6 +69,75 @@
                     (bytevector->u8-list bv))
                ":"))
 
+
+;;; Key cache.
+
+;; Parsing a key (and decrypting a private key) is expensive, so the keys
+;; that are read from files are cached.  A cached key is used as long as the
+;; file is not changed; the file is checked by its inode, size and
+;; modification time.  Keys are not changed after they are read, so the
+;; same key object can be shared between threads.
+
+(define %key-cache-mutex (make-mutex))
+
+;; (type . file-name) -> (file-state . key)
+(define %key-cache (make-hash-table))
+
+(define (file-state file-name)
+  "Get the state of a FILE-NAME that is used to detect changes, or #f if the
+file cannot be accessed."
+  (let ((st (stat file-name #f)))
+    (and st
+         (list (stat:dev st) (stat:ino st) (stat:size st)
+               (stat:mtime st) (stat:mtimensec st)))))
+
+(define (cached-key-from-file type file-name read-key)
+  "Get a key of TYPE ('private' or 'public') from a FILE-NAME using the key
+cache; call READ-KEY with FILE-NAME as an argument to read the key if it is
+not cached or the file has changed."
+  (let ((state (file-state file-name))
+        (cache-key (cons type file-name)))
+    (or (and state
+             (with-mutex %key-cache-mutex
+               (let ((entry (hash-ref %key-cache cache-key)))
+                 (and entry
+                      (equal? (car entry) state)
+                      (cdr entry)))))
+        ;; The key is read outside of the mutex, as the user may be asked
+        ;; for a passphrase.
+        (let ((key (read-key file-name)))
+          (when (and key state)
+            (with-mutex %key-cache-mutex
+              (hash-set! %key-cache cache-key (cons state key))))
+          key))))
+
+(define* (key-cache-flush! #:optional file-name)
+  "Drop the cached keys that are read from a FILE-NAME, or all the cached keys
+if FILE-NAME is not specified.  Return value is undefined."
+  (with-mutex %key-cache-mutex
+    (if file-name
+        (begin
+          (hash-remove! %key-cache (cons 'private file-name))
+          (hash-remove! %key-cache (cons 'public  file-name)))
+        (hash-clear! %key-cache))))
+
+(define (private-key-from-file file-name)
+  "Read a private key from a FILE-NAME.  If the key is encrypted the user will
+be asked for passphrase to decrypt the key.  The key is cached until the file
+changes (see 'key-cache-flush!'.)  Return a new SSH key or #f on error."
+  (cached-key-from-file 'private file-name %gssh-private-key-from-file))
+
+(define (public-key-from-file file-name)
+  "Read a public key from a FILE-NAME.  The key is cached until the file
+changes (see 'key-cache-flush!'.)  Return a SSH key."
+  (cached-key-from-file 'public file-name %gssh-public-key-from-file))
+
+(define (private-key-to-file key file-name)
+  "Export a private KEY to a file FILE-NAME.  Throw 'guile-ssh-error' on an
+error.  Return value is undefined."
+  (%gssh-private-key-to-file key file-name)
+  (key-cache-flush! file-name))
+
 (unless (getenv "GUILE_SSH_CROSS_COMPILING")
   (load-extension "libguile-ssh" "init_key"))
 
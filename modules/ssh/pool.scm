@@ -0,0 +1,391 @@
+;;; pool.scm -- Pool of authenticated SSH sessions.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+
+;;; Commentary:
+
+;; This module contains a pool of connected and authenticated SSH sessions.
+;; Sessions are kept in the pool by (user, host, port, identity) key so the
+;; repeated operations on the same host can skip the connection and the
+;; authentication.
+;;
+;; The module exports:
+;;   session-pool?
+;;   make-session-pool
+;;   session-pool-lease
+;;   session-pool-return
+;;   session-pool-discard
+;;   call-with-pooled-session
+;;   session-pool-expire!
+;;   session-pool-close!
+;;   session-pool-stats
+;;   default-session-pool-connect
+;;
+;; See the Info documentation for the detailed description of these
+;; procedures.
+
+
+;;; Code:
+
+(define-module (ssh pool)
+  #:use-module (srfi srfi-1)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 threads)
+  #:use-module (ice-9 receive)
+  #:use-module (ssh session)
+  #:use-module (ssh auth)
+  #:export (session-pool?
+            make-session-pool
+            session-pool-lease
+            session-pool-return
+            session-pool-discard
+            call-with-pooled-session
+            session-pool-expire!
+            session-pool-close!
+            session-pool-stats
+            default-session-pool-connect))
+
+
+;;; Pool types.
+
+;; Sessions for a single key.
+(define-record-type <pool-host>
+  (make-pool-host idle count)
+  pool-host?
+  ;; List of idle sessions in the form of (session . last-use-time) pairs,
+  ;; the most recently used session goes first.
+  (idle  pool-host-idle  set-pool-host-idle!)
+  ;; Number of open sessions, both idle and leased.
+  (count pool-host-count set-pool-host-count!))
+
+(define-record-type <session-pool>
+  (%make-session-pool connect idle-timeout max-per-host keepalive
+                      mutex condition hosts leases closed?)
+  session-pool?
+  (connect      session-pool-connect)         ; <procedure>
+  (idle-timeout session-pool-idle-timeout)    ; <number>
+  (max-per-host session-pool-max-per-host)    ; <number>
+  (keepalive    session-pool-keepalive)       ; <number> or #f
+  (mutex        session-pool-mutex)           ; <mutex>
+  (condition    session-pool-condition)       ; <condition-variable>
+  (hosts        session-pool-hosts)           ; <hash-table>: key -> <pool-host>
+  (leases       session-pool-leases)          ; <hash-table>: session -> key
+  (closed?      session-pool-closed?          ; <boolean>
+                set-session-pool-closed!))
+
+(set-record-type-printer!
+ <session-pool>
+ (lambda (pool port)
+   (format port "#<session-pool max-per-host: ~a idle-timeout: ~a ~a>"
+           (session-pool-max-per-host pool)
+           (session-pool-idle-timeout pool)
+           (number->string (object-address pool) 16))))
+
+
+;;; Helper procedures.
+
+(define (default-session-pool-connect user host port identity)
+  "Make a new session for a USER on a HOST:PORT, connect it, check the server
+and authenticate with the public key IDENTITY (or with the default keys if
+IDENTITY is #f.)  Return the session or throw 'guile-ssh-error' on an
+error."
+  (let ((session (make-session #:user     user
+                               #:host     host
+                               #:port     port
+                               #:identity identity)))
+    (unless (eq? (connect! session) 'ok)
+      (throw 'guile-ssh-error "Could not connect to a host"
+             host port (get-error session)))
+    (let ((server-state (authenticate-server session)))
+      (unless (eq? server-state 'ok)
+        (disconnect! session)
+        (throw 'guile-ssh-error "Could not authenticate the server"
+               host port server-state)))
+    (let ((auth-result (userauth-public-key/auto! session)))
+      (unless (eq? auth-result 'success)
+        (disconnect! session)
+        (throw 'guile-ssh-error "Could not authenticate the user"
+               user host port auth-result)))
+    session))
+
+(define (pool-host pool key)
+  "Get the <pool-host> for a KEY, create it if needed.  The pool mutex must be
+held."
+  (let ((hosts (session-pool-hosts pool)))
+    (or (hash-ref hosts key)
+        (let ((ph (make-pool-host '() 0)))
+          (hash-set! hosts key ph)
+          ph))))
+
+(define (pool-host-forget! ph count)
+  "Decrease the number of open sessions of a PH by COUNT."
+  (set-pool-host-count! ph (- (pool-host-count ph) count)))
+
+(define (take-expired! pool now)
+  "Remove sessions that stay idle for too long from a POOL.  Return the list of
+removed sessions.  The threads that wait for a free slot are woken up if any
+session was removed.  The pool mutex must be held."
+  (let* ((timeout (session-pool-idle-timeout pool))
+         (removed (hash-fold (lambda (key ph result)
+                               (receive (fresh expired)
+                                   (partition (lambda (entry)
+                                                (< (- now (cdr entry))
+                                                   timeout))
+                                              (pool-host-idle ph))
+                                 (set-pool-host-idle! ph fresh)
+                                 (pool-host-forget! ph (length expired))
+                                 (append (map car expired) result)))
+                             '()
+                             (session-pool-hosts pool))))
+    (unless (null? removed)
+      (broadcast-condition-variable (session-pool-condition pool)))
+    removed))
+
+(define (check-open pool)
+  "Throw 'guile-ssh-error' if a POOL is closed.  The pool mutex must be
+held."
+  (when (session-pool-closed? pool)
+    (throw 'guile-ssh-error "session-pool-lease: Pool is closed" pool)))
+
+(define (session-usable? pool session last-use)
+  "Check if an idle SESSION of a POOL that was last used at LAST-USE time can
+be leased.  If the pool keepalive is enabled and the SESSION stayed idle for
+longer than the keepalive interval, a keepalive request is sent to detect a
+dead peer, so the check may take a while.  The pool mutex must not be
+held."
+  (let ((keepalive (session-pool-keepalive pool)))
+    (if (and keepalive
+             (> (- (current-time) last-use) keepalive))
+        (session-alive? session)
+        (connected? session))))
+
+(define (close-sessions sessions)
+  (for-each (lambda (session)
+              (when (connected? session)
+                (disconnect! session)))
+            sessions))
+
+(define (acquire! pool key deadline)
+  "Take an idle session for a KEY from a POOL, or reserve a slot for a new
+session.  Return a (session . last-use-time) pair, or #f if the caller must
+make a new session.  The idle session keeps its slot but it is not checked yet (see
+'session-usable?').  Wait until DEADLINE (or forever, if DEADLINE is #f) if
+the number of sessions for the key reached the limit."
+  (let ((mutex     (session-pool-mutex pool))
+        (condition (session-pool-condition pool)))
+    (with-mutex mutex
+      (let loop ()
+        (check-open pool)
+        (let* ((ph   (pool-host pool key))
+               (idle (pool-host-idle ph)))
+          (cond
+           ((not (null? idle))
+            (set-pool-host-idle! ph (cdr idle))
+            (car idle))
+           ((< (pool-host-count ph) (session-pool-max-per-host pool))
+            (set-pool-host-count! ph (1+ (pool-host-count ph)))
+            #f)
+           ((if deadline
+                (wait-condition-variable condition mutex deadline)
+                (wait-condition-variable condition mutex))
+            (loop))
+           (else
+            (throw 'guile-ssh-error
+                   "session-pool-lease: Timed out waiting for a session"
+                   key))))))))
+
+(define (acquire-usable! pool key deadline)
+  "Like 'acquire!', but check an idle session before returning it.  The check
+is done without the pool mutex, as it may do network I/O; dead sessions are
+dropped and another session is acquired."
+  (let loop ()
+    (let* ((entry   (acquire! pool key deadline))
+           (session (and entry (car entry))))
+      (cond
+       ((not session)
+        #f)
+       ((session-usable? pool session (cdr entry))
+        (with-mutex (session-pool-mutex pool)
+          (hashq-set! (session-pool-leases pool) session key))
+        session)
+       (else
+        (with-mutex (session-pool-mutex pool)
+          (pool-host-forget! (pool-host pool key) 1)
+          (broadcast-condition-variable (session-pool-condition pool)))
+        (close-sessions (list session))
+        (loop))))))
+
+(define (release! pool session)
+  "Remove a SESSION from the leased sessions of a POOL.  Return the
+<pool-host> of the session.  The pool mutex must be held."
+  (let* ((leases (session-pool-leases pool))
+         (key    (hashq-ref leases session)))
+    (unless key
+      (throw 'guile-ssh-error "Session is not leased from the pool"
+             pool session))
+    (hashq-remove! leases session)
+    (pool-host pool key)))
+
+
+;;; Public API.
+
+(define* (make-session-pool #:key
+                            (idle-timeout 300)
+                            (max-per-host 4)
+                            (keepalive    15)
+                            (connect default-session-pool-connect))
+  "Make a new session pool.  Idle sessions are closed after IDLE-TIMEOUT
+seconds, at most MAX-PER-HOST sessions are open for each key.  CONNECT is a
+procedure that is called as (CONNECT USER HOST PORT IDENTITY) to make a new
+connected and authenticated session.
+
+If KEEPALIVE is a number, TCP keepalive with the interval of KEEPALIVE seconds
+is enabled for new sessions (see 'session-set-keepalive!') and the sessions
+that stayed idle for longer than KEEPALIVE seconds are checked with
+'session-alive?' before they are leased, so dead peers are detected
+quickly.  KEEPALIVE set to #f disables the checks."
+  (%make-session-pool connect idle-timeout max-per-host keepalive
+                      (make-mutex) (make-condition-variable)
+                      (make-hash-table) (make-hash-table) #f))
+
+(define* (session-pool-lease pool host
+                             #:key
+                             (user     #f)
+                             (port     22)
+                             (identity #f)
+                             (timeout  #f))
+  "Lease a connected and authenticated session for a USER on a HOST:PORT with
+an IDENTITY from a POOL.  A live idle session is reused if possible; a new
+session is made otherwise.  If the POOL already has the maximum number of
+sessions for the host, wait for TIMEOUT seconds (forever if TIMEOUT is #f)
+until a session is returned.
+
+The session must be returned to the pool with 'session-pool-return' or
+'session-pool-discard'.  Throw 'guile-ssh-error' on an error."
+  (let ((key      (list user host port identity))
+        (deadline (and timeout (+ (current-time) timeout))))
+    (close-sessions (with-mutex (session-pool-mutex pool)
+                      (take-expired! pool (current-time))))
+    (or (acquire-usable! pool key deadline)
+        (catch #t
+          (lambda ()
+            (let ((session ((session-pool-connect pool)
+                            user host port identity)))
+              (when (and (session-pool-keepalive pool)
+                         (connected? session))
+                (session-set-keepalive! session
+                                        #:interval
+                                        (session-pool-keepalive pool)))
+              (with-mutex (session-pool-mutex pool)
+                (hashq-set! (session-pool-leases pool) session key))
+              session))
+          (lambda args
+            ;; Free the reserved slot.
+            (with-mutex (session-pool-mutex pool)
+              (pool-host-forget! (pool-host pool key) 1)
+              (broadcast-condition-variable (session-pool-condition pool)))
+            (apply throw args))))))
+
+(define (session-pool-return pool session)
+  "Return a leased SESSION to a POOL.  Disconnected sessions are dropped from
+the pool; if the pool is closed, the SESSION is dropped and disconnected.
+Return value is undefined."
+  (let ((keep? (with-mutex (session-pool-mutex pool)
+                 (let ((ph    (release! pool session))
+                       (keep? (and (not (session-pool-closed? pool))
+                                   (connected? session))))
+                   (if keep?
+                       (set-pool-host-idle! ph (cons (cons session
+                                                           (current-time))
+                                                     (pool-host-idle ph)))
+                       (pool-host-forget! ph 1))
+                   (broadcast-condition-variable
+                    (session-pool-condition pool))
+                   keep?))))
+    (unless keep?
+      (close-sessions (list session)))))
+
+(define (session-pool-discard pool session)
+  "Drop a leased SESSION from a POOL and disconnect it.  This should be used
+when the session is known to be broken.  Return value is undefined."
+  (with-mutex (session-pool-mutex pool)
+    (pool-host-forget! (release! pool session) 1)
+    (broadcast-condition-variable (session-pool-condition pool)))
+  (close-sessions (list session)))
+
+(define* (call-with-pooled-session pool host proc
+                                   #:key
+                                   (user     #f)
+                                   (port     22)
+                                   (identity #f)
+                                   (timeout  #f))
+  "Lease a session from a POOL (see 'session-pool-lease'), call a PROC with
+the session as the argument, and return the session to the pool.  Return the
+values yielded by PROC."
+  (let ((session (session-pool-lease pool host
+                                     #:user     user
+                                     #:port     port
+                                     #:identity identity
+                                     #:timeout  timeout)))
+    (dynamic-wind
+      (const #t)
+      (lambda () (proc session))
+      (lambda () (session-pool-return pool session)))))
+
+(define (session-pool-expire! pool)
+  "Close all the sessions of a POOL that stay idle for longer than the pool
+idle timeout.  Return value is undefined."
+  (close-sessions (with-mutex (session-pool-mutex pool)
+                    (take-expired! pool (current-time)))))
+
+(define (session-pool-close! pool)
+  "Close all the idle sessions of a POOL.  Leased sessions are closed when
+they are returned to the pool, and further leases throw 'guile-ssh-error'.
+Return value is undefined."
+  (close-sessions
+   (with-mutex (session-pool-mutex pool)
+     (set-session-pool-closed! pool #t)
+     ;; Wake up the threads that wait for a session, so they fail.
+     (broadcast-condition-variable (session-pool-condition pool))
+     (hash-fold (lambda (key ph result)
+                  (let ((idle (pool-host-idle ph)))
+                    (set-pool-host-idle! ph '())
+                    (pool-host-forget! ph (length idle))
+                    (append (map car idle) result)))
+                '()
+                (session-pool-hosts pool)))))
+
+(define (session-pool-stats pool)
+  "Get statistics for a POOL as an alist with the following keys: 'hosts' (the
+number of known keys), 'open' (the number of open sessions), 'idle' (the
+number of idle sessions) and 'leased' (the number of leased sessions.)"
+  (with-mutex (session-pool-mutex pool)
+    (let ((hosts (session-pool-hosts pool)))
+      (list (cons 'hosts  (hash-count (const #t) hosts))
+            (cons 'open   (hash-fold (lambda (key ph result)
+                                       (+ result (pool-host-count ph)))
+                                     0 hosts))
+            (cons 'idle   (hash-fold (lambda (key ph result)
+                                       (+ result (length (pool-host-idle ph))))
+                                     0 hosts))
+            (cons 'leased (hash-count (const #t)
+                                      (session-pool-leases pool)))))))
+
+;;; pool.scm ends here.
@@ -0,0 +1,310 @@
+;;; scp.scm -- Procedures for copying files with SCP.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+
+;;; Commentary:
+
+;; This module contains procedures for copying files and directory trees
+;; with SCP protocol.  Unlike SFTP, SCP streams file contents without waiting
+;; for a reply to each chunk, so it is often faster over links with high
+;; latency.
+;;
+;; The module exports:
+;;   scp-session?
+;;   make-scp-session
+;;   scp-get-session
+;;   scp-close
+;;   scp-push-file
+;;   scp-pull-file
+;;   scp-push-tree
+;;   scp-pull-tree
+;;
+;; See the Info documentation for the detailed description of these
+;; procedures.
+
+;;; Code:
+
+(define-module (ssh scp)
+  #:use-module (srfi srfi-1)
+  #:use-module (ice-9 ftw)
+  #:use-module (rnrs bytevectors)
+  #:use-module (rnrs io ports)
+  #:export (scp-session?
+            make-scp-session
+            scp-get-session
+            scp-close
+
+            ;; High-level procedures
+            scp-push-file
+            scp-pull-file
+            scp-push-tree
+            scp-pull-tree))
+
+
+;;; SCP session procedures.
+
+(define* (make-scp-session session mode location #:key (recursive? #f))
+  "Make a new SCP session using an SSH SESSION and initialize it.  MODE must
+be either 'write' (to send files to the remote side) or 'read' (to receive
+files from the remote side.)  LOCATION is a remote file or directory.  If
+RECURSIVE? is true, directories are copied recursively.  Throw
+'guile-ssh-error' on an error."
+  (let ((scp-session (%gssh-make-scp-session session mode location
+                                             recursive?)))
+    (%gssh-scp-init scp-session)
+    scp-session))
+
+(define (scp-session? x)
+  "Return #t if X is a SCP session, #f otherwise."
+  (%gssh-scp-session? x))
+
+(define (scp-get-session scp-session)
+  "Get the parent SSH session for a SCP-SESSION."
+  (%gssh-scp-get-session scp-session))
+
+(define (scp-close scp-session)
+  "Close a SCP-SESSION.  Throw 'guile-ssh-error' on an error.  Return value is
+undefined."
+  (%gssh-scp-close scp-session))
+
+
+;;; Helper procedures.
+
+;; Size of the buffer for file contents.  The data is read into and written
+;; from the buffer directly by libssh, without intermediate copies.
+(define %scp-buffer-size (* 64 1024))
+
+(define (call-with-scp-session session mode location recursive? proc)
+  (let ((scp-session (make-scp-session session mode location
+                                       #:recursive? recursive?)))
+    (dynamic-wind
+      (const #t)
+      (lambda () (proc scp-session))
+      (lambda () (scp-close scp-session)))))
+
+(define (call-with-file-port filename mode proc)
+  (let ((port (open-file filename mode)))
+    (dynamic-wind
+      (const #t)
+      (lambda () (proc port))
+      (lambda () (close-port port)))))
+
+(define (file-permissions file-stat)
+  (logand (stat:perms file-stat) #o7777))
+
+(define (remote-file-mode mode)
+  "Make a MODE that is sent by the remote side safe to apply to a local file:
+drop the setuid, setgid and sticky bits and apply the umask, as 'scp' does."
+  (logand mode #o777 (lognot (umask))))
+
+(define (send-file scp-session filename file-stat buffer progress)
+  "Send a local file FILENAME through a SCP-SESSION.  Return the number of
+bytes sent."
+  (let ((size (stat:size file-stat)))
+    (%gssh-scp-push-file scp-session (basename filename) size
+                         (file-permissions file-stat))
+    (call-with-file-port filename "rb"
+      (lambda (port)
+        (let loop ((done 0))
+          (when progress
+            (progress done size))
+          (if (< done size)
+              (let ((count (get-bytevector-n! port buffer 0
+                                              (min (bytevector-length buffer)
+                                                   (- size done)))))
+                (when (eof-object? count)
+                  (throw 'guile-ssh-error "File was truncated while sending"
+                         filename))
+                (%gssh-scp-write scp-session buffer 0 count)
+                (loop (+ done count)))
+              done))))))
+
+(define (receive-file scp-session filename buffer progress)
+  "Receive the file of the current request of a SCP-SESSION into a local file
+FILENAME.  Return the number of bytes received."
+  (let ((size (%gssh-scp-request-get-size scp-session))
+        (mode (%gssh-scp-request-get-permissions scp-session)))
+    (%gssh-scp-accept-request scp-session)
+    (call-with-file-port filename "wb"
+      (lambda (port)
+        (let loop ((done 0))
+          (when progress
+            (progress done size))
+          (when (< done size)
+            (let ((count (%gssh-scp-read scp-session buffer 0
+                                         (min (bytevector-length buffer)
+                                              (- size done)))))
+              (when (zero? count)
+                (throw 'guile-ssh-error "File was truncated while receiving"
+                       filename done size))
+              (put-bytevector port buffer 0 count)
+              (loop (+ done count)))))))
+    (when mode
+      (chmod filename (remote-file-mode mode)))
+    size))
+
+(define (valid-file-name? name)
+  "Check if a NAME that is sent by the remote side is a plain file name that
+cannot refer to a file outside of the current directory."
+  (not (or (string-null? name)
+           (string-index name #\/)
+           (member name '("." "..")))))
+
+(define (ensure-directory dirname mode)
+  "Make a directory DIRNAME with a MODE from the remote side, unless it
+exists.  Throw 'guile-ssh-error' if DIRNAME exists and it is not a directory;
+an existing symbolic link is refused as well, so the remote side cannot make
+the files to be written outside of the target directory."
+  (let ((st (false-if-exception (lstat dirname))))
+    (cond
+     ((not st)
+      (mkdir dirname (remote-file-mode mode)))
+     ((not (eq? (stat:type st) 'directory))
+      (throw 'guile-ssh-error "Not a directory" dirname (stat:type st))))))
+
+
+;;; High-level procedures.
+
+(define* (scp-push-file session local-file remote-file
+                        #:key (progress #f))
+  "Copy a LOCAL-FILE to a REMOTE-FILE using an SSH SESSION.  If REMOTE-FILE
+names an existing directory, the file is copied into it.
+
+PROGRESS, if specified, is called as (PROGRESS BYTES-DONE BYTES-TOTAL) during
+the transfer.
+
+Return the number of bytes sent.  Throw 'guile-ssh-error' on an error."
+  (call-with-scp-session session 'write remote-file #f
+    (lambda (scp-session)
+      (send-file scp-session local-file (stat local-file)
+                 (make-bytevector %scp-buffer-size)
+                 progress))))
+
+(define* (scp-pull-file session remote-file local-file
+                        #:key (progress #f))
+  "Copy a REMOTE-FILE to a LOCAL-FILE using an SSH SESSION.
+
+PROGRESS, if specified, is called as (PROGRESS BYTES-DONE BYTES-TOTAL) during
+the transfer.
+
+Return the number of bytes received.  Throw 'guile-ssh-error' on an error."
+  (call-with-scp-session session 'read remote-file #f
+    (lambda (scp-session)
+      (let ((request (%gssh-scp-pull-request scp-session)))
+        (unless (eq? request 'new-file)
+          (throw 'guile-ssh-error "Unexpected SCP request"
+                 remote-file request
+                 (%gssh-scp-request-get-warning scp-session)))
+        (receive-file scp-session local-file
+                      (make-bytevector %scp-buffer-size)
+                      progress)))))
+
+(define* (scp-push-tree session local-directory remote-directory
+                        #:key (progress #f))
+  "Copy a LOCAL-DIRECTORY recursively into a REMOTE-DIRECTORY using an SSH
+SESSION, like 'scp -r' does.  Only regular files and directories are copied.
+
+PROGRESS, if specified, is called as (PROGRESS BYTES-DONE BYTES-TOTAL) for
+each file during its transfer.
+
+Return the total number of bytes sent.  Throw 'guile-ssh-error' on an
+error."
+  (let ((buffer (make-bytevector %scp-buffer-size)))
+    (call-with-scp-session session 'write remote-directory #t
+      (lambda (scp-session)
+        (let push ((dirname local-directory))
+          (%gssh-scp-push-directory scp-session (basename dirname)
+                                    (file-permissions (stat dirname)))
+          (let ((total
+                 (fold (lambda (name total)
+                         (let* ((filename  (string-append dirname "/" name))
+                                (file-stat (stat filename)))
+                           (case (stat:type file-stat)
+                             ((directory)
+                              (+ total (push filename)))
+                             ((regular)
+                              (+ total (send-file scp-session filename
+                                                  file-stat buffer
+                                                  progress)))
+                             (else
+                              total))))
+                       0
+                       (scandir dirname
+                                (lambda (name)
+                                  (not (member name '("." ".."))))))))
+            (%gssh-scp-leave-directory scp-session)
+            total))))))
+
+(define* (scp-pull-tree session remote-directory local-directory
+                        #:key (progress #f))
+  "Copy a REMOTE-DIRECTORY recursively into a LOCAL-DIRECTORY using an SSH
+SESSION, like 'scp -r' does.  The LOCAL-DIRECTORY must exist.
+
+PROGRESS, if specified, is called as (PROGRESS BYTES-DONE BYTES-TOTAL) for
+each file during its transfer.
+
+Return the total number of bytes received.  Throw 'guile-ssh-error' on an
+error."
+  (let ((buffer (make-bytevector %scp-buffer-size)))
+    (call-with-scp-session session 'read remote-directory #t
+      (lambda (scp-session)
+        (define (request-path dirname)
+          (let ((name (%gssh-scp-request-get-filename scp-session)))
+            ;; Do not let the remote side write outside of LOCAL-DIRECTORY
+            ;; (see CVE-2019-6111.)
+            (unless (valid-file-name? name)
+              (throw 'guile-ssh-error "Invalid file name in a SCP request"
+                     remote-directory name))
+            (string-append dirname "/" name)))
+        (let loop ((dirs  (list local-directory))
+                   (total 0))
+          (case (%gssh-scp-pull-request scp-session)
+            ((new-directory)
+             (let ((dirname (request-path (car dirs))))
+               (ensure-directory dirname
+                                 (or (%gssh-scp-request-get-permissions
+                                      scp-session)
+                                     #o755))
+               (%gssh-scp-accept-request scp-session)
+               (loop (cons dirname dirs) total)))
+            ((end-directory)
+             (when (null? (cdr dirs))
+               (throw 'guile-ssh-error "Unexpected end of a SCP directory"
+                      remote-directory))
+             (loop (cdr dirs) total))
+            ((new-file)
+             (loop dirs
+                   (+ total (receive-file scp-session
+                                          (request-path (car dirs))
+                                          buffer
+                                          progress))))
+            ((warning)
+             (throw 'guile-ssh-error "SCP warning"
+                    remote-directory
+                    (%gssh-scp-request-get-warning scp-session)))
+            ((eof)
+             total)))))))
+
+
+;;; Load libraries.
+
+(unless (getenv "GUILE_SSH_CROSS_COMPILING")
+  (load-extension "libguile-ssh" "init_scp_session"))
+
+;;; scp.scm ends here.
@@ -27,12 +27,15 @@
 ;;
 ;;   %make-server
 ;;   make-server
+;;   make-server-listeners
 ;;   server-accept
 ;;   server-set!
 ;;   server-get
 ;;   server-listen!
 ;;   server-handle-key-exchange
 ;;   server-message-get
+;;   server-set-message-handlers!
+;;   server-dispatch-message
 
 
 ;;; Code:
@@ -44,19 +47,22 @@
             server?
 	    %make-server
             make-server
+            make-server-listeners
             server-accept
             server-set!
             server-get
             server-listen
             server-handle-key-exchange
-            server-message-get))
+            server-message-get
+            server-set-message-handlers!
+            server-dispatch-message))
 
 ;; Set a SSH option if it is specified by the user
 (define-macro (server-set-if-specified! option)
   `(if ,option (server-set! server (quote ,option) ,option)))
 
 (define* (make-server #:key bindaddr bindport hostkey dsakey rsakey banner
-                      log-verbosity blocking-mode)
+                      log-verbosity blocking-mode fd reuseport backlog)
   "Make a new SSH server with the specified configuration.\n
 Return a new SSH server."
   (let ((server (%make-server)))
@@ -68,8 +74,22 @@ Return a new SSH server."
     (server-set-if-specified! banner)
     (server-set-if-specified! log-verbosity)
     (server-set-if-specified! blocking-mode)
+    (server-set-if-specified! fd)
+    (server-set-if-specified! reuseport)
+    (server-set-if-specified! backlog)
     server))
 
+(define (make-server-listeners count . args)
+  "Make COUNT servers that listen on the same address with 'SO_REUSEPORT'
+option, so the kernel spreads incoming connections over them.  ARGS are
+passed to 'make-server'.  Each server should be accepted on its own thread
+(see 'make-server-pool'.)  Return a list of listening servers."
+  (map (lambda (n)
+         (let ((server (apply make-server #:reuseport #t args)))
+           (server-listen server)
+           server))
+       (iota count)))
+
 (unless (getenv "GUILE_SSH_CROSS_COMPILING")
   (load-extension "libguile-ssh" "init_server"))
 
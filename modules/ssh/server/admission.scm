@@ -0,0 +1,268 @@
+;;; admission.scm -- Admission control for servers.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+
+;;; Commentary:
+
+;; This module contains admission control for servers.  An accepted session
+;; is checked against limits on the number of sessions, the number of
+;; sessions that are not authenticated yet and the rate of connections from
+;; its source address before the key exchange, so sessions that would be
+;; dropped anyway do not cost a handshake.
+;;
+;; The module exports:
+;;   admission-control?
+;;   make-admission-control
+;;   admission-admit!
+;;   admission-authenticated!
+;;   admission-release!
+;;   admission-counters
+;;
+;; See the Info documentation for the detailed description of these
+;; procedures.
+
+
+;;; Code:
+
+(define-module (ssh server admission)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 threads)
+  #:use-module (ssh session)
+  #:use-module (ssh log)
+  #:export (admission-control?
+            make-admission-control
+            admission-admit!
+            admission-authenticated!
+            admission-release!
+            admission-counters))
+
+
+;;; Admission control type.
+
+(define-record-type <admission-control>
+  (%make-admission-control max-sessions max-unauthenticated
+                           rate-limit rate-burst
+                           mutex sessions buckets last-prune counters)
+  admission-control?
+  (max-sessions        admission-control-max-sessions)        ; <number> or #f
+  (max-unauthenticated admission-control-max-unauthenticated) ; <number> or #f
+  (rate-limit          admission-control-rate-limit)          ; <number> or #f
+  (rate-burst          admission-control-rate-burst)          ; <number>
+  (mutex               admission-control-mutex)               ; <mutex>
+  ;; <hash-table>: session -> 'unauthenticated or 'authenticated.
+  (sessions            admission-control-sessions)
+  ;; <hash-table>: source address -> (tokens . time).
+  (buckets             admission-control-buckets)
+  (last-prune          admission-control-last-prune
+                       set-admission-control-last-prune!)
+  ;; <hash-table>: counter name -> value.
+  (counters            admission-control-counters))
+
+(set-record-type-printer!
+ <admission-control>
+ (lambda (control port)
+   (format port "#<admission-control sessions: ~a/~a ~a>"
+           (counter-ref control 'sessions)
+           (or (admission-control-max-sessions control) "-")
+           (number->string (object-address control) 16))))
+
+
+;;; Helper procedures.
+
+(define %counters
+  '(admitted
+    rejected-rate-limit
+    rejected-max-sessions
+    rejected-max-unauthenticated
+    sessions
+    unauthenticated))
+
+;; Buckets of addresses that have not connected for this number of seconds
+;; are full again, and they are removed from the table.
+(define %prune-interval 60)
+
+(define (counter-ref control name)
+  (hashq-ref (admission-control-counters control) name 0))
+
+(define (counter-add! control name value)
+  "Add a VALUE to the counter NAME of a CONTROL.  The mutex of the CONTROL
+must be held."
+  (hashq-set! (admission-control-counters control) name
+              (+ (counter-ref control name) value)))
+
+(define (current-time)
+  "Get the current time in seconds as a real number."
+  (exact->inexact (/ (get-internal-real-time)
+                     internal-time-units-per-second)))
+
+(define (refill control bucket now)
+  "Get the number of tokens in a BUCKET at the time NOW."
+  (if bucket
+      (min (admission-control-rate-burst control)
+           (+ (car bucket)
+              (* (admission-control-rate-limit control)
+                 (- now (cdr bucket)))))
+      (admission-control-rate-burst control)))
+
+(define (prune-buckets! control now)
+  "Remove the full buckets from a CONTROL."
+  (let ((buckets (admission-control-buckets control)))
+    (for-each (lambda (address)
+                (hash-remove! buckets address))
+              (hash-fold (lambda (address bucket result)
+                           (if (>= (refill control bucket now)
+                                   (admission-control-rate-burst control))
+                               (cons address result)
+                               result))
+                         '()
+                         buckets))
+    (set-admission-control-last-prune! control now)))
+
+(define (take-token! control address)
+  "Take a token from the bucket of a source ADDRESS.  Return #t on success,
+#f if the bucket is empty."
+  (let* ((now     (current-time))
+         (buckets (admission-control-buckets control))
+         (tokens  (refill control (hash-ref buckets address) now)))
+    (when (> (- now (admission-control-last-prune control)) %prune-interval)
+      (prune-buckets! control now))
+    (if (>= tokens 1)
+        (begin
+          (hash-set! buckets address (cons (- tokens 1) now))
+          #t)
+        (begin
+          (hash-set! buckets address (cons tokens now))
+          #f))))
+
+(define (check control address)
+  "Check whether a session from a source ADDRESS can be admitted by a
+CONTROL.  Return #f if it can, or the name of the counter of the exceeded
+limit.  A token is taken from the bucket of the ADDRESS only when the other
+limits are not exceeded, so rejected sessions do not use up the rate of an
+address.  The mutex of the CONTROL must be held."
+  (let ((max-sessions        (admission-control-max-sessions control))
+        (max-unauthenticated (admission-control-max-unauthenticated control)))
+    (cond
+     ((and max-sessions
+           (>= (counter-ref control 'sessions) max-sessions))
+      'rejected-max-sessions)
+     ((and max-unauthenticated
+           (>= (counter-ref control 'unauthenticated) max-unauthenticated))
+      'rejected-max-unauthenticated)
+     ((and (admission-control-rate-limit control)
+           address
+           (not (take-token! control address)))
+      'rejected-rate-limit)
+     (else
+      #f))))
+
+(define (positive-or-false? x)
+  (or (not x) (and (real? x) (positive? x))))
+
+
+;;; Public API.
+
+(define* (make-admission-control #:key
+                                 (max-sessions        #f)
+                                 (max-unauthenticated #f)
+                                 (rate-limit          #f)
+                                 (rate-burst          (or rate-limit 1)))
+  "Make a new admission control.  MAX-SESSIONS limits the number of admitted
+sessions, MAX-UNAUTHENTICATED limits the number of admitted sessions that are
+not authenticated yet.  RATE-LIMIT limits the number of connections per
+second from a source address; up to RATE-BURST connections are admitted at
+once.  A limit that is set to #f is not checked.  Return a new admission
+control."
+  (for-each (lambda (name value)
+              (unless (positive-or-false? value)
+                (throw 'guile-ssh-error
+                       (format #f "make-admission-control: Wrong ~a" name)
+                       value)))
+            '(max-sessions max-unauthenticated rate-limit rate-burst)
+            (list max-sessions max-unauthenticated rate-limit rate-burst))
+  (%make-admission-control max-sessions max-unauthenticated
+                           rate-limit rate-burst
+                           (make-mutex)
+                           (make-hash-table)
+                           (make-hash-table)
+                           (current-time)
+                           (make-hash-table)))
+
+(define (admission-admit! control session)
+  "Check an accepted SESSION against the limits of a CONTROL before the key
+exchange.  If the SESSION is admitted, count it as not authenticated and
+return #t.  Otherwise disconnect the SESSION, increment the counter of the
+exceeded limit and return #f."
+  (let* ((address (get-peer-address session))
+         (reason  (with-mutex (admission-control-mutex control)
+                    (let ((reason (check control address)))
+                      (if reason
+                          (counter-add! control reason 1)
+                          (begin
+                            (hashq-set! (admission-control-sessions control)
+                                        session 'unauthenticated)
+                            (counter-add! control 'admitted 1)
+                            (counter-add! control 'sessions 1)
+                            (counter-add! control 'unauthenticated 1)))
+                      reason))))
+    (if reason
+        (begin
+          (format-log 'rare "admission-admit!"
+                      "Session from ~a is rejected: ~a" address reason)
+          (when (connected? session)
+            (disconnect! session))
+          #f)
+        #t)))
+
+(define (admission-authenticated! control session)
+  "Mark an admitted SESSION of a CONTROL as authenticated, so it does not
+count against the limit of unauthenticated sessions anymore.  Return value
+is undefined."
+  (with-mutex (admission-control-mutex control)
+    (let ((sessions (admission-control-sessions control)))
+      (when (eq? (hashq-ref sessions session) 'unauthenticated)
+        (hashq-set! sessions session 'authenticated)
+        (counter-add! control 'unauthenticated -1)))))
+
+(define (admission-release! control session)
+  "Forget an admitted SESSION of a CONTROL when the session is closed.
+Return value is undefined."
+  (with-mutex (admission-control-mutex control)
+    (let* ((sessions (admission-control-sessions control))
+           (state    (hashq-ref sessions session)))
+      (when state
+        (hashq-remove! sessions session)
+        (counter-add! control 'sessions -1)
+        (when (eq? state 'unauthenticated)
+          (counter-add! control 'unauthenticated -1))))))
+
+(define (admission-counters control)
+  "Get the counters of a CONTROL as an alist with the following keys:
+'admitted' (the number of admitted sessions), 'rejected-rate-limit',
+'rejected-max-sessions' and 'rejected-max-unauthenticated' (the numbers of
+sessions rejected because of each limit), 'sessions' (the number of admitted
+sessions that are not released yet) and 'unauthenticated' (the number of
+those sessions that are not authenticated yet.)"
+  (with-mutex (admission-control-mutex control)
+    (map (lambda (name)
+           (cons name (counter-ref control name)))
+         %counters)))
+
+;;; admission.scm ends here.
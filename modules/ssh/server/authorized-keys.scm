@@ -0,0 +1,314 @@
+;;; authorized-keys.scm -- Index of authorized public keys.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+
+;;; Commentary:
+
+;; This module contains an index of authorized public keys for servers.  The
+;; keys are loaded from an OpenSSH 'authorized_keys' file into a hash table
+;; keyed by the key fingerprint, so checking of a key takes constant time
+;; regardless of the number of keys.  The file is loaded again when it
+;; changes.  Key options are parsed and kept along with the keys.
+;;
+;; The module exports:
+;;   authorized-keys?
+;;   make-authorized-keys
+;;   authorized-keys-file
+;;   authorized-keys-count
+;;   authorized-keys-reload!
+;;   authorized-key?
+;;   authorized-key-options
+;;   authorized-keys-handler
+;;
+;; See the Info documentation for the detailed description of these
+;; procedures.
+
+
+;;; Code:
+
+(define-module (ssh server authorized-keys)
+  #:use-module (srfi srfi-1)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 rdelim)
+  #:use-module (ice-9 threads)
+  #:use-module (ssh key)
+  #:use-module (ssh log)
+  #:export (authorized-keys?
+            make-authorized-keys
+            authorized-keys-file
+            authorized-keys-count
+            authorized-keys-reload!
+            authorized-key?
+            authorized-key-options
+            authorized-keys-handler))
+
+\f
+;;; Store type.
+
+(define-record-type <authorized-keys>
+  (%make-authorized-keys file check-interval mutex index stamp last-check)
+  authorized-keys?
+  (file           authorized-keys-file)                   ; <string>
+  (check-interval authorized-keys-check-interval)         ; <number>
+  (mutex          authorized-keys-mutex)                  ; <mutex>
+  ;; <hash-table>: fingerprint -> (key . options).
+  (index          authorized-keys-index      set-authorized-keys-index!)
+  ;; A stamp of the loaded file (see 'file-stamp'), or #f.
+  (stamp          authorized-keys-stamp      set-authorized-keys-stamp!)
+  ;; Internal real time of the last check for changes.
+  (last-check     authorized-keys-last-check set-authorized-keys-last-check!))
+
+(set-record-type-printer!
+ <authorized-keys>
+ (lambda (store port)
+   (format port "#<authorized-keys ~a keys: ~a ~a>"
+           (authorized-keys-file store)
+           (hash-count (const #t) (authorized-keys-index store))
+           (number->string (object-address store) 16))))
+
+\f
+;;; Helper procedures.
+
+;; OpenSSH key type names mapping to Guile-SSH key types.  Some ECDSA key
+;; types are known by libssh 0.9 and later only; older versions use 'ecdsa'
+;; for all of them.
+(define %key-types
+  '(("ssh-rsa"             rsa)
+    ("ssh-dss"             dss)
+    ("ssh-ed25519"         ed25519)
+    ("ecdsa-sha2-nistp256" ecdsa-p256 ecdsa)
+    ("ecdsa-sha2-nistp384" ecdsa-p384 ecdsa)
+    ("ecdsa-sha2-nistp521" ecdsa-p521 ecdsa)))
+
+(define %non-whitespace (char-set-complement char-set:whitespace))
+
+(define (key-fingerprint key)
+  "Get the fingerprint of a public KEY as a string."
+  (bytevector->hex-string (get-public-key-hash key 'sha1)))
+
+(define (string->key type-name base64)
+  "Convert a BASE64 string to a public key of the OpenSSH type TYPE-NAME.
+Return #f if the key cannot be converted."
+  (let loop ((types (assoc-ref %key-types type-name)))
+    (and (pair? types)
+         (catch 'guile-ssh-error
+           (lambda ()
+             (string->public-key base64 (car types)))
+           (lambda args
+             (loop (cdr types)))))))
+
+(define (split-options str)
+  "Split the options field at the beginning of a string STR.  Options are
+separated by commas; double quotes protect spaces and commas in option
+values, and a quote inside of quotes is escaped with a backslash.  Return two
+values: a list of options with the quotes removed and the rest of the STR
+after the options field, or #f and #f if a quote is not closed."
+  (let ((len (string-length str)))
+    (let loop ((idx        0)
+               (in-quotes? #f)
+               (current    '())
+               (options    '()))
+      (define (options+current)
+        (reverse (cons (list->string (reverse current)) options)))
+      (if (= idx len)
+          (if in-quotes?
+              (values #f #f)
+              (values (options+current) ""))
+          (let ((c (string-ref str idx)))
+            (cond
+             ((and in-quotes?
+                   (char=? c #\\)
+                   (< (1+ idx) len)
+                   (char=? (string-ref str (1+ idx)) #\"))
+              (loop (+ idx 2) #t (cons #\" current) options))
+             ((char=? c #\")
+              (loop (1+ idx) (not in-quotes?) current options))
+             (in-quotes?
+              (loop (1+ idx) #t (cons c current) options))
+             ((char=? c #\,)
+              (loop (1+ idx) #f '()
+                    (cons (list->string (reverse current)) options)))
+             ((char-whitespace? c)
+              (values (options+current) (substring str idx)))
+             (else
+              (loop (1+ idx) #f (cons c current) options))))))))
+
+(define (option->pair option)
+  "Convert an OPTION string of the form \"name\" or \"name=value\" to a pair
+(NAME . VALUE), where NAME is a symbol in lower case and VALUE is a string, or
+#t for an option without a value."
+  (let ((idx (string-index option #\=)))
+    (if idx
+        (cons (string->symbol (string-downcase (substring option 0 idx)))
+              (substring option (1+ idx)))
+        (cons (string->symbol (string-downcase option)) #t))))
+
+(define (parse-line line)
+  "Parse a LINE of an 'authorized_keys' file.  Return a pair (KEY . OPTIONS)
+where OPTIONS is an alist of the key options (see 'option->pair'), or #f for
+empty lines, comments and lines that cannot be parsed."
+  (define (parse-key str options)
+    (let ((fields (string-tokenize str %non-whitespace)))
+      (and (>= (length fields) 2)
+           (assoc (car fields) %key-types)
+           (let ((key (string->key (car fields) (cadr fields))))
+             (and key
+                  (cons key (map option->pair options)))))))
+
+  (let ((line (string-trim-both line)))
+    (cond
+     ((or (string-null? line) (string-prefix? "#" line))
+      #f)
+     ((assoc (car (string-tokenize line %non-whitespace)) %key-types)
+      (parse-key line '()))
+     (else
+      (call-with-values (lambda () (split-options line))
+        (lambda (options rest)
+          (and options
+               (parse-key rest options))))))))
+
+(define (load-index file)
+  "Load the keys from a FILE into a new hash table."
+  (let ((index (make-hash-table)))
+    (call-with-input-file file
+      (lambda (port)
+        (let loop ((line (read-line port))
+                   (number 1))
+          (unless (eof-object? line)
+            (let ((entry (parse-line line)))
+              (cond
+               (entry
+                (hash-set! index (key-fingerprint (car entry)) entry))
+               ((not (or (string-null? (string-trim line))
+                         (string-prefix? "#" (string-trim line))))
+                (format-log 'rare "authorized-keys"
+                            "~a:~a: Could not parse a key" file number))))
+            (loop (read-line port) (1+ number))))))
+    index))
+
+(define (file-stamp file)
+  "Get a stamp of a FILE that changes when the file is modified or replaced,
+or #f if the FILE does not exist."
+  (and (file-exists? file)
+       (let ((st (stat file)))
+         (list (stat:dev st)
+               (stat:ino st)
+               (stat:size st)
+               (stat:mtime st)
+               (stat:mtimensec st)))))
+
+(define (reload-if-changed! store)
+  "Reload a STORE if its file has changed since the last load.  The file is
+checked at most once in the check interval of the STORE.  The store mutex
+must be held."
+  (let ((now (get-internal-real-time)))
+    (when (>= (- now (authorized-keys-last-check store))
+              (* (authorized-keys-check-interval store)
+                 internal-time-units-per-second))
+      (set-authorized-keys-last-check! store now)
+      (let ((stamp (file-stamp (authorized-keys-file store))))
+        (unless (equal? stamp (authorized-keys-stamp store))
+          (set-authorized-keys-index! store
+                                      (if stamp
+                                          (load-index
+                                           (authorized-keys-file store))
+                                          (make-hash-table)))
+          (set-authorized-keys-stamp! store stamp))))))
+
+\f
+;;; Public API.
+
+(define* (make-authorized-keys file #:key (check-interval 1))
+  "Make a new index of authorized keys loaded from an OpenSSH 'authorized_keys'
+FILE.  The FILE is checked for changes at most once in CHECK-INTERVAL seconds
+and loaded again when it changes.  A FILE that does not exist is treated as
+empty.  Return a new index."
+  (let ((store (%make-authorized-keys file check-interval (make-mutex)
+                                      (make-hash-table) #f 0)))
+    (authorized-keys-reload! store)
+    store))
+
+(define (authorized-keys-reload! store)
+  "Load the keys of a STORE from its file again.  Return value is
+undefined."
+  (with-mutex (authorized-keys-mutex store)
+    (set-authorized-keys-stamp! store #f)
+    (set-authorized-keys-last-check! store
+                                     (- (get-internal-real-time)
+                                        (* (authorized-keys-check-interval
+                                            store)
+                                           internal-time-units-per-second)))
+    (reload-if-changed! store)))
+
+(define (authorized-keys-count store)
+  "Get the number of keys in a STORE."
+  (with-mutex (authorized-keys-mutex store)
+    (reload-if-changed! store)
+    (hash-count (const #t) (authorized-keys-index store))))
+
+(define (lookup store key)
+  "Get the entry (KEY . OPTIONS) for a public KEY from a STORE, or #f."
+  (let ((fingerprint (key-fingerprint key)))
+    (with-mutex (authorized-keys-mutex store)
+      (reload-if-changed! store)
+      (hash-ref (authorized-keys-index store) fingerprint))))
+
+(define (authorized-key? store key)
+  "Check if a public KEY is in a STORE.  Return #t if it is, #f otherwise.
+Note that the key may have options that restrict its use (see
+'authorized-key-options'.)"
+  (and (lookup store key) #t))
+
+(define (authorized-key-options store key)
+  "Get the options of a public KEY in a STORE as an alist of the form
+((NAME . VALUE) ...), where NAME is a symbol in lower case and VALUE is a
+string, or #t for an option without a value.  Return #f if the KEY is not in
+the STORE."
+  (let ((entry (lookup store key)))
+    (and entry (cdr entry))))
+
+(define* (authorized-keys-handler store #:key (options #f))
+  "Make a public key authentication handler for 'server-set-message-handlers!'
+and 'make-server-engine'.  STORE is either an index of authorized keys or a
+procedure that is called as (STORE USER) and returns an index for a USER, or
+#f.  The handler returns 'success' for keys that are in the index and have no
+options, and 'denied' otherwise.  Requests with a signature that could not be
+verified (the 'wrong' and 'error' states) are always denied.  If OPTIONS is a procedure, it is called as
+(OPTIONS SESSION USER KEY KEY-OPTIONS) for keys that have options, and the key
+is accepted if it returns a true value; the procedure must apply the
+restrictions of the options to the SESSION.  Without the OPTIONS procedure
+keys with options are denied, since their restrictions would not be
+applied."
+  (lambda (session user key state)
+    (let* ((store       (if (procedure? store) (store user) store))
+           (key-options (and store key (authorized-key-options store key))))
+      (cond
+       ((not (memq state '(none valid)))
+        'denied)
+       ((not key-options)
+        'denied)
+       ((null? key-options)
+        'success)
+       ((and options (options session user key key-options))
+        'success)
+       (else
+        'denied)))))
+
+;;; authorized-keys.scm ends here.
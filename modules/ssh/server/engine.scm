@@ -0,0 +1,301 @@
+;;; engine.scm -- Event-driven server engine.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+
+;;; Commentary:
+
+;; This module contains an event-driven server engine.  An engine handles
+;; many server sessions in one thread: libssh polls all the sessions of the
+;; engine at once and calls Scheme handlers for authentication, channel
+;; opening and channel requests as they arrive.  So thousands of mostly idle
+;; sessions can be served by a few engine threads instead of a thread per
+;; session.
+;;
+;; The module exports:
+;;   server-engine?
+;;   make-server-engine
+;;   server-engine-add-session!
+;;   server-engine-poll
+;;   server-engine-start!
+;;   server-engine-stop!
+;;   server-engine-session-count
+;;   serve-with-engines
+;;
+;; See the Info documentation for the detailed description of these
+;; procedures.
+
+
+;;; Code:
+
+(define-module (ssh server engine)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 threads)
+  #:use-module (ssh session)
+  #:use-module (ssh server)
+  #:use-module (ssh log)
+  #:export (server-engine?
+            make-server-engine
+            server-engine-add-session!
+            server-engine-poll
+            server-engine-start!
+            server-engine-stop!
+            server-engine-session-count
+            serve-with-engines))
+
+
+;;; Engine type.
+
+(define-record-type <server-engine>
+  (%make-server-engine engine login-grace-time mutex pending thread state)
+  server-engine?
+  (engine  server-engine-engine)                  ; <server-engine> smob
+  ;; Number of seconds that a session may take to authenticate, or #f.
+  (login-grace-time server-engine-login-grace-time)
+  (mutex   server-engine-mutex)                   ; <mutex>
+  ;; Sessions that are waiting to be added to the engine by the engine
+  ;; thread.
+  (pending server-engine-pending set-server-engine-pending!)
+  (thread  server-engine-thread  set-server-engine-thread!)
+  ;; One of the symbols: 'new', 'running', 'stopping', 'stopped'.
+  (state   server-engine-state   set-server-engine-state!))
+
+(set-record-type-printer!
+ <server-engine>
+ (lambda (engine port)
+   (format port "#<server-engine ~a sessions: ~a ~a>"
+           (server-engine-state engine)
+           (server-engine-session-count engine)
+           (number->string (object-address engine) 16))))
+
+
+;;; Helper procedures.
+
+;; Poll timeout in milliseconds.  Sessions that were added from other
+;; threads are picked up by the engine thread at least this often.
+(define %poll-timeout 100)
+
+(define (close-session session)
+  (when (connected? session)
+    (disconnect! session)))
+
+(define (add-pending-sessions! engine)
+  "Add the sessions that are waiting in the pending list to an ENGINE."
+  (let ((sessions (with-mutex (server-engine-mutex engine)
+                    (let ((sessions (server-engine-pending engine)))
+                      (set-server-engine-pending! engine '())
+                      (reverse sessions)))))
+    (for-each (lambda (session)
+                (catch #t
+                  (lambda ()
+                    (%gssh-server-engine-add-session!
+                     (server-engine-engine engine) session))
+                  (lambda args
+                    (format-log 'rare "server-engine"
+                                "Could not add a session: ~a" args)
+                    (close-session session))))
+              sessions)))
+
+(define (expire-logins! engine)
+  "Disconnect the sessions of an ENGINE that have not authenticated within
+the login grace time."
+  (let ((grace (server-engine-login-grace-time engine)))
+    (when grace
+      (let ((smob  (server-engine-engine engine))
+            (limit (- (get-internal-real-time)
+                      (* grace internal-time-units-per-second))))
+        (for-each (lambda (entry)
+                    (when (< (cdr entry) limit)
+                      (format-log 'rare "server-engine"
+                                  "Login grace time is over: ~a" (car entry))
+                      (%gssh-server-engine-remove-session! smob (car entry))
+                      (close-session (car entry))))
+                  (%gssh-server-engine-logins smob))))))
+
+(define (engine-thread engine)
+  (let loop ()
+    (when (eq? (with-mutex (server-engine-mutex engine)
+                 (server-engine-state engine))
+               'running)
+      (server-engine-poll engine %poll-timeout)
+      (loop))))
+
+
+;;; Public API.
+
+(define* (make-server-engine #:key
+                             (login-grace-time 120)
+                             (auth-none       #f)
+                             (auth-password   #f)
+                             (auth-public-key #f)
+                             (channel-open    #f)
+                             (exec            #f)
+                             (shell           #f)
+                             (pty             #f)
+                             (env             #f)
+                             (data            #f)
+                             (eof             #f)
+                             (close           #f))
+  "Make a new server engine with the specified handlers.  Each handler is
+called from the engine thread as soon as the corresponding event arrives:
+
+  (AUTH-NONE SESSION USER)
+  (AUTH-PASSWORD SESSION USER PASSWORD)
+  (AUTH-PUBLIC-KEY SESSION USER KEY STATE)
+  (CHANNEL-OPEN SESSION)
+  (EXEC SESSION CHANNEL COMMAND)
+  (SHELL SESSION CHANNEL)
+  (PTY SESSION CHANNEL TERM WIDTH HEIGHT)
+  (ENV SESSION CHANNEL NAME VALUE)
+  (DATA SESSION CHANNEL BYTEVECTOR STDERR?)
+  (EOF SESSION CHANNEL)
+  (CLOSE SESSION CHANNEL)
+
+Authentication handlers return one of the symbols 'success', 'partial' or
+'denied' (or a boolean); only the methods that have handlers are offered to
+clients.  Request handlers return true to accept a request; requests without
+a handler are denied.  A channel is opened unless CHANNEL-OPEN returns #f.  A
+DATA handler may return the number of bytes it has consumed.  Handlers must
+not block, since they delay every other session of the engine.
+
+A session that is not authenticated within LOGIN-GRACE-TIME seconds after it
+is added to the engine (the key exchange included) is disconnected; '#f'
+means no limit.  Return a new server engine."
+  (unless (or (not login-grace-time)
+              (and (real? login-grace-time) (positive? login-grace-time)))
+    (throw 'guile-ssh-error "make-server-engine: Wrong login grace time"
+           login-grace-time))
+  (let ((handlers (filter cdr
+                          `((auth-none       . ,auth-none)
+                            (auth-password   . ,auth-password)
+                            (auth-public-key . ,auth-public-key)
+                            (channel-open    . ,channel-open)
+                            (exec            . ,exec)
+                            (shell           . ,shell)
+                            (pty             . ,pty)
+                            (env             . ,env)
+                            (data            . ,data)
+                            (eof             . ,eof)
+                            (close           . ,close)))))
+    (%make-server-engine (%gssh-make-server-engine handlers)
+                         login-grace-time
+                         (make-mutex)
+                         '()
+                         #f
+                         'new)))
+
+(define (server-engine-add-session! engine session)
+  "Hand over an accepted SESSION (see 'server-accept') to an ENGINE.  The key
+exchange, the authentication and the rest of the session are handled by the
+engine thread.  This procedure can be called from any thread.  Return #t if
+the SESSION is accepted, or #f if the ENGINE is stopped; in that case the
+SESSION is disconnected."
+  (let ((accepted?
+         (with-mutex (server-engine-mutex engine)
+           (and (memq (server-engine-state engine) '(new running))
+                (begin
+                  (set-server-engine-pending! engine
+                                              (cons session
+                                                    (server-engine-pending
+                                                     engine)))
+                  #t)))))
+    (unless accepted?
+      (close-session session))
+    accepted?))
+
+(define* (server-engine-poll engine #:optional (timeout %poll-timeout))
+  "Add the pending sessions to an ENGINE, then wait at most TIMEOUT
+milliseconds for events on its sessions and call the handlers.  Closed
+sessions are dropped from the ENGINE, and the sessions that are over the
+login grace time are disconnected.  Only one thread may poll an ENGINE at
+a time; usually that is the engine thread (see 'server-engine-start!').
+Return the number of sessions handled by the ENGINE."
+  (add-pending-sessions! engine)
+  (%gssh-server-engine-poll (server-engine-engine engine) timeout)
+  (expire-logins! engine)
+  (server-engine-session-count engine))
+
+(define (server-engine-start! engine)
+  "Start a thread that polls an ENGINE until it is stopped.  An engine can be
+started only once.  Return value is undefined."
+  (with-mutex (server-engine-mutex engine)
+    (unless (eq? (server-engine-state engine) 'new)
+      (throw 'guile-ssh-error "server-engine-start!: Engine is already started"
+             engine))
+    (set-server-engine-state! engine 'running))
+  (set-server-engine-thread! engine
+                             (call-with-new-thread
+                              (lambda () (engine-thread engine)))))
+
+(define (server-engine-stop! engine)
+  "Stop an ENGINE: wait for the engine thread to exit, then disconnect all the
+sessions of the ENGINE, including the pending ones.  Return value is
+undefined."
+  (with-mutex (server-engine-mutex engine)
+    (set-server-engine-state! engine 'stopping))
+  (let ((thread (server-engine-thread engine)))
+    (when thread
+      (join-thread thread)))
+  (let ((smob (server-engine-engine engine)))
+    (for-each (lambda (session)
+                (%gssh-server-engine-remove-session! smob session)
+                (close-session session))
+              (%gssh-server-engine-sessions smob)))
+  (with-mutex (server-engine-mutex engine)
+    (for-each close-session (server-engine-pending engine))
+    (set-server-engine-pending! engine '())
+    (set-server-engine-thread! engine #f)
+    (set-server-engine-state! engine 'stopped)))
+
+(define (server-engine-session-count engine)
+  "Get the number of sessions that are handled by an ENGINE, not counting the
+pending ones."
+  (%gssh-server-engine-session-count (server-engine-engine engine)))
+
+(define (serve-with-engines server engines)
+  "Accept connections on a listening SERVER forever and spread the sessions
+over the list of ENGINES in round-robin order.  Engines that are not started
+yet are started first.  This procedure does not return."
+  (for-each (lambda (engine)
+              (when (eq? (server-engine-state engine) 'new)
+                (server-engine-start! engine)))
+            engines)
+  (let loop ((next engines))
+    (let ((next    (if (null? next) engines next))
+          (session (catch 'guile-ssh-error
+                     (lambda ()
+                       (server-accept server))
+                     (lambda args
+                       (format-log 'rare "server-engine"
+                                   "Could not accept a connection: ~a"
+                                   args)
+                       #f))))
+      (if session
+          (begin
+            (server-engine-add-session! (car next) session)
+            (loop (cdr next)))
+          (loop next)))))
+
+
+;;; Load libraries.
+
+(unless (getenv "GUILE_SSH_CROSS_COMPILING")
+  (load-extension "libguile-ssh" "init_server_engine"))
+
+;;; engine.scm ends here.
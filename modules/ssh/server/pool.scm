@@ -0,0 +1,298 @@
+;;; pool.scm -- Handling of server sessions in a pool of worker threads.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+
+;;; Commentary:
+
+;; This module contains a server pool: one thread accepts incoming
+;; connections and puts new sessions into a bounded queue, a pool of worker
+;; threads takes sessions from the queue, does the key exchange and calls a
+;; handler for each session.  So a slow client does not block accepting of
+;; new connections.
+;;
+;; The module exports:
+;;   server-pool?
+;;   make-server-pool
+;;   server-pool-start!
+;;   server-pool-stop!
+;;   server-pool-stats
+;;
+;; See the Info documentation for the detailed description of these
+;; procedures.
+
+
+;;; Code:
+
+(define-module (ssh server pool)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ice-9 q)
+  #:use-module (ice-9 threads)
+  #:use-module (ssh session)
+  #:use-module (ssh server)
+  #:use-module (ssh server admission)
+  #:use-module (ssh log)
+  #:export (server-pool?
+            make-server-pool
+            server-pool-start!
+            server-pool-stop!
+            server-pool-stats))
+
+
+;;; Pool type.
+
+(define-record-type <server-pool>
+  (%make-server-pool server handler workers queue-depth overflow admission
+                     mutex not-empty not-full queue threads state stats)
+  server-pool?
+  (server      server-pool-server)               ; <server> or a list
+  (handler     server-pool-handler)              ; <procedure>
+  (workers     server-pool-workers)              ; <number>
+  (queue-depth server-pool-queue-depth)          ; <number>
+  (overflow    server-pool-overflow)             ; <symbol>
+  (admission   server-pool-admission)            ; <admission-control> or #f
+  (mutex       server-pool-mutex)                ; <mutex>
+  (not-empty   server-pool-not-empty)            ; <condition-variable>
+  (not-full    server-pool-not-full)             ; <condition-variable>
+  (queue       server-pool-queue)                ; <q> of sessions
+  (threads     server-pool-threads set-server-pool-threads!)
+  ;; One of the symbols: 'new', 'running', 'stopping', 'stopped'.
+  (state       server-pool-state   set-server-pool-state!)
+  ;; <hash-table>: counter name -> value.
+  (stats       server-pool-counters))
+
+(set-record-type-printer!
+ <server-pool>
+ (lambda (pool port)
+   (format port "#<server-pool ~a workers: ~a queue-depth: ~a ~a>"
+           (server-pool-state pool)
+           (server-pool-workers pool)
+           (server-pool-queue-depth pool)
+           (number->string (object-address pool) 16))))
+
+
+;;; Helper procedures.
+
+(define %counters
+  '(accepted rejected handled failed busy))
+
+(define (counter-add! pool name value)
+  "Add a VALUE to the counter NAME of a POOL.  The pool mutex must be held."
+  (let ((stats (server-pool-counters pool)))
+    (hashq-set! stats name (+ (hashq-ref stats name 0) value))))
+
+(define (close-session session)
+  (when (connected? session)
+    (disconnect! session)))
+
+(define (release-session pool session)
+  "Close a SESSION and release it from the admission control of a POOL."
+  (close-session session)
+  (let ((admission (server-pool-admission pool)))
+    (when admission
+      (admission-release! admission session))))
+
+(define (enqueue! pool session)
+  "Put a SESSION into the queue of a POOL.  If the queue is full, either wait
+for a free slot or reject the session, according to the pool overflow
+policy."
+  (let ((mutex (server-pool-mutex pool))
+        (queue (server-pool-queue pool)))
+    (lock-mutex mutex)
+    (let loop ()
+      (cond
+       ((not (eq? (server-pool-state pool) 'running))
+        (counter-add! pool 'rejected 1)
+        (unlock-mutex mutex)
+        (release-session pool session))
+       ((< (q-length queue) (server-pool-queue-depth pool))
+        (enq! queue session)
+        (counter-add! pool 'accepted 1)
+        (signal-condition-variable (server-pool-not-empty pool))
+        (unlock-mutex mutex))
+       ((eq? (server-pool-overflow pool) 'reject)
+        (counter-add! pool 'rejected 1)
+        (unlock-mutex mutex)
+        (release-session pool session))
+       (else
+        (wait-condition-variable (server-pool-not-full pool) mutex)
+        (loop))))))
+
+(define (dequeue! pool)
+  "Take a session from the queue of a POOL, wait for it if the queue is
+empty.  Return #f if the pool is stopped and the queue is empty."
+  (with-mutex (server-pool-mutex pool)
+    (let loop ()
+      (let ((queue (server-pool-queue pool)))
+        (cond
+         ((not (q-empty? queue))
+          (let ((session (deq! queue)))
+            (counter-add! pool 'busy 1)
+            (signal-condition-variable (server-pool-not-full pool))
+            session))
+         ((eq? (server-pool-state pool) 'running)
+          (wait-condition-variable (server-pool-not-empty pool)
+                                   (server-pool-mutex pool))
+          (loop))
+         (else
+          #f))))))
+
+(define (handle-session pool session)
+  "Do the key exchange for a SESSION and call the handler of a POOL."
+  (let ((result (catch #t
+                  (lambda ()
+                    (server-handle-key-exchange session)
+                    ((server-pool-handler pool) session)
+                    'handled)
+                  (lambda args
+                    (format-log 'rare "server-pool"
+                                "Session handler failed: ~a" args)
+                    'failed))))
+    (release-session pool session)
+    (with-mutex (server-pool-mutex pool)
+      (counter-add! pool result 1)
+      (counter-add! pool 'busy -1))))
+
+(define (worker-thread pool)
+  (let loop ()
+    (let ((session (dequeue! pool)))
+      (when session
+        (handle-session pool session)
+        (loop)))))
+
+(define (pool-servers pool)
+  (let ((server (server-pool-server pool)))
+    (if (list? server) server (list server))))
+
+;; The range of delays in microseconds after a failed 'server-accept'.  A
+;; persistent error (e.g. when the process is out of file descriptors) makes
+;; the delay grow up to the maximum, so the thread does not spin.
+(define %accept-backoff-min 10000)
+(define %accept-backoff-max 1000000)
+
+(define (accept-thread pool server)
+  (let loop ((backoff %accept-backoff-min))
+    (when (eq? (with-mutex (server-pool-mutex pool)
+                 (server-pool-state pool))
+               'running)
+      (let ((session (catch 'guile-ssh-error
+                       (lambda ()
+                         (server-accept server))
+                       (lambda args
+                         ;; Log only the first error of a series.
+                         (when (= backoff %accept-backoff-min)
+                           (format-log 'rare "server-pool"
+                                       "Could not accept a connection: ~a"
+                                       args))
+                         #f))))
+        (cond
+         (session
+          (when (or (not (server-pool-admission pool))
+                    (admission-admit! (server-pool-admission pool) session))
+            (enqueue! pool session))
+          (loop %accept-backoff-min))
+         (else
+          (usleep backoff)
+          (loop (min (* backoff 2) %accept-backoff-max))))))))
+
+
+;;; Public API.
+
+(define* (make-server-pool server handler
+                           #:key
+                           (workers     16)
+                           (queue-depth 1024)
+                           (overflow    'block)
+                           (admission   #f))
+  "Make a new server pool for a listening SERVER, or for a list of servers
+that share an address (see 'make-server-listeners'); each server gets its own
+accepting thread.  Each accepted session is passed to one of WORKERS threads
+that does the key exchange and calls a HANDLER as (HANDLER SESSION); the
+session is disconnected when the HANDLER returns.  At most QUEUE-DEPTH
+sessions wait for a free worker; when the queue is full, an accepting thread
+either waits (if OVERFLOW is 'block') or disconnects the new session (if
+OVERFLOW is 'reject').  If ADMISSION is an admission control (see
+'make-admission-control'), each accepted session is checked against it
+before it is queued.  Return a new server pool."
+  (unless (memq overflow '(block reject))
+    (throw 'guile-ssh-error "make-server-pool: Wrong overflow policy"
+           overflow))
+  (unless (and (integer? workers) (positive? workers))
+    (throw 'guile-ssh-error "make-server-pool: Wrong number of workers"
+           workers))
+  (unless (and (integer? queue-depth) (positive? queue-depth))
+    (throw 'guile-ssh-error "make-server-pool: Wrong queue depth"
+           queue-depth))
+  (%make-server-pool server handler workers queue-depth overflow admission
+                     (make-mutex)
+                     (make-condition-variable)
+                     (make-condition-variable)
+                     (make-q)
+                     '()
+                     'new
+                     (make-hash-table)))
+
+(define (server-pool-start! pool)
+  "Start the accepting threads and the worker threads of a POOL.  The servers
+of the POOL must be listening (see 'server-listen').  A pool can be started
+only once.  Return value is undefined."
+  (with-mutex (server-pool-mutex pool)
+    (unless (eq? (server-pool-state pool) 'new)
+      (throw 'guile-ssh-error "server-pool-start!: Pool is already started"
+             pool))
+    (set-server-pool-state! pool 'running))
+  (set-server-pool-threads!
+   pool
+   (map (lambda (n)
+          (call-with-new-thread (lambda () (worker-thread pool))))
+        (iota (server-pool-workers pool))))
+  (for-each (lambda (server)
+              (call-with-new-thread (lambda () (accept-thread pool server))))
+            (pool-servers pool)))
+
+(define (server-pool-stop! pool)
+  "Stop a POOL.  Sessions that are already in the queue are handled, then the
+worker threads exit; this procedure waits for them.  The accepting threads
+cannot be interrupted while they wait for a connection in 'server-accept', so
+each of them exits after its next incoming connection, which is rejected.
+Return value is undefined."
+  (with-mutex (server-pool-mutex pool)
+    (set-server-pool-state! pool 'stopping)
+    (broadcast-condition-variable (server-pool-not-empty pool))
+    (broadcast-condition-variable (server-pool-not-full pool)))
+  (let ((threads (server-pool-threads pool)))
+    (for-each join-thread threads))
+  (with-mutex (server-pool-mutex pool)
+    (set-server-pool-threads! pool '())
+    (set-server-pool-state! pool 'stopped)))
+
+(define (server-pool-stats pool)
+  "Get statistics for a POOL as an alist with the following keys: 'accepted'
+(the number of sessions put into the queue), 'rejected' (the number of
+sessions disconnected because of a full queue or a stopped pool), 'handled'
+(the number of sessions handled successfully), 'failed' (the number of
+sessions whose key exchange or handler failed), 'busy' (the number of busy
+workers) and 'queued' (the number of sessions in the queue.)"
+  (with-mutex (server-pool-mutex pool)
+    (append (map (lambda (name)
+                   (cons name (hashq-ref (server-pool-counters pool) name 0)))
+                 %counters)
+            (list (cons 'queued (q-length (server-pool-queue pool)))))))
+
+;;; pool.scm ends here.
@@ -0,0 +1,193 @@
+;;; prefork.scm -- Prefork server mode.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+
+;;; Commentary:
+
+;; This module contains a prefork server mode.  The parent process binds
+;; the server socket and loads the host keys once, then forks worker
+;; processes that inherit both and run the accept loop.  The parent
+;; supervises the workers and restarts the ones that exit, so a crash in a
+;; handler affects only one worker.
+;;
+;; The module exports:
+;;   prefork?
+;;   prefork-start!
+;;   prefork-supervise!
+;;   prefork-stop!
+;;   prefork-workers
+;;   prefork-restarts
+;;
+;; See the Info documentation for the detailed description of these
+;; procedures.
+
+
+;;; Code:
+
+(define-module (ssh server prefork)
+  #:use-module (srfi srfi-9)
+  #:use-module (srfi srfi-9 gnu)
+  #:use-module (ssh session)
+  #:use-module (ssh server)
+  #:use-module (ssh log)
+  #:export (prefork?
+            prefork-start!
+            prefork-supervise!
+            prefork-stop!
+            prefork-workers
+            prefork-restarts))
+
+\f
+;;; Prefork type.
+
+(define-record-type <prefork>
+  (%make-prefork server handler workers restart-delay pids state restarts)
+  prefork?
+  (server        prefork-server)                  ; <server>
+  (handler       prefork-handler)                 ; <procedure>
+  (workers       prefork-worker-count)            ; <number>
+  (restart-delay prefork-restart-delay)           ; <number>
+  ;; <hash-table>: PID -> #t for the running workers.
+  (pids          prefork-pids)
+  ;; One of the symbols: 'running', 'stopping', 'stopped'.
+  (state         prefork-state    set-prefork-state!)
+  (restarts      prefork-restarts set-prefork-restarts!))
+
+(set-record-type-printer!
+ <prefork>
+ (lambda (prefork port)
+   (format port "#<prefork ~a workers: ~a/~a ~a>"
+           (prefork-state prefork)
+           (hash-count (const #t) (prefork-pids prefork))
+           (prefork-worker-count prefork)
+           (number->string (object-address prefork) 16))))
+
+\f
+;;; Helper procedures.
+
+(define (worker-loop server handler)
+  "Accept sessions on a SERVER and call a HANDLER for each of them, one
+session at a time.  This procedure does not return."
+  (let loop ()
+    (let ((session (server-accept server)))
+      (catch #t
+        (lambda ()
+          (server-handle-key-exchange session)
+          (handler session))
+        (lambda args
+          (format-log 'rare "prefork"
+                      "Session handler failed: ~a" args)))
+      (when (connected? session)
+        (disconnect! session))
+      (loop))))
+
+(define (spawn-worker! prefork)
+  "Fork a new worker process for a PREFORK.  Return the worker PID."
+  (let ((pid (primitive-fork)))
+    (if (zero? pid)
+        (begin
+          ;; Signal handlers of the parent are not needed in a worker.
+          (sigaction SIGTERM SIG_DFL)
+          (sigaction SIGINT  SIG_DFL)
+          (catch #t
+            (lambda ()
+              (worker-loop (prefork-server prefork)
+                           (prefork-handler prefork)))
+            (lambda args
+              (format-log 'rare "prefork" "Worker failed: ~a" args)))
+          (primitive-exit 1))
+        (begin
+          (hashv-set! (prefork-pids prefork) pid #t)
+          pid))))
+
+(define (workers-alive? prefork)
+  (positive? (hash-count (const #t) (prefork-pids prefork))))
+
+\f
+;;; Public API.
+
+(define* (prefork-start! server handler
+                         #:key
+                         (workers       4)
+                         (restart-delay 1))
+  "Start a prefork SERVER: make the SERVER listen, which binds the socket and
+loads the host keys in this process, then fork WORKERS processes.  Each worker
+accepts sessions on the SERVER and calls a HANDLER as (HANDLER SESSION) for
+each of them, one session at a time; the session is disconnected when the
+HANDLER returns.  Workers that exit are restarted by 'prefork-supervise!'
+after RESTART-DELAY seconds.  Return a new prefork object."
+  (unless (and (integer? workers) (positive? workers))
+    (throw 'guile-ssh-error "prefork-start!: Wrong number of workers"
+           workers))
+  (server-listen server)
+  (let ((prefork (%make-prefork server handler workers restart-delay
+                                (make-hash-table) 'running 0)))
+    (for-each (lambda (n) (spawn-worker! prefork))
+              (iota workers))
+    prefork))
+
+(define (prefork-supervise! prefork)
+  "Wait for the workers of a PREFORK to exit and restart them, until the
+PREFORK is stopped (see 'prefork-stop!') and all its workers exit.  The
+procedure can be stopped from a signal handler.  Return value is
+undefined."
+  (let loop ()
+    (when (workers-alive? prefork)
+      (let* ((result (catch 'system-error
+                       (lambda ()
+                         (waitpid WAIT_ANY))
+                       (lambda args
+                         ;; No child processes are left.
+                         (hash-clear! (prefork-pids prefork))
+                         '(#f . #f))))
+             (pid    (car result)))
+        (when (hashv-ref (prefork-pids prefork) pid)
+          (hashv-remove! (prefork-pids prefork) pid)
+          (when (eq? (prefork-state prefork) 'running)
+            (format-log 'rare "prefork"
+                        "Worker ~a exited with status ~a; restarting"
+                        pid (cdr result))
+            (sleep (prefork-restart-delay prefork))
+            ;; The prefork may be stopped while sleeping.
+            (when (eq? (prefork-state prefork) 'running)
+              (set-prefork-restarts! prefork (1+ (prefork-restarts prefork)))
+              (spawn-worker! prefork)))))
+      (loop)))
+  (set-prefork-state! prefork 'stopped))
+
+(define* (prefork-stop! prefork #:key (signal SIGTERM) (wait? #t))
+  "Stop a PREFORK: send a SIGNAL to its workers so they exit.  When WAIT? is
+true, wait for the workers to exit.  In a signal handler that interrupts
+'prefork-supervise!', WAIT? should be #f; 'prefork-supervise!' returns when
+the workers exit.  Return value is undefined."
+  (set-prefork-state! prefork 'stopping)
+  (hash-for-each (lambda (pid value)
+                   (catch 'system-error
+                     (lambda ()
+                       (kill pid signal))
+                     (const #f)))
+                 (prefork-pids prefork))
+  (when wait?
+    (prefork-supervise! prefork)))
+
+(define (prefork-workers prefork)
+  "Get the list of PIDs of the running workers of a PREFORK."
+  (hash-map->list (lambda (pid value) pid) (prefork-pids prefork)))
+
+;;; prefork.scm ends here.
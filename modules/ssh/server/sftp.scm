@@ -0,0 +1,237 @@
+;;; sftp.scm -- SFTP server.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+
+;;; Commentary:
+
+;; This module contains an SFTP server for the "sftp" subsystem of server
+;; channels.  A server either serves a local directory natively (the
+;; requests are handled in C, without entering Scheme), or passes the
+;; requests to a virtual file system (VFS) that is implemented with Scheme
+;; procedures.
+;;
+;; The module exports:
+;;   sftp-server?
+;;   make-sftp-server
+;;   make-sftp-vfs
+;;   sftp-vfs?
+;;   sftp-server-serve-directory
+;;   sftp-server-serve-vfs
+;;   sftp-server-start!
+;;   stat->sftp-attributes
+;;
+;; See the Info documentation for the detailed description of these
+;; procedures.
+
+
+;;; Code:
+
+(define-module (ssh server sftp)
+  #:use-module (srfi srfi-1)
+  #:use-module (srfi srfi-9)
+  #:use-module (ice-9 threads)
+  #:use-module (rnrs bytevectors)
+  #:use-module (ssh log)
+  #:export (sftp-server?
+            make-sftp-server
+            make-sftp-vfs
+            sftp-vfs?
+            sftp-server-serve-directory
+            sftp-server-serve-vfs
+            sftp-server-start!
+            stat->sftp-attributes))
+
+
+;;; Virtual file system type.
+
+(define-record-type <sftp-vfs>
+  (%make-sftp-vfs procedures)
+  sftp-vfs?
+  ;; An alist that maps request types to procedures.
+  (procedures sftp-vfs-procedures))
+
+(define* (make-sftp-vfs #:key open close read write stat lstat fstat
+                        setstat fsetstat opendir readdir remove mkdir rmdir
+                        (realpath normalize-path) rename readlink symlink)
+  "Make a virtual file system for an SFTP server from procedures that handle
+SFTP requests.  Requests that do not have a procedure are replied with the
+'op-unsupported' status.  See the Info documentation for the arguments and
+return values of the procedures."
+  (%make-sftp-vfs
+   (filter-map (lambda (entry) (and (cdr entry) entry))
+               `((open     . ,open)
+                 (close    . ,close)
+                 (read     . ,read)
+                 (write    . ,write)
+                 (stat     . ,stat)
+                 (lstat    . ,lstat)
+                 (fstat    . ,fstat)
+                 (setstat  . ,setstat)
+                 (fsetstat . ,fsetstat)
+                 (opendir  . ,opendir)
+                 (readdir  . ,readdir)
+                 (remove   . ,remove)
+                 (mkdir    . ,mkdir)
+                 (rmdir    . ,rmdir)
+                 (realpath . ,realpath)
+                 (rename   . ,rename)
+                 (readlink . ,readlink)
+                 (symlink  . ,symlink)))))
+
+
+;;; Helper procedures.
+
+(define (normalize-path path)
+  "Make an absolute PATH without \".\" and \"..\" components."
+  (let loop ((components (string-split path #\/))
+             (result     '()))
+    (cond
+     ((null? components)
+      (string-append "/" (string-join (reverse result) "/")))
+     ((member (car components) '("" "."))
+      (loop (cdr components) result))
+     ((string=? (car components) "..")
+      (loop (cdr components) (if (null? result) result (cdr result))))
+     (else
+      (loop (cdr components) (cons (car components) result))))))
+
+(define (errno->status errno)
+  (cond
+   ((memv errno (list ENOENT ENOTDIR)) 'no-such-file)
+   ((memv errno (list EACCES EPERM))   'permission-denied)
+   ((eqv? errno EEXIST)                'file-already-exists)
+   (else                               'failure)))
+
+(define (result->reply type result)
+  "Make a reply to a request of TYPE from a RESULT of a VFS procedure."
+  (case type
+    ((open opendir)
+     (list 'handle result))
+    ((read)
+     (if (or (eof-object? result) (zero? (bytevector-length result)))
+         (list 'status 'eof #f)
+         (list 'data result)))
+    ((stat lstat fstat)
+     (list 'attrs result))
+    ((readdir)
+     (if (null? result)
+         (list 'status 'eof #f)
+         (list 'names result)))
+    ((realpath readlink)
+     (list 'names (list (cons result '()))))
+    (else
+     (list 'status 'ok #f))))
+
+(define (vfs-dispatch vfs request)
+  "Handle a REQUEST with a procedure of a VFS.  Return a reply: a list of
+the reply type ('handle', 'data', 'attrs', 'names' or 'status') and its
+arguments."
+  (let* ((type (car request))
+         (proc (assq-ref (sftp-vfs-procedures vfs) type)))
+    (if proc
+        (catch #t
+          (lambda ()
+            (result->reply type (apply proc (cdr request))))
+          (lambda (key . args)
+            (case key
+              ((system-error)
+               (let ((errno (system-error-errno (cons key args))))
+                 (list 'status (errno->status errno) (strerror errno))))
+              (else
+               (format-log 'rare "sftp-server"
+                           "~a request failed: ~a ~a" type key args)
+               (list 'status 'failure "Request failed")))))
+        (list 'status 'op-unsupported "Unsupported request"))))
+
+(define (send-reply server reply)
+  "Send a REPLY (see 'vfs-dispatch') to the current request of a SERVER."
+  (let ((args (cdr reply)))
+    (case (car reply)
+      ((handle) (%gssh-sftp-server-reply-handle server (car args)))
+      ((data)   (%gssh-sftp-server-reply-data server (car args)))
+      ((attrs)  (%gssh-sftp-server-reply-attrs server (car args)))
+      ((names)  (%gssh-sftp-server-reply-names server (car args)))
+      ((status) (%gssh-sftp-server-reply-status server
+                                                (car args) (cadr args))))))
+
+
+;;; Public API.
+
+(define (sftp-server? x)
+  "Return #t if X is an SFTP server, #f otherwise."
+  (%gssh-sftp-server? x))
+
+(define (make-sftp-server channel)
+  "Make an SFTP server on a CHANNEL for which the \"sftp\" subsystem request
+has been accepted.  Wait for the client to initialize the SFTP session.
+Throw 'guile-ssh-error' on an error."
+  (%gssh-make-sftp-server channel))
+
+(define (sftp-server-serve-directory server root)
+  "Serve the SFTP requests of a SERVER with a local directory ROOT that is
+seen by the client as \"/\".  The requests are handled in C.  Symbolic links
+that point outside of ROOT cannot be followed, and the client cannot create
+symbolic links.  Block until the client closes the session, then return the
+number of served requests.  Throw 'guile-ssh-error' if ROOT does not exist."
+  (%gssh-sftp-server-serve-directory server root))
+
+(define (sftp-server-serve-vfs server vfs)
+  "Serve the SFTP requests of a SERVER with a virtual file system VFS (see
+'make-sftp-vfs'.)  Block until the client closes the session, then return
+the number of served requests."
+  (let loop ((count 0))
+    (let ((request (%gssh-sftp-server-get-request server)))
+      (if request
+          (begin
+            (send-reply server (vfs-dispatch vfs request))
+            (loop (1+ count)))
+          count))))
+
+(define* (sftp-server-start! server #:key (root #f) (vfs #f))
+  "Serve a SERVER in a new thread either with a local directory ROOT or with
+a virtual file system VFS.  Return the thread; the result of the thread is
+the number of served requests."
+  (cond
+   (root
+    (call-with-new-thread
+     (lambda () (sftp-server-serve-directory server root))))
+   (vfs
+    (call-with-new-thread
+     (lambda () (sftp-server-serve-vfs server vfs))))
+   (else
+    (throw 'guile-ssh-error "sftp-server-start!: No root or VFS specified"
+           server))))
+
+(define (stat->sftp-attributes st)
+  "Convert a file status ST (as returned by 'stat' and 'lstat') to SFTP
+attributes that a VFS procedure returns."
+  `((size        . ,(stat:size st))
+    (uid         . ,(stat:uid st))
+    (gid         . ,(stat:gid st))
+    (permissions . ,(stat:mode st))
+    (atime       . ,(stat:atime st))
+    (mtime       . ,(stat:mtime st))))
+
+
+;;; Load libraries.
+
+(unless (getenv "GUILE_SSH_CROSS_COMPILING")
+  (load-extension "libguile-ssh" "init_sftp_server"))
+
+;;; sftp.scm ends here.
@@ -39,12 +39,29 @@
 ;;   get-public-key-hash
 ;;   write-known-host!
 ;;   get-error
+;;   get-fd
+;;   get-peer-address
+;;   get-poll-flags
+;;   connect-many
+;;   session-reaper-stats
+;;   known-hosts-cache-flush!
+;;   send-keepalive!
+;;   session-set-keepalive!
+;;   session-alive?
+;;   call-with-deadline
+;;   with-deadline
+;;   deadline-remaining
 
 
 ;;; Code:
 
 (define-module (ssh session)
   #:use-module (ice-9 optargs)
+  #:use-module (ice-9 rdelim)
+  #:use-module (ice-9 threads)
+  #:use-module (srfi srfi-1)
+  #:use-module (srfi srfi-9)
+  #:use-module (ssh key)
   #:use-module (ssh log)
   #:export (session
             session?
@@ -61,7 +78,21 @@
             authenticate-server
             get-server-public-key
             write-known-host!
-            get-error))
+            get-error
+            get-fd
+            get-peer-address
+            get-poll-flags
+            connect-many
+            session-reaper-stats
+            known-hosts-cache-flush!
+            send-keepalive!
+            session-set-keepalive!
+            session-alive?
+            call-with-deadline
+            with-deadline
+            deadline-remaining
+            ;; Low-level procedures
+            %gssh-thread-cpu-time))
 
 ;; Set a SSH option if it is specified by the user
 (define-macro (session-set-if-specified! option)
@@ -75,7 +106,7 @@
                        ciphers-c-s ciphers-s-c compression-c-s compression-s-c
                        proxycommand stricthostkeycheck compression
                        compression-level nodelay callbacks config
-                       public-key-accepted-types)
+                       public-key-accepted-types (blocking-mode #t))
   "Make a new SSH session with specified configuration.\n
 Return a new SSH session."
   (let ((session (%make-session)))
@@ -102,6 +133,9 @@ Return a new SSH session."
     (session-set-if-specified! nodelay)
     (session-set-if-specified! callbacks)
 
+    (unless blocking-mode
+      (session-set! session 'blocking-mode #f))
+
     (when config
       (or host
           (throw 'guile-ssh-error
@@ -122,6 +156,330 @@ set, the default SSH '~/.ssh/config' is used.  Throw 'guile-ssh-error' on an
 error.  Return value is undefined."
   (%gssh-session-parse-config! session file-name))
 
+
+;;; Known hosts cache.
+
+;; 'ssh_session_is_known_server' reads and parses the whole known hosts file
+;; on each call.  The cache keeps an index of the plain entries of each file
+;; by host name, so a known server is verified without reading the file.
+;; Hashed entries ("|1|SALT|HASH", as written by OpenSSH with
+;; 'HashKnownHosts') are indexed by salt and hash: a host name is hashed
+;; with each salt of the file once, and the keys that are found for the name
+;; are memoized.  The other hosts (the ones that are stored only in wildcard
+;; entries) are checked by libssh, and the successful results are memoized;
+;; failures are never cached, so a host that is added to the file later is
+;; not rejected by a stale result.  The cache entry for a file is dropped
+;; when the file changes.
+
+(define-record-type <known-hosts>
+  (make-known-hosts state index salts names results)
+  known-hosts?
+  ;; See 'known-hosts-file-state'.
+  (state   known-hosts-state)           ; <list>
+  ;; Host name -> list of (key-type . base64-key) pairs.
+  (index   known-hosts-index)           ; <hash-table>
+  ;; Base64 salt -> <hash-table> of base64 hash -> list of (key-type
+  ;; . base64-key) pairs.
+  (salts   known-hosts-salts)           ; <hash-table>
+  ;; Host name -> list of (key-type . base64-key) pairs from both plain and
+  ;; hashed entries, for the names that have been looked up.
+  (names   known-hosts-names)           ; <hash-table>
+  ;; (host-name key-type key) -> #t for the hosts verified by libssh.
+  (results known-hosts-results))        ; <hash-table>
+
+(define %known-hosts-mutex (make-mutex))
+
+;; File name -> <known-hosts>
+(define %known-hosts-cache (make-hash-table))
+
+;; SSH names of the public key types, as they are written to known hosts
+;; files.
+(define %known-hosts-key-types
+  '((rsa        . "ssh-rsa")
+    (dss        . "ssh-dss")
+    (ed25519    . "ssh-ed25519")
+    (ecdsa-p256 . "ecdsa-sha2-nistp256")
+    (ecdsa-p384 . "ecdsa-sha2-nistp384")
+    (ecdsa-p521 . "ecdsa-sha2-nistp521")))
+
+(define (plain-host-pattern? pattern)
+  "Check if a known hosts PATTERN is a host name (as opposed to a hashed
+host name or a wildcard pattern.)"
+  (not (or (string-prefix? "|" pattern)
+           (string-index pattern (char-set #\* #\? #\!)))))
+
+(define (known-hosts-file-state file-stat)
+  "Get the state of a known hosts file that is used to detect changes from a
+FILE-STAT.  The nanoseconds of the modification time catch changes within the
+same second, and the device and inode numbers catch a file that is replaced
+with another one."
+  (list (stat:dev file-stat) (stat:ino file-stat) (stat:size file-stat)
+        (stat:mtime file-stat) (stat:mtimensec file-stat)))
+
+(define (hashed-host-pattern pattern)
+  "Get the salt and the hash of a hashed known hosts PATTERN of the form
+\"|1|SALT|HASH\" as a pair, or #f if the PATTERN is not hashed."
+  (let ((parts (string-split pattern #\|)))
+    (and (= (length parts) 4)
+         (string-null? (car parts))
+         (string=? (cadr parts) "1")
+         (cons (caddr parts) (cadddr parts)))))
+
+(define (read-known-hosts file file-stat)
+  "Read the plain and hashed entries of a known hosts FILE into a new
+<known-hosts>."
+  (let ((index (make-hash-table))
+        (salts (make-hash-table)))
+    (define (add! table name key)
+      (hash-set! table name (cons key (hash-ref table name '()))))
+    (call-with-input-file file
+      (lambda (port)
+        (let loop ((line (read-line port)))
+          (unless (eof-object? line)
+            (let ((fields (string-tokenize line)))
+              ;; Lines with markers ('@revoked', '@cert-authority') are left
+              ;; for libssh.
+              (when (and (>= (length fields) 3)
+                         (not (string-prefix? "#" (car fields)))
+                         (not (string-prefix? "@" (car fields))))
+                (let ((key (cons (cadr fields) (caddr fields))))
+                  (for-each
+                   (lambda (host)
+                     (cond
+                      ((hashed-host-pattern host)
+                       => (lambda (salt+hash)
+                            (let ((hashes
+                                   (or (hash-ref salts (car salt+hash))
+                                       (let ((table (make-hash-table)))
+                                         (hash-set! salts (car salt+hash)
+                                                    table)
+                                         table))))
+                              (add! hashes (cdr salt+hash) key))))
+                      ((plain-host-pattern? host)
+                       (add! index (string-downcase host) key))))
+                   (string-split (car fields) #\,)))))
+            (loop (read-line port))))))
+    (make-known-hosts (known-hosts-file-state file-stat)
+                      index salts (make-hash-table) (make-hash-table))))
+
+(define (known-hosts-keys known-hosts name)
+  "Get the list of (key-type . base64-key) pairs of a host NAME from the
+plain and hashed entries of a KNOWN-HOSTS.  The cache mutex must be held."
+  (or (hash-ref (known-hosts-names known-hosts) name)
+      (let ((keys (hash-fold
+                   (lambda (salt hashes result)
+                     (let ((hash (%gssh-hash-host-name salt name)))
+                       (append (or (and hash (hash-ref hashes hash)) '())
+                               result)))
+                   (hash-ref (known-hosts-index known-hosts) name '())
+                   (known-hosts-salts known-hosts))))
+        (hash-set! (known-hosts-names known-hosts) name keys)
+        keys)))
+
+(define (known-hosts-ref file)
+  "Get the <known-hosts> for a FILE, read the file if it is not cached or
+changed.  Return #f if the file does not exist.  The cache mutex must be
+held."
+  (let ((file-stat (stat file #f))
+        (cached    (hash-ref %known-hosts-cache file)))
+    (cond
+     ((not file-stat)
+      (hash-remove! %known-hosts-cache file)
+      #f)
+     ((and cached
+           (equal? (known-hosts-state cached)
+                   (known-hosts-file-state file-stat)))
+      cached)
+     (else
+      (let ((known-hosts (read-known-hosts file file-stat)))
+        (hash-set! %known-hosts-cache file known-hosts)
+        known-hosts)))))
+
+(define (session-known-hosts-file session)
+  "Get the known hosts file of a SESSION, or #f if it cannot be requested
+with the current version of libssh."
+  (catch 'guile-ssh-error
+    (lambda ()
+      (session-get session 'knownhosts))
+    (const #f)))
+
+(define (known-hosts-check session file)
+  "Authenticate the server of a SESSION using the known hosts cache for a
+FILE."
+  (let* ((host     (string-downcase (session-get session 'host)))
+         (port     (session-get session 'port))
+         (key      (get-server-public-key session))
+         (key-type (assq-ref %known-hosts-key-types (get-key-type key)))
+         (key-data (public-key->string key))
+         (name     (if (= port 22)
+                       host
+                       (string-append "[" host "]:" (number->string port))))
+         (result-key (list name key-type key-data)))
+    (define (check)
+      (with-mutex %known-hosts-mutex
+        (let ((known-hosts (known-hosts-ref file)))
+          (and known-hosts
+               (or (member (cons key-type key-data)
+                           (known-hosts-keys known-hosts name))
+                   (hash-ref (known-hosts-results known-hosts) result-key))
+               'ok))))
+    (define (remember!)
+      (with-mutex %known-hosts-mutex
+        (let ((known-hosts (known-hosts-ref file)))
+          (when known-hosts
+            (hash-set! (known-hosts-results known-hosts) result-key #t)))))
+    (if key-type
+        (or (check)
+            (let ((result (%gssh-authenticate-server session)))
+              (when (eq? result 'ok)
+                (remember!))
+              result))
+        (%gssh-authenticate-server session))))
+
+(define (known-hosts-cache-flush!)
+  "Drop all the cached known hosts files.  Return value is undefined."
+  (with-mutex %known-hosts-mutex
+    (hash-clear! %known-hosts-cache)))
+
+(define (authenticate-server session)
+  "Authenticate the server of a SESSION against the known hosts.  Return one
+of the following symbols: 'ok', 'known-changed', 'found-other', 'not-known',
+'file-not-found', 'error'."
+  (let ((file (and (connected? session)
+                   (session-known-hosts-file session))))
+    (if file
+        (known-hosts-check session file)
+        (%gssh-authenticate-server session))))
+
+(define (write-known-host! session)
+  "Write the current server of a SESSION as known in the known hosts file.
+Throw 'guile-ssh-error' on an error.  Return value is undefined."
+  (%gssh-write-known-host! session)
+  (let ((file (session-known-hosts-file session)))
+    (when file
+      (with-mutex %known-hosts-mutex
+        (hash-remove! %known-hosts-cache file)))))
+
+
+(define* (connect-many hosts
+                       #:key
+                       (concurrency    64)
+                       (timeout        10)
+                       (user           #f)
+                       (port           #f)
+                       (identity       #f)
+                       (knownhosts     #f)
+                       (check-server?  #t)
+                       (authenticate?  #t)
+                       (callback       #f))
+  "Connect to HOSTS in parallel, with at most CONCURRENCY handshakes in
+flight.  HOSTS is a list of host names or sessions; sessions are made for host
+names with the USER, PORT, IDENTITY, KNOWNHOSTS and TIMEOUT (in seconds)
+options.  If CHECK-SERVER? is true then each server is checked against the
+known hosts; if AUTHENTICATE? is true then the user is authenticated with the
+public keys.  TIMEOUT limits the whole handshake of each host, or '#f' for no
+limit.
+
+The handshakes are non-blocking and are driven by a single native thread
+outside of Guile mode, so they do not block the garbage collector.  CALLBACK,
+if specified, is called as (CALLBACK SESSION RESULT) as each session
+completes.
+
+Return a list of (SESSION . RESULT) pairs in the order of completion, where
+RESULT is one of the symbols: 'ok', 'connect-error', 'server-known-changed',
+'server-found-other', 'server-not-known', 'server-file-not-found',
+'server-error', 'auth-denied', 'auth-partial', 'auth-error', 'timeout'.
+Sessions that failed are disconnected."
+  (define (host->session host)
+    (if (session? host)
+        host
+        (let ((session (make-session #:host host)))
+          (when timeout
+            (session-set! session 'timeout timeout))
+          (when user
+            (session-set! session 'user user))
+          (when port
+            (session-set! session 'port port))
+          (when identity
+            (session-set! session 'identity identity))
+          (when knownhosts
+            (session-set! session 'knownhosts knownhosts))
+          session)))
+  (let ((sessions (list->vector (map host->session hosts)))
+        (results  '()))
+    (%gssh-connect-many sessions concurrency timeout
+                        (and check-server? authenticate-server)
+                        authenticate?
+                        (lambda (session result)
+                          (unless (eq? result 'ok)
+                            (when (connected? session)
+                              (disconnect! session)))
+                          (set! results (cons (cons session result) results))
+                          (when callback
+                            (callback session result))))
+    (reverse results)))
+
+
+
+;;; Keepalive.
+
+(define* (session-set-keepalive! session
+                                 #:key
+                                 (interval 15)
+                                 (count    3)
+                                 (idle     interval))
+  "Enable TCP keepalive on the socket of a connected SESSION.  The first probe
+is sent after IDLE seconds of inactivity, then probes are sent each INTERVAL
+seconds; the connection is considered dead after COUNT unanswered probes.
+IDLE and INTERVAL must be in the range 1..32767, COUNT in the range 1..127.
+Where the system supports it, data that is not acknowledged by the peer for
+the same time also drops the connection.  After that any pending or further
+operation on the session fails with 'guile-ssh-error' instead of hanging until
+the system TCP timeout.  Throw 'guile-ssh-error' on an error.  Return value is
+undefined."
+  (%gssh-set-tcp-keepalive! session idle interval count))
+
+(define* (session-alive? session #:key (timeout 5))
+  "Check if a SESSION is still alive by sending a keepalive request to the
+server and waiting at most TIMEOUT seconds for the server to answer.  If the
+request cannot be sent, the connection is closed or the server does not
+answer in time, the session is marked dead by disconnecting it.  Return #t if
+the session is alive, #f otherwise."
+  (define (mark-dead!)
+    (when (connected? session)
+      (false-if-exception (disconnect! session)))
+    #f)
+  (and (connected? session)
+       (catch 'guile-ssh-error
+         (lambda ()
+           (or (%gssh-session-ping session timeout)
+               (mark-dead!)))
+         (lambda args
+           (mark-dead!)))))
+
+
+
+;;; Deadlines.
+
+(define (call-with-deadline seconds thunk)
+  "Call a THUNK with a deadline in SECONDS from now.  Channel reads, writes
+and requests, SFTP operations and 'server-message-get' that do not complete
+before the deadline throw 'guile-ssh-timeout'.  A nested deadline cannot
+extend the outer one; SECONDS set to #f removes the deadline.  Return the
+values yielded by THUNK."
+  (with-fluids ((%gssh-deadline (%gssh-deadline-after seconds)))
+    (thunk)))
+
+(define-syntax-rule (with-deadline seconds body ...)
+  "Evaluate BODY with a deadline in SECONDS from now.  See
+'call-with-deadline'."
+  (call-with-deadline seconds (lambda () body ...)))
+
+(define (deadline-remaining)
+  "Get the number of seconds left until the current deadline, or #f if there
+is no deadline."
+  (%gssh-deadline-remaining (fluid-ref %gssh-deadline)))
+
 (unless (getenv "GUILE_SSH_CROSS_COMPILING")
   (load-extension "libguile-ssh" "init_session"))
 
@@ -43,6 +43,11 @@
 ;;   call-with-remote-output-file
 ;;   with-input-from-remote-file
 ;;   with-output-to-remote-file
+;;   sftp-extensions
+;;   sftp-file-hash
+;;   local-file-hash
+;;   sftp-put-file
+;;   sftp-sync-file
 ;;
 ;; See the Info documentation for the detailed description of these
 ;; procedures.
@@ -51,11 +56,15 @@
 
 (define-module (ssh sftp)
   #:use-module (ice-9 receive)
+  #:use-module (rnrs bytevectors)
+  #:use-module (rnrs io ports)
+  #:use-module (ssh shell)
   #:export (sftp-session?
             make-sftp-session
             sftp-init
             sftp-get-session
             sftp-get-error
+            sftp-extensions
             sftp-mkdir
             sftp-rmdir
             sftp-mv
@@ -76,7 +85,15 @@
             call-with-remote-input-file
             call-with-remote-output-file
             with-input-from-remote-file
-            with-output-to-remote-file))
+            with-output-to-remote-file
+
+            ;; Hashing
+            sftp-file-hash
+            local-file-hash
+
+            ;; Synchronization
+            sftp-put-file
+            sftp-sync-file))
 
 
 ;;; Low-level SFTP session procedures.
@@ -116,6 +133,12 @@ on an error"
 or throw 'guile-ssh-error' on if an error occurred in the procedure itself."
   (%gssh-sftp-get-error sftp-session))
 
+(define (sftp-extensions sftp-session)
+  "Get the list of SFTP protocol extensions that are supported by the server of
+an SFTP-SESSION.  Return an alist where each key is an extension name and each
+value is the extension data."
+  (%gssh-sftp-extensions sftp-session))
+
 
 (define* (sftp-mkdir sftp-session dirname #:optional (mode #o777))
   "Create a directory DIRNAME using a SFTP-SESSION with permissions specified
@@ -247,6 +270,198 @@ behavior is implementation dependent."
   (call-with-remote-output-file sftp-session filename
     (lambda (p) (with-output-to-port p thunk))))
 
+
+;;; Hashing of remote and local files.
+
+(define (shell-quote str)
+  "Quote a string STR for use as a single argument in a POSIX shell command."
+  (string-append "'" (string-join (string-split str #\') "'\\''") "'"))
+
+(define (sha256sum-line->hash line)
+  "Get a hash from a LINE of 'sha256sum' output."
+  (let ((hash (car (string-split line #\space))))
+    ;; 'sha256sum' prepends a backslash to the line if the file name
+    ;; contains special characters.
+    (if (string-prefix? "\\" hash)
+        (substring hash 1)
+        hash)))
+
+(define (sftp-file-hash sftp-session filename)
+  "Calculate SHA-256 hash of a remote FILENAME.  The hash is calculated on the
+remote side by 'sha256sum' program that is run through the parent SSH session
+of an SFTP-SESSION, so the file contents is not transferred.  Return the hash
+as a hex string, or #f if the hash could not be calculated."
+  (receive (lines exit-status)
+      (rexec (sftp-get-session sftp-session)
+             (string-append "sha256sum -- " (shell-quote filename)))
+    (and (zero? exit-status)
+         (not (null? lines))
+         (sha256sum-line->hash (car lines)))))
+
+(define (local-file-hash filename)
+  "Calculate SHA-256 hash of a local FILENAME.  Return the hash as a hex
+string.  Throw 'guile-ssh-error' on an error."
+  (%gssh-file-sha256 filename))
+
+(define (remote-file-unchanged? sftp-session local-file remote-file)
+  "Check if a REMOTE-FILE has the same contents as a LOCAL-FILE."
+  (let ((hash (sftp-file-hash sftp-session remote-file)))
+    (and hash
+         (string=? hash (local-file-hash local-file)))))
+
+
+;;; Synchronization.
+
+(define %default-sync-block-size (* 128 1024))
+
+;; Number of blocks that are read from a local file and hashed at once.
+(define %sync-blocks-per-batch 64)
+
+;; Size of the buffer that is used for plain file copying.
+(define %transfer-buffer-size (* 64 1024))
+
+(define (remote-block-hashes session filename block-size)
+  "Get SHA-256 hashes of the blocks of BLOCK-SIZE bytes of a remote FILENAME
+using an SSH SESSION.  Return two values: the size of the remote file and a
+vector of hex-encoded hashes, or #f and #f if the file could not be read."
+  (let ((file (shell-quote filename)))
+    (receive (lines exit-status)
+        (rexec session
+               (string-append "stat -c %s -- " file
+                              " && split -b " (number->string block-size)
+                              " --filter=sha256sum -- " file))
+      (if (and (zero? exit-status) (not (null? lines)))
+          (values (string->number (car lines))
+                  (list->vector
+                   (map (lambda (line)
+                          (sha256sum-line->hash line))
+                        (cdr lines))))
+          (values #f #f)))))
+
+(define (call-with-transfer-ports sftp-session local-file remote-file flags
+                                  proc)
+  "Call a PROC with an input port of a LOCAL-FILE and an output port of a
+REMOTE-FILE that is opened with FLAGS using an SFTP-SESSION.  The ports are
+closed when the PROC returns or throws."
+  (let ((input (open-file local-file "rb")))
+    (dynamic-wind
+      (const #t)
+      (lambda ()
+        (let ((output (sftp-open sftp-session remote-file flags)))
+          (dynamic-wind
+            (const #t)
+            (lambda () (proc input output))
+            (lambda () (close-port output)))))
+      (lambda () (close-port input)))))
+
+(define (sync-file sftp-session local-file remote-file block-size progress)
+  (let ((session    (sftp-get-session sftp-session))
+        (total-size (stat:size (stat local-file))))
+    (receive (remote-size remote-hashes)
+        (remote-block-hashes session remote-file block-size)
+      (let* ((full-copy?  (or (not remote-size) (> remote-size total-size)))
+             (flags       (if full-copy?
+                              (logior O_WRONLY O_CREAT O_TRUNC)
+                              (logior O_WRONLY O_CREAT)))
+             (hashes      (if full-copy? #() remote-hashes))
+             (batch-size  (* block-size %sync-blocks-per-batch))
+             (buffer      (make-bytevector batch-size)))
+
+        (define (block-changed? index hash)
+          (or full-copy?
+              (>= index (vector-length hashes))
+              (not (string=? hash (vector-ref hashes index)))))
+
+        (call-with-transfer-ports sftp-session local-file remote-file flags
+          (lambda (input output)
+            (define (send-block! bv start count offset)
+              (seek output offset SEEK_SET)
+              (put-bytevector output bv start count))
+
+            (let loop ((offset 0)
+                       (sent   0))
+              (let ((count (get-bytevector-n! input buffer 0 batch-size)))
+                (if (eof-object? count)
+                    sent
+                    (let send-loop ((hashes (%gssh-sha256-blocks buffer count
+                                                                 block-size))
+                                    (start  0)
+                                    (sent   sent))
+                      (if (null? hashes)
+                          (let ((offset (+ offset count)))
+                            (when progress
+                              (progress offset total-size))
+                            (loop offset sent))
+                          (let ((size  (min block-size (- count start)))
+                                (index (quotient (+ offset start)
+                                                 block-size)))
+                            (if (block-changed? index (car hashes))
+                                (begin
+                                  (send-block! buffer start size
+                                               (+ offset start))
+                                  (send-loop (cdr hashes)
+                                             (+ start size)
+                                             (+ sent size)))
+                                (send-loop (cdr hashes)
+                                           (+ start size)
+                                           sent))))))))))))))
+
+(define* (sftp-sync-file sftp-session local-file remote-file
+                         #:key
+                         (block-size %default-sync-block-size)
+                         (progress #f)
+                         (if-changed? #f))
+  "Synchronize a REMOTE-FILE with a LOCAL-FILE using an SFTP-SESSION.  The
+remote file is split into blocks of BLOCK-SIZE bytes, hashes of the blocks are
+calculated on the remote side and only the blocks that differ from the local
+file are sent.  When the remote file does not exist or cannot be hashed, or
+when it is larger than the local file, the whole file is sent.
+
+If IF-CHANGED? is true, the hashes of the whole files are compared first and
+nothing is done when the files are the same.
+
+PROGRESS, if specified, is called as (PROGRESS BYTES-DONE BYTES-TOTAL) after
+each processed portion of the local file.
+
+Return the number of bytes sent to the remote side.  Throw 'guile-ssh-error'
+on an error."
+  (if (and if-changed?
+           (remote-file-unchanged? sftp-session local-file remote-file))
+      0
+      (sync-file sftp-session local-file remote-file block-size progress)))
+
+(define* (sftp-put-file sftp-session local-file remote-file
+                        #:key
+                        (progress #f)
+                        (if-changed? #f))
+  "Copy a LOCAL-FILE to a REMOTE-FILE using an SFTP-SESSION.  If IF-CHANGED?
+is true, the file is copied only if the SHA-256 hash of the remote file
+differs from the hash of the local file.
+
+PROGRESS, if specified, is called as (PROGRESS BYTES-DONE BYTES-TOTAL) during
+the transfer.
+
+Return the number of bytes sent to the remote side.  Throw 'guile-ssh-error'
+on an error."
+  (if (and if-changed?
+           (remote-file-unchanged? sftp-session local-file remote-file))
+      0
+      (let ((total-size (stat:size (stat local-file)))
+            (buffer     (make-bytevector %transfer-buffer-size)))
+        (call-with-transfer-ports sftp-session local-file remote-file
+                                  (logior O_WRONLY O_CREAT O_TRUNC)
+          (lambda (input output)
+            (let loop ((done 0))
+              (when progress
+                (progress done total-size))
+              (let ((count (get-bytevector-n! input buffer 0
+                                              %transfer-buffer-size)))
+                (if (eof-object? count)
+                    done
+                    (begin
+                      (put-bytevector output buffer 0 count)
+                      (loop (+ done count)))))))))))
+
 
 ;;; Load libraries.
 
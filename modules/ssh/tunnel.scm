@@ -28,6 +28,7 @@
 
 (define-module (ssh tunnel)
   #:use-module (rnrs io ports)
+  #:use-module (srfi srfi-1)
   #:use-module (srfi srfi-9)
   #:use-module (srfi srfi-9 gnu)
   #:use-module (srfi srfi-11)
@@ -36,6 +37,7 @@
   #:use-module (rnrs bytevectors)
   #:use-module (ssh session)
   #:use-module (ssh channel)
+  #:use-module (ssh log)
   #:export (make-tunnel
             tunnel?
             tunnel-reverse?
@@ -46,6 +48,7 @@
             tunnel-host-port
             start-forward
             call-with-ssh-forward
+            connect-via
 
             ;; Helper procedures
             make-tunnel-channel
@@ -279,4 +282,182 @@ versa. Return the result the PROC call."
                                 (tunnel-host tunnel)
                                 (tunnel-host-port tunnel))))))
 
+
+;;; Jump hosts.
+
+;; A session to a host behind a jump host (bastion) works over a pair of
+;; connected sockets: one socket is used by the inner session as its file
+;; descriptor, the other one is connected to a "direct-tcpip" channel that is
+;; opened on the bastion session.  All the channels of a bastion session are
+;; served by a single thread that holds the bastion lock while doing I/O,
+;; as libssh sessions must not be used from several threads at once.  The
+;; thread sleeps in 'select' on the local sockets and on the bastion socket,
+;; so the data is forwarded as soon as it arrives in either direction.  No
+;; external process is spawned, unlike with the 'proxycommand' option.
+
+(define-record-type <jump-link>
+  (make-jump-link channel sock)
+  jump-link?
+  (channel      jump-link-channel)      ; channel on the bastion
+  (sock         jump-link-sock))        ; socket connected to the channel
+
+(define-record-type <jump-forwarder>
+  (make-jump-forwarder mutex links running?)
+  jump-forwarder?
+  (mutex    jump-forwarder-mutex)         ; mutex
+  (links    jump-forwarder-links          ; list of <jump-link>
+            set-jump-forwarder-links!)
+  (running? jump-forwarder-running?       ; boolean
+            set-jump-forwarder-running?!))
+
+;; Bastion session -> <jump-forwarder>
+(define %jump-forwarders (make-weak-key-hash-table))
+(define %jump-forwarders-mutex (make-mutex))
+
+;; The longest time to wait for the sockets in the forwarder loop, in
+;; milliseconds.  The loop is woken up by the data on the bastion socket, so
+;; the timeout matters only when another thread reads the data of the
+;; forwarded channels from the bastion socket, or when the bastion is
+;; disconnected.
+(define %jump-poll-interval 100)
+
+(define (bastion-forwarder bastion)
+  (with-mutex %jump-forwarders-mutex
+    (or (hashq-ref %jump-forwarders bastion)
+        (let ((forwarder (make-jump-forwarder (make-mutex) '() #f)))
+          (hashq-set! %jump-forwarders bastion forwarder)
+          forwarder))))
+
+(define (jump-link-close! link)
+  (for-each (lambda (port)
+              (unless (port-closed? port)
+                (close port)))
+            (list (jump-link-channel link) (jump-link-sock link))))
+
+(define (jump-link-transfer! link)
+  "Transfer the available data of a LINK in both directions.  Return #f if
+the link is closed, #t otherwise."
+  (let ((channel (jump-link-channel link))
+        (sock    (jump-link-sock link)))
+    (catch #t
+      (lambda ()
+        (cond-io
+         (channel -> sock => transfer))
+        (cond-io
+         (sock -> channel => transfer))
+        (and (not (port-closed? channel))
+             (not (port-closed? sock))
+             (channel-open? channel)
+             (or (not (channel-eof? channel))
+                 (begin
+                   (jump-link-close! link)
+                   #f))))
+      (lambda args
+        (jump-link-close! link)
+        #f))))
+
+(define (jump-link-pending? link)
+  "Check if the channel of a LINK has data that is already read from the
+bastion socket, so 'poll' would not report it."
+  (let ((channel (jump-link-channel link)))
+    (catch #t
+      (lambda ()
+        (and (not (port-closed? channel))
+             (char-ready? channel)))
+      (const #f))))
+
+(define (jump-forwarder-stop! forwarder)
+  "Close all links of a FORWARDER and mark it as stopped, so a new forwarder
+thread is started for the next link.  The mutex of the FORWARDER must be
+held."
+  (for-each jump-link-close! (jump-forwarder-links forwarder))
+  (set-jump-forwarder-links! forwarder '())
+  (set-jump-forwarder-running?! forwarder #f))
+
+(define (jump-forwarder-wait bastion forwarder)
+  "Transfer the available data of the links of a FORWARDER.  Return #f when
+the forwarder is stopped, #t when there is pending data, or the pair of the
+lists of descriptors to wait for reading and writing."
+  (with-mutex (jump-forwarder-mutex forwarder)
+    (let ((links (filter jump-link-transfer!
+                         (jump-forwarder-links forwarder))))
+      (set-jump-forwarder-links! forwarder links)
+      (when (or (null? links)
+                (not (connected? bastion)))
+        (jump-forwarder-stop! forwarder))
+      (and (jump-forwarder-running? forwarder)
+           (or (any jump-link-pending? links)
+               (let ((fd    (get-fd bastion))
+                     (socks (map (lambda (link)
+                                   (port->fdes (jump-link-sock link)))
+                                 links)))
+                 (cons (if fd (cons fd socks) socks)
+                       (if (and fd
+                                (memq 'write (get-poll-flags bastion)))
+                           (list fd)
+                           '()))))))))
+
+(define (jump-forwarder-loop bastion forwarder)
+  ;; The descriptors are waited for with 'poll', since the number of links
+  ;; can make them larger than FD_SETSIZE.  On an error all the links are
+  ;; closed, so their sessions fail instead of hanging.
+  (let loop ()
+    (let ((wait (catch #t
+                  (lambda ()
+                    (let ((wait (jump-forwarder-wait bastion forwarder)))
+                      (when (pair? wait)
+                        (%gssh-poll-fds (car wait) (cdr wait)
+                                        %jump-poll-interval))
+                      wait))
+                  (lambda args
+                    (format-log 'rare "jump-forwarder-loop"
+                                "Forwarder failed: ~a" args)
+                    (with-mutex (jump-forwarder-mutex forwarder)
+                      (jump-forwarder-stop! forwarder))
+                    #f))))
+      (when wait
+        (loop)))))
+
+(define (connect-via bastion session)
+  "Connect a SESSION through a connected and authenticated BASTION session,
+like 'ssh -J' does: a \"direct-tcpip\" channel to the host and port of the
+SESSION is opened on the BASTION, and the SESSION works over the channel.  No
+external process is spawned.  Return the result of 'connect!' for the
+SESSION."
+  (let* ((forwarder (bastion-forwarder bastion))
+         (pair      (socketpair PF_UNIX SOCK_STREAM 0))
+         (link      (with-mutex (jump-forwarder-mutex forwarder)
+                      (let ((channel (make-channel bastion)))
+                        (unless channel
+                          (error "Could not make a channel" bastion))
+                        (case (channel-open-forward
+                               channel
+                               #:source-host "127.0.0.1"
+                               #:local-port  0
+                               #:remote-host (session-get session 'host)
+                               #:remote-port (session-get session 'port))
+                          ((ok)
+                           (make-jump-link channel (cdr pair)))
+                          (else =>
+                                (lambda (res)
+                                  (close (car pair))
+                                  (close (cdr pair))
+                                  (throw 'guile-ssh-error
+                                         "Could not open forward channel"
+                                         bastion session res))))))))
+    ;; The descriptor is owned by the SESSION from now on, as libssh closes
+    ;; it on disconnect.  A revealed port is not closed when it is GC'ed, so
+    ;; the descriptor is not closed twice.
+    (set-port-revealed! (car pair) 1)
+    (session-set! session 'fd (car pair))
+    (with-mutex (jump-forwarder-mutex forwarder)
+      (set-jump-forwarder-links! forwarder
+                                 (cons link (jump-forwarder-links forwarder)))
+      (unless (jump-forwarder-running? forwarder)
+        (set-jump-forwarder-running?! forwarder #t)
+        (call-with-new-thread
+         (lambda ()
+           (jump-forwarder-loop bastion forwarder)))))
+    (connect! session)))
+
 ;;; tunnel.scm ends here.
@@ -0,0 +1,114 @@
+;;; auth.scm -- Testing of the authentication method cache.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (ssh session)
+             (ssh auth)
+             (tests common))
+
+(test-begin-with-log "auth")
+
+;;;
+
+(define (make-test-session)
+  (make-session #:user "alice" #:host "example.org" #:port 22))
+
+;; Make a list of fake authentication methods that return RESULTS; the names
+;; of the called methods are stored in the CALLS box.
+(define (make-methods calls results)
+  (map (lambda (name result)
+         (cons name
+               (lambda (session)
+                 (set-car! calls (append (car calls) (list name)))
+                 result)))
+       (list-head '(a b c) (length results))
+       results))
+
+(test-equal-with-log "userauth-sequence!, first success"
+  '(success (a b))
+  (let ((calls (list '())))
+    (list (userauth-sequence! (make-test-session)
+                              #:methods (make-methods calls
+                                                      '(denied success denied)))
+          (car calls))))
+
+(test-equal-with-log "userauth-sequence!, all methods failed"
+  '(denied (a b c))
+  (let ((calls (list '())))
+    (list (userauth-sequence! (make-test-session)
+                              #:methods (make-methods calls
+                                                      '(error denied denied)))
+          (car calls))))
+
+(test-equal-with-log "userauth-sequence!, cached method is tried first"
+  '(success (c) c)
+  (let ((cache   (make-userauth-cache))
+        (session (make-test-session)))
+    (userauth-sequence! session
+                        #:methods (make-methods (list '())
+                                                '(denied denied success))
+                        #:cache   cache)
+    (let* ((calls  (list '()))
+           (result (userauth-sequence! session
+                                       #:methods (make-methods
+                                                  calls
+                                                  '(denied denied success))
+                                       #:cache   cache)))
+      (list result (car calls) (userauth-cache-ref cache session)))))
+
+(test-equal-with-log "userauth-sequence!, fallback from the cached method"
+  '(success (c a) a)
+  (let ((cache   (make-userauth-cache))
+        (session (make-test-session)))
+    (userauth-sequence! session
+                        #:methods (make-methods (list '())
+                                                '(denied denied success))
+                        #:cache   cache)
+    (let* ((calls  (list '()))
+           (result (userauth-sequence! session
+                                       #:methods (make-methods
+                                                  calls
+                                                  '(success denied denied))
+                                       #:cache   cache)))
+      (list result (car calls) (userauth-cache-ref cache session)))))
+
+(test-equal-with-log "userauth-method/public-key, no key"
+  'error
+  (userauth-sequence! (make-test-session)
+                      #:methods (list (userauth-method/public-key
+                                       "no-such-key-file"))))
+
+(test-assert-with-log "userauth-cache-flush!"
+  (let ((cache   (make-userauth-cache))
+        (session (make-test-session)))
+    (userauth-sequence! session
+                        #:methods (make-methods (list '()) '(success))
+                        #:cache   cache)
+    (userauth-cache-flush! cache)
+    (not (userauth-cache-ref cache session))))
+
+;;;
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "auth")
+
+(exit (= 0 exit-status))
+
+;;; auth.scm ends here.
@@ -0,0 +1,168 @@
+;;; authorized-keys.scm -- Testing of the authorized keys index.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (ice-9 rdelim)
+             (ssh key)
+             (ssh server authorized-keys)
+             (tests common))
+
+(test-begin-with-log "authorized-keys")
+
+;;;
+
+(define (read-file file)
+  (call-with-input-file file read-string))
+
+(define (call-with-authorized-keys-file data proc)
+  (let* ((port     (mkstemp! (string-copy
+                              "/tmp/guile-ssh-authorized-keys-XXXXXX")))
+         (filename (port-filename port)))
+    (display data port)
+    (close-port port)
+    (let ((result (proc filename)))
+      (delete-file filename)
+      result)))
+
+(test-equal-with-log "make-authorized-keys, comments and options"
+  2
+  (call-with-authorized-keys-file
+   (string-append "# A comment\n"
+                  "\n"
+                  (read-file %rsakey-pub)
+                  "no-pty,from=\"127.0.0.1\" " (read-file %ecdsakey-pub))
+   (lambda (file)
+     (authorized-keys-count (make-authorized-keys file)))))
+
+(test-equal-with-log "make-authorized-keys, unclosed quote"
+  0
+  (call-with-authorized-keys-file
+   (string-append "command=\"echo " (read-file %rsakey-pub))
+   (lambda (file)
+     (authorized-keys-count (make-authorized-keys file)))))
+
+(test-equal-with-log "authorized-key-options"
+  '(()
+    ((command . "echo \"a, b\"") (no-pty . #t) (from . "127.0.0.1")))
+  (call-with-authorized-keys-file
+   (string-append (read-file %rsakey-pub)
+                  "command=\"echo \\\"a, b\\\"\",No-Pty,from=\"127.0.0.1\" "
+                  (read-file %ecdsakey-pub))
+   (lambda (file)
+     (let ((store (make-authorized-keys file)))
+       (list (authorized-key-options store (public-key-from-file %rsakey-pub))
+             (authorized-key-options store
+                                     (public-key-from-file %ecdsakey-pub)))))))
+
+(test-equal-with-log "make-authorized-keys, non-existing file"
+  0
+  (authorized-keys-count (make-authorized-keys "/non-existing-file")))
+
+(test-equal-with-log "authorized-key?"
+  '(#t #f)
+  (call-with-authorized-keys-file (read-file %rsakey-pub)
+    (lambda (file)
+      (let ((store (make-authorized-keys file)))
+        (list (authorized-key? store (public-key-from-file %rsakey-pub))
+              (authorized-key? store
+                               (public-key-from-file %ecdsakey-pub)))))))
+
+(test-assert-with-log "authorized-key?, file is changed"
+  (call-with-authorized-keys-file (read-file %rsakey-pub)
+    (lambda (file)
+      (let ((store (make-authorized-keys file #:check-interval 0))
+            (key   (public-key-from-file %ecdsakey-pub)))
+        (and (not (authorized-key? store key))
+             (begin
+               (with-output-to-file file
+                 (lambda ()
+                   (display (read-file %rsakey-pub))
+                   (display (read-file %ecdsakey-pub))))
+               (authorized-key? store key)))))))
+
+(test-equal-with-log "authorized-keys-handler"
+  '(success denied denied)
+  (call-with-authorized-keys-file (read-file %rsakey-pub)
+    (lambda (file)
+      (let* ((store   (make-authorized-keys file))
+             (handler (authorized-keys-handler
+                       (lambda (user)
+                         (and (string=? user "alice") store)))))
+        (list (handler #f "alice" (public-key-from-file %rsakey-pub) 'none)
+              (handler #f "alice" (public-key-from-file %ecdsakey-pub) 'none)
+              (handler #f "bob"   (public-key-from-file %rsakey-pub) 'none))))))
+
+;; A listed key with a signature that failed to verify must be denied.
+(test-equal-with-log "authorized-keys-handler, wrong signature"
+  '(success denied denied)
+  (call-with-authorized-keys-file (read-file %rsakey-pub)
+    (lambda (file)
+      (let ((handler (authorized-keys-handler (make-authorized-keys file)))
+            (key     (public-key-from-file %rsakey-pub)))
+        (map (lambda (state)
+               (handler #f "alice" key state))
+             '(valid wrong error))))))
+
+;; A key with options must not be accepted unless the options are applied.
+(test-equal-with-log "authorized-keys-handler, key with options"
+  '(denied success ((no-pty . #t)))
+  (call-with-authorized-keys-file
+   (string-append "no-pty " (read-file %rsakey-pub))
+   (lambda (file)
+     (let* ((store  (make-authorized-keys file))
+            (key    (public-key-from-file %rsakey-pub))
+            (result #f))
+       (list ((authorized-keys-handler store) #f "alice" key 'none)
+             ((authorized-keys-handler
+               store
+               #:options (lambda (session user key options)
+                           (set! result options)
+                           #t))
+              #f "alice" key 'none)
+             result)))))
+
+;; The file is replaced with a file of the same size and modification time;
+;; the change must be noticed anyway.
+(test-equal-with-log "authorized-key-options, file is replaced"
+  '(((no-pty . #t)) ((no-x11 . #t)))
+  (call-with-authorized-keys-file
+   (string-append "no-pty " (read-file %rsakey-pub))
+   (lambda (file)
+     (let ((store (make-authorized-keys file #:check-interval 0))
+           (key   (public-key-from-file %rsakey-pub))
+           (new   (string-append file ".new")))
+       (let ((options (authorized-key-options store key))
+             (st      (stat file)))
+         (with-output-to-file new
+           (lambda ()
+             (display (string-append "no-x11 " (read-file %rsakey-pub)))))
+         (utime new
+                (stat:atime st) (stat:mtime st)
+                (stat:atimensec st) (stat:mtimensec st))
+         (rename-file new file)
+         (list options (authorized-key-options store key)))))))
+
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "authorized-keys")
+
+(exit (= 0 exit-status))
+
+;;; authorized-keys.scm ends here.
@@ -0,0 +1,87 @@
+;;; benchmark.scm -- Testing of the benchmark procedures.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (ice-9 threads)
+             (ssh benchmark)
+             (tests common))
+
+(test-begin-with-log "benchmark")
+
+;;;
+
+(test-equal "cipher-preference-string"
+  "aes128-ctr,aes256-ctr,aes128-cbc"
+  (cipher-preference-string '(("aes256-ctr" . 200.0)
+                              ("aes128-cbc" . 100.0)
+                              ("aes128-ctr" . 300.0))))
+
+(test-equal "cipher-preference-string, no results"
+  ""
+  (cipher-preference-string '()))
+
+(test-assert-with-log "benchmark-cipher"
+  (let ((result (benchmark-cipher "aes128-ctr"
+                                  #:host-key %rsakey
+                                  #:bytes    (* 1024 1024))))
+    (and (real? result)
+         (> result 0))))
+
+;; The server thread must not be left behind when the client fails.
+(test-assert-with-log "benchmark-cipher, unsupported cipher"
+  (let ((threads (length (all-threads))))
+    (and (catch 'guile-ssh-error
+           (lambda ()
+             (benchmark-cipher "no-such-cipher"
+                               #:host-key %rsakey
+                               #:bytes    1024)
+             #f)
+           (const #t))
+         (= (length (all-threads)) threads))))
+
+(test-assert-with-log "benchmark-handshakes"
+  (let ((threads (length (all-threads))))
+    (if (libssh-version>=? 0 8)
+        (let ((result (benchmark-handshakes #:host-key %rsakey
+                                            #:count    3)))
+          (and (real? result)
+               (> result 0)
+               (= (length (all-threads)) threads)))
+        ;; Host key objects are not supported.
+        (catch 'guile-ssh-error
+          (lambda ()
+            (benchmark-handshakes #:host-key %rsakey #:count 1)
+            #f)
+          (const #t)))))
+
+(test-equal-with-log "benchmark-ciphers, unsupported ciphers are skipped"
+  '("aes128-ctr")
+  (map car (benchmark-ciphers #:ciphers  '("no-such-cipher" "aes128-ctr")
+                              #:host-key %rsakey
+                              #:bytes    (* 64 1024))))
+
+;;;
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "benchmark")
+
+(exit (= 0 exit-status))
+
+;;; benchmark.scm ends here.
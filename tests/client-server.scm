@@ -34,6 +34,9 @@
              (ssh channel)
              (ssh log)
              (ssh tunnel)
+             (ssh sftp)
+             (ssh scp)
+             (ssh server sftp)
              (srfi srfi-4)
              (tests common))
 
@@ -121,6 +124,39 @@
        (delete-file %knownhosts)
        res))))
 
+(test-equal-with-log "authenticate-server, failures are not cached"
+  '(not-known not-known 0)
+  (run-client-test
+   ;; server
+   (lambda (server)
+     (let ((s (server-accept server)))
+       (server-handle-key-exchange s)))
+   ;; client
+   (lambda ()
+     (let ((file    "authenticate-server-cache.knownhosts")
+           (session (make-session-for-test)))
+       (call-with-output-file file
+         (lambda (port)
+           (write-line (string-append "example.org "
+                                      (call-with-input-file %rsakey-pub
+                                        read-line))
+                       port)))
+       (session-set! session 'knownhosts file)
+       (connect! session)
+       (let* ((results (list (authenticate-server session)
+                             (authenticate-server session)))
+              (cached  (hash-ref (@@ (ssh session) %known-hosts-cache)
+                                 file)))
+         (disconnect! session)
+         (delete-file file)
+         (known-hosts-cache-flush!)
+         (append results
+                 (list (if cached
+                           (hash-count (const #t)
+                                       ((@@ (ssh session) known-hosts-results)
+                                        cached))
+                           0))))))))
+
 (test-assert-with-log "get-public-key-hash"
   (run-client-test
 
@@ -338,6 +374,62 @@
         (authenticate-server session)
         (userauth-password! session "password"))))))
 
+
+(test-equal-with-log "userauth-password!, server-dispatch-message"
+  'success
+  (run-client-test
+
+   ;; server
+   (lambda (server)
+     (server-listen server)
+     (server-set-message-handlers!
+      server
+      `((request-service      . ,(lambda (session service)
+                                   (string=? service "ssh-userauth")))
+        (auth-method-password . ,(lambda (session user password)
+                                   (if (string=? password "password")
+                                       'success
+                                       'denied)))))
+     (let ((session (server-accept server)))
+       (server-handle-key-exchange session)
+       (let loop ()
+         (unless (eof-object? (server-dispatch-message server session))
+           (loop)))))
+
+   ;; client
+   (lambda ()
+     (call-with-connected-session
+      (lambda (session)
+        (authenticate-server session)
+        (userauth-password! session "password"))))))
+
+;; The "none" request has no handler, so it is denied; the server must keep
+;; dispatching the messages of the session.
+(test-equal-with-log "server-dispatch-message, denied request"
+  '(denied success)
+  (run-client-test
+
+   ;; server
+   (lambda (server)
+     (server-listen server)
+     (server-set-message-handlers!
+      server
+      `((request-service      . ,(const #t))
+        (auth-method-password . ,(const 'success))))
+     (let ((session (server-accept server)))
+       (server-handle-key-exchange session)
+       (let loop ()
+         (unless (eof-object? (server-dispatch-message server session))
+           (loop)))))
+
+   ;; client
+   (lambda ()
+     (call-with-connected-session
+      (lambda (session)
+        (authenticate-server session)
+        (let ((none (userauth-none! session)))
+          (list none (userauth-password! session "password"))))))))
+
 
 ;;; 'userauth-public-key!'
 
@@ -740,7 +832,419 @@
                (not (output-port? channel))
                (string=? (read-line channel) str))))))))
 
+;; Server connects the channel to a local "cat" process.  Client sends data
+;; and EOF, and gets the data back along with the exit status of the process.
+(test-equal-with-log "channel-exec-process"
+  '("Hello Scheme World!" 0)
+  (run-client-test
+   (lambda (server)
+     (start-server/dt-test server
+                           (lambda (channel)
+                             (channel-exec-process channel '("/bin/cat")))))
+   (lambda ()
+     (call-with-connected-session/channel-test
+      (lambda (session)
+        (let ((channel (make-channel/dt-test session)))
+          (write-line "Hello Scheme World!" channel)
+          (channel-send-eof channel)
+          (list (read-line channel)
+                (channel-get-exit-status channel))))))))
+
+;; Server serves a directory with the native SFTP server.  Client reads a
+;; file from the directory.
+(test-equal-with-log "sftp-server-serve-directory"
+  "Hello Scheme World!"
+  (let ((root "sftp-server-root-1"))
+    (unless (file-exists? root)
+      (mkdir root))
+    (with-output-to-file (string-append root "/test")
+      (lambda ()
+        (write-line "Hello Scheme World!")))
+    (run-client-test
+     (lambda (server)
+       (start-server/sftp server #:root "sftp-server-root-1"))
+     (lambda ()
+       (call-with-connected-session/channel-test
+        (lambda (session)
+          (call-with-remote-input-file (make-sftp-session session)
+                                       "/test"
+                                       read-line)))))))
+
+(define (sftp-error sftp-session thunk)
+  "Call a THUNK that makes an SFTP request with an SFTP-SESSION.  Return the
+SFTP error of the request, or #f if the request succeeded."
+  (catch 'guile-ssh-error
+    (lambda ()
+      (thunk)
+      #f)
+    (lambda args
+      (sftp-get-error sftp-session))))
+
+;; The root of the native SFTP server has symbolic links to a file inside of
+;; the root and to a file outside of it.  Client must be able to read only
+;; the former, and must not be able to make new links.
+(test-equal-with-log "sftp-server-serve-directory, symbolic links"
+  '("Hello Scheme World!" fx-permission-denied fx-permission-denied)
+  (let ((root "sftp-server-root-2")
+        (file "sftp-server-outside.txt"))
+    (unless (file-exists? root)
+      (mkdir root))
+    (with-output-to-file file
+      (lambda ()
+        (write-line "secret")))
+    (with-output-to-file (string-append root "/test")
+      (lambda ()
+        (write-line "Hello Scheme World!")))
+    (for-each (lambda (target link)
+                (let ((link (string-append root "/" link)))
+                  (when (false-if-exception (lstat link))
+                    (delete-file link))
+                  (symlink target link)))
+              (list "test" (string-append (getcwd) "/" file))
+              '("inside" "outside"))
+    (run-client-test
+     (lambda (server)
+       (start-server/sftp server #:root "sftp-server-root-2"))
+     (lambda ()
+       (call-with-connected-session/channel-test
+        (lambda (session)
+          (let ((sftp-session (make-sftp-session session)))
+            (list (call-with-remote-input-file sftp-session "/inside"
+                                               read-line)
+                  (sftp-error sftp-session
+                              (lambda ()
+                                (sftp-open sftp-session "/outside" O_RDONLY)))
+                  (sftp-error sftp-session
+                              (lambda ()
+                                (sftp-symlink sftp-session
+                                              "/etc/passwd"
+                                              "/passwd")))))))))))
+
+;; Server serves a VFS with 'sftp-server-start!'.  Client writes a file and
+;; reads it back, then makes requests that fail and that the VFS does not
+;; support.
+(test-equal-with-log "sftp-server-serve-vfs"
+  '("Hello Scheme World!" fx-no-such-file fx-op-unsupported)
+  (run-client-test
+   (lambda (server)
+     (start-server/sftp server #:vfs (make-memory-sftp-vfs '())))
+   (lambda ()
+     (call-with-connected-session/channel-test
+      (lambda (session)
+        (let ((sftp-session (make-sftp-session session)))
+          (call-with-remote-output-file sftp-session "/test"
+            (lambda (port)
+              (write-line "Hello Scheme World!" port)))
+          (list (call-with-remote-input-file sftp-session "/test" read-line)
+                (sftp-error sftp-session
+                            (lambda ()
+                              (sftp-open sftp-session "/missing" O_RDONLY)))
+                (sftp-error sftp-session
+                            (lambda ()
+                              (sftp-mkdir sftp-session "/dir"))))))))))
+
+;; Server runs the hashing commands and then serves the current directory
+;; with SFTP.  Client syncs a file that differs from the remote one in one
+;; block, only that block must be sent.
+(test-equal-with-log "sftp-sync-file"
+  '(3 #t)
+  (let ((local-file  "sftp-sync-file.local")
+        (remote-file "sftp-sync-file.remote"))
+    (with-output-to-file local-file  (lambda () (display "abcdefghi")))
+    (with-output-to-file remote-file (lambda () (display "abcXefghi")))
+    (run-client-test
+     (lambda (server)
+       (start-server/sftp server #:after-exec? #t))
+     (lambda ()
+       (call-with-connected-session/channel-test
+        (lambda (session)
+          (let ((sent (sftp-sync-file (make-sftp-session session)
+                                      local-file remote-file
+                                      #:block-size 3)))
+            (list sent
+                  (string=? (local-file-hash local-file)
+                            (local-file-hash remote-file))))))))))
+
+;; Server calculates the hash of a file in the current directory.
+(test-assert-with-log "sftp-file-hash"
+  (let ((file "sftp-file-hash.txt"))
+    (with-output-to-file file (lambda () (display "Hello Scheme World!")))
+    (run-client-test
+     (lambda (server)
+       (start-server/sftp server #:after-exec? #t))
+     (lambda ()
+       (call-with-connected-session/channel-test
+        (lambda (session)
+          (equal? (sftp-file-hash (make-sftp-session session) file)
+                  (local-file-hash file))))))))
+
+;; The remote file has the same contents as the local one, so nothing is
+;; sent.  The remote file must not be truncated.
+(test-equal-with-log "sftp-put-file, unchanged file"
+  '(0 "Hello Scheme World!")
+  (let ((local-file  "sftp-put-file-1.local")
+        (remote-file "sftp-put-file-1.remote"))
+    (with-output-to-file local-file
+      (lambda () (display "Hello Scheme World!")))
+    (copy-file local-file remote-file)
+    (run-client-test
+     (lambda (server)
+       (start-server/sftp server #:after-exec? #t))
+     (lambda ()
+       (call-with-connected-session/channel-test
+        (lambda (session)
+          (list (sftp-put-file (make-sftp-session session)
+                               local-file remote-file
+                               #:if-changed? #t)
+                (with-input-from-file remote-file read-line))))))))
+
+(test-equal-with-log "sftp-put-file, changed file"
+  '(19 "Hello Scheme World!")
+  (let ((local-file  "sftp-put-file-2.local")
+        (remote-file "sftp-put-file-2.remote"))
+    (with-output-to-file local-file
+      (lambda () (display "Hello Scheme World!")))
+    (with-output-to-file remote-file
+      (lambda () (display "Hello World!")))
+    (run-client-test
+     (lambda (server)
+       (start-server/sftp server #:after-exec? #t))
+     (lambda ()
+       (call-with-connected-session/channel-test
+        (lambda (session)
+          (list (sftp-put-file (make-sftp-session session)
+                               local-file remote-file
+                               #:if-changed? #t)
+                (with-input-from-file remote-file read-line))))))))
+
+;; Server serves a file from a VFS and answers the first read request too
+;; late.  The next read must start from the same offset and must not get the
+;; late reply.
+(test-equal-with-log "with-deadline, sftp file read"
+  '(timeout "Hello Scheme World!")
+  (run-client-test
+   (lambda (server)
+     (define data  (string->utf8 "Hello Scheme World!"))
+     (define count 0)
+     (start-server/sftp
+      server
+      #:vfs (make-sftp-vfs
+             #:open  (lambda (path flags mode) path)
+             #:close (const #t)
+             #:read  (lambda (handle offset length)
+                       (set! count (1+ count))
+                       (when (= count 1)
+                         (sleep 3))
+                       (if (>= offset (bytevector-length data))
+                           (eof-object)
+                           (let* ((size (min length
+                                             (- (bytevector-length data)
+                                                offset)))
+                                  (bv   (make-bytevector size)))
+                             (bytevector-copy! data offset bv 0 size)
+                             bv))))))
+   (lambda ()
+     (call-with-connected-session/channel-test
+      (lambda (session)
+        (let ((file (sftp-open (make-sftp-session session) "/test" O_RDONLY)))
+          (list (catch 'guile-ssh-timeout
+                  (lambda ()
+                    (with-deadline 1
+                      (get-string-all file)))
+                  (const 'timeout))
+                (get-string-all file))))))))
+
+;; Server acts as a malicious SCP source.  Client must refuse the requests
+;; instead of writing outside of the local directory or looping forever.
+(define (scp-pull-tree/error session local-directory)
+  "Pull a remote tree into a LOCAL-DIRECTORY using a SESSION.  Return #t if
+'guile-ssh-error' was thrown, #f otherwise."
+  (unless (file-exists? local-directory)
+    (mkdir local-directory))
+  (catch #t
+    (lambda ()
+      (scp-pull-tree session "dir" local-directory)
+      #f)
+    (lambda (key . args)
+      (eq? key 'guile-ssh-error))))
+
+(test-assert-with-log "scp-pull-tree, file name with '..'"
+  (run-client-test
+   (lambda (server)
+     (start-server/scp-source server "C0644 5 ../scp-pull-tree-1\nabcde"))
+   (lambda ()
+     (call-with-connected-session/channel-test
+      (lambda (session)
+        (and (scp-pull-tree/error session "scp-pull-tree-1.d")
+             (not (file-exists? "scp-pull-tree-1"))))))))
+
+(test-assert-with-log "scp-pull-tree, file name with a directory"
+  (run-client-test
+   (lambda (server)
+     (start-server/scp-source server "C0644 5 a/scp-pull-tree-2\nabcde"))
+   (lambda ()
+     (call-with-connected-session/channel-test
+      (lambda (session)
+        (scp-pull-tree/error session "scp-pull-tree-2.d"))))))
+
+(test-assert-with-log "scp-pull-tree, unbalanced end of directory"
+  (run-client-test
+   (lambda (server)
+     (start-server/scp-source server "E\n"))
+   (lambda ()
+     (call-with-connected-session/channel-test
+      (lambda (session)
+        (scp-pull-tree/error session "scp-pull-tree-3.d"))))))
+
+(test-assert-with-log "scp-pull-tree, short read"
+  (run-client-test
+   (lambda (server)
+     (start-server/scp-source server "C0644 10 file\nabc"))
+   (lambda ()
+     (call-with-connected-session/channel-test
+      (lambda (session)
+        (scp-pull-tree/error session "scp-pull-tree-4.d"))))))
+
+;; Server reads data but does not reply.  Client reads from the channel with
+;; a deadline and must get a timeout error instead of waiting forever.
+(test-error-with-log "with-deadline, channel read"
+  'guile-ssh-timeout
+  (run-client-test
+   (lambda (server)
+     (start-server/dt-test server
+                           (lambda (channel)
+                             (read-line channel)
+                             (sleep 3))))
+   (lambda ()
+     (call-with-connected-session/channel-test
+      (lambda (session)
+        (let ((channel (make-channel/dt-test session)))
+          (write-line "Hello Scheme World!" channel)
+          (with-deadline 1
+            (read-line channel))))))))
+
 
+
+;;; Server engine.
+
+(test-equal-with-log "server engine, password authentication"
+  '(denied success)
+  (run-client-test
+   (lambda (server)
+     (start-server/engine server))
+   (lambda ()
+     (let ((session (make-session-for-test)))
+       (connect! session)
+       (authenticate-server session)
+       (let* ((wrong (userauth-password! session "wrong"))
+              (right (userauth-password! session "secret")))
+         (disconnect! session)
+         (list wrong right))))))
+
+(test-equal-with-log "server engine, exec and data"
+  '(rejected "Hello Scheme World!" 0)
+  (run-client-test
+   (lambda (server)
+     (start-server/engine server))
+   (lambda ()
+     (let ((session (make-session-for-test)))
+       (connect! session)
+       (authenticate-server session)
+       (userauth-password! session "secret")
+       (let ((rejected (catch 'guile-ssh-error
+                         (lambda ()
+                           (let ((channel (make-channel session)))
+                             (channel-open-session channel)
+                             (channel-request-exec channel "uname")
+                             'accepted))
+                         (const 'rejected)))
+             (channel (make-channel session)))
+         (channel-open-session channel)
+         (channel-request-exec channel "echo")
+         (write-line "Hello Scheme World!" channel)
+         (channel-send-eof channel)
+         (let ((line (read-line channel)))
+           (list rejected line (channel-get-exit-status channel))))))))
+
+
+
+;;; Keepalive.
+
+(test-assert-with-log "session-alive?, live session"
+  (run-client-test
+   ;; server
+   (lambda (server)
+     (start-server-loop server
+       (lambda (session)
+         (start-session-loop session message-reply-success))))
+   ;; client
+   (lambda ()
+     (call-with-connected-session
+      (lambda (session)
+        (session-alive? session))))))
+
+;; The server does the key exchange and then does not read anything, so the
+;; keepalive request is never answered.
+(test-assert-with-log "session-alive?, silent server"
+  (run-client-test
+   ;; server
+   (lambda (server)
+     (let ((session (server-accept server)))
+       (server-handle-key-exchange session)
+       (sleep 30)))
+   ;; client
+   (lambda ()
+     (let ((session (make-session-for-test)))
+       (session-set! session 'timeout 1)
+       (connect! session)
+       (and (not (session-alive? session #:timeout 1))
+            (not (connected? session)))))))
+
+(test-assert-with-log "session-set-keepalive!, values out of range"
+  (run-client-test
+   ;; server
+   (lambda (server)
+     (start-server-loop server
+       (lambda (session)
+         (start-session-loop session message-reply-success))))
+   ;; client
+   (lambda ()
+     (call-with-connected-session
+      (lambda (session)
+        (define (rejected? . args)
+          (catch 'wrong-type-arg
+            (lambda ()
+              (apply session-set-keepalive! session args)
+              #f)
+            (const #t)))
+        (and (rejected? #:count 128)
+             (rejected? #:interval 32768)
+             (rejected? #:idle 4294967 #:interval 1)
+             (begin
+               (session-set-keepalive! session #:interval 32767 #:count 127)
+               #t)))))))
+
+
+;;; 'connect-many'
+
+(test-equal-with-log "connect-many, ok"
+  '(ok #t)
+  (run-client-test
+   ;; server
+   (lambda (server)
+     (let ((s (server-accept server)))
+       (server-handle-key-exchange s)))
+   ;; client
+   (lambda ()
+     (let* ((results (connect-many (list (make-session-for-test))
+                                   #:check-server? #f
+                                   #:authenticate? #f))
+            (session (caar results))
+            (res     (list (cdar results) (connected? session))))
+       (disconnect! session)
+       res))))
+
+
 ;;;
 
 (define exit-status (test-runner-fail-count (test-runner-current)))
@@ -25,12 +25,17 @@
   #:use-module (ice-9 regex)
   #:use-module (ice-9 popen)
   #:use-module (ice-9 threads)
+  #:use-module (rnrs io ports)
   #:use-module (ssh session)
   #:use-module (ssh channel)
   #:use-module (ssh server)
   #:use-module (ssh auth)
   #:use-module (ssh log)
   #:use-module (ssh message)
+  #:use-module (ssh version)
+  #:use-module (ssh server sftp)
+  #:use-module (ssh server engine)
+  #:use-module (rnrs bytevectors)
   #:export (;; Variables
             %topdir
             %topbuilddir
@@ -47,6 +52,7 @@
             ;; Procedures
             get-unused-port
             set-port!
+            libssh-version>=?
             test-begin-with-log
             test-assert-with-log
             test-error-with-log
@@ -61,8 +67,13 @@
             call-with-connected-session/shell
             start-server-loop
             start-server/dt-test
+            start-server/jump-host
             start-server/dist-test
             start-server/exec
+            start-server/sftp
+            make-memory-sftp-vfs
+            start-server/scp-source
+            start-server/engine
             run-client-test
             run-client-test/separate-process
             run-server-test
@@ -317,6 +328,18 @@ disconnected when the PROC is finished."
 (define (set-port! port)
   (set! *port* port))
 
+
+;;; libssh version.
+
+(define (libssh-version>=? major minor)
+  "Check if the version of the libssh (as returned by 'get-libssh-version') is
+MAJOR.MINOR or later."
+  (let ((version (map string->number
+                      (string-split (get-libssh-version) #\.))))
+    (or (> (car version) major)
+        (and (= (car version) major)
+             (>= (cadr version) minor)))))
+
 
 ;;;
 
@@ -374,6 +397,66 @@ disconnected when the PROC is finished."
             (else
              (message-reply-success msg))))))))
 
+(define (start-server/jump-host server rwproc)
+  "Start a SERVER that acts as a jump host for one session.  A \"direct-tcpip\"
+channel that is opened on the first session is connected to the SERVER
+itself; the second session, which comes through the channel, is served like
+in 'start-server/dt-test'."
+  (define (forward! from to)
+    (let ((data (get-bytevector-some from)))
+      (if (eof-object? data)
+          (begin
+            (close from)
+            (close to))
+          (begin
+            (put-bytevector to data)
+            (force-output to)))))
+
+  (define (forward-loop channel sock)
+    (let loop ()
+      (unless (or (port-closed? channel) (port-closed? sock))
+        (catch #t
+          (lambda ()
+            (cond
+             ((char-ready? channel) (forward! channel sock))
+             ((char-ready? sock)    (forward! sock channel))
+             (else                  (usleep 1000))))
+          (lambda args
+            (format-log/scm 'nolog "start-server/jump-host"
+                            "forwarding error: ~a" args)
+            (close channel)
+            (close sock)))
+        (loop))))
+
+  (let ((bastion (server-accept server)))
+    (server-handle-key-exchange bastion)
+    (start-session-loop bastion
+      (lambda (msg)
+        (case (car (message-get-type msg))
+          ((request-channel-open)
+           (let ((channel (message-channel-request-open-reply-accept msg))
+                 (sock    (socket PF_INET SOCK_STREAM 0)))
+             (connect sock AF_INET (inet-pton AF_INET %addr)
+                      (server-get server 'bindport))
+             ;; The bastion session is used only by this thread, so the
+             ;; inner session is served by another one.
+             (call-with-new-thread
+              (lambda ()
+                (let ((session (server-accept server)))
+                  (server-handle-key-exchange session)
+                  (start-session-loop session
+                    (lambda (msg)
+                      (case (car (message-get-type msg))
+                        ((request-channel-open)
+                         (poll (message-channel-request-open-reply-accept msg)
+                               rwproc))
+                        (else
+                         (message-reply-success msg))))))))
+             (forward-loop channel sock)
+             (disconnect! bastion)))
+          (else
+           (message-reply-success msg)))))))
+
 
 (define %guile-version-string "\
 GNU Guile 2.2.3
@@ -487,6 +570,150 @@ scheme@(guile-user)> ")
 
   (state:init))
 
+(define* (start-server/sftp server #:key (root (getcwd)) (vfs #f)
+                            (after-exec? #f))
+  "Start a SERVER for an SFTP test.  The \"sftp\" subsystem is served with a
+local directory ROOT, or with a virtual file system VFS.  Commands are run
+locally with 'channel-exec-command'.
+
+A session is served by one thread, so the SFTP requests cannot be served
+while a command is running.  If AFTER-EXEC? is #t, the SFTP session is
+served only after the first command is finished; this allows the client to
+run a command while the SFTP session is open."
+  (define sftp-server #f)
+
+  (define (serve!)
+    (when sftp-server
+      (let ((s sftp-server))
+        (set! sftp-server #f)
+        (if vfs
+            (join-thread (sftp-server-start! s #:vfs vfs))
+            (sftp-server-serve-directory s root)))))
+
+  (start-server-loop server
+    (lambda (session)
+      (let ((channel #f))
+        (start-session-loop session
+          (lambda (msg)
+            (let ((type (message-get-type msg)))
+              (format-log/scm 'nolog "start-server/sftp"
+                              "message-type: ~a" type)
+              (cond
+               ((eq? (car type) 'request-channel-open)
+                (set! channel (message-channel-request-open-reply-accept msg)))
+               ((memq 'channel-request-subsystem type)
+                (message-reply-success msg)
+                (set! sftp-server (make-sftp-server channel))
+                (unless after-exec?
+                  (serve!)))
+               ((memq 'channel-request-exec type)
+                (message-reply-success msg)
+                (channel-exec-command channel
+                                      (exec-req:cmd (message-get-req msg)))
+                (serve!))
+               (else
+                (message-reply-success msg))))))))))
+
+(define (make-memory-sftp-vfs files)
+  "Make an SFTP virtual file system with a single directory \"/\" that keeps
+FILES in memory.  FILES is an alist of file names and their contents as
+strings.  Open files and directories are not shared, so a handle is the file
+name for a file and a box for the directory."
+  (define table (make-hash-table))
+
+  (define (system-error proc errno)
+    (throw 'system-error proc "~A" (list (strerror errno)) (list errno)))
+
+  (for-each (lambda (file)
+              (hash-set! table (car file) (string->utf8 (cdr file))))
+            files)
+
+  (make-sftp-vfs
+   #:open    (lambda (path flags mode)
+               (cond
+                ((hash-ref table path)
+                 (when (memq 'truncate flags)
+                   (hash-set! table path (make-bytevector 0)))
+                 path)
+                ((memq 'create flags)
+                 (hash-set! table path (make-bytevector 0))
+                 path)
+                (else
+                 (system-error "open" ENOENT))))
+   #:close   (const #t)
+   #:read    (lambda (handle offset length)
+               (let* ((data (hash-ref table handle))
+                      (size (bytevector-length data)))
+                 (if (>= offset size)
+                     (eof-object)
+                     (let ((bv (make-bytevector (min length (- size offset)))))
+                       (bytevector-copy! data offset bv 0
+                                         (bytevector-length bv))
+                       bv))))
+   #:write   (lambda (handle offset bv)
+               (let* ((data (hash-ref table handle))
+                      (new  (make-bytevector
+                             (max (bytevector-length data)
+                                  (+ offset (bytevector-length bv)))
+                             0)))
+                 (bytevector-copy! data 0 new 0 (bytevector-length data))
+                 (bytevector-copy! bv 0 new offset (bytevector-length bv))
+                 (hash-set! table handle new)))
+   #:opendir (lambda (path)
+               (if (string=? path "/")
+                   (list #f)
+                   (system-error "opendir" ENOTDIR)))
+   #:readdir (lambda (handle)
+               ;; The box tells if the directory has been read already.
+               (if (car handle)
+                   '()
+                   (begin
+                     (set-car! handle #t)
+                     (hash-map->list (lambda (name data)
+                                       (cons (substring name 1)
+                                             `((size . ,(bytevector-length
+                                                         data)))))
+                                     table))))))
+
+(define (start-server/engine server)
+  "Serve the sessions of a SERVER with a server engine that accepts the
+\"secret\" password and the \"echo\" command, and echoes the channel data
+back to the client.  Exit status 0 is sent on EOF."
+  (serve-with-engines
+   server
+   (list (make-server-engine
+          #:auth-password (lambda (session user password)
+                            (if (string=? password "secret")
+                                'success
+                                'denied))
+          #:exec          (lambda (session channel command)
+                            (string=? command "echo"))
+          #:data          (lambda (session channel data stderr?)
+                            (display (utf8->string data) channel))
+          #:eof           (lambda (session channel)
+                            (channel-request-send-exit-status channel 0)
+                            (channel-send-eof channel))))))
+
+(define (start-server/scp-source server data)
+  "Start a SERVER that replies to any command with raw SCP protocol DATA, as
+the source side of SCP does, and closes the channel."
+  (start-server-loop server
+    (lambda (session)
+      (let ((channel #f))
+        (start-session-loop session
+          (lambda (msg)
+            (let ((type (message-get-type msg)))
+              (cond
+               ((eq? (car type) 'request-channel-open)
+                (set! channel (message-channel-request-open-reply-accept msg)))
+               ((memq 'channel-request-exec type)
+                (message-reply-success msg)
+                (display data channel)
+                (channel-send-eof channel)
+                (close channel))
+               (else
+                (message-reply-success msg))))))))))
+
 (define (start-server/dist-test server)
   (server-listen server)
   (let ((session (server-accept server)))
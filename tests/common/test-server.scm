@@ -1,4 +1,5 @@
 (use-modules (ice-9 rdelim)
+             (rnrs bytevectors)
              (tests common)
              (ssh auth)
              (ssh channel)
@@ -7,6 +8,7 @@
              (ssh message)
              (ssh popen)
              (ssh server)
+             (ssh server sftp)
              (ssh session)
              (ssh tunnel)
              (ssh log)
@@ -0,0 +1,79 @@
+;;; compression.scm -- Testing of the compression advisor.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (ssh session)
+             (ssh compression)
+             (tests common))
+
+(test-begin-with-log "compression")
+
+;;;
+
+(test-equal-with-log "compression-suggest, unmeasured levels go first"
+  '(0 1 6)
+  (let ((advisor (make-compression-advisor)))
+    (map (lambda (level)
+           (let ((suggested (compression-suggest advisor "example.org")))
+             (compression-record! advisor "example.org" suggested 1000 1)
+             suggested))
+         '(0 1 6))))
+
+(test-equal-with-log "compression-suggest, the fastest level"
+  1
+  (let ((advisor (make-compression-advisor)))
+    (compression-record! advisor "example.org" 0 1000 10)
+    (compression-record! advisor "example.org" 1 1000 2)
+    (compression-record! advisor "example.org" 6 1000 5)
+    (compression-suggest advisor "example.org")))
+
+(test-equal-with-log "compression-suggest, CPU limit"
+  6
+  (let ((advisor (make-compression-advisor)))
+    (compression-record! advisor "example.org" 0 1000 10)
+    (compression-record! advisor "example.org" 1 1000 2 2)
+    (compression-record! advisor "example.org" 6 1000 5 1)
+    (compression-suggest advisor "example.org")))
+
+(test-equal-with-log "compression-history, size limit"
+  2
+  (let ((advisor (make-compression-advisor #:history-size 2)))
+    (compression-record! advisor "example.org" 0 1000 1)
+    (compression-record! advisor "example.org" 1 1000 1)
+    (compression-record! advisor "example.org" 6 1000 1)
+    (length (compression-history advisor "example.org"))))
+
+(test-equal-with-log "call-with-measured-transfer"
+  '(0 1000)
+  (let* ((advisor (make-compression-advisor))
+         (session (make-session/adaptive advisor #:host "example.org")))
+    (call-with-measured-transfer advisor session (const 1000))
+    (let ((sample (car (compression-history advisor "example.org"))))
+      (list (assq-ref sample 'level)
+            (assq-ref sample 'bytes)))))
+
+;;;
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "compression")
+
+(exit (= 0 exit-status))
+
+;;; compression.scm ends here.
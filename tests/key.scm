@@ -105,6 +105,18 @@
        (and (key? key)
             (private-key? key))))))
 
+(test-assert-with-log "private-key-from-file, cached"
+  (eq? (private-key-from-file %rsakey)
+       (private-key-from-file %rsakey)))
+
+(test-assert-with-log "key-cache-flush!"
+  (let ((key (public-key-from-file %rsakey-pub)))
+    (key-cache-flush! %rsakey-pub)
+    (let ((new-key (public-key-from-file %rsakey-pub)))
+      (and (not (eq? key new-key))
+           (equal? (public-key->string key)
+                   (public-key->string new-key))))))
+
 
 ;;; Converting between strings and keys
 
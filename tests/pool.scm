@@ -0,0 +1,171 @@
+;;; pool.scm -- Testing of the session pool.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (ssh session)
+             (ssh pool)
+             (tests common))
+
+(test-begin-with-log "pool")
+
+;;;
+
+;; The sessions made by this procedure are not connected, so the pool drops
+;; them when they are returned.
+(define (fake-connect user host port identity)
+  (make-session #:host host #:port port))
+
+(define (make-test-pool)
+  (make-session-pool #:max-per-host 1
+                     #:connect      fake-connect))
+
+(test-assert-with-log "make-session-pool"
+  (session-pool? (make-test-pool)))
+
+(test-equal-with-log "session-pool-lease"
+  '((hosts . 1) (open . 1) (idle . 0) (leased . 1))
+  (let ((pool (make-test-pool)))
+    (session-pool-lease pool "localhost")
+    (session-pool-stats pool)))
+
+(test-error-with-log "session-pool-lease, max-per-host reached"
+  'guile-ssh-error
+  (let ((pool (make-test-pool)))
+    (session-pool-lease pool "localhost")
+    (session-pool-lease pool "localhost" #:timeout 1)))
+
+(test-equal-with-log "session-pool-return, disconnected session"
+  '((hosts . 1) (open . 0) (idle . 0) (leased . 0))
+  (let* ((pool    (make-test-pool))
+         (session (session-pool-lease pool "localhost")))
+    (session-pool-return pool session)
+    (session-pool-stats pool)))
+
+(test-error-with-log "session-pool-return, not leased session"
+  'guile-ssh-error
+  (session-pool-return (make-test-pool) (make-session)))
+
+(test-assert-with-log "call-with-pooled-session"
+  (let ((pool (make-test-pool)))
+    (and (call-with-pooled-session pool "localhost" session?)
+         (call-with-pooled-session pool "localhost" session?))))
+
+(test-error-with-log "session-pool-lease, closed pool"
+  'guile-ssh-error
+  (let ((pool (make-test-pool)))
+    (session-pool-close! pool)
+    (session-pool-lease pool "localhost")))
+
+
+;;; Connected sessions.
+
+;; The sessions made by this procedure are connected to the test server.
+(define (test-server-connect user host port identity)
+  (let ((session (make-session-for-test)))
+    (unless (eq? (connect! session) 'ok)
+      (throw 'guile-ssh-error "Could not connect to the test server"
+             session))
+    session))
+
+(define (make-connected-test-pool)
+  (make-session-pool #:max-per-host 1
+                     #:keepalive    #f
+                     #:connect      test-server-connect))
+
+(test-assert-with-log "session-pool-lease, connected session is reused"
+  (run-client-test
+   (lambda (server)
+     (start-server-loop server
+       (lambda (session)
+         (start-session-loop session message-reply-success))))
+   (lambda ()
+     (let* ((pool    (make-connected-test-pool))
+            (session (session-pool-lease pool "localhost")))
+       (session-pool-return pool session)
+       (and (equal? (session-pool-stats pool)
+                    '((hosts . 1) (open . 1) (idle . 1) (leased . 0)))
+            (eq? (session-pool-lease pool "localhost") session)
+            (connected? session)
+            (equal? (session-pool-stats pool)
+                    '((hosts . 1) (open . 1) (idle . 0) (leased . 1))))))))
+
+(test-assert-with-log "session-pool-close!, leased session"
+  (run-client-test
+   (lambda (server)
+     (start-server-loop server
+       (lambda (session)
+         (start-session-loop session message-reply-success))))
+   (lambda ()
+     (let* ((pool    (make-connected-test-pool))
+            (session (session-pool-lease pool "localhost")))
+       (session-pool-close! pool)
+       (session-pool-return pool session)
+       (and (not (connected? session))
+            (equal? (session-pool-stats pool)
+                    '((hosts . 1) (open . 0) (idle . 0) (leased . 0)))
+            (catch 'guile-ssh-error
+              (lambda ()
+                (session-pool-lease pool "localhost")
+                #f)
+              (const #t)))))))
+
+(test-assert-with-log "session-pool-lease, keepalive, live session is reused"
+  (run-client-test
+   (lambda (server)
+     (start-server-loop server
+       (lambda (session)
+         (start-session-loop session message-reply-success))))
+   (lambda ()
+     (let* ((pool    (make-session-pool #:max-per-host 1
+                                        #:keepalive    15
+                                        #:connect      test-server-connect))
+            (session (session-pool-lease pool "localhost")))
+       (session-pool-return pool session)
+       (and (eq? (session-pool-lease pool "localhost") session)
+            (connected? session))))))
+
+;; The server closes each session right after the key exchange, so an idle
+;; session is found dead by the keepalive check and replaced with a new one.
+(test-assert-with-log "session-pool-lease, keepalive, dead session is replaced"
+  (run-client-test
+   (lambda (server)
+     (start-server-loop server
+       (lambda (session)
+         (disconnect! session))))
+   (lambda ()
+     (let* ((pool    (make-session-pool #:max-per-host 1
+                                        #:keepalive    15
+                                        #:connect      test-server-connect))
+            (session (session-pool-lease pool "localhost")))
+       (session-pool-return pool session)
+       (let ((new-session (session-pool-lease pool "localhost")))
+         (and (not (eq? new-session session))
+              (not (connected? session))
+              (equal? (session-pool-stats pool)
+                      '((hosts . 1) (open . 1) (idle . 0) (leased . 1)))))))))
+
+;;;
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "pool")
+
+(exit (= 0 exit-status))
+
+;;; pool.scm ends here.
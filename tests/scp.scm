@@ -0,0 +1,78 @@
+;;; scp.scm -- Testing of SCP procedures.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (ssh scp)
+             (tests common))
+
+(test-begin-with-log "scp")
+
+;;;
+
+(define valid-file-name? (@@ (ssh scp) valid-file-name?))
+(define remote-file-mode (@@ (ssh scp) remote-file-mode))
+(define ensure-directory (@@ (ssh scp) ensure-directory))
+
+(test-assert-with-log "valid-file-name?, plain names"
+  (and (valid-file-name? "file")
+       (valid-file-name? ".hidden")
+       (valid-file-name? "...")))
+
+(test-assert-with-log "valid-file-name?, names that leave the directory"
+  (not (or (valid-file-name? "")
+           (valid-file-name? ".")
+           (valid-file-name? "..")
+           (valid-file-name? "../file")
+           (valid-file-name? "dir/file")
+           (valid-file-name? "/etc/passwd"))))
+
+(test-equal-with-log "remote-file-mode, special bits are dropped"
+  #o755
+  (let ((mask (umask #o022)))
+    (let ((mode (remote-file-mode #o6775)))
+      (umask mask)
+      mode)))
+
+(test-error-with-log "ensure-directory, symbolic link"
+  'guile-ssh-error
+  (let ((link "scp-ensure-directory-link"))
+    (when (false-if-exception (lstat link))
+      (delete-file link))
+    (symlink "." link)
+    (dynamic-wind
+      (const #t)
+      (lambda () (ensure-directory link #o755))
+      (lambda () (delete-file link)))))
+
+(test-assert-with-log "scp-session?, not a session"
+  (not (scp-session? 'not-a-session)))
+
+(test-error-with-log "make-scp-session, not a session"
+  'wrong-type-arg
+  (make-scp-session 'not-a-session 'read "file"))
+
+;;;
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "scp")
+
+(exit (= 0 exit-status))
+
+;;; scp.scm ends here.
@@ -0,0 +1,108 @@
+;;; server-admission.scm -- Testing of the admission control for servers.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (ssh session)
+             (ssh server admission)
+             (tests common))
+
+(test-begin-with-log "server-admission")
+
+;;;
+
+(test-error-with-log "make-admission-control, wrong limit"
+  'guile-ssh-error
+  (make-admission-control #:max-sessions 0))
+
+(test-equal-with-log "admission-admit!, max-sessions"
+  '(#t #f 1 1)
+  (let* ((control (make-admission-control #:max-sessions 1))
+         (first   (admission-admit! control (%make-session)))
+         (second  (admission-admit! control (%make-session)))
+         (counters (admission-counters control)))
+    (list first second
+          (assq-ref counters 'sessions)
+          (assq-ref counters 'rejected-max-sessions))))
+
+(test-equal-with-log "admission-authenticated!, max-unauthenticated"
+  '(#t #f #t 1)
+  (let* ((control (make-admission-control #:max-unauthenticated 1))
+         (session (%make-session))
+         (first   (admission-admit! control session))
+         (second  (admission-admit! control (%make-session))))
+    (admission-authenticated! control session)
+    (list first second
+          (admission-admit! control (%make-session))
+          (assq-ref (admission-counters control)
+                    'rejected-max-unauthenticated))))
+
+(define take-token! (@@ (ssh server admission) take-token!))
+(define check       (@@ (ssh server admission) check))
+
+(test-equal-with-log "take-token!, rate limit"
+  '(#t #t #f #t)
+  (let ((control (make-admission-control #:rate-limit 1 #:rate-burst 2)))
+    (list (take-token! control "192.0.2.1")
+          (take-token! control "192.0.2.1")
+          (take-token! control "192.0.2.1")
+          (take-token! control "192.0.2.2"))))
+
+(test-equal-with-log "take-token!, refill"
+  '(#t #f #t)
+  (let* ((control (make-admission-control #:rate-limit 10 #:rate-burst 1))
+         (first   (take-token! control "192.0.2.1"))
+         (second  (take-token! control "192.0.2.1")))
+    ;; One token is added in 0.1 s.
+    (usleep 200000)
+    (list first second (take-token! control "192.0.2.1"))))
+
+;; A session that is rejected because of the number of sessions must not
+;; take a token from the bucket of its address.
+(test-equal-with-log "admission-admit!, rejected session keeps the token"
+  '(rejected-max-sessions #f 0)
+  (let* ((control (make-admission-control #:max-sessions 1
+                                          #:rate-limit   1
+                                          #:rate-burst   1))
+         (session (%make-session)))
+    (admission-admit! control session)
+    (let ((rejected (check control "192.0.2.1")))
+      (admission-release! control session)
+      (list rejected
+            (check control "192.0.2.1")
+            (assq-ref (admission-counters control) 'rejected-rate-limit)))))
+
+(test-equal-with-log "admission-release!"
+  '(0 0)
+  (let ((control (make-admission-control))
+        (session (%make-session)))
+    (admission-admit! control session)
+    (admission-release! control session)
+    (let ((counters (admission-counters control)))
+      (list (assq-ref counters 'sessions)
+            (assq-ref counters 'unauthenticated)))))
+
+;;;
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "server-admission")
+
+(exit (= 0 exit-status))
+
+;;; server-admission.scm ends here.
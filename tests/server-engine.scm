@@ -0,0 +1,80 @@
+;;; server-engine.scm -- Testing of the event-driven server engine.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (ssh session)
+             (ssh server engine)
+             (tests common))
+
+(test-begin-with-log "server-engine")
+
+;;;
+
+(test-assert-with-log "make-server-engine"
+  (server-engine? (make-server-engine #:auth-password (const 'success)
+                                      #:exec          (const #t))))
+
+(test-error-with-log "make-server-engine, wrong login grace time"
+  'guile-ssh-error
+  (make-server-engine #:login-grace-time 0))
+
+(test-equal-with-log "server-engine-session-count, new engine"
+  0
+  (server-engine-session-count (make-server-engine)))
+
+(test-equal-with-log "server-engine-poll, no sessions"
+  0
+  (server-engine-poll (make-server-engine) 0))
+
+(test-equal-with-log "server-engine-poll, session is not connected"
+  0
+  (let ((engine (make-server-engine)))
+    (server-engine-add-session! engine (make-session))
+    (server-engine-poll engine 0)))
+
+(test-assert-with-log "server-engine-start!, server-engine-stop!"
+  (let ((engine (make-server-engine)))
+    (server-engine-start! engine)
+    (server-engine-stop! engine)
+    (zero? (server-engine-session-count engine))))
+
+(test-error-with-log "server-engine-start!, engine is already started"
+  'guile-ssh-error
+  (let ((engine (make-server-engine)))
+    (server-engine-start! engine)
+    (server-engine-stop! engine)
+    (server-engine-start! engine)))
+
+(test-equal-with-log "server-engine-add-session!, engine is stopped"
+  '(#f 0 0)
+  (let ((engine (make-server-engine)))
+    (server-engine-start! engine)
+    (server-engine-stop! engine)
+    (list (server-engine-add-session! engine (make-session))
+          (server-engine-poll engine 0)
+          (server-engine-session-count engine))))
+
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "server-engine")
+
+(exit (= 0 exit-status))
+
+;;; server-engine.scm ends here.
@@ -0,0 +1,126 @@
+;;; server-pool.scm -- Testing of the server pool.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (ssh server)
+             (ssh server pool)
+             (ssh session)
+             (ssh auth)
+             (ssh message)
+             (tests common))
+
+(test-begin-with-log "server-pool")
+
+;;;
+
+(define (make-test-pool . args)
+  (apply make-server-pool (%make-server) (const #t) args))
+
+(test-assert-with-log "make-server-pool"
+  (server-pool? (make-test-pool)))
+
+(test-error-with-log "make-server-pool, wrong overflow policy"
+  'guile-ssh-error
+  (make-test-pool #:overflow 'wrong-policy))
+
+(test-error-with-log "make-server-pool, wrong number of workers"
+  'guile-ssh-error
+  (make-test-pool #:workers 0))
+
+(test-equal-with-log "server-pool-stats, new pool"
+  '((accepted . 0) (rejected . 0) (handled . 0) (failed . 0) (busy . 0)
+    (queued . 0))
+  (server-pool-stats (make-test-pool)))
+
+(test-assert-with-log "server-pool-stop!, not started pool"
+  (let ((pool (make-test-pool)))
+    (server-pool-stop! pool)
+    (equal? (assq-ref (server-pool-stats pool) 'queued) 0)))
+
+
+;;; Client-server tests.
+
+(define (wait-for-sessions pool count)
+  "Wait until COUNT sessions are handled or failed by a POOL, then stop the
+POOL.  Return the POOL statistics."
+  (let loop ((n 100))
+    (let ((stats (server-pool-stats pool)))
+      (when (and (positive? n)
+                 (< (+ (assq-ref stats 'handled) (assq-ref stats 'failed))
+                    count))
+        (usleep 100000)
+        (loop (1- n)))))
+  (server-pool-stop! pool)
+  (server-pool-stats pool))
+
+(define (connect-and-authenticate session)
+  (sleep 1)
+  (connect! session)
+  (authenticate-server session)
+  (userauth-none! session))
+
+;; Client connects and asks for the "none" authentication.  The pool passes
+;; the session to the handler after the key exchange.
+(test-equal-with-log "server-pool, session is handled"
+  '((request-service)
+    ((accepted . 1) (rejected . 0) (handled . 1) (failed . 0) (busy . 0)
+     (queued . 0)))
+  (run-server-test
+   ;; client
+   connect-and-authenticate
+   ;; server
+   (lambda (server)
+     (server-listen server)
+     (let* ((result #f)
+            (pool   (make-server-pool
+                     server
+                     (lambda (session)
+                       (let ((msg (server-message-get session)))
+                         (set! result (message-get-type msg))
+                         (message-auth-set-methods! msg '(none))
+                         (message-reply-success msg)))
+                     #:workers 2)))
+       (server-pool-start! pool)
+       (let ((stats (wait-for-sessions pool 1)))
+         (list result stats))))))
+
+(test-equal-with-log "server-pool, handler fails"
+  '((accepted . 1) (rejected . 0) (handled . 0) (failed . 1) (busy . 0)
+    (queued . 0))
+  (run-server-test
+   ;; client
+   connect-and-authenticate
+   ;; server
+   (lambda (server)
+     (server-listen server)
+     (let ((pool (make-server-pool server
+                                   (lambda (session)
+                                     (throw 'test-error session))
+                                   #:workers 1)))
+       (server-pool-start! pool)
+       (wait-for-sessions pool 1)))))
+
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "server-pool")
+
+(exit (= 0 exit-status))
+
+;;; server-pool.scm ends here.
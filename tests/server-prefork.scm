@@ -0,0 +1,69 @@
+;;; server-prefork.scm -- Testing of the prefork server mode.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (ssh server)
+             (ssh server prefork)
+             (tests common))
+
+(test-begin-with-log "server-prefork")
+
+;;;
+
+(define (make-test-server)
+  (make-server #:bindaddr      "127.0.0.1"
+               #:bindport      (get-unused-port)
+               #:rsakey        %rsakey
+               #:log-verbosity 'nolog))
+
+(test-error-with-log "prefork-start!, wrong number of workers"
+  'guile-ssh-error
+  (prefork-start! (make-test-server) (const #t) #:workers 0))
+
+(test-equal-with-log "prefork-start!, prefork-stop!"
+  '(2 0)
+  (let* ((prefork (prefork-start! (make-test-server) (const #t)
+                                  #:workers 2))
+         (started (length (prefork-workers prefork))))
+    (prefork-stop! prefork)
+    (list started (length (prefork-workers prefork)))))
+
+(test-equal-with-log "prefork-supervise!, worker is restarted"
+  1
+  (let* ((prefork (prefork-start! (make-test-server) (const #t)
+                                  #:workers       1
+                                  #:restart-delay 0))
+         (pid     (car (prefork-workers prefork))))
+    ;; Stop the prefork from a signal handler after the worker is restarted.
+    (sigaction SIGALRM (lambda (signum)
+                         (prefork-stop! prefork #:wait? #f)))
+    (alarm 2)
+    (kill pid SIGKILL)
+    (prefork-supervise! prefork)
+    (sigaction SIGALRM SIG_DFL)
+    (prefork-restarts prefork)))
+
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "server-prefork")
+
+(exit (= 0 exit-status))
+
+;;; server-prefork.scm ends here.
@@ -21,13 +21,11 @@
 
 (use-modules (srfi srfi-64)
              (ssh server)
-             (ssh version)
+             (ssh session)
+             (ssh key)
              ;; Helper procedures
              (tests common))
 
-(define %libssh-minor-version
-  (string->number (cadr (string-split (get-libssh-version) #\.))))
-
 (test-begin-with-log "server")
 
 ;;;
@@ -52,14 +50,16 @@
          (topdir  (getenv "abs_top_srcdir"))
          (options `((bindaddr      "127.0.0.1")
                     (bindport      22)
-                    ,(if (>= %libssh-minor-version 7)
+                    ,(if (libssh-version>=? 0 7)
                          (list 'hostkey %rsakey %dsakey)
                          '(hostkey "ssh-rsa" "ssh-dss"))
                     (rsakey        ,%rsakey)
                     (dsakey        ,%dsakey)
                     (banner        "string")
                     (log-verbosity nolog rare protocol packet functions)
-                    (blocking-mode #f #t)))
+                    (blocking-mode #f #t)
+                    (reuseport     #f #t)
+                    (backlog       1 1024)))
          (log (test-runner-aux-value (test-runner-current)))
          (res #t))
 
@@ -96,7 +96,10 @@
                    (hostkey        "invalid value" 1 'invalid-value)
                    (banner         12345)
                    (log-verbosity  -1 0 1 2 3 4 5)
-                   (blocking-mode  42 "string")))
+                   (blocking-mode  42 "string")
+                   (fd             -1 "string")
+                   (reuseport      42 "string")
+                   (backlog        0 -1 "string")))
         (log (test-runner-aux-value (test-runner-current)))
         (res #t))
 
@@ -116,6 +119,24 @@
      options)
     res))
 
+(test-assert-with-log "server-set!, hostkey, key objects"
+  (let ((server (%make-server))
+        (key    (private-key-from-file %rsakey)))
+    (if (libssh-version>=? 0 8)
+        (begin
+          (server-set! server 'hostkey key)
+          (and (eq? (server-get server 'hostkey) key)
+               (catch #t
+                 (lambda ()
+                   (server-set! server 'hostkey (private-key->public-key key))
+                   #f)
+                 (const #t))))
+        (catch 'guile-ssh-error
+          (lambda ()
+            (server-set! server 'hostkey key)
+            #f)
+          (const #t)))))
+
 (test-assert-with-log "make-server"
   (let ((topdir  (getenv "abs_top_srcdir")))
     (make-server #:bindaddr      "127.0.0.1"
@@ -157,6 +178,64 @@
     (server-listen server)
     #t))
 
+(test-equal-with-log "server-listen, backlog"
+  1024
+  (let ((server (make-server #:bindaddr      "127.0.0.1"
+                             #:bindport      (get-unused-port)
+                             #:rsakey        %rsakey
+                             #:backlog       1024
+                             #:log-verbosity 'nolog)))
+    (server-listen server)
+    (server-get server 'backlog)))
+
+;; The listening socket is bound by the test itself, as a supervisor process
+;; would do, and passed to the server.
+(test-assert-with-log "server-accept, socket passed with 'fd'"
+  (let ((sock (socket PF_INET SOCK_STREAM 0))
+        (port (get-unused-port)))
+    (setsockopt sock SOL_SOCKET SO_REUSEADDR 1)
+    (bind sock AF_INET (inet-pton AF_INET "127.0.0.1") port)
+    (listen sock 1)
+    (let ((server (make-server #:fd            (port->fdes sock)
+                               #:rsakey        %rsakey
+                               #:log-verbosity 'nolog))
+          (client (socket PF_INET SOCK_STREAM 0)))
+      (server-listen server)
+      (connect client AF_INET (inet-pton AF_INET "127.0.0.1") port)
+      (let ((session (server-accept server)))
+        ;; SOCK is closed by the server; 'port->fdes' keeps Guile from
+        ;; closing it too.
+        (close client)
+        (session? session)))))
+
+(test-equal-with-log "make-server-listeners"
+  2
+  (let ((servers (make-server-listeners 2
+                                        #:bindaddr      "127.0.0.1"
+                                        #:bindport      (get-unused-port)
+                                        #:rsakey        %rsakey
+                                        #:log-verbosity 'nolog)))
+    (length (filter server? servers))))
+
+(test-assert-with-log "server-set-message-handlers!"
+  (let ((server (%make-server)))
+    (server-set-message-handlers! server
+                                  `((request-service       . ,(const #t))
+                                    (auth-method-password  . ,(const 'success))
+                                    (channel-request-exec  . ,(const #t))
+                                    (default               . ,(const #f))))
+    #t))
+
+(test-error-with-log "server-set-message-handlers!, unknown message kind"
+  'guile-ssh-error
+  (server-set-message-handlers! (%make-server)
+                                `((no-such-message . ,(const #t)))))
+
+(test-error-with-log "server-set-message-handlers!, handler is not a procedure"
+  'wrong-type-arg
+  (server-set-message-handlers! (%make-server)
+                                '((request-service . #t))))
+
 (define exit-status (test-runner-fail-count (test-runner-current)))
 
 (test-end "server")
@@ -20,6 +20,7 @@
 (add-to-load-path (getenv "abs_top_srcdir"))
 
 (use-modules (srfi srfi-64)
+             (ice-9 threads)
              (ssh session)
              (ssh log)
              (ssh version)
@@ -153,6 +154,12 @@
          ;; Make sure that default callbacks value is '#f'.
          (equal?   (session-get (%make-session) 'callbacks) #f))))
 
+(test-assert "session-get, blocking-mode"
+  (let ((session (make-session #:host "localhost" #:blocking-mode #f)))
+    (and (not (session-get session 'blocking-mode))
+         ;; Sessions are blocking by default.
+         (session-get (%make-session) 'blocking-mode))))
+
 (test-error "session-get, non-session object"
   'wrong-type-arg
   (session-get "non-session object" 'test))
@@ -210,6 +217,185 @@
   (let ((session (%make-session)))
     (not (connected? session))))
 
+(test-assert "get-fd, not connected"
+  (not (get-fd (%make-session))))
+
+(test-assert "get-peer-address, not connected"
+  (not (get-peer-address (%make-session))))
+
+(test-assert "session-reaper-stats"
+  (begin
+    (let loop ((count 100))
+      (unless (zero? count)
+        (%make-session)
+        (loop (1- count))))
+    (gc)
+    (let ((stats (session-reaper-stats)))
+      (and (equal? (map car stats)
+                   '(queued reaped synchronous pending max-pending))
+           (and-map (lambda (value) (>= value 0)) (map cdr stats))))))
+
+(test-assert "session-reaper-stats, GC'ed sessions are reaped"
+  (let* ((stat   (lambda (stats key) (assq-ref stats key)))
+         (before (session-reaper-stats))
+         (freed  (lambda (stats)
+                   (+ (stat stats 'queued) (stat stats 'synchronous)))))
+    (let loop ((count 1000))
+      (unless (zero? count)
+        (%make-session)
+        (loop (1- count))))
+    (gc)
+    (gc)
+    ;; The reaper thread frees the queued sessions asynchronously.
+    (let wait ((tries 100))
+      (let ((stats (session-reaper-stats)))
+        (cond
+         ((and (> (freed stats) (freed before))
+               (> (stat stats 'reaped) (stat before 'reaped))
+               (zero? (stat stats 'pending))
+               (= (stat stats 'reaped) (stat stats 'queued)))
+          #t)
+         ((zero? tries)
+          #f)
+         (else
+          (usleep 100000)
+          (wait (1- tries))))))))
+
+(test-error "send-keepalive!, non-connected session"
+  'wrong-type-arg
+  (send-keepalive! (%make-session)))
+
+(test-error "session-set-keepalive!, non-connected session"
+  'wrong-type-arg
+  (session-set-keepalive! (%make-session) #:interval 5))
+
+(test-assert "session-alive?, non-connected session"
+  (not (session-alive? (%make-session))))
+
+(test-equal "deadline-remaining, no deadline"
+  #f
+  (deadline-remaining))
+
+(test-assert "with-deadline"
+  (let ((remaining (with-deadline 10 (deadline-remaining))))
+    (and (> remaining 0) (<= remaining 10))))
+
+(test-assert "with-deadline, nested deadline cannot extend the outer one"
+  (<= (with-deadline 1 (with-deadline 100 (deadline-remaining))) 1))
+
+(test-equal "with-deadline, no deadline"
+  #f
+  (with-deadline #f (deadline-remaining)))
+
+
+;;; Known hosts cache.
+
+(define known-hosts-ref (@@ (ssh session) known-hosts-ref))
+(define known-hosts-index (@@ (ssh session) known-hosts-index))
+(define known-hosts-keys (@@ (ssh session) known-hosts-keys))
+(define %gssh-hash-host-name (@@ (ssh session) %gssh-hash-host-name))
+(define %known-hosts-mutex (@@ (ssh session) %known-hosts-mutex))
+
+(define (known-hosts-cached-names file)
+  (with-mutex %known-hosts-mutex
+    (hash-map->list (lambda (name keys) name)
+                    (known-hosts-index (known-hosts-ref file)))))
+
+(define (write-known-hosts-file file name)
+  (with-output-to-file file
+    (lambda ()
+      (display name)
+      (display " ssh-rsa AAAAB3NzaC1yc2EAAAADAQABAAABAQ\n"))))
+
+(test-equal "known hosts cache, change within the same second"
+  '(("host1") ("host2"))
+  (let* ((file   "known-hosts-cache-1.txt")
+         (before (begin
+                   (write-known-hosts-file file "host1")
+                   (known-hosts-cached-names file)))
+         (st     (stat file))
+         (mtime  (stat:mtime st))
+         (nsec   (if (zero? (stat:mtimensec st)) 1 0)))
+    ;; Same size and the same modification time in seconds.
+    (write-known-hosts-file file "host2")
+    (utime file mtime mtime nsec nsec)
+    (let ((after (known-hosts-cached-names file)))
+      (delete-file file)
+      (known-hosts-cache-flush!)
+      (list before after))))
+
+(test-equal "known hosts cache, hashed entry"
+  '(#t #f)
+  (let* ((file  "known-hosts-cache-3.txt")
+         (salt  "9nkEoEezrfaFN6vGeVG1bAO5+tc=")
+         (keys  (lambda (name)
+                  (with-mutex %known-hosts-mutex
+                    (known-hosts-keys (known-hosts-ref file) name)))))
+    (write-known-hosts-file file
+                            (string-append "|1|" salt "|"
+                                           (%gssh-hash-host-name salt
+                                                                 "host1")))
+    (let ((result (list (not (null? (keys "host1")))
+                        (not (null? (keys "host2"))))))
+      (delete-file file)
+      (known-hosts-cache-flush!)
+      result)))
+
+(test-equal "known hosts cache, replaced file"
+  '(("host1") ("host2"))
+  (let* ((file   "known-hosts-cache-2.txt")
+         (new    "known-hosts-cache-2.new")
+         (before (begin
+                   (write-known-hosts-file file "host1")
+                   (known-hosts-cached-names file)))
+         (st     (stat file)))
+    ;; Same size and the same modification time, but another inode.
+    (write-known-hosts-file new "host2")
+    (utime new (stat:mtime st) (stat:mtime st)
+           (stat:mtimensec st) (stat:mtimensec st))
+    (rename-file new file)
+    (let ((after (known-hosts-cached-names file)))
+      (delete-file file)
+      (known-hosts-cache-flush!)
+      (list before after))))
+
+
+;;; 'connect-many'
+
+(test-equal "connect-many, no hosts"
+  '()
+  (connect-many '()))
+
+(test-error "connect-many, session with callbacks"
+  'guile-ssh-error
+  (connect-many (list (make-session #:host "localhost"
+                                    #:callbacks '((user-data . #f))))))
+
+(test-equal-with-log "connect-many, connection refused"
+  '(connect-error connect-error)
+  (map cdr (connect-many (list "127.0.0.1" "127.0.0.1")
+                         #:port (get-unused-port)
+                         #:concurrency 1
+                         #:timeout 5)))
+
+;; The server accepts TCP connections but never sends the SSH banner, so the
+;; handshakes can only end by the timeout.
+(test-equal-with-log "connect-many, timeout"
+  '(timeout timeout)
+  (let ((sock (socket PF_INET SOCK_STREAM 0))
+        (port (get-unused-port)))
+    (setsockopt sock SOL_SOCKET SO_REUSEADDR 1)
+    (bind sock AF_INET INADDR_LOOPBACK port)
+    (listen sock 10)
+    (dynamic-wind
+      (const #t)
+      (lambda ()
+        (map cdr (connect-many (list "127.0.0.1" "127.0.0.1")
+                               #:port port
+                               #:timeout 1)))
+      (lambda ()
+        (close sock)))))
+
 (define exit-status (test-runner-fail-count (test-runner-current)))
 
 (test-end "session")
@@ -0,0 +1,118 @@
+;;; sftp-server.scm -- Testing of the SFTP server.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (rnrs bytevectors)
+             (ssh server sftp)
+             (tests common))
+
+(test-begin-with-log "sftp-server")
+
+;;;
+
+(test-assert-with-log "make-sftp-vfs"
+  (sftp-vfs? (make-sftp-vfs #:stat (lambda (path) '()))))
+
+(test-assert-with-log "sftp-server?, not a server"
+  (not (sftp-server? 'not-a-server)))
+
+(test-error-with-log "make-sftp-server, not a channel"
+  'wrong-type-arg
+  (make-sftp-server 'not-a-channel))
+
+(test-equal-with-log "stat->sftp-attributes"
+  '(size uid gid permissions atime mtime)
+  (map car (stat->sftp-attributes (stat "/"))))
+
+
+;;; Virtual file system.
+
+(define vfs-dispatch (@@ (ssh server sftp) vfs-dispatch))
+
+(define (system-error proc errno)
+  (throw 'system-error proc "~A" (list (strerror errno)) (list errno)))
+
+(define (make-memory-vfs)
+  (make-memory-sftp-vfs '(("/hello" . "Hello Scheme World!"))))
+
+(test-equal-with-log "vfs-dispatch, open"
+  '(handle "/hello")
+  (vfs-dispatch (make-memory-vfs) '(open "/hello" (read) #f)))
+
+(test-equal-with-log "vfs-dispatch, read"
+  (list (list 'data (string->utf8 "Hello"))
+        '(status eof #f))
+  (let ((vfs (make-memory-vfs)))
+    (list (vfs-dispatch vfs '(read "/hello" 0 5))
+          (vfs-dispatch vfs '(read "/hello" 19 5)))))
+
+(test-equal-with-log "vfs-dispatch, write"
+  (list '(handle "/new")
+        '(status ok #f)
+        (list 'data (string->utf8 "Hi")))
+  (let* ((vfs    (make-memory-vfs))
+         (open   (vfs-dispatch vfs '(open "/new" (write create) #o644)))
+         (write  (vfs-dispatch vfs (list 'write "/new" 0
+                                         (string->utf8 "Hi")))))
+    (list open write (vfs-dispatch vfs '(read "/new" 0 1024)))))
+
+(test-equal-with-log "vfs-dispatch, readdir"
+  '((names (("hello" (size . 19))))
+    (status eof #f))
+  (let* ((vfs    (make-memory-vfs))
+         (handle (cadr (vfs-dispatch vfs '(opendir "/")))))
+    (list (vfs-dispatch vfs (list 'readdir handle))
+          (vfs-dispatch vfs (list 'readdir handle)))))
+
+(test-equal-with-log "vfs-dispatch, errno to status"
+  '((status no-such-file)
+    (status no-such-file)
+    (status permission-denied)
+    (status file-already-exists))
+  (let ((vfs (make-memory-vfs))
+        (denied-vfs
+         (make-sftp-vfs
+          #:open  (lambda (path flags mode) (system-error "open" EACCES))
+          #:mkdir (lambda (path mode) (system-error "mkdir" EEXIST)))))
+    (map (lambda (vfs request)
+           (list-head (vfs-dispatch vfs request) 2))
+         (list vfs vfs denied-vfs denied-vfs)
+         '((open "/missing" (read) #f)
+           (opendir "/hello")
+           (open "/hello" (read) #f)
+           (mkdir "/dir" #o755)))))
+
+(test-equal-with-log "vfs-dispatch, other error"
+  '(status failure "Request failed")
+  (vfs-dispatch (make-sftp-vfs #:stat (lambda (path) (error "Oops")))
+                '(stat "/hello")))
+
+(test-equal-with-log "vfs-dispatch, unsupported request"
+  '(status op-unsupported "Unsupported request")
+  (vfs-dispatch (make-memory-vfs) '(mkdir "/dir" #o755)))
+
+;;;
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "sftp-server")
+
+(exit (= 0 exit-status))
+
+;;; sftp-server.scm ends here.
@@ -0,0 +1,91 @@
+;;; sftp.scm -- Testing of SFTP procedures.
+
+;; Copyright (C) 2021 Artyom V. Poptsov <poptsov.artyom@gmail.com>
+;;
+;; This file is a part of Guile-SSH.
+;;
+;; Guile-SSH is free software: you can redistribute it and/or
+;; modify it under the terms of the GNU General Public License as
+;; published by the Free Software Foundation, either version 3 of the
+;; License, or (at your option) any later version.
+;;
+;; Guile-SSH is distributed in the hope that it will be useful, but
+;; WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+;; General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with Guile-SSH.  If not, see <http://www.gnu.org/licenses/>.
+
+(use-modules (srfi srfi-64)
+             (rnrs bytevectors)
+             (ssh sftp)
+             (tests common))
+
+(test-begin-with-log "sftp")
+
+;;;
+
+(define (call-with-temporary-file data proc)
+  (let* ((port     (mkstemp! (string-copy "/tmp/guile-ssh-sftp-XXXXXX")))
+         (filename (port-filename port)))
+    (display data port)
+    (close-port port)
+    (let ((result (proc filename)))
+      (delete-file filename)
+      result)))
+
+(test-equal-with-log "local-file-hash, empty file"
+  "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+  (call-with-temporary-file "" local-file-hash))
+
+(test-equal-with-log "local-file-hash, 'abc'"
+  "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+  (call-with-temporary-file "abc" local-file-hash))
+
+(test-equal-with-log "local-file-hash, multiple blocks"
+  "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"
+  (call-with-temporary-file
+   "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+   local-file-hash))
+
+(test-error-with-log "local-file-hash, non-existing file"
+  'guile-ssh-error
+  (local-file-hash "/non-existing-file"))
+
+
+;;; Hashing of blocks.
+
+(define %sha256-blocks (@@ (ssh sftp) %gssh-sha256-blocks))
+
+(test-equal-with-log "%gssh-sha256-blocks, one block"
+  '("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad")
+  (%sha256-blocks (string->utf8 "abc") 3 3))
+
+(test-equal-with-log "%gssh-sha256-blocks, full blocks"
+  '("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+    "cb8379ac2098aa165029e3938a51da0bcecfc008fd6795f401178647f96c5b34")
+  (%sha256-blocks (string->utf8 "abcdef") 6 3))
+
+(test-equal-with-log "%gssh-sha256-blocks, partial last block"
+  '("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+    "18ac3e7343f016890c510e93f935261169d9e3f565436429830faf0934f4f8e4")
+  (%sha256-blocks (string->utf8 "abcdef") 4 3))
+
+(test-equal-with-log "%gssh-sha256-blocks, empty data"
+  '()
+  (%sha256-blocks (string->utf8 "abc") 0 3))
+
+(test-error-with-log "%gssh-sha256-blocks, count is out of range"
+  'guile-ssh-error
+  (%sha256-blocks (string->utf8 "abc") 4 3))
+
+;;;
+
+(define exit-status (test-runner-fail-count (test-runner-current)))
+
+(test-end "sftp")
+
+(exit (= 0 exit-status))
+
+;;; sftp.scm ends here.
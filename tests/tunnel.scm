@@ -172,6 +172,30 @@
             result)))))))
 
 
+(test-equal-with-log "connect-via"
+  %test-string
+  (run-client-test
+   ;; server
+   (lambda (server)
+     (start-server/jump-host server
+                             (lambda (channel)
+                               (write-line (read-line channel) channel))))
+   ;; client
+   (lambda ()
+     (call-with-connected-session/tunnel
+      (lambda (bastion)
+        (let ((session (make-session-for-test)))
+          (unless (eq? (connect-via bastion session) 'ok)
+            (error "Could not connect through the bastion" session))
+          (userauth-none! session)
+          (let ((channel (make-channel session)))
+            (channel-open-session channel)
+            (write-line %test-string channel)
+            (let ((result (poll channel read-line)))
+              (close channel)
+              (disconnect! session)
+              result))))))))
+
 (test-assert-with-log "channel-{listen,cancel}-forward"
   (run-client-test
    ;; Server